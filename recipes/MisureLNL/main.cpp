@@ -22,6 +22,7 @@
 
 #include <iostream>
 #include <fstream>
+#include <algorithm>
 
 #include "IB.h"
 
@@ -60,6 +61,9 @@
 #include "Detectors/MuonScatter.h"
 #include "IBMuonEventTTreeReader.h"
 #include "IBMuonEventTTreeLNLdataReader.h"
+#include "IBColumnExport.h"
+#include "IBVoxSnapshot.h"
+#include "IBVoxImageStack.h"
 #include "IBVoxFilters.h"
 #include "IBAnalyzerWPoca.h"
 #include "IBAnalyzerPoca.h"
@@ -90,6 +94,8 @@ static struct Parameters : Options
     float start;
     float voxsize;
     bool dump;
+    bool dumpColumns;
+    std::string snapshot;
 
     float momentum;
     float sijcut;
@@ -141,6 +147,8 @@ static struct Parameters : Options
                 ("iterations",    &iterations, Vector3i(1, 1000, 5000), "iterations [start drop end]")
                 ("analyzers",    &analyzers, std::string("no analyzer selected"),"selected analyzers class names")
                 ("dump",    &dump,  (bool)0,"Dump muon root file")
+                ("dumpColumns", &dumpColumns, (bool)0,"Dump muon and per iteration event columns")
+                ("snapshot", &snapshot, std::string("vtk"),"iteration image format: vtk vtkbinary raw")
 
                 // DETECTOR //
                 ("detector.datafile",&detector.datafile,std::string("datafile.txt"),"Muon data file from detector")
@@ -289,16 +297,12 @@ float getTotDensityImg(const IBVoxCollection &img) {
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-float objectDensity(const char *file_in, Vector4f B, Vector4f E) {
+float objectDensity(const IBVoxCollection &image, Vector4f B, Vector4f E) {
 
   std::cout << "calculating object density " << std::endl;
 
-    /// clip object
-    IBVoxCollection img;
-    if( !img.ImportFromVtk(file_in) )
-        return 0;
-
     // returns in 1/m units
+    IBVoxCollection img(image);
     img = img.LambdaToInvLrad(3.);
 
     Vector4f slice_tolerance = HVector3f(0.,0.,0.);
@@ -346,6 +350,15 @@ float objectDensity(const char *file_in, Vector4f B, Vector4f E) {
     return density;
 }
 
+float objectDensity(const char *file_in, Vector4f B, Vector4f E) {
+
+    /// clip object
+    IBVoxCollection img;
+    if( !IBVoxImageStack::Load(file_in, img) )
+        return 0;
+    return objectDensity(img, B, E);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 Vector<Vector2f> objectVarSliceDensities(const char *file_in, Vector4f B, Vector4f E, int nslices) {
 
@@ -427,19 +440,12 @@ Vector<Vector2f> objectVarSliceDensities(const char *file_in, Vector4f B, Vector
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-Vector<Vector2f> objectSliceDensities(const char *file_in, Vector4f B, Vector4f E, int nslices) {
+Vector<Vector2f> objectSliceDensities(const IBVoxCollection &image, Vector4f B, Vector4f E, int nslices) {
 
     /// this function computes density running over voxels, voxel dim=slice thickness
-  std::cout << "Importing from vtk" << std::endl;
-
-    /// clip object
-    IBVoxCollection img;
-    if( !img.ImportFromVtk(file_in) )
-        return 0;
-
-    std::cout << "Done" << std::endl;
 
     // returns in 1/m units
+    IBVoxCollection img(image);
     img = img.LambdaToInvLrad(3.);
 
     /// init density vector
@@ -447,7 +453,7 @@ Vector<Vector2f> objectSliceDensities(const char *file_in, Vector4f B, Vector4f
 
     std::cout << "Generating region densities" << std::endl;
     /// compare with total object density and save it in vector
-    float totDensity = objectDensity(file_in, B, E);
+    float totDensity = objectDensity(image, B, E);
     float totPos = E(2)/2. + B(2)/2. + p.analysis.sliceBegin + 10.;
 
     /// 20150331 carota mockup, III region densities
@@ -457,15 +463,15 @@ Vector<Vector2f> objectSliceDensities(const char *file_in, Vector4f B, Vector4f
     // region 1
     Vector4f Br1 = HPoint3f(B(0),B(1),start + tol);
     Vector4f Er1 = HPoint3f(E(0),E(1),start + 20 - tol);
-    float IregionDensity = objectDensity(file_in, Br1, Er1);
+    float IregionDensity = objectDensity(image, Br1, Er1);
     // region 2
     Vector4f Br2 = HPoint3f(B(0),B(1),start + 20 + tol);
     Vector4f Er2 = HPoint3f(E(0),E(1),start + 30 - tol);
-    float IIregionDensity = objectDensity(file_in, Br2, Er2);
+    float IIregionDensity = objectDensity(image, Br2, Er2);
     // region 3
     Vector4f Br3 = HPoint3f(B(0),B(1),start + 30 + tol);
     Vector4f Er3 = HPoint3f(E(0),E(1),start + 47.5 - tol);
-    float IIIregionDensity = objectDensity(file_in, Br3, Er3);
+    float IIIregionDensity = objectDensity(image, Br3, Er3);
 
     std::cout << "Done" << std::endl;
 
@@ -547,6 +553,20 @@ Vector<Vector2f> objectSliceDensities(const char *file_in, Vector4f B, Vector4f
     return densities;
 }
 
+Vector<Vector2f> objectSliceDensities(const char *file_in, Vector4f B, Vector4f E, int nslices) {
+
+  std::cout << "Importing from vtk" << std::endl;
+
+    /// clip object
+    IBVoxCollection img;
+    if( !IBVoxImageStack::Load(file_in, img) )
+        return 0;
+
+    std::cout << "Done" << std::endl;
+
+    return objectSliceDensities(img, B, E, nslices);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 void goClips(const char *file){
 
@@ -657,32 +677,32 @@ void objectSliceAnalisis(int argc, char **argv, TGraph *&gr_mean){
       std::cout << "Begin = " << B << std::endl;
       std::cout << "End = " << E << std::endl;
 
+      /// the first 100 images loaded once, in parallel
+      std::vector<std::string> samples(files.begin(), files.begin() + std::min(files.size(), (size_t)100));
+      IBVoxImageStack stack;
+      stack.LoadSequence(samples);
+
       int c=0;
-      foreach (std::string &str, files) {
-          if(c<100){
-              //if(c==0)
-              std::cout << "processing file: " << str << "\n";
-              Vector<Vector2f> densities = objectSliceDensities(str.c_str(),B,E,p.analysis.nslices);
-              for(int iv=0; iv<p.analysis.nslices+4; iv++){
-                  densities_mean[iv](0) =  densities[iv](0);
-                  densities_mean[iv](1) +=  densities[iv](1);
-              }
-              //mg_set->Add(CreateTGraph(densities,densities_rms,c+2));
-              c++;
+      IBVoxCollection img;
+      Vector< Vector<Vector2f> > sample_densities;
+      for(size_t is=0; stack.GetImage(is, img); ++is) {
+          std::cout << "processing file: " << samples[is] << "\n";
+          Vector<Vector2f> densities = objectSliceDensities(img,B,E,p.analysis.nslices);
+          for(int iv=0; iv<p.analysis.nslices+4; iv++){
+              densities_mean[iv](0) =  densities[iv](0);
+              densities_mean[iv](1) +=  densities[iv](1);
           }
+          //mg_set->Add(CreateTGraph(densities,densities_rms,c+2));
+          sample_densities.push_back(densities);
+          c++;
       }
       for(int iv=0; iv<p.analysis.nslices+4; iv++)
         densities_mean[iv](1) = densities_mean[iv](1) / c;
 
       // density RMS
-      c=0;
-      foreach (std::string &str, files) {
-          if(c<100){
-              Vector<Vector2f> densities = objectSliceDensities(str.c_str(),B,E,p.analysis.nslices);
-              for(int iv=0; iv<densities.size(); iv++)
-                  densities_rms[iv] += pow(densities[iv](1)-densities_mean[iv](1),2.);
-              c++;
-          }
+      foreach (Vector<Vector2f> &densities, sample_densities) {
+          for(int iv=0; iv<densities.size(); iv++)
+              densities_rms[iv] += pow(densities[iv](1)-densities_mean[iv](1),2.);
       }
       for(int iv=0; iv<p.analysis.nslices+4; iv++)
         densities_rms[iv] = sqrt(densities_rms[iv]/(c-1)) / sqrt(c); //standard deviation from mean
@@ -877,13 +897,15 @@ int doIterations(const char *file_in,
     int ev = reader->getNumberOfEvents();
 
     for( int i=0; i<80; ++i) std::cout << "-"; std::cout << "\r";
-    for (int i=0; i<ev; i++) {
-        MuonScatter mu;
-        if(reader->readNext(&mu)) {
-            muons.AddMuon(mu);
-            tot++;
+    {
+        const int batch = std::max(ev/80, 1);
+        Vector<MuonScatter> mu(batch);
+        for (int i=0; i<ev; i+=batch) {
+            int n = reader->readBatch(&mu[0], std::min(batch, ev-i));
+            muons.AddMuons(&mu[0], n);
+            tot += n;
+            std::cout << "o" << std::flush;
         }
-        if(tot++%(ev/80) == 0) std::cout << "o" << std::flush;
     }
     std::cout << "\n";
 
@@ -910,13 +932,15 @@ int doIterations(const char *file_in,
         int ev = reader->getNumberOfEvents();
 
         for( int i=0; i<80; ++i) std::cout << "-"; std::cout << "\r";
-        for (int i=0; i<ev; i++) {
-            MuonScatter mu;
-            if(reader->readNext(&mu)) {
-                rototrans_muons.AddMuon(mu);
-                tot++;
+        {
+            const int batch = std::max(ev/80, 1);
+            Vector<MuonScatter> mu(batch);
+            for (int i=0; i<ev; i+=batch) {
+                int n = reader->readBatch(&mu[0], std::min(batch, ev-i));
+                rototrans_muons.AddMuons(&mu[0], n);
+                tot += n;
+                std::cout << "o" << std::flush;
             }
-            if(tot++%(ev/80) == 0) std::cout << "o" << std::flush;
         }
         std::cout << "\n";
 
@@ -1015,6 +1039,18 @@ int doIterations(const char *file_in,
         muons.DumpSimpleTree(rootfile);
     }
 
+    /// written in background while the analyzers go on
+    IBColumnExport muon_columns, event_columns;
+    if(p.dumpColumns){
+        char colfile[200];
+        sprintf(colfile, "%s_muons.ibcol",p.file_out);
+        if(muon_columns.Open(colfile, IBMuonCollection::ColumnNames()))
+            muons.DumpColumns(muon_columns);
+        sprintf(colfile, "%s_events.ibcol",p.file_out);
+        event_columns.Open(colfile, IBAnalyzerEM::EventColumnNames(),
+                           IBColumnExport::Binary, IBAnalyzerEM::EventColumnTypes());
+    }
+
 
     ////////////////////////////////////////////////////////////////////////////
     /////////////////////////////////// VOX COLLECTION /////
@@ -1162,12 +1198,19 @@ int doIterations(const char *file_in,
         std::cout << "\n--------- ITERATIONS...." << std::endl;
         voxels.InitLambda(air);
         char file[100];
+        /// images written in background while the next iterations run
+        IBVoxSnapshot snapshot(p.snapshot == "raw" ? IBVoxSnapshot::Raw :
+                               p.snapshot == "vtkbinary" ? IBVoxSnapshot::VtkBinary :
+                                                           IBVoxSnapshot::Vtk);
         for (int i=p.iterations(0); i<=p.iterations(2)/p.iterations(1); ++i) {
           std::cout << "Running iteration " << i << std::endl;
             aem->Run(p.iterations(1),1);
                 int n = i*p.iterations(1);
-                sprintf(file, "%s_%05i.vtk",file_out,n);
-                voxels.ExportToVtk(file,0);
+                sprintf(file, "%s_%05i.%s",file_out,n,
+                        snapshot.GetFormat() == IBVoxSnapshot::Raw ? "raw" : "vtk");
+                snapshot.Export(voxels,file,0);
+                if(event_columns.IsOpen())
+                    aem->DumpEventColumns(event_columns, n);
         }
         delete aem;
     }
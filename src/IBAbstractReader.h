@@ -32,6 +32,13 @@ public:
     virtual unsigned long GetNumberOfEvents() =0;
     virtual T *GetNext() =0;
 
+    // pulls up to n items, stopping at the first NULL; returns how many //
+    virtual unsigned long GetNext(T **items, unsigned long n) {
+        unsigned long i = 0;
+        while(i < n && (items[i] = GetNext())) ++i;
+        return i;
+    }
+
 protected:
     IBAbstractReader() {}
     IBAbstractReader(IBAbstractReader &copy) {}
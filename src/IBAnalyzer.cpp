@@ -25,7 +25,36 @@
 #include "IBAnalyzerPoca.h"
 #include "IBAnalyzerEM.h"
 #include "IBAnalyzerWPoca.h"
+#include "IBVoxCollection.h"
+#include "IBSparseVoxCollection.h"
 
 using namespace uLib;
 
 
+IBVoxel *IBAnalyzer::GetVoxel(Id_t id, bool allocate)
+{
+    if(m_SparseVoxCollection)
+        return allocate ? &m_SparseVoxCollection->operator [](id) :
+                          m_SparseVoxCollection->Find(id);
+    return &m_VoxCollection->operator [](id);
+}
+
+StructuredGrid *IBAnalyzer::GetVoxelGrid()
+{
+    if(m_SparseVoxCollection) return m_SparseVoxCollection;
+    return m_VoxCollection;
+}
+
+bool IBAnalyzer::IsInsideBounds(const Vector4f &pt) const
+{
+    if(m_SparseVoxCollection) return m_SparseVoxCollection->IsInsideBounds(pt);
+    return m_VoxCollection->IsInsideBounds(pt);
+}
+
+Id_t IBAnalyzer::GetNumberOfVoxels() const
+{
+    if(m_SparseVoxCollection) return m_SparseVoxCollection->GetDims().prod();
+    return m_VoxCollection->GetDims().prod();
+}
+
+
@@ -24,6 +24,7 @@
 
 #include <Detectors/MuonScatter.h>
 #include <Detectors/MuonError.h>
+#include <Math/StructuredGrid.h>
 
 #include "IBMuonCollection.h"
 
@@ -37,6 +38,8 @@ class IBAnalyzerEM;
 class IBPocaEvaluator;
 class IBMinimizationVariablesEvaluator;
 class IBVoxCollection;
+class IBSparseVoxCollection;
+class IBVoxel;
 
 
 class IBAnalyzer : public Object {
@@ -48,6 +51,8 @@ public:
     virtual uLibSetMacro(Experiment,IBExperiment *)
     virtual uLibGetMacro(VoxCollection,IBVoxCollection *)
     virtual uLibSetMacro(VoxCollection,IBVoxCollection *)
+    virtual uLibGetMacro(SparseVoxCollection,IBSparseVoxCollection *)
+    virtual uLibSetMacro(SparseVoxCollection,IBSparseVoxCollection *)
     virtual uLibGetMacro(MuonCollection,IBMuonCollection *)
     virtual uLibSetMacro(MuonCollection,IBMuonCollection *)
 
@@ -55,10 +60,18 @@ public:
     virtual void Run(unsigned int iterations, float muons_ratio) = 0;
     virtual unsigned int Size() { return 0; }
 
+    // voxel access on the sparse collection if set, on the dense otherwise //
+    // with allocate == false a voxel of an empty sparse block gives NULL   //
+    IBVoxel *GetVoxel(Id_t id, bool allocate = true);
+    StructuredGrid *GetVoxelGrid();
+    bool IsInsideBounds(const Vector4f &pt) const;
+    Id_t GetNumberOfVoxels() const;
+
 protected:
     IBAnalyzer() :
         m_Experiment(NULL),
         m_VoxCollection(NULL),
+        m_SparseVoxCollection(NULL),
         m_MuonCollection(NULL)
     {}
 
@@ -69,6 +82,7 @@ public:
 private:    
     IBExperiment       *m_Experiment;
     IBVoxCollection    *m_VoxCollection;
+    IBSparseVoxCollection *m_SparseVoxCollection;
 };
 
 #endif // IBANALYZER_H
@@ -20,6 +20,7 @@
 #include <math.h>
 #include <fstream>
 #include <algorithm>
+#include <typeinfo>
 
 #include <TTree.h>
 #include <TFile.h>
@@ -30,14 +31,22 @@
 #include <Core/Debug.h>
 
 #include "IBPocaEvaluator.h"
+#include "IBLineDistancePocaEvaluator.h"
 #include "IBMinimizationVariablesEvaluator.h"
+#include "IBMuonEventTTreeReader.h"
 #include "IBVoxRaytracer.h"
+#include "IBVoxOccupancy.h"
+#include "IBSparseVoxCollection.h"
+#include "IBColumnExport.h"
 
 #include "IBVoxCollectionCap.h"
 #include "IBAnalyzerEM.h"
 
 #include "IBAnalyzerEMAlgorithm.h"
 #include "IBAnalyzerEMAlgorithmSGA.h"
+#include "IBAnalyzerEMEngine.h"
+#include "IBAnalyzerEMSijStatistics.h"
+#include "IBAnalyzerEMSijRank.h"
 
 #include <string>
 #include <map>
@@ -61,9 +70,26 @@ public:
   IBAnalyzerEMPimpl(IBAnalyzerEM *parent, float rankLimit) :
         m_parent(parent),
         m_SijAlgorithm(NULL),
+        m_DumpPFile(NULL),
+        m_DumpPCounter(0),
+        m_Engine(NULL),
+        m_EngineSij(NULL),
+        m_EngineSijType(NULL),
+        m_EngineUpdate(NULL),
+        m_EngineMap(NULL),
+        m_EnginePrecision(IBAnalyzerEM::FloatPrecision),
+        m_EngineVoxels(0),
 	m_firstIteration(false),
 	m_rankLimit(rankLimit){;}
-  
+
+  ~IBAnalyzerEMPimpl() { delete m_Engine; }
+
+    // compile time specialized engine, kept across iterations and rebuilt
+    // only when the algorithms, the precision or the image size change;
+    // NULL when the algorithms are only known through their virtual call //
+    IBAnalyzerEMEngine *Engine(IBAbstract::IBVoxCollectionUpdateAlgorithm *update,
+                               IBAbstract::IBVoxCollectionMAPAlgorithm *map,
+                               IBVoxCollection *voxels);
   
     void Project(Event *evc);
 
@@ -71,12 +97,18 @@ public:
 
     void Evaluate(float muons_ratio);
 
+    // removes the events not kept along with their source muons, and full
+    // paths, from the collection; the selection is refreshed //
+    void Compact(const Vector<char> &keep);
+
     void filterEventsVoxelMask();
 
     void filterEventsLineDistance(float min, float max);
 
     void SijCut(float threshold);
 
+    void RankCut(float limit);
+
     Vector<Event > SijCutCount(float threshold_low, float threshold_high);
 
     float SijMedian(const Event &evc);
@@ -89,15 +121,56 @@ public:
 
     void SetSijMedianMomentum();
 
+    // Sij statistics of the last evaluation, computed on first use and
+    // extended when new cut levels are asked //
+    const IBAnalyzerEMSijStatistics &SijStatistics(const Vector<float> &levels = Vector<float>());
+
     // members //
     IBAnalyzerEM          *m_parent;
     IBAnalyzerEMAlgorithm *m_SijAlgorithm;
     Vector<Event> m_Events;
+    IBAnalyzerEMSijStatistics m_SijStats;
+    TFile                 *m_DumpPFile;
+    int                    m_DumpPCounter;
+
+    IBAnalyzerEMEngine    *m_Engine;
+    IBAnalyzerEMAlgorithm *m_EngineSij;
+    const std::type_info  *m_EngineSijType;
+    IBAbstract::IBVoxCollectionUpdateAlgorithm *m_EngineUpdate;
+    IBAbstract::IBVoxCollectionMAPAlgorithm    *m_EngineMap;
+    IBAnalyzerEMEngine::Precision m_EnginePrecision;
+    size_t                 m_EngineVoxels;
 
-  bool m_rankLimit;      
   bool m_firstIteration;
+  float m_rankLimit;
 };
 
+//________________________
+IBAnalyzerEMEngine *
+IBAnalyzerEMPimpl::Engine(IBAbstract::IBVoxCollectionUpdateAlgorithm *update,
+                          IBAbstract::IBVoxCollectionMAPAlgorithm *map,
+                          IBVoxCollection *voxels)
+{
+    const std::type_info *type = m_SijAlgorithm ? &typeid(*m_SijAlgorithm) : NULL;
+    const size_t nvox = voxels ? voxels->Data().size() : 0;
+    if(m_EngineSijType && m_SijAlgorithm == m_EngineSij && type &&
+       *type == *m_EngineSijType && update == m_EngineUpdate &&
+       map == m_EngineMap && m_parent->m_Precision == m_EnginePrecision &&
+       nvox == m_EngineVoxels)
+        return m_Engine;
+
+    delete m_Engine;
+    m_Engine = IBAnalyzerEMEngine::Create(m_SijAlgorithm, update, map,
+                                          m_parent->m_Precision);
+    m_EngineSij       = m_SijAlgorithm;
+    m_EngineSijType   = type;
+    m_EngineUpdate    = update;
+    m_EngineMap       = map;
+    m_EnginePrecision = m_parent->m_Precision;
+    m_EngineVoxels    = nvox;
+    return m_Engine;
+}
+
 //________________________
 void IBAnalyzerEMPimpl::Project(Event *evc){
     // compute sigma //
@@ -109,28 +182,8 @@ void IBAnalyzerEMPimpl::Project(Event *evc){
 
 //________________________
 void IBAnalyzerEMPimpl::BackProject(Event *evc){
-
-    IBVoxel *vox = NULL;
     // sommatoria della formula 38 //
-    for (unsigned int j = 0; j < evc->elements.size(); j++) {
-      vox = evc->elements[j].voxel;
-      if( vox==NULL || std::isnan(evc->elements[j].Sij) || std::isnan(vox->SijCap))
-        continue;
-      #pragma omp atomic
-      vox->SijCap += evc->elements[j].Sij;
-//        {
-//            //            IBVoxel *v0 = &(*m_parent->GetVoxCollection()->Data().begin());
-//            //            int id = (vox-v0)/sizeof(IBVoxel);
-//            if( isnan(evc->elements[j].Sij) ) {
-//                std::cout << "nan Sij in vox:" << vox << " mu:" << evc << "\n" << std::flush;
-//            }
-//            if( isnan(vox->SijCap) ) {
-//                std::cout << "nan SijCap in vox:" << vox << " mu:" << evc << "\n" << std::flush;
-//            }
-//        }
-	#pragma omp atomic
-        vox->Count++;
-    }
+    IBAnalyzerEMPolicy::BackProject(evc);
 }
 
 //________________________
@@ -142,9 +195,16 @@ void IBAnalyzerEMPimpl::Evaluate(float muons_ratio)
     unsigned int end = (unsigned int) (m_Events.size());
     unsigned int ev = start;
 
+    m_SijStats.Invalidate();
+
     std::cout << "IBAnalyzerEMPimpl::Evaluate form start " << start << " to end " << end << " collection size " << m_Events.size() << " muons ratio " << muons_ratio << std::endl;
 
-    if(m_SijAlgorithm) {
+    IBVoxCollection *dense = m_parent->GetSparseVoxCollection() ? NULL :
+                             m_parent->GetVoxCollection();
+    if(IBAnalyzerEMEngine *engine = this->Engine(NULL, NULL, dense)) {
+        engine->Evaluate(m_Events, dense);
+    }
+    else if(m_SijAlgorithm) {
       // Projection
       #pragma omp parallel for
       for (unsigned int i = start; i < end; ++i){
@@ -163,97 +223,6 @@ void IBAnalyzerEMPimpl::Evaluate(float muons_ratio)
     else {
         std::cerr << "Error: Lamda ML Algorithm not set\n";
     }
-    
-    //------------- SIJ RANK NEEDED FOR ALL SIJ RANK STUFF
-    // if(m_firstIteration){
-    //   m_firstIteration = false;
-                  
-    //   //---- Step 1: Map voxel ('elements[j]') to sij
-    //   std::map<IBVoxel*,std::vector<float> > voxelMap;
-    //   for (unsigned int i = start; i < end; ++i){
-    // 	for (unsigned int j = 0; j < m_Events[i].elements.size(); ++j) {
-    // 	  IBVoxel* vox = m_Events[i].elements[j].voxel;
-    // 	  float sij = m_Events[i].elements[j].Sij;
-    // 	  if(voxelMap.find(vox)==voxelMap.end()) voxelMap[vox] = std::vector<float>();
-    // 	  voxelMap[vox].push_back(sij);
-    // 	}
-    //   }      
-    //   //std::cout << "\n>> Got a voxel map of size " << voxelMap.size() << std::endl;
-
-    //   //------------- SIJ RANK KILL
-    //   //---- NEED TO ALSO SET muon_event.SetMomentum(7); in *MUBLAST*p
-    //   //   //----
-    // //   std::vector<Event*> killList;
-    // //   for (unsigned int i = start; i < end; ++i) {	
-    // // 	float rankSum = 0.;
-    // // 	for (unsigned int j = 0; j < m_Events[i].elements.size(); ++j) {
-    // //  	  IBVoxel* vox = m_Events[i].elements[j].voxel;
-    // //  	  float sij = m_Events[i].elements[j].Sij;
-    // // 	  std::vector<float>& v = voxelMap[vox];
-    // // 	  std::sort(v.begin(), v.end());
-    // // 	  int sijPos = 0;
-    // // 	  for(; sijPos < v.size() && v[sijPos] != sij; sijPos++);
-    // // 	  rankSum += float(sijPos - v.size()/2)/sqrt(float(v.size()));
-     // // 	}
-    // // 	rankSum = rankSum/sqrt(m_Events[i].elements.size());
-    // // 	if(rankSum < m_rankLimit) killList.push_back(&m_Events.at(i));
-    // //   }
-      
-    // //   for(std::vector<Event*>::iterator it=killList.begin(); it!=killList.end(); it++){
-    // // 	m_Events.remove_element(**it);
-    // //   }
-    // // }
-    //   //------------- END SIJ RANK KILL
-
-    //   //------------- END SIJ RANK FIND
-    // //   //---- Step 3.5 Make TFile and TTree
-    // //   gROOT->ProcessLine("#include <vector>");
-    // //   TFile* tfile = new TFile("joelout.root","RECREATE");
-    // //   TTree* ttree = new TTree("joeltree","joeltree");
-    // //   //      std::vector<float> sigmaMean;  
-    // //   //      std::vector<float> sigmaMedian;
-    // //   std::vector<int> position;
-    // //   std::vector<int> size;
-    // //   float muonMomentum;
-    // //   //      ttree->Branch("sigmaMean", &sigmaMean);
-    // //   //      ttree->Branch("sigmaMedian", &sigmaMedian);
-    // //   ttree->Branch("position", &position);
-    // //   ttree->Branch("size", &size);
-    // //   ttree->Branch("muonMomentum", &muonMomentum);      
-    
-    // //   //---- Step 4: For each muon i calculate the sij distribution
-    // //   for (unsigned int i = start; i < end; ++i) {
-    // // 	//    	sigmaMean.clear();
-    // // 	//    	sigmaMedian.clear();
-    // // 	position.clear();
-    // // 	size.clear();
-    // // 	for (unsigned int j = 0; j < m_Events[i].elements.size(); ++j) {
-    // // 	  IBVoxel* vox = m_Events[i].elements[j].voxel;
-    // // 	  float sij = m_Events[i].elements[j].Sij;
-	  
-    // // 	  //----
-    // // 	  std::vector<float>& v = voxelMap[vox];
-    // // 	  std::sort(v.begin(), v.end());
-    // // 	  int sijPos = 0;
-    // // 	  for(; sijPos < v.size() && v[sijPos] != sij; sijPos++);
-    // // 	  position.push_back(sijPos);
-    // // 	  size.push_back(v.size());
-
-    // // 	  // //----
-    // // 	  // if(voxelMap_stats.find(vox) == voxelMap_stats.end()) continue;
-    // // 	  // std::vector<float>& v_stats = voxelMap_stats[vox];
-    // // 	  // if(v_stats[1] == 0) continue;
-    // // 	  // sigmaMean.push_back((v_stats[0]-sij)/v_stats[1]);
-    // // 	  // sigmaMedian.push_back((v_stats[2]-sij)/v_stats[3]);
-    // // 	}
-    // // 	muonMomentum = m_Events[i].header.InitialSqrP;
-    // // 	std::cout << m_Events[i].header.InitialSqrP << std::endl;
-    // // 	ttree->Fill();
-    // //   }
-    // //   ttree->Write();
-    // //   tfile->Close();  
-    // // }
-      //------------- END SIJ RANK FIND END
 }
     
 
@@ -263,15 +232,64 @@ void IBAnalyzerEMPimpl::Evaluate(float muons_ratio)
 ////// CUTS ////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////
 
+/// events and muons are compacted in place; a muon goes with its event, the
+/// muons that gave no event are left in the collection
+void IBAnalyzerEMPimpl::Compact(const Vector<char> &keep)
+{
+    m_SijStats.Invalidate();
+    IBMuonCollection *collection = this->m_parent->m_MuonCollection;
+    const unsigned int nmuons = collection ? collection->Data().size() : 0;
+    Vector<char> drop(nmuons, 0);
+
+    const unsigned int size = m_Events.size();
+    unsigned int k = 0;
+    for (unsigned int i = 0; i < size; ++i) {
+        if(!keep[i]) {
+            if(m_Events[i].header.muon < nmuons) drop[m_Events[i].header.muon] = 1;
+            continue;
+        }
+        if(k != i) {
+            m_Events[k].header = m_Events[i].header;
+            m_Events[k].elements.swap(m_Events[i].elements);
+        }
+        ++k;
+    }
+    m_Events.erase(m_Events.begin() + k, m_Events.end());
+    if(!collection || k == size) return;
+
+    // muons and full paths, the events follow the new muon positions //
+    Vector<MuonScatterData> &muons = collection->Data();
+    Vector< Vector<Vector4f> > &paths = collection->FullPath();
+    const bool with_paths = paths.size() == nmuons;
+    Vector<unsigned int> moved(nmuons);
+    unsigned int n = 0;
+    for (unsigned int j = 0; j < nmuons; ++j) {
+        moved[j] = n;
+        if(drop[j]) continue;
+        if(n != j) {
+            muons[n] = muons[j];
+            if(with_paths) paths[n].swap(paths[j]);
+        }
+        ++n;
+    }
+    muons.erase(muons.begin() + n, muons.end());
+    if(with_paths) paths.erase(paths.begin() + n, paths.end());
+    for (unsigned int i = 0; i < k; ++i)
+        if(m_Events[i].header.muon < nmuons)
+            m_Events[i].header.muon = moved[m_Events[i].header.muon];
+    collection->UpdateSelection();
+}
+
+//________________________
 /// filter events after voxel mask has been applied
 void IBAnalyzerEMPimpl::filterEventsVoxelMask()
 {
   std::cout << "\nIBAnalyzerEM: Removing frozen voxels from " << this->m_Events.size() << " muon collection." << std::endl;
-    Vector< Event >::iterator itr = this->m_Events.begin();
-    const Vector< Event >::iterator begin = this->m_Events.begin();
+    m_SijStats.Invalidate();
+    Vector<char> keep(this->m_Events.size());
 
-    while (itr != this->m_Events.end()) {
-        Event & evc = *itr;
+    for (unsigned int i = 0; i < this->m_Events.size(); ++i) {
+        Event & evc = this->m_Events[i];
         Vector< Event::Element >::iterator itre = evc.elements.begin();
         // create new vector and fill it with positive voxels
         Vector< Event::Element > newvelc;
@@ -288,21 +306,14 @@ void IBAnalyzerEMPimpl::filterEventsVoxelMask()
         }
 //        if(newvelc.size() != evc.elements.size()){
 //            std::cout << newvelc.size() << " voxels left from muon of " << evc.elements.size() << " voxels " << std::endl;
-//            std::cout << this->m_parent->m_MuonCollection->Data().at(itr-begin);
+//            std::cout << this->m_parent->m_MuonCollection->Data().at(evc.header.muon);
 //        }
 
         evc.elements = newvelc;
-
-        /// erase event and muon with empty voxel collection
-        if(evc.elements.empty()){
-            unsigned int pos = itr - begin;
-            this->m_Events.remove_element(evc);
-            if(this->m_parent->m_MuonCollection)
-                this->m_parent->m_MuonCollection->Data().remove_element(pos);
-        }
-        else
-            ++itr;
+        keep[i] = !evc.elements.empty();
     }
+    /// erase event and muon with empty voxel collection
+    this->Compact(keep);
     std::cout << " " << this->m_Events.size() << " muons left!" << std::endl;
 
     return;
@@ -314,27 +325,49 @@ void IBAnalyzerEMPimpl::filterEventsVoxelMask()
 void IBAnalyzerEMPimpl::filterEventsLineDistance(float min, float max)
 {
   std::cout << "\n*** Removing events with line distance out of range from " << this->m_Events.size() << " muon collection." << std::endl;
+    m_SijStats.Invalidate();
 
-    Vector< Event >::iterator itr = this->m_Events.begin();
-    const Vector< Event >::iterator begin = this->m_Events.begin();
-
-    while (itr != this->m_Events.end()) {
-        Event & evc = *itr;
-        unsigned int pos = itr - begin;
-
-        MuonScatterData muon = this->m_parent->m_MuonCollection->At(pos);
-        bool use_poca = this->m_parent->m_PocaAlgorithm->evaluate(muon);
-        float dist = this->m_parent->m_PocaAlgorithm->getDistance();
-
-        /// erase event and muon with distance out of range
-        if(!isFinite(dist) || dist >= max || dist < min){
-
-            this->m_Events.remove_element(evc);
-            this->m_parent->m_MuonCollection->Data().remove_element(pos);
+    if(!this->m_parent->m_MuonCollection) {
+        std::cerr << "*** line distance filter needs the muon collection ***\n";
+        return;
+    }
+    // each event goes back to its own source muon, whatever the selection //
+    const Vector<MuonScatterData> &muons = this->m_parent->m_MuonCollection->Data();
+    const int size = this->m_Events.size();
+    Vector<int> src;
+    src.reserve(size);
+    for(int i = 0; i < size; ++i)
+        if(this->m_Events[i].header.muon < muons.size())
+            src.push_back(i);
+    const int n = src.size();
+    Vector<Scalarf> dist(n, NAN);
+
+    // line distance evaluator runs as a single stateless batch //
+    IBLineDistancePocaEvaluator *ld =
+            dynamic_cast<IBLineDistancePocaEvaluator *>(this->m_parent->m_PocaAlgorithm);
+    if(ld) {
+        Vector<HLine3f> line_in(n), line_out(n);
+        for(int i = 0; i < n; ++i) {
+            const MuonScatterData &mu = muons[this->m_Events[src[i]].header.muon];
+            line_in[i]  = mu.LineIn();
+            line_out[i] = mu.LineOut();
         }
-        else
-	  ++itr;
+        if(n) ld->evaluate(&line_in[0], &line_out[0], n,
+                           NULL, NULL, NULL, &dist[0], NULL);
     }
+    else {
+        for(int i = 0; i < n; ++i) {
+            this->m_parent->m_PocaAlgorithm->evaluate(muons[this->m_Events[src[i]].header.muon]);
+            dist[i] = this->m_parent->m_PocaAlgorithm->getDistance();
+        }
+    }
+
+    /// erase event and muon with distance out of range, events with no
+    /// source muon are kept
+    Vector<char> keep(size, 1);
+    for(int i = 0; i < n; ++i)
+        keep[src[i]] = isFinite(dist[i]) && dist[i] < max && dist[i] >= min;
+    this->Compact(keep);
 
     std::cout << " " << this->m_Events.size() << " muons left!" << std::endl;
 
@@ -343,77 +376,45 @@ void IBAnalyzerEMPimpl::filterEventsLineDistance(float min, float max)
 
 //________________________
 ////////////////////////////////////////////////////////////////////////////////
-/// SijCut RECIPE1:  (true if Sij cut proposed) //
-static bool em_test_SijCut(const Event &evc, float cut_level, int &nvox_cut){
-    nvox_cut = 0;
-//    std::cout << "Testing treshold " << cut_level << std::endl;
-
-   for (unsigned int i = 0; i < evc.elements.size(); i++) {
-        const Event::Element &el = evc.elements[i];
-        if (fabs( (el.Sij * el.voxel->Count - el.voxel->SijCap)
-                  / el.voxel->SijCap ) > cut_level) nvox_cut++;
-//        if(isnan(el.voxel->SijCap)){
-//            std::cout << "ATTENTION: nan Sij sum!....";
-//            /// this voxel should increment n_cuts, which is not at the moment. FIX it in the future
-//            /// this "bug" consequence is that 2% of events is nasty and not classified with SijCutCount
-//        }
+const IBAnalyzerEMSijStatistics &
+IBAnalyzerEMPimpl::SijStatistics(const Vector<float> &levels)
+{
+    bool valid = m_SijStats.IsValid() && m_SijStats.Size() == m_Events.size();
+    Vector<Scalarf> cuts = m_SijStats.GetCutLevels();
+    for (unsigned int i = 0; i < levels.size(); ++i)
+        if(!m_SijStats.HasCutLevel(levels[i])) {
+            cuts.push_back(levels[i]);
+            valid = false;
+        }
+    if(!valid) {
+        m_SijStats.SetCutLevels(cuts);
+        m_SijStats.Compute(m_Events);
     }
-//    std::cout << "\n n_cuts=" << nvox_cut << ", 1/3 of the voxels=" << evc.elements.size()/3  << std::endl;
-    if (nvox_cut > (int)(evc.elements.size()/3) ) return true;
-    else return false;
-
-    /// MEMORANDUM : testing this function I see that voxel Count doubles at each call ... WHY?
-    /// SijCap updates, so the Sij incrementum is the same, no difference in computation.
-    /// 20160408 SV stop inquiring.... no time now!
+    return m_SijStats;
 }
 
 //________________________
 float IBAnalyzerEMPimpl::SijMedian(const Event &evc){
-
-    Vector< float > Si;
-    for (unsigned int i = 0; i < evc.elements.size(); i++) {
-        const Event::Element &el = evc.elements[i];
-        Si.push_back(fabs( (el.Sij * el.voxel->Count - el.voxel->SijCap) / el.voxel->SijCap ));
-    }
-
-    // compute median
-    float Smedian;
-    std::sort(Si.begin(),Si.end());
-   int nS = Si.size();
-   if(nS){
-       if(nS%2)
-           Smedian = Si[nS / 2];
-       else
-           Smedian = (Si[nS / 2 - 1] + Si[nS / 2]) / 2;
-    }
-//    /// debug
-//    if(Smedian==0){
-//        for(int i=0; i<nS; i++) std::cout << Si[i] << ",";
-//        std::cout << "\n     MEDIAN =" << Smedian << std::endl;
-//    }
-    return Smedian;
+    // cached for events of the collection //
+    if(m_SijStats.IsValid() && m_SijStats.Size() == m_Events.size() &&
+            !m_Events.empty() && &evc >= &m_Events.front() && &evc <= &m_Events.back())
+        return m_SijStats.Median(&evc - &m_Events.front());
+    Vector<Scalarf> Si;
+    return IBAnalyzerEMSijStatistics::Median(evc, Si);
 }
 
 //________________________
 Vector<Event > IBAnalyzerEMPimpl::SijCutCount(float threshold_low, float threshold_high)
 {
-    //std::cout << "Cut tresholds : " << std::dec << threshold_low << ", " << threshold_high << " ... " << std::endl;
+    Vector<float> levels;
+    levels.push_back(threshold_low);
+    levels.push_back(threshold_high);
+    const IBAnalyzerEMSijStatistics &stats = this->SijStatistics(levels);
+
     Vector< Event > ve;
-    Vector< Event >::iterator itr = this->m_Events.begin();
-    const Vector< Event >::iterator begin = this->m_Events.begin();
-    int evnum = 0;
-    int nvox_cut_low = 0;
-    int nvox_cut_high = 0;
-
-    while (itr != this->m_Events.end()) {
-//        std::cout << "\n\n *** Event " << evnum << std::endl;
-        if(em_test_SijCut(*itr, threshold_low,nvox_cut_low) && !em_test_SijCut(*itr, threshold_high,nvox_cut_high)){
-            ve.push_back(*itr);
-//            std::cout << "Passed!\n";
-        }
-        evnum++;
-        ++itr;
-    }
+    for (unsigned int i = 0; i < m_Events.size(); ++i)
+        if(stats.IsCut(i, threshold_low) && !stats.IsCut(i, threshold_high))
+            ve.push_back(m_Events[i]);
 //    std::cout << "SijCutCount: muons between tresholds ["
 //              << threshold_low << "," << threshold_high << "] = "
 //              << ve.size() << " over " << m_Events.size() << "\n";
@@ -426,106 +427,69 @@ void IBAnalyzerEMPimpl::dumpEventsSijInfo(const char *name, Vector<float> N)
     std::fstream fout;
     fout.open(name, std::fstream::out | std::fstream::app);
 
-    Vector< Event > ve;
-    Vector< Event >::iterator itr = this->m_Events.begin();
-    const Vector< Event >::iterator begin = this->m_Events.begin();
-    int nev = 0;
+    const IBAnalyzerEMSijStatistics &stats = this->SijStatistics();
 
     /// loop over events
-    while (itr != this->m_Events.end()) {
-        //std::cout << "\n\n *** Event " << nev << std::endl;
-        Event & evc = *itr;
+    for (unsigned int nev = 0; nev < m_Events.size(); ++nev) {
+        const Event & evc = m_Events[nev];
         /// momentum
-        float p0sq = 3. * 3.;
         //float mom = sqrt(p0sq/evc.header.InitialSqrP);
         float mom =  evc.header.pTrue;
 
-        /// compute and dump median
-        Vector< float > Si;
-        float median;
-        Vector< Event::Element >::iterator itre = evc.elements.begin();
-        while (itre != evc.elements.end()) {
-            Event::Element & elc = *itre;
-            float Nij = fabs( (elc.Sij * elc.voxel->Count - elc.voxel->SijCap) / elc.voxel->SijCap );
-            Si.push_back(Nij);
-            ++itre;
-        }
-        std::sort(Si.begin(),Si.end());
-        int nS = Si.size();
-        if(nS){
-           if(nS%2)
-               median = Si[nS / 2];
-           else
-               median = (Si[nS / 2 - 1] + Si[nS / 2]) / 2;
-        }
-
+        /// dump median
         fout << nev << " " << mom << " ";
-        // fout << evc.elements.size() << " ";
-        //float median =  SijMedian(*itr);
-        fout << median << " ";
-
-//        /// loop over Sij tresholds
-//        Vector< float >::iterator itrN = N.begin();
-//        const Vector< float >::iterator beginN = N.begin();
-//        while (itrN != N.end()) {
-//            int nvox_cut = 0;
-//            // dump number of voxels above the threshold
-//            em_test_SijCut(*itr, *itrN, nvox_cut);
-//            fout << nvox_cut << " ";
-//            // dump N cut bin low edge
-//            float threshold_low = *itrN;
-//            float threshold_high = *(itrN+1);
-//            if(itrN+1==N.end())
-//                threshold_high = 10000;
-//             if(em_test_SijCut(*itr, threshold_low,nvox_cut) && !em_test_SijCut(*itr, threshold_high,nvox_cut))
-//                 fout << threshold_low << " ";
-
-//            ++itrN;
-//        }
-
+        fout << stats.Median(nev) << " ";
         fout << "\n";
-        nev++;
-        ++itr;
     }
     fout.close();
     return;
 }
 //________________________
 void IBAnalyzerEMPimpl::SijCut(float threshold){
-    Vector< Event >::iterator itr = this->m_Events.begin();
-    const Vector< Event >::iterator begin = this->m_Events.begin();
+    Vector<float> levels(1, threshold);
+    const IBAnalyzerEMSijStatistics &stats = this->SijStatistics(levels);
+
+    /// SijCut RECIPE1: more than a third of the voxels above threshold
+    const unsigned int size = m_Events.size();
+    Vector<char> keep(size);
+    for (unsigned int i = 0; i < size; ++i)
+        keep[i] = !stats.IsCut(i, threshold);
+    this->Compact(keep);
+    std::cout << "SijCut removed muons: " << size - m_Events.size() << "\n" << std::endl;
+}
 
-    int count = 0;
-    int nvox_cut=0;
-    while (itr != this->m_Events.end()) {
-        if(em_test_SijCut(*itr, threshold, nvox_cut))
-        {
-            unsigned int pos = itr - begin;
-            this->m_Events.remove_element(*itr);
-            if(this->m_parent->m_MuonCollection)
-                this->m_parent->m_MuonCollection->Data().remove_element(pos);
-            count ++;
-        }
-        else ++itr;
-    }
-    std::cout << "SijCut removed muons: " << count << "\n" << std::endl;
+//________________________
+void IBAnalyzerEMPimpl::RankCut(float limit){
+    IBAnalyzerEMSijRank rank;
+    rank.Build(m_Events);
+
+    /// events with normalized Sij rank sum below limit are removed
+    const unsigned int size = m_Events.size();
+    Vector<char> keep(size);
+    for (unsigned int i = 0; i < size; ++i)
+        keep[i] = rank.Score(i) >= limit;
+    this->Compact(keep);
+    std::cout << "RankCut removed muons: " << size - m_Events.size() << " over "
+              << rank.GetNumberOfVoxels() << " crossed voxels\n" << std::endl;
 }
 
 //________________________
 void IBAnalyzerEMPimpl::SijGuess(float threshold, float p){
-    Vector< Event >::iterator itr = this->m_Events.begin();
+    Vector<float> levels(1, threshold);
+    const IBAnalyzerEMSijStatistics &stats = this->SijStatistics(levels);
+
+    const float invp2 = pow(m_parent->$$.nominal_momentum / p, 2);
     int count = 0;
-    int nvox_cut=0;
-    while (itr != this->m_Events.end()) {
-        if(em_test_SijCut(*itr, threshold, nvox_cut))
+    #pragma omp parallel for reduction(+:count)
+    for (int i = 0; i < (int)m_Events.size(); ++i) {
+        if(stats.IsCut(i, threshold))
         {
-            itr->header.InitialSqrP = m_parent->$$.nominal_momentum / p;
-            itr->header.InitialSqrP *= itr->header.InitialSqrP;
-            for (unsigned int j = 0; j < itr->elements.size(); ++j)
-                itr->elements[j].pw = itr->header.InitialSqrP;
+            Event &evc = m_Events[i];
+            evc.header.InitialSqrP = invp2;
+            for (unsigned int j = 0; j < evc.elements.size(); ++j)
+                evc.elements[j].pw = invp2;
             count ++;
         }
-        itr++;
     }
     std::cout << "Guess class " << threshold << ", p=" << p << "   counted muons: " << count << "\n" << std::endl;
 }
@@ -533,14 +497,13 @@ void IBAnalyzerEMPimpl::SijGuess(float threshold, float p){
 //________________________
 ///////////////////////////////////////////////////////////////////////////////////////
 void IBAnalyzerEMPimpl::SetSijMedianMomentum(){
-    Vector< Event >::iterator itr = this->m_Events.begin();
-
-//    std::cout << "SetSijMedianMomentum \n"
-//              << "old invp2 = " << itr->header.InitialSqrP/(m_parent->$$.nominal_momentum * m_parent->$$.nominal_momentum);
+    const IBAnalyzerEMSijStatistics &stats = this->SijStatistics();
+    const float p0sq = m_parent->$$.nominal_momentum * m_parent->$$.nominal_momentum;
 
-    while (itr != this->m_Events.end()) {
-        Event & evc = (*itr);
-        float m = SijMedian(evc);
+    #pragma omp parallel for
+    for (int i = 0; i < (int)m_Events.size(); ++i) {
+        Event & evc = m_Events[i];
+        float m = stats.Median(i);
 
         //fit function for pguess from Sij median
         /// 20160530 entire furnace
@@ -550,30 +513,21 @@ void IBAnalyzerEMPimpl::SetSijMedianMomentum(){
         float invp2guess = 0.0375 + (0.0333 *m)-(0.0002 *m*m);
 
         if(std::isnan(invp2guess)){
+            #pragma omp critical
             std::cout << "ATTENTION nan invp2!!" << std::endl;
-        invp2guess = 0.0004;
+            invp2guess = 0.0004;
         }
 
-
         // cut off if p>50GeV i.e. 1/p2 < 0.0004
         if(invp2guess<0.0004)
             invp2guess = 0.0004;
 
         /// set InitialSqrP variable
-        itr->header.InitialSqrP = m_parent->$$.nominal_momentum * m_parent->$$.nominal_momentum * invp2guess;
+        evc.header.InitialSqrP = p0sq * invp2guess;
 
         /// set in addition every voxel pw, since from voxel momentum code it is used in the algorithm
-        Vector< Event::Element >::iterator itre = evc.elements.begin();
-        while (itre != evc.elements.end()) {
-            Event::Element &elc = *itre;
-            elc.pw = m_parent->$$.nominal_momentum * m_parent->$$.nominal_momentum *invp2guess;
-//            std::cout << "Setting voxel pw.... " << elc.pw << std::endl;
-            ++itre;
-        }
-
-//        std::cout  << ", median = " << m << ", invp2guess " << invp2guess
-//                  << ", pguess = " <<  sqrt(m_parent->$$.nominal_momentum *m_parent-> $$.nominal_momentum/itr->header.InitialSqrP) << std::endl;
-        itr++;
+        for (unsigned int j = 0; j < evc.elements.size(); ++j)
+            evc.elements[j].pw = p0sq * invp2guess;
     }
 }
 
@@ -582,23 +536,18 @@ void IBAnalyzerEMPimpl::SetSijMedianMomentum(){
 ////////////////////////////////////////////////////////////////////////////////
 void IBAnalyzerEMPimpl::Chi2Cut(float threshold)
 {
-    std::vector< Event >::iterator itr = this->m_Events.begin();
-    const Vector< Event >::iterator begin = this->m_Events.begin();
-
-    do {
+    const int size = this->m_Events.size();
+    Vector<char> keep(size);
+    #pragma omp parallel for
+    for (int i = 0; i < size; ++i) {
         Matrix4f Sigma = Matrix4f::Zero();
-        Event &evc = *itr;
+        Event &evc = this->m_Events[i];
         this->m_SijAlgorithm->ComputeSigma(Sigma,&evc);
         Matrix4f iS = Sigma.inverse();
         Matrix4f Dn = iS * (evc.header.Di * evc.header.Di.transpose());
-        if ( Dn.trace() > threshold ){
-            unsigned int pos = itr - begin;
-            this->m_Events.remove_element(*itr);
-            if(this->m_parent->m_MuonCollection)
-                this->m_parent->m_MuonCollection->Data().remove_element(pos);
-        }
-        else ++itr;
-    } while (itr != this->m_Events.end());
+        keep[i] = !( Dn.trace() > threshold );
+    }
+    this->Compact(keep);
 }
 
 
@@ -614,21 +563,26 @@ class UpdateDensitySijCapAlgorithm :
 public:
     static void UpdateDensity(IBVoxCollection *voxels, unsigned int threshold)
     {
-        for(unsigned int i=0; i< voxels->Data().size(); ++i) {
-            IBVoxel& voxel = voxels->Data()[i];
-            unsigned int tcount = voxel.Count;
-            if ( voxel.Value > 0 && tcount > 0 && (threshold == 0 || tcount >= threshold) ) {
-                voxel.Value += voxel.SijCap / static_cast<float>(tcount);
-                if(unlikely(!isFinite(voxel.Value) || voxel.Value > 100.E-6)) {  // HARDCODED!!!
-                    voxel.Value = 100.E-6;
-                }
-                //                 else if (unlikely(voxel.Value < 0.)) voxel.Value = 0.1E-6;
-            }
-            // else
-            //             voxel.Value = 0;
-            voxel.SijCap = 0;
+        for(unsigned int i=0; i< voxels->Data().size(); ++i)
+            UpdateVoxel(voxels->Data()[i], threshold);
+    }
+
+    // background voxels are never crossed, only allocated blocks change //
+    static void UpdateDensity(IBSparseVoxCollection *voxels, unsigned int threshold)
+    {
+        const unsigned int size = voxels->GetBlockVolume();
+        for(unsigned int i=0; i< voxels->GetNumberOfBlocks(); ++i) {
+            IBVoxel *block = voxels->GetBlock(i);
+            for(unsigned int j=0; j<size; ++j)
+                UpdateVoxel(block[j], threshold);
         }
     }
+
+private:
+    static inline void UpdateVoxel(IBVoxel &voxel, unsigned int threshold)
+    {
+        IBAnalyzerEMPolicy::SijCapUpdate::UpdateVoxel(voxel, threshold);
+    }
 };
 
 
@@ -644,26 +598,68 @@ IBAnalyzerEM::IBAnalyzerEM(IBVoxCollection &voxels, int nPath, double alpha, boo
     m_VarAlgorithm(NULL),
     m_RayAlgorithm(NULL),
     m_UpdateAlgorithm(NULL),
+    m_Precision(FloatPrecision),
+    m_PWeightStage(NULL),
     m_nPath(nPath),
     m_alpha(alpha),
     m_useRecoPath(useRecoPath),
     m_oldTCalculation(oldTCalculation),
     m_rankLimit(rankLimit),
     m_initialSqrPfromVtk(initialSqrPfromVtk),
-    m_pVoxelMean(pVoxelMean)
+    m_pVoxelMean(pVoxelMean),
+    m_Occupancy(NULL)
 {
+  BaseClass::SetVoxCollection(&voxels);
+  Init();
+}
+
+//___________________________
+IBAnalyzerEM::IBAnalyzerEM(IBSparseVoxCollection &voxels, int nPath, double alpha, bool useRecoPath,
+               bool oldTCalculation, float rankLimit, IBVoxCollection* initialSqrPfromVtk, int pVoxelMean) :
+    m_PocaAlgorithm(NULL),
+    m_VarAlgorithm(NULL),
+    m_RayAlgorithm(NULL),
+    m_UpdateAlgorithm(NULL),
+    m_Precision(FloatPrecision),
+    m_PWeightStage(NULL),
+    m_nPath(nPath),
+    m_alpha(alpha),
+    m_useRecoPath(useRecoPath),
+    m_oldTCalculation(oldTCalculation),
+    m_rankLimit(rankLimit),
+    m_initialSqrPfromVtk(initialSqrPfromVtk),
+    m_pVoxelMean(pVoxelMean),
+    m_Occupancy(NULL)
+{
+  BaseClass::SetSparseVoxCollection(&voxels);
+  Init();
+}
+
+//___________________________
+void IBAnalyzerEM::Init(){
   //---- Print the settings
   std::cout << "Using alpha = " << m_alpha << ", #path = " << m_nPath << std::endl;
   std::cout << "Reco path ("    << m_useRecoPath      << "), "
 	    << "Old T ("        << m_oldTCalculation  << "), " << std::endl;
-  BaseClass::SetVoxCollection(&voxels);
   init_properties(); // < DANGER !!! should be moved away !!
   m_d = new IBAnalyzerEMPimpl(this, m_rankLimit);
 }
 
+//___________________________
+const IBVoxel *IBAnalyzerEM::FrozenBackground() const {
+  const IBSparseVoxCollection *sparse =
+      const_cast<IBAnalyzerEM *>(this)->GetSparseVoxCollection();
+  if(!sparse) return NULL;
+  // only a masked (negative) background is frozen, the default zero is not //
+  const IBVoxel &bg = sparse->GetBackground();
+  return (bg.Count == 0 && isFinite(bg.Value) && bg.Value < 0) ? &bg : NULL;
+}
+
 //___________________________
 IBAnalyzerEM::~IBAnalyzerEM(){
+    if(m_d->m_DumpPFile) this->DumpP(NULL);
     delete m_d;
+    delete m_Occupancy;
 }
 
 //___________________________
@@ -697,6 +693,7 @@ void IBAnalyzerEM::DumpEvent(Event *evc){
 bool IBAnalyzerEM::AddMuon(const MuonScatterData &muon){
   if(unlikely(!m_RayAlgorithm || !m_VarAlgorithm)) return false;
   Event evc;
+  evc.header.muon = Event::NoMuon;
   
   evc.header.InitialSqrP = pow($$.nominal_momentum/muon.GetMomentum() ,2);
   if(std::isnan(evc.header.InitialSqrP)) std::cout << "sono in AddMuon: nominalp:" << $$.nominal_momentum << " muon.GetMomentum():" << muon.GetMomentum() <<"\n"
@@ -749,7 +746,7 @@ bool IBAnalyzerEM::AddMuon(const MuonScatterData &muon){
       //            DBG(trd,poca_prj);
       use_poca &= ( poca_prj > 0 );
     }
-    if(use_poca && this->GetVoxCollection()->IsInsideBounds(poca)) {
+    if(use_poca && this->IsInsideBounds(poca)) {
       poca = m_PocaAlgorithm->getPoca();
       ray = m_RayAlgorithm->TraceBetweenPoints(entry_pt,poca);
       ray.AppendRay( m_RayAlgorithm->TraceBetweenPoints(poca,exit_pt) );      
@@ -760,17 +757,19 @@ bool IBAnalyzerEM::AddMuon(const MuonScatterData &muon){
   }
   
   Event::Element elc;
+  const IBVoxel *background = FrozenBackground();
   Scalarf T = ray.TotalLength();
   for(int i=0; i<ray.Data().size(); ++i)
     {
       // voxel //
       const IBVoxRaytracer::RayData::Element &el = ray.Data().at(i);
 
-      if(el.vox_id >= this->GetVoxCollection()->GetDims().prod()){
+      if(el.vox_id >= this->GetNumberOfVoxels()){
         std::cout << "ATTENTION voxel ID > size collection!! " << std::endl;
         return false;
       }
-      elc.voxel = &this->GetVoxCollection()->operator [](el.vox_id);
+      elc.voxel = this->GetVoxel(el.vox_id, background == NULL);
+      const IBVoxel &voxel = elc.voxel ? *elc.voxel : *background;
 
       // Wij   //
       Scalarf L = el.L;  T = fabs(T-L);
@@ -780,10 +779,10 @@ bool IBAnalyzerEM::AddMuon(const MuonScatterData &muon){
       elc.pw = evc.header.InitialSqrP;
       
       
-      if(elc.voxel->Value <= 0){
+      if(voxel.Value <= 0){
 	// add both views
-	evc.header.E.block<2,2>(2,0) += elc.Wij * fabs(elc.voxel->Value) * evc.header.InitialSqrP;
-	evc.header.E.block<2,2>(0,2) += elc.Wij * fabs(elc.voxel->Value) * evc.header.InitialSqrP;
+	evc.header.E.block<2,2>(2,0) += elc.Wij * fabs(voxel.Value) * evc.header.InitialSqrP;
+	evc.header.E.block<2,2>(0,2) += elc.Wij * fabs(voxel.Value) * evc.header.InitialSqrP;
       }
       else
     evc.elements.push_back(elc);
@@ -819,6 +818,7 @@ bool IBAnalyzerEM::AddMuonFullPath(const MuonScatterData &muon, Vector<Vector4f>
   evc.header.E << NAN, NAN, NAN,NAN,NAN, NAN, NAN,NAN,NAN, NAN, NAN,NAN,NAN, NAN, NAN,NAN;
   evc.header.InitialSqrP = NAN;
   evc.header.pTrue = NAN;
+  evc.header.muon = Event::NoMuon;
   Vector<Event::Element> voxVec(0);
   evc.elements = voxVec;
   evc.elements.clear();
@@ -843,6 +843,41 @@ bool IBAnalyzerEM::AddMuonFullPath(const MuonScatterData &muon, Vector<Vector4f>
       return false;
   }
 
+  //---- POCA, with the in and out track pocas for the 3-path
+  Vector4f pocas[3];
+  bool poca_ok = false;
+  if(m_useRecoPath && m_nPath > 1 && m_PocaAlgorithm && m_PocaAlgorithm->evaluate(muon)){
+    poca_ok = true;
+    pocas[0] = m_PocaAlgorithm->getPoca();
+    if(m_nPath == 3){
+      pocas[1] = m_PocaAlgorithm->getInTrackPoca();
+      pocas[2] = m_PocaAlgorithm->getOutTrackPoca();
+    }
+  }
+
+  if(!BuildEvent(muon, muonPath, poca_ok ? pocas : NULL, evc))
+    return false;
+  m_d->m_Events.push_back(evc);
+
+  //---- cross check
+  if(debug){
+    std::cout << "\n\n Add Event to collection\n";
+    this->DumpEvent(&evc);
+  }
+  return true;
+}
+
+//___________________________
+//---- Steps #2 and #3 of AddMuonFullPath: trace the path and fill the
+//---- elements of evc, whose header is already set. Only reads the analyzer
+//---- (voxel allocation of sparse blocks is serialized), so the streaming
+//---- ingestion calls it concurrently. pocas holds poca, in track and out
+//---- track poca, NULL if the poca is not valid
+bool IBAnalyzerEM::BuildEvent(const MuonScatterData &muon, const Vector<Vector4f> &muonPath,
+                              const Vector4f *pocas, Event &evc){
+
+  bool debug = false;
+
   //-------------------------
   //---- STEP #2: Perform raytracing
 
@@ -879,15 +914,15 @@ bool IBAnalyzerEM::AddMuonFullPath(const MuonScatterData &muon, Vector<Vector4f>
     if(m_nPath > 1){
       
       //---- Evaluate the POCA and check that it is valid
-      if(m_PocaAlgorithm && m_PocaAlgorithm->evaluate(muon)){;	  
-  	Vector4f poca = m_PocaAlgorithm->getPoca();	
+      if(pocas){
+  	Vector4f poca = pocas[0];
 
   	//---- Check that the POCA is valid
   	Vector4f in, out;
   	in  = poca - muon.LineIn().origin();
   	out = muon.LineOut().origin() - poca;
   	float poca_prj = in.transpose() * out;
-  	bool validPoca = poca_prj > 0 && GetVoxCollection()->IsInsideBounds(poca);
+  	bool validPoca = poca_prj > 0 && IsInsideBounds(poca);
 
   	//---- If using the two-line path
   	if(m_nPath==2){
@@ -896,8 +931,8 @@ bool IBAnalyzerEM::AddMuonFullPath(const MuonScatterData &muon, Vector<Vector4f>
   	//---- If using the three-line path
   	else if(m_nPath == 3){
   	  //---- Get the poca on the entry/exit tracks
-  	  Vector4f entry_poca = m_PocaAlgorithm->getInTrackPoca();
-  	  Vector4f exit_poca  = m_PocaAlgorithm->getOutTrackPoca();
+  	  Vector4f entry_poca = pocas[1];
+  	  Vector4f exit_poca  = pocas[2];
 	  
   	  //---- Get the distance along the tracks to the inflection points
   	  double entry_length = (entry_pt - entry_poca).norm();
@@ -946,6 +981,14 @@ bool IBAnalyzerEM::AddMuonFullPath(const MuonScatterData &muon, Vector<Vector4f>
   std::vector<int> voxelOrder; //<---- An ordered list of the voxels
   Scalarf totalLength = 0.;    //<---- Total length of the muon path
 
+  //---- Frozen blocks are skipped and folded into E afterwards (not with
+  //---- pVoxelMean, that needs every voxel of the path, nor with the old T
+  //---- calculation, that depends on the order of the voxels)
+  const IBVoxOccupancy *occupancy =
+      (m_pVoxelMean || m_oldTCalculation) ? NULL : m_Occupancy;
+  Vector<IBVoxOccupancy::Piece> pieces;
+  Vector<IBVoxOccupancy::Piece> frozen;
+
   //---- Loop over the points
   for(int i=0; i<pts.size()-1; ++i){
     //---- Get the points
@@ -956,31 +999,45 @@ bool IBAnalyzerEM::AddMuonFullPath(const MuonScatterData &muon, Vector<Vector4f>
     Scalarf  rayLength = (pt2-pt1).norm();
     Vector4f rayDir    = (pt2-pt1)/rayLength;
 
-    IBVoxRaytracer::RayData ray = m_RayAlgorithm->TraceBetweenPoints(pt1,pt2);
-  
-    //---- Loop over the voxels in the ray
-    float cumulativeLength = 0.;
-    foreach(const IBVoxRaytracer::RayData::Element &el, ray.Data()){
+    pieces.clear();
+    if(occupancy) occupancy->Split(pt1, pt2, pieces);
+    else {
+      IBVoxOccupancy::Piece all = { pt1, pt2, false, 0 };
+      pieces.push_back(all);
+    }
 
-      //---- Project the muon track to the current position
-      Vector4f pti = pt1 + cumulativeLength*rayDir;
+    for(unsigned int k=0; k<pieces.size(); ++k){
+      if(pieces[k].frozen){
+        frozen.push_back(pieces[k]);
+        continue;
+      }
+      const Vector4f &start = pieces[k].begin;
+      IBVoxRaytracer::RayData ray = m_RayAlgorithm->TraceBetweenPoints(start,pieces[k].end);
 
-      //---- Project the muon track to the next position 
-      cumulativeLength += el.L; //<---- Length of the muon track in the voxel
-      Vector4f ptj = pt1 + cumulativeLength*rayDir;
+      //---- Loop over the voxels in the ray
+      float cumulativeLength = 0.;
+      foreach(const IBVoxRaytracer::RayData::Element &el, ray.Data()){
+
+        //---- Project the muon track to the current position
+        Vector4f pti = start + cumulativeLength*rayDir;
+
+        //---- Project the muon track to the next position 
+        cumulativeLength += el.L; //<---- Length of the muon track in the voxel
+        Vector4f ptj = start + cumulativeLength*rayDir;
       
-      //---- If this muon HAS NOT crossed this voxel before
-      if(voxelMap.find(el.vox_id) == voxelMap.end()){
-	//---- Add the voxel and points to the map
-	voxelMap[el.vox_id] = std::vector<Vector4f>();
-	voxelMap[el.vox_id].push_back(pti);
-	voxelMap[el.vox_id].push_back(ptj);
-	//---- Add the voxel to the ordered list
-	voxelOrder.push_back(el.vox_id);
+        //---- If this muon HAS NOT crossed this voxel before
+        if(voxelMap.find(el.vox_id) == voxelMap.end()){
+	  //---- Add the voxel and points to the map
+	  voxelMap[el.vox_id] = std::vector<Vector4f>();
+	  voxelMap[el.vox_id].push_back(pti);
+	  voxelMap[el.vox_id].push_back(ptj);
+	  //---- Add the voxel to the ordered list
+	  voxelOrder.push_back(el.vox_id);
+        }
+        //---- Otherwise, update the final point in the voxel
+        voxelMap[el.vox_id][1] = ptj;
       }
-      //---- Otherwise, update the final point in the voxel
-      voxelMap[el.vox_id][1] = ptj;
-    }    
+    }
     //---- Increment the total length of the muon path
     totalLength += rayLength;
   }
@@ -1090,8 +1147,13 @@ bool IBAnalyzerEM::AddMuonFullPath(const MuonScatterData &muon, Vector<Vector4f>
 
   float sumLijFurnace = 0.;
 
+  //---- Voxels of empty sparse blocks with a frozen background are folded
+  //---- into E like the frozen blocks below
+  const IBVoxel *background = FrozenBackground();
+  unsigned int nfolded = 0;
+
   //---- Cut muons crossing one voxel only
-  if(voxelOrder.size()<2)
+  if(voxelOrder.size() + frozen.size() < 2)
     return false;
 
   //---- Loop over the ordered list of voxels
@@ -1108,13 +1170,18 @@ bool IBAnalyzerEM::AddMuonFullPath(const MuonScatterData &muon, Vector<Vector4f>
     elc.voxel = NULL;
   
     //---- Retrieve the voxel from the voxel collection by the ID (== *it)
-    if( (*it) >= this->GetVoxCollection()->GetDims().prod()){
+    if( (*it) >= this->GetNumberOfVoxels()){
       std::cout << "ATTENTION voxel ID > size collection!! " << std::endl;
       return false;
     }
-    elc.voxel = &this->GetVoxCollection()->operator [](*it);
+    if(background == NULL && this->GetSparseVoxCollection()){
+      #pragma omp critical (IBAnalyzerEM_BuildEvent)
+      elc.voxel = this->GetVoxel(*it, true);
+    }
+    else
+      elc.voxel = this->GetVoxel(*it, background == NULL);
 
-    if(elc.voxel->Count != 0 || elc.voxel == NULL || elc.voxel->Value == NAN)
+    if(elc.voxel && (elc.voxel->Count != 0 || elc.voxel->Value == NAN))
         continue;
   
     //---- Get length of ray in the voxel
@@ -1174,20 +1241,49 @@ bool IBAnalyzerEM::AddMuonFullPath(const MuonScatterData &muon, Vector<Vector4f>
       if(elc.voxel != NULL)
     }
 */
-    if(!std::isnan(elc.voxel->Value))
+    if(!elc.voxel){
+      evc.header.E.block<2,2>(2,0) += elc.Wij * fabs(background->Value) * elc.pw;
+      evc.header.E.block<2,2>(0,2) += elc.Wij * fabs(background->Value) * elc.pw;
+      ++nfolded;
+    }
+    else if(!std::isnan(elc.voxel->Value))
       evc.elements.push_back(elc);
   }
   //std::cout << "=== >  Muon in FURNACE  sumLij " << sumLijFurnace << ", totalLenght " << totalLengthFurnace << std::endl;
 
-  //---- Keep the event
-  if(!noAddMuon && evc.elements.size()>1 && evc.header.Di[0]!=NAN){
-    m_d->m_Events.push_back(evc);
-
-    //---- cross check
-    if(debug){
-        std::cout << "\n\n Add Event to collection\n";
-        this->DumpEvent(&evc);
+  //---- Fold skipped frozen blocks into E in both views: the piece is traced
+  //---- and T is taken at the end of each voxel as in the loop above, as T
+  //---- is a projection on the incoming direction and not the path length.
+  //---- Each voxel is weighted by the pw the loop above would give it
+  //---- (no pVoxelMean here, the occupancy is off with it)
+  for(unsigned int k=0; k<frozen.size(); ++k){
+    const Vector4f &start = frozen[k].begin;
+    Vector4f rayDir = frozen[k].end - start;
+    rayDir /= rayDir.norm();
+    IBVoxRaytracer::RayData ray = m_RayAlgorithm->TraceBetweenPoints(start,frozen[k].end);
+    Matrix2f Wij = Matrix2f::Zero();
+    Scalarf cumulativeLength = 0.;
+    foreach(const IBVoxRaytracer::RayData::Element &el, ray.Data()){
+      cumulativeLength += el.L;
+      Scalarf L  = el.L;
+      Scalarf Tf = muon.LineIn().direction().dot(back_pt - (start + cumulativeLength*rayDir)) / normIn;
+      if(Tf < 0) Tf = 0.;
+      Scalarf pw = evc.header.InitialSqrP;
+      if(m_initialSqrPfromVtk){
+        float voxel_1op2 = m_initialSqrPfromVtk->operator [](el.vox_id).Value * (1.e6) *  $$.nominal_momentum *  $$.nominal_momentum;
+        pw = voxel_1op2 != 0. ? voxel_1op2 : 0.36;
+      }
+      Matrix2f Wv;
+      Wv << L, L*L/2. + L*Tf, L*L/2. + L*Tf, L*L*L/3. + L*L*Tf + L*Tf*Tf;
+      Wij += Wv * pw;
     }
+    evc.header.E.block<2,2>(2,0) += Wij * fabs(frozen[k].value);
+    evc.header.E.block<2,2>(0,2) += Wij * fabs(frozen[k].value);
+  }
+
+  //---- Keep the event
+  if(!noAddMuon && !evc.elements.empty() &&
+     evc.elements.size() + frozen.size() + nfolded > 1 && evc.header.Di[0]!=NAN){
     return true;
   } else{
       if(debug)
@@ -1199,8 +1295,9 @@ bool IBAnalyzerEM::AddMuonFullPath(const MuonScatterData &muon, Vector<Vector4f>
 
 //________________________
 ///
-/// \note MuonCollection is syncronized with Event vector ONLY if SetMuonCollection is called
-/// if AddMuons is called by the analyzer it is not!
+/// \note Events are built from the selected muons (At, size) and the
+/// collection is left untouched: muons whose path has an error give no
+/// event, so events and muons are not one to one.
 /// \param muons
 ///
 void IBAnalyzerEM::SetMuonCollection(IBMuonCollection *muons){
@@ -1212,11 +1309,38 @@ void IBAnalyzerEM::SetMuonCollection(IBMuonCollection *muons){
   std::cout << "Clearing all events " << std::endl;
   m_d->m_Events.clear();
 
-  //---- Iterate over the muon data, and collec the muon data, and the muon path
-  Vector<MuonScatterData>::iterator itr = muons->Data().begin();
-  Vector<Vector<Vector4f> >::iterator path_itr = muons->FullPath().begin();    
-  std::cout << "Adding " << muons->Data().size() << " muons " << std::endl;    
+  //---- Iterate over the selected muons, full paths follow Data() //
+  const bool selected = muons->HasSelection();
+  const bool paths = muons->FullPath().size() == muons->Data().size();
+  Vector<Vector4f> no_path;
+  std::cout << "Adding " << muons->size() << " muons " << std::endl;
 
+  if(!PrepareVoxelMomentum())
+      return;
+
+  const int size = muons->size();
+  for(int i = 0; i < size; ++i){
+    if((i+1)%100000==0)
+    	std::cout << "Adding muon " << i+1 << "...." << std::endl; 
+
+    const size_t id = selected ? muons->Selection()[i] : i;
+    if(AddMuonFullPath(muons->At(i), paths ? muons->FullPath()[id] : no_path))
+        m_d->m_Events.back().header.muon = id;
+  }
+  //---- Pass the muons to the base class
+  std::cout << "\nDone, now calling base class... " << m_d->m_Events.size() << " events from " << muons->size() << " muons" << std::endl;
+  BaseClass::SetMuonCollection(muons);
+
+//  //--- cross check: dump muon collection
+//  std::cout << "Dumping muon collection.... " << std::endl;
+//  itr = muons->Data().begin();
+//  while(itr != muons->Data().end())
+//    std::cout << (*itr) << std::endl;
+
+}
+
+//________________________
+bool IBAnalyzerEM::PrepareVoxelMomentum(){
   if(m_pVoxelMean){
       std::cout << "\n*** Computing p voxel from linear function from <1/p2> mean IN to <1/p2> mean OUT *** " << std::endl;
       /// get MC furnace to locate voxel in furnace
@@ -1224,39 +1348,155 @@ void IBAnalyzerEM::SetMuonCollection(IBMuonCollection *muons){
       const char *mcFurnace =  "/mnt/mutom-gluster/data/mublast/imageFromMC/mcFurnace_2016-05-03_vox20_250vox.vtk";
       if( !m_imgMC.ImportFromVtk(mcFurnace) ){
           std::cout << "ATTENTION : error opening image from file..." << mcFurnace << std::endl;
-          return;
+          return false;
       }
   }
   else if(m_initialSqrPfromVtk)
       std::cout << "\n*** Computing p voxel from file vtk*** " << std::endl;
+  return true;
+}
+
+//________________________
+////////////////////////////////////////////////////////////////////////////////
+/////////////////// STREAMING INGESTION ////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+// muons of a chunk are built in tasks of this size //
+static const int StreamBlock = 256;
+
+// chunk of the streaming pipeline being built, the prefetcher holds the
+// next one //
+struct StreamChunk {
+    Vector<MuonScatterData> muons;
+    Vector<Vector4f>        pocas;   // poca, in and out track poca (3-path)
+    Vector<char>            pocaOk;
+    Vector<Event>           events;
+    Vector<char>            kept;
+};
 
-  int countmu = 0; 
-  while(itr != muons->Data().end()){
-    countmu++; 
-    if(countmu%100000==0)
-    	std::cout << "Adding muon " << countmu << "...." << std::endl; 
+} // namespace
 
-    //---- If the muon full path has an error, remove the muon
-    if(!AddMuonFullPath(*itr, *path_itr)){
-      muons->Data().remove_element(*itr);
-      if(muons->FullPath().size() > 0) muons->FullPath().remove_element(*path_itr);
+//________________________
+unsigned long IBAnalyzerEM::StreamMuons(IBMuonEventTTreeReader *reader,
+                                        IBMuonCollection *muons,
+                                        unsigned int chunk_size){
+  uLibAssert(reader);
+  if(unlikely(!m_RayAlgorithm || !m_VarAlgorithm)){
+      std::cerr << "No RayAlgorithm or VarAlgorithm set, nothing to stream\n";
+      return 0;
+  }
+  if(!m_useRecoPath){
+      std::cerr << "Streaming ingestion needs the reconstructed path, "
+                   "readers give no full muon path\n";
+      return 0;
+  }
+  if(chunk_size < StreamBlock) chunk_size = StreamBlock;
+
+  std::cout << "Streaming muons into events, chunks of " << chunk_size << std::endl;
+  m_d->m_Events.clear();
+  m_d->m_SijStats.Invalidate();
+  if(muons) {
+      muons->Data().clear();
+      muons->FullPath().clear();
+      muons->UpdateSelection();
+  }
+  if(!PrepareVoxelMomentum())
+      return 0;
+
+  const unsigned long total = reader->getNumberOfEvents();
+  unsigned long read = 0;
+
+  // the 3-path needs in and out track pocas, only the stateful evaluator
+  // gives them so they are computed before the chunk is handed to tasks //
+  const bool use_poca = m_nPath > 1 && m_PocaAlgorithm;
+  const bool serial_poca = use_poca && m_nPath == 3;
+
+  // the next chunk is read by the prefetcher on its own thread, outside the
+  // OpenMP team below, so a parallel reader decodes with its own team
+  // instead of running nested and serialized inside the single region //
+  IBMuonEventPrefetcher prefetch(reader, total, chunk_size);
+  StreamChunk cur;
+
+  for(int k = 0; prefetch.next(cur.muons); ++k) {
+    const int size = cur.muons.size();
+
+    if(serial_poca) {
+        cur.pocas.resize(3 * size);
+        cur.pocaOk.assign(size, 0);
+        for(int i = 0; i < size; ++i) {
+            if(!m_PocaAlgorithm->evaluate(cur.muons[i])) continue;
+            cur.pocaOk[i] = 1;
+            cur.pocas[3*i]   = m_PocaAlgorithm->getPoca();
+            cur.pocas[3*i+1] = m_PocaAlgorithm->getInTrackPoca();
+            cur.pocas[3*i+2] = m_PocaAlgorithm->getOutTrackPoca();
+        }
+    }
+    cur.events.resize(size);
+    cur.kept.assign(size, 0);
+
+    // variables, poca, raytrace and event build stages, per block //
+    #pragma omp parallel
+    #pragma omp single
+    for(int b = 0; b < size; b += StreamBlock) {
+        #pragma omp task firstprivate(b) shared(cur)
+        {
+            const int n = std::min(StreamBlock, size - b);
+            const MuonScatterData *mu = &cur.muons[b];
+            Vector4f data[StreamBlock];
+            Matrix4f covariance[StreamBlock];
+            bool valid[StreamBlock];
+            Vector4f poca[StreamBlock];
+            bool poca_ok[StreamBlock];
+            m_VarAlgorithm->evaluate(mu, n, data, covariance, valid);
+            if(use_poca && !serial_poca)
+                m_PocaAlgorithm->evaluate(mu, n, poca, poca_ok);
+
+            const Vector<Vector4f> no_path;
+            for(int j = 0; j < n; ++j) {
+                if(!valid[j]) continue;
+                Event &evc = cur.events[b+j];
+                evc.elements.clear();
+                evc.header.Di = data[j];
+                evc.header.E  = covariance[j];
+                evc.header.InitialSqrP = pow($$.nominal_momentum/mu[j].GetMomentum() ,2);
+                evc.header.pTrue = mu[j].GetMomentumPrime();
+
+                const Vector4f *pocas = NULL;
+                if(serial_poca) {
+                    if(cur.pocaOk[b+j]) pocas = &cur.pocas[3*(b+j)];
+                }
+                else if(use_poca && poca_ok[j]) pocas = &poca[j];
+                cur.kept[b+j] = BuildEvent(mu[j], no_path, pocas, evc);
+            }
+        }
     }
-    //---- Otherwise, iterate
-    else{  
-      itr++;
-      path_itr++;
+
+    // event store stage, in reading order; the kept muons are compacted
+    // at the front of the chunk and appended at once //
+    int nkept = 0;
+    const unsigned int first = muons ? muons->Data().size() : 0;
+    for(int i = 0; i < size; ++i) {
+        if(!cur.kept[i]) continue;
+        m_d->m_Events.push_back(Event());
+        Event &evc = m_d->m_Events.back();
+        evc.header = cur.events[i].header;
+        evc.header.muon = muons ? first + nkept : Event::NoMuon;
+        evc.elements.swap(cur.events[i].elements);
+        if(muons && nkept != i) cur.muons[nkept] = cur.muons[i];
+        ++nkept;
     }
-  }
-  //---- Pass the muons to the base class
-  std::cout << "\nDone, now calling base class... adding muon collection of " << muons->size() << " muons" << std::endl;
-  BaseClass::SetMuonCollection(muons);
+    if(muons && nkept) muons->AddMuons(&cur.muons[0], nkept);
 
-//  //--- cross check: dump muon collection
-//  std::cout << "Dumping muon collection.... " << std::endl;
-//  itr = muons->Data().begin();
-//  while(itr != muons->Data().end())
-//    std::cout << (*itr) << std::endl;
+    read = prefetch.position();
+    if(k % 16 == 0 || read == total)
+        std::cout << "Read " << read << " of " << total << " muons, "
+                  << m_d->m_Events.size() << " events" << std::endl;
+  }
 
+  BaseClass::SetMuonCollection(muons);
+  return m_d->m_Events.size();
 }
 
 //________________________
@@ -1266,21 +1506,51 @@ unsigned int IBAnalyzerEM::Size(){
 
 //________________________
 void IBAnalyzerEM::Run(unsigned int iterations, float muons_ratio){
+    if(m_UpdateAlgorithm && this->GetSparseVoxCollection())
+        std::cerr << "IBAnalyzerEM: update algorithm ignored on sparse voxels, "
+                     "using the default Sij cap update\n";
+    // compile time specialized iteration when the algorithms allow it //
+    IBVoxCollection *dense = this->GetSparseVoxCollection() ? NULL : this->GetVoxCollection();
+    IBAnalyzerEMEngine *engine =
+            m_d->Engine(dense ? m_UpdateAlgorithm : NULL,
+                        dense ? dense->GetMAPAlgorithm() : NULL, dense);
     // performs iterations //
     for (unsigned int it = 0; it < iterations; it++) {
         fprintf(stderr,"\r[%d muons] EM -> performing iteration %i",
                 (int) m_d->m_Events.size(), it);
+        if(engine) {
+            engine->Evaluate(m_d->m_Events, dense);
+            if(dense) engine->UpdateDensity(dense, 10);   // DEFAULT HARDCODE THRESHOLD
+            else this->UpdateDensity(10);
+            // Sij and densities changed, the residual statistics go stale //
+            m_d->m_SijStats.Invalidate();
+            if(m_PWeightStage)
+                (*m_PWeightStage)(m_d->m_Events, $$.nominal_momentum);
+            continue;
+        }
         m_d->Evaluate(muons_ratio);          // run single iteration of proback //
-        if(!m_UpdateAlgorithm)
-            this->GetVoxCollection()->UpdateDensity<UpdateDensitySijCapAlgorithm>(10);                // DEFAULT HARDCODE THRESHOLD
+        if(!m_UpdateAlgorithm || this->GetSparseVoxCollection())
+            this->UpdateDensity(10);                // DEFAULT HARDCODE THRESHOLD
 //            this->GetVoxCollection()->UpdateDensity<UpdateDensitySijCapAlgorithm>(2);                // HARDCODE THRESHOLD
         else
             this->m_UpdateAlgorithm->operator()(this->GetVoxCollection(),10);   // DEFAULT HARDCODE THRESHOLD
 //            this->m_UpdateAlgorithm->operator()(this->GetVoxCollection(),2);   // HARDCODE THRESHOLD
+        if(m_PWeightStage)
+            (*m_PWeightStage)(m_d->m_Events, $$.nominal_momentum);
     }
     printf("\nEM -> done\n");
 }
 
+//________________________
+void IBAnalyzerEM::UpdateDensity(unsigned int threshold){
+    // Count and SijCap are reset, the residual statistics go stale //
+    m_d->m_SijStats.Invalidate();
+    if(IBSparseVoxCollection *sparse = this->GetSparseVoxCollection())
+        sparse->UpdateDensity<UpdateDensitySijCapAlgorithm>(threshold);
+    else
+        this->GetVoxCollection()->UpdateDensity<UpdateDensitySijCapAlgorithm>(threshold);
+}
+
 //________________________
 void IBAnalyzerEM::SetMLAlgorithm(IBAnalyzerEMAlgorithm *MLAlgorithm){
     m_d->m_SijAlgorithm = MLAlgorithm;
@@ -1291,6 +1561,20 @@ void IBAnalyzerEM::filterEventsVoxelMask() {
     m_d->filterEventsVoxelMask();
 }
 
+void IBAnalyzerEM::SetEmptySpaceSkipping(int block_size) {
+    delete m_Occupancy;
+    m_Occupancy = NULL;
+    if(block_size <= 0) return;
+    m_Occupancy = new IBVoxOccupancy(block_size);
+    if(this->GetSparseVoxCollection())
+        m_Occupancy->Build(this->GetSparseVoxCollection());
+    else
+        m_Occupancy->Build(this->GetVoxCollection());
+    std::cout << "IBAnalyzerEM: empty space skipping on "
+              << m_Occupancy->GetNumberOfFrozenBlocks() << " frozen blocks of "
+              << block_size << "^3 voxels" << std::endl;
+}
+
 //________________________
 void IBAnalyzerEM::filterEventsLineDistance(float min, float max) {
     m_d->filterEventsLineDistance(min, max);
@@ -1314,35 +1598,50 @@ void IBAnalyzerEM::dumpEventsSijInfo(const char *name, Vector<float> N) {
 void IBAnalyzerEM::SijCut(float threshold) {
     m_d->Evaluate(1);
     m_d->SijCut(threshold);
-    this->GetVoxCollection()->UpdateDensity<UpdateDensitySijCapAlgorithm>(0);   // HARDCODE THRESHOLD
+    this->UpdateDensity(0);   // HARDCODE THRESHOLD
 }
 
 //________________________
 float IBAnalyzerEM::SijMedian(const Event &evc) {
     m_d->Evaluate(1);
-    m_d->SijMedian(evc);
+    return m_d->SijMedian(evc);
+}
+
+//________________________
+void IBAnalyzerEM::RankCut() {
+    this->RankCut(m_rankLimit);
+}
+
+void IBAnalyzerEM::RankCut(float limit) {
+    m_d->Evaluate(1);
+    m_d->RankCut(limit);
+    this->UpdateDensity(0);   // HARDCODE THRESHOLD
 }
 
 //________________________
 void IBAnalyzerEM::SijGuess(Vector<Vector2f> tpv){
     m_d->Evaluate(1);
+    // all the class thresholds are counted in a single pass //
+    Vector<float> levels;
+    for (int i=0; i<tpv.size(); ++i) levels.push_back(tpv[i](0));
+    m_d->SijStatistics(levels);
     // ATTENZIONE!! il vettore deve essere ordinato per threshold crescenti   //
     for (int i=0; i<tpv.size(); ++i)
         m_d->SijGuess( tpv[i](0), tpv[i](1) );
-    this->GetVoxCollection()->UpdateDensity<UpdateDensitySijCapAlgorithm>(0);   // HARDCODE THRESHOLD
+    this->UpdateDensity(0);   // HARDCODE THRESHOLD
 }
 
 //________________________
 void IBAnalyzerEM::SetSijMedianMomentum(){
     m_d->Evaluate(1);
     m_d->SetSijMedianMomentum();
-    this->GetVoxCollection()->UpdateDensity<UpdateDensitySijCapAlgorithm>(0);   // HARDCODE THRESHOLD
+    this->UpdateDensity(0);   // HARDCODE THRESHOLD
 }
 
 //________________________
 void IBAnalyzerEM::Chi2Cut(float threshold){
     m_d->Evaluate(1);
-    this->GetVoxCollection()->UpdateDensity<UpdateDensitySijCapAlgorithm>(0);   // HARDCODE THRESHOLD
+    this->UpdateDensity(0);   // HARDCODE THRESHOLD
     m_d->Chi2Cut(threshold);
 }
 
@@ -1350,6 +1649,7 @@ void IBAnalyzerEM::Chi2Cut(float threshold){
 void IBAnalyzerEM::SetVoxCollection(IBVoxCollection *voxels){
     if(this->GetMuonCollection()) {
         BaseClass::SetVoxCollection(voxels);
+        if(m_Occupancy) m_Occupancy->Build(voxels);
         this->SetMuonCollection(BaseClass::GetMuonCollection());
     }
     else
@@ -1360,7 +1660,7 @@ void IBAnalyzerEM::SetVoxCollection(IBVoxCollection *voxels){
 //________________________
 void IBAnalyzerEM::SetVoxcollectionShift(Vector3f shift){
   if(this->GetMuonCollection()) {
-    IBVoxCollection *voxels = this->GetVoxCollection();
+    StructuredGrid *voxels = this->GetVoxelGrid();
     Vector3f pos = voxels->GetPosition();
     voxels->SetPosition(pos + shift);
     IBMuonCollection *muons = this->GetMuonCollection();
@@ -1376,15 +1676,23 @@ void IBAnalyzerEM::SetVoxcollectionShift(Vector3f shift){
 ////////////////////////////////////////////////////////////////////////////////
 void IBAnalyzerEM::DumpP(const char *filename, float x0, float x1)
 {
-    static int counter = 0;
-    static TFile *file = new TFile(filename,"RECREATE");
+    // the file stays open across calls until DumpP(NULL) //
+    int &counter = m_d->m_DumpPCounter;
+    TFile *&file = m_d->m_DumpPFile;
 
     if(!filename) {
-        file->Write();
-        file->Close();
-        delete file;
+        if(file) {
+            file->Write();
+            file->Close();
+            delete file;
+            file = NULL;
+        }
         return;
     }
+    if(!file) {
+        file = new TFile(filename,"RECREATE");
+        counter = 0;
+    }
 
     if(file) {
         gDirectory->cd(file->GetPath());
@@ -1423,7 +1731,7 @@ void IBAnalyzerEM::dumpEventsTTree(const char *filename)
 
     /// open file, tree
     std::cout << "\n*** Dump event collection from IBAnalyzer on file " << filename << std::endl;
-    static TFile *file = new TFile(filename,"RECREATE");
+    TFile *file = new TFile(filename,"RECREATE");
     gDirectory->cd(file->GetPath());
     gROOT->ProcessLine("#include<vector>");
 
@@ -1451,6 +1759,7 @@ void IBAnalyzerEM::dumpEventsTTree(const char *filename)
 
 
     /// event loop
+    const IBAnalyzerEMSijStatistics &stats = m_d->SijStatistics();
     Vector< Event >::iterator itr = m_d->m_Events.begin();
     std::cout << "Reading " << m_d->m_Events.size() << " events " << std::endl;
     while (itr != m_d->m_Events.end()) {
@@ -1459,14 +1768,11 @@ void IBAnalyzerEM::dumpEventsTTree(const char *filename)
         /// crossed voxel loop
         sumLij = 0;
         vpw->clear();
-        Vector< float > Si;
         Vector< Event::Element >::iterator itre = evc.elements.begin();
 
         while (itre != evc.elements.end()) {
             Event::Element & elc = *itre;
             sumLij += elc.Wij(0,0);
-            float Nij = fabs( (elc.Sij * elc.voxel->Count - elc.voxel->SijCap) / elc.voxel->SijCap );
-            Si.push_back(Nij);
 
             vpw->push_back($$.nominal_momentum/sqrt(elc.pw));
 
@@ -1480,15 +1786,7 @@ void IBAnalyzerEM::dumpEventsTTree(const char *filename)
         DT = evc.header.Di[2];
         DZ = evc.header.Di[3];
 
-        // compute median
-        std::sort(Si.begin(),Si.end());
-       int nS = Si.size();
-       if(nS){
-           if(nS%2)
-               Smedian = Si[nS / 2];
-           else
-               Smedian = (Si[nS / 2 - 1] + Si[nS / 2]) / 2;
-       }
+        Smedian = stats.Median(ev);
 
         tree->Fill();
 
@@ -1513,6 +1811,55 @@ void IBAnalyzerEM::dumpEventsTTree(const char *filename)
 
     tree->Write();
     file->Close();
+    delete file;
+    delete vpw;
 
     return;
 }
+
+//________________________
+std::vector<std::string> IBAnalyzerEM::EventColumnNames()
+{
+    static const char *names[] = {
+        "tag", "ev", "p", "sumLij", "nvox", "DP", "DX", "DT", "DZ", "Smedian"
+    };
+    return std::vector<std::string>(names, names + 10);
+}
+
+std::vector<IBColumnExport::Type> IBAnalyzerEM::EventColumnTypes()
+{
+    std::vector<IBColumnExport::Type> types(10, IBColumnExport::Float32);
+    types[0] = types[1] = types[4] = IBColumnExport::UInt32;
+    return types;
+}
+
+bool IBAnalyzerEM::DumpEventColumns(IBColumnExport &out, int tag)
+{
+    if(out.GetNumberOfColumns() != 10 || out.GetColumnType(1) != IBColumnExport::UInt32) {
+        std::cerr << "IBAnalyzerEM: export not open on the event columns\n";
+        return false;
+    }
+    const Vector<Event> &events = m_d->m_Events;
+    const IBAnalyzerEMSijStatistics &stats = m_d->SijStatistics();
+    const long size = events.size();
+
+    IBColumnExport::Block block;
+    out.Allocate(block, size);
+    float *c[10];
+    for(int k = 0; k < 10; ++k) c[k] = size ? &block[k][0] : NULL;
+    #pragma omp parallel for schedule(static)
+    for(long i = 0; i < size; ++i) {
+        const Event &evc = events[i];
+        float sumLij = 0;
+        for(unsigned int j = 0; j < evc.elements.size(); ++j)
+            sumLij += evc.elements[j].Wij(0,0);
+        c[0][i] = IBColumnExport::UInt(tag);
+        c[1][i] = IBColumnExport::UInt(i);
+        c[2][i] = $$.nominal_momentum/sqrt(evc.header.InitialSqrP);
+        c[3][i] = sumLij;
+        c[4][i] = IBColumnExport::UInt(evc.elements.size());
+        for(int k = 0; k < 4; ++k) c[5 + k][i] = evc.header.Di[k];
+        c[9][i] = stats.Median(i);
+    }
+    return out.Push(block);
+}
@@ -23,12 +23,16 @@
 #include "IBVoxCollection.h"
 #include "IBVoxRaytracer.h"
 #include "IBVoxel.h"
+#include "IBPWeightAlgorithms.h"
+#include "IBColumnExport.h"
 #include <string>
 #include <iomanip>
 
 class IBPocaEvaluator;
 class IBMinimizationVariablesEvaluator;
+class IBVoxOccupancy;
 class IBAnalyzerEMAlgorithm;
+class IBMuonEventTTreeReader;
 
 
 class IBAnalyzerEM : public IBAnalyzer {
@@ -51,11 +55,23 @@ public:
             Matrix4f E;
             Scalarf  InitialSqrP;
             Scalarf  pTrue; // SV 20160921 variable to store useful quantities to study....
+            unsigned int muon; // source muon in the collection Data(), NoMuon if none
         } header;
+        static const unsigned int NoMuon = ~0u;
         Vector<Element> elements;
     };
 
 
+    // precision of the compile time specialized EM iteration: float kernels
+    // with compensated sums (default, as the float virtual path), float
+    // kernels with double inversion and sums on request, or all double for
+    // validation //
+    enum Precision {
+        FloatPrecision,
+        MixedPrecision,
+        DoublePrecision
+    };
+
     ULIB_props()
     {
         Scalarf nominal_momentum;
@@ -65,13 +81,30 @@ public:
 public:
     IBAnalyzerEM(IBVoxCollection &voxels, int nPath=2, double alpha=0., bool doRecoPath=true,
          bool oldTCalculation=false, float rankLimit=-100., IBVoxCollection* initialSqrPfromVtk=NULL, int pVoxelMean=0);
+    // voxels in empty sparse blocks are folded into E when the background
+    // is masked (value < 0), allocated on first crossing otherwise
+    IBAnalyzerEM(IBSparseVoxCollection &voxels, int nPath=2, double alpha=0., bool doRecoPath=true,
+         bool oldTCalculation=false, float rankLimit=-100., IBVoxCollection* initialSqrPfromVtk=NULL, int pVoxelMean=0);
     ~IBAnalyzerEM();
 
     bool AddMuon(const MuonScatterData &muon);//{ return false;}
     bool AddMuonFullPath(const MuonScatterData &muon, Vector<Vector4f>& muonPath);
 
+    // Builds the events from the selected muons, the collection is not
+    // modified. Muons giving no event are skipped //
     void SetMuonCollection(IBMuonCollection *muons);
 
+    // Builds the events straight from the reader, without a muon collection.
+    // Chunks of chunk_size reader entries go through variables, poca, raytrace and
+    // event build in parallel tasks while a prefetch thread reads the next
+    // chunk outside the OpenMP team, so at most two chunks of raw muons are
+    // resident. Muons giving an event are appended to muons once per chunk
+    // if not NULL (cleared first, one to one with the events). Errors are
+    // assigned by the reader, see setError. Returns the number of events //
+    unsigned long StreamMuons(IBMuonEventTTreeReader *reader,
+                              IBMuonCollection *muons = NULL,
+                              unsigned int chunk_size = 16384);
+
     unsigned int Size();
 
     void Run(unsigned int iterations, float muons_ratio);
@@ -82,13 +115,30 @@ public:
     uLibGetSetMacro(VarAlgorithm,IBMinimizationVariablesEvaluator *)
     uLibGetSetMacro(RayAlgorithm,IBVoxRaytracer *)
     uLibGetSetMacro(UpdateAlgorithm,IBAbstract::IBVoxCollectionUpdateAlgorithm *)
+    uLibGetSetMacro(Precision,Precision)
+
+    // optional stage recomputing pw of all events after each density
+    // update, e.g. IBPWeightEngine< IBPWeightAlgorithm_PW<Event>, Event > //
+    typedef IBAbstract::IBPWeightStage<Event> PWeightStage;
+    uLibGetSetMacro(PWeightStage,PWeightStage *)
 
     void filterEventsVoxelMask();
 
+    // Event building skips blocks of frozen voxels (value <= 0), folding
+    // their contribution into E as filterEventsVoxelMask does. The mask must
+    // be applied before SetMuonCollection. block_size 0 disables, it is not
+    // used with the old T calculation nor with pVoxelMean.
+    void SetEmptySpaceSkipping(int block_size = 4);
+
     void filterEventsLineDistance(float min, float max);
 
     void SijCut(float threshold);
 
+    // removes muons whose Sij rank sum over the crossed voxels is below
+    // limit, by default the rankLimit given at construction //
+    void RankCut();
+    void RankCut(float limit);
+
     Vector<Event > SijCutCount(float threshold_low, float threshold_high);
 
     void dumpEventsSijInfo(const char *filename, Vector<float> N);
@@ -103,6 +153,16 @@ public:
 
     void dumpEventsTTree(const char *filename);
     void DumpP(const char *filename, float x0 = 0, float x1 = 10);
+
+    // events as IBColumnExport columns, in EventColumnNames() order, with
+    // the Sij medians of the last evaluation and tag in the first column.
+    // out must be opened with EventColumnTypes(): tag, ev and nvox are
+    // UInt32 so event indices stay exact past 2^24. Only the column filling
+    // waits, the blocks are written while the caller goes on with the next
+    // iterations //
+    static std::vector<std::string> EventColumnNames();
+    static std::vector<IBColumnExport::Type> EventColumnTypes();
+    bool DumpEventColumns(IBColumnExport &out, int tag = 0);
     void DumpEvent(Event *evc);
 
     Vector<Event> & Events();
@@ -112,10 +172,19 @@ public:
     void SetSijMedianMomentum();
 
 private:    
+    void Init();
+    void UpdateDensity(unsigned int threshold);
+    const IBVoxel *FrozenBackground() const;
+    bool PrepareVoxelMomentum();
+    bool BuildEvent(const MuonScatterData &muon, const Vector<Vector4f> &muonPath,
+                    const Vector4f *pocas, Event &evc);
+
     IBPocaEvaluator                            *m_PocaAlgorithm;
     IBMinimizationVariablesEvaluator           *m_VarAlgorithm;
     IBVoxRaytracer                             *m_RayAlgorithm;
     IBAbstract::IBVoxCollectionUpdateAlgorithm *m_UpdateAlgorithm;
+    Precision                                   m_Precision;
+    PWeightStage                               *m_PWeightStage;
     friend class IBAnalyzerEMPimpl;    
     class IBAnalyzerEMPimpl *m_d;
 
@@ -128,6 +197,7 @@ private:
     IBVoxCollection* m_initialSqrPfromVtk;
     int m_pVoxelMean;   //---- compute p voxel by hand
     IBVoxCollection m_imgMC;
+    IBVoxOccupancy *m_Occupancy;
 };
 
 inline void IBAnalyzerEM::init_properties() {
@@ -54,6 +54,7 @@ bool IBAnalyzerEM3p::AddMuon(const MuonScatterData &muon)
     if(unlikely(!GetRayAlgorithm() || !GetVarAlgorithm())) return false;
     Event evc;
 
+    evc.header.muon = Event::NoMuon;
     evc.header.InitialSqrP = $$.nominal_momentum/muon.GetMomentum();
     evc.header.InitialSqrP *= evc.header.InitialSqrP;
 
@@ -93,7 +94,7 @@ bool IBAnalyzerEM3p::AddMuon(const MuonScatterData &muon)
                 case 2: poca = PocaAlgorithm->getOutTrackPoca(); break;
                 }
             }
-            if(use_poca && this->GetVoxCollection()->IsInsideBounds(poca)) {
+            if(use_poca && this->IsInsideBounds(poca)) {
                 ray = GetRayAlgorithm()->TraceBetweenPoints(entry_pt,poca);
                 ray.AppendRay( GetRayAlgorithm()->TraceBetweenPoints(poca,exit_pt) );
             }
@@ -108,7 +109,7 @@ bool IBAnalyzerEM3p::AddMuon(const MuonScatterData &muon)
         {
             // voxel //
             const IBVoxRaytracer::RayData::Element *el = &ray.Data().at(i);
-            elc.voxel = &this->GetVoxCollection()->operator [](el->vox_id);
+            elc.voxel = this->GetVoxel(el->vox_id);
             // Wij   //
             Scalarf L = el->L;  T -= L;
             elc.Wij << L ,          L*L/2 + L*T,
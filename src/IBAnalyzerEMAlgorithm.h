@@ -38,6 +38,8 @@ public:
 
     IBAnalyzerEMAlgorithm() { init_properties(); }
 
+    Scalarf GetInertia() { return $$.inertia; }
+
     virtual void evaluate(Matrix4f &Sigma, Event *evc) = 0;
 
     virtual bool ComputeSigma(Matrix4f &Sigma, Event *evc);
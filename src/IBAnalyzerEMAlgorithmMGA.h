@@ -22,6 +22,7 @@
 
 #include <Core/Vector.h>
 #include "IBAnalyzerEMAlgorithm.h"
+#include "IBAnalyzerEMEngine.h"
 
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -33,19 +34,39 @@ template < int size = 1 >
 class IBAnalyzerEMAlgorithmMGA : public IBAnalyzerEMAlgorithm {
     typedef struct IBAnalyzerEM::Event Event;
 public:
+    IBAnalyzerEMAlgorithmMGA() : m_P(0), m_KiStep(0) {}
+
     void SetGaussians(Vector<Vector2f> &WS);
     void SetGaussians(Scalarf *w, Scalarf *s);
     Scalarf GetNominalMomentum() const { return m_P; }
 
+    // Ki is interpolated on KiTableSize nodes over [0, KiTableMax) of Chi2
+    // and computed exactly outside //
+    static const int KiTableSize = 16384;
+    static Scalarf KiTableMax() { return 32; }
+
+    Scalarf Ki(Scalarf Chi2) const;
+    Scalarf KiExact(Scalarf Chi2) const;
+
 protected:
     virtual ~IBAnalyzerEMAlgorithmMGA() {}
 
-    Scalarf Ki(Scalarf Chi2);
     Vector<Vector2f> normalizeScaling(Vector<Vector2f> &ws);
 
-private:    
-    Vector2f m_Kparams[size * size];
-    Scalarf  m_P;
+    // forwards Ki to the shared per element kernels //
+    struct KiFunction {
+        KiFunction(const IBAnalyzerEMAlgorithmMGA *mga) : m(mga) {}
+        template < typename T > T operator()(T Chi2) const { return m->Ki(Chi2); }
+        const IBAnalyzerEMAlgorithmMGA *m;
+    };
+
+private:
+    // Ki = sum_k 1/sum_l Ka_kl exp(Chi2 Kb_kl), kept apart for simd //
+    Scalarf m_Ka[size * size];
+    Scalarf m_Kb[size * size];
+    Scalarf m_P;
+    Scalarf m_KiStep;
+    Vector<Scalarf> m_KiTable;
 };
 
 
@@ -90,32 +111,47 @@ void IBAnalyzerEMAlgorithmMGA<size>::SetGaussians(Vector<Vector2f> &WS)
         float sk_cap = ws[k](1)/wsnorm;
         for (int l=0 ; l<size ; ++l) {
             float sl_cap = ws[l](1)/wsnorm;
-            m_Kparams[k*size+l] <<
-                    (sk_cap) * sqrt(sk_cap/sl_cap) * (ws[l](0)/ws[k](0)),
-                    -0.5 * (1/sl_cap - 1/sk_cap);
+            m_Ka[k*size+l] = (sk_cap) * sqrt(sk_cap/sl_cap) * (ws[l](0)/ws[k](0));
+            m_Kb[k*size+l] = -0.5 * (1/sl_cap - 1/sk_cap);
         }
     }
 
+    m_KiStep = KiTableMax() / KiTableSize;
+    m_KiTable.resize(KiTableSize + 1);
+    for (int i = 0; i <= KiTableSize; ++i)
+        m_KiTable[i] = KiExact(i * m_KiStep);
 }
 
 
 template < int size >
-Scalarf IBAnalyzerEMAlgorithmMGA<size>::Ki(Scalarf Chi2)
+Scalarf IBAnalyzerEMAlgorithmMGA<size>::KiExact(Scalarf Chi2) const
 {
+    Scalarf e[size * size];
+    #pragma omp simd
+    for (int i = 0; i < size * size; ++i)
+        e[i] = m_Ka[i] * exp(Chi2 * m_Kb[i]);
+
     Scalarf Ki = 0;
-    float Ki_tmp = 0;
-    // optimize even more: linearize for cycles //
     for (int k=0 ; k<size; ++k) {
-        for (int l=0 ; l<size ; ++l) {
-            Ki_tmp += this->m_Kparams[k*size+l](0) *
-                    exp(Chi2 * m_Kparams[k*size+l](1));
-        }
-        Ki    += 1 / Ki_tmp;
-        Ki_tmp = 0;
+        Scalarf Ki_tmp = 0;
+        for (int l=0 ; l<size ; ++l)
+            Ki_tmp += e[k*size+l];
+        Ki += 1 / Ki_tmp;
     }
     return Ki;
 }
 
+template < int size >
+Scalarf IBAnalyzerEMAlgorithmMGA<size>::Ki(Scalarf Chi2) const
+{
+    Scalarf x = m_KiStep > 0 ? Chi2 / m_KiStep : -1;
+    if (!(x >= 0 && x < KiTableSize))
+        return KiExact(Chi2);
+    int i = (int)x;
+    Scalarf f = x - i;
+    return m_KiTable[i] + f * (m_KiTable[i+1] - m_KiTable[i]);
+}
+
 
 
 
@@ -126,7 +162,8 @@ Scalarf IBAnalyzerEMAlgorithmMGA<size>::Ki(Scalarf Chi2)
 //// ALGORITHMS  ///////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////
 
-
+// Sij = Ki tr(Bn Dn) - tr(Bn) per element, through the block structured
+// kernels of IBAnalyzerEMPolicy //
 
 
 
@@ -136,6 +173,7 @@ Scalarf IBAnalyzerEMAlgorithmMGA<size>::Ki(Scalarf Chi2)
 template < int size >
 class IBAnalyzerEMAlgorithmMGA_PXTZ : public IBAnalyzerEMAlgorithmMGA<size> {
     typedef struct IBAnalyzerEM::Event Event;
+    typedef IBAnalyzerEMAlgorithmMGA<size> BaseClass;
 public:
     void evaluate(Matrix4f &Sigma, Event *evc);
 
@@ -144,21 +182,8 @@ public:
 template < int size >
 void IBAnalyzerEMAlgorithmMGA_PXTZ<size>::evaluate(Matrix4f &Sigma, Event *evc)
 {
-    Matrix4f iS = Sigma.inverse();
-    Matrix4f Dn = iS * (evc->header.Di * evc->header.Di.transpose());
-    Scalarf  Ki = this->Ki(Dn.trace());
-
-    for (unsigned int j = 0; j < evc->elements.size(); ++j) {
-
-        Matrix4f Wij = Matrix4f::Zero();
-        Wij.block<2,2>(0,0) = evc->elements[j].Wij;
-        Wij.block<2,2>(2,2) = evc->elements[j].Wij;
-        Matrix4f Bn = iS * Wij;
-
-        float Sij = Ki * (Bn * Dn).trace() - Bn.trace();
-        evc->elements[j].Sij =  Sij * evc->elements[j].lambda *
-                evc->elements[j].lambda * evc->elements[j].pw;
-    }
+    typedef IBAnalyzerEMPolicy::SGA_PXTZ<IBAnalyzerEMPolicy::FloatPrecision> Policy;
+    Policy::Apply(Policy::Reduce(Sigma), evc, typename BaseClass::KiFunction(this), 1);
 }
 
 
@@ -170,6 +195,7 @@ void IBAnalyzerEMAlgorithmMGA_PXTZ<size>::evaluate(Matrix4f &Sigma, Event *evc)
 template < int size >
 class IBAnalyzerEMAlgorithmMGA_PX : public IBAnalyzerEMAlgorithmMGA<size> {
     typedef struct IBAnalyzerEM::Event Event;
+    typedef IBAnalyzerEMAlgorithmMGA<size> BaseClass;
 public:
     void evaluate(Matrix4f &Sigma, Event *evc);
 };
@@ -177,24 +203,8 @@ public:
 
 template < int size >
 void IBAnalyzerEMAlgorithmMGA_PX<size>::evaluate(Matrix4f &Sigma, Event *evc) {
-
-    Matrix2f iS;
-    {
-        Matrix2f S;
-        S << Sigma(0,0), Sigma(0,1), Sigma(1,0), Sigma(1,1);
-        iS = S.inverse();
-    }
-    Vector2f Di(evc->header.Di(0),evc->header.Di(1));
-
-    Matrix2f Dn = iS * (Di * Di.transpose());
-    Scalarf  Ki = this->Ki(Dn.trace());
-
-    for (unsigned int j = 0; j < evc->elements.size(); ++j) {
-        Matrix2f Bn = iS * evc->elements[j].Wij;
-        float Sij = Ki * (Bn * Dn).trace() - Bn.trace();
-        evc->elements[j].Sij =  Sij * evc->elements[j].lambda *
-                evc->elements[j].lambda * evc->elements[j].pw;
-    }
+    typedef IBAnalyzerEMPolicy::SGA_PX<IBAnalyzerEMPolicy::FloatPrecision> Policy;
+    Policy::Apply(Policy::Reduce(Sigma), evc, typename BaseClass::KiFunction(this), 1);
 }
 
 
@@ -204,6 +214,7 @@ void IBAnalyzerEMAlgorithmMGA_PX<size>::evaluate(Matrix4f &Sigma, Event *evc) {
 template < int size >
 class IBAnalyzerEMAlgorithmMGA_TZ : public IBAnalyzerEMAlgorithmMGA<size> {
     typedef struct IBAnalyzerEM::Event Event;
+    typedef IBAnalyzerEMAlgorithmMGA<size> BaseClass;
 public:
     void evaluate(Matrix4f &Sigma, Event *evc);
 };
@@ -211,25 +222,8 @@ public:
 
 template < int size >
 void IBAnalyzerEMAlgorithmMGA_TZ<size>::evaluate(Matrix4f &Sigma, Event *evc) {
-
-    Matrix2f iS;
-    {
-        Matrix2f S;
-        S << Sigma(2,2), Sigma(2,3), Sigma(3,2), Sigma(3,3);
-        iS = S.inverse();
-    }
-    Vector2f Di(evc->header.Di(2),evc->header.Di(3));
-
-
-    Matrix2f Dn = iS * (Di * Di.transpose());
-    Scalarf  Ki = this->Ki(Dn.trace());
-
-    for (unsigned int j = 0; j < evc->elements.size(); ++j) {
-        Matrix2f Bn = iS * evc->elements[j].Wij;
-        float Sij = Ki * (Bn * Dn).trace() - Bn.trace();
-        evc->elements[j].Sij =  Sij * evc->elements[j].lambda *
-                evc->elements[j].lambda * evc->elements[j].pw;
-    }
+    typedef IBAnalyzerEMPolicy::SGA_TZ<IBAnalyzerEMPolicy::FloatPrecision> Policy;
+    Policy::Apply(Policy::Reduce(Sigma), evc, typename BaseClass::KiFunction(this), 1);
 }
 
 
@@ -241,6 +235,7 @@ void IBAnalyzerEMAlgorithmMGA_TZ<size>::evaluate(Matrix4f &Sigma, Event *evc) {
 template < int size >
 class IBAnalyzerEMAlgorithmMGA_PT : public IBAnalyzerEMAlgorithmMGA<size> {
     typedef struct IBAnalyzerEM::Event Event;
+    typedef IBAnalyzerEMAlgorithmMGA<size> BaseClass;
 public:
     void evaluate(Matrix4f &Sigma, Event *evc);
 };
@@ -249,26 +244,8 @@ public:
 
 template < int size >
 void IBAnalyzerEMAlgorithmMGA_PT<size>::evaluate(Matrix4f &Sigma, Event *evc) {
-    Matrix2f iS;
-    {
-        Matrix2f S;
-        S << Sigma(0,0), Sigma(0,2), Sigma(2,0), Sigma(2,2);
-        iS = S.inverse();
-    }
-    Vector2f Di(evc->header.Di(0),evc->header.Di(2));
-    Matrix2f Dn = iS * (Di * Di.transpose());
-    Scalarf  Ki = this->Ki(Dn.trace());
-
-    for (unsigned int j = 0; j < evc->elements.size(); ++j) {
-        Matrix2f Wij;
-        Wij << evc->elements[j].Wij(0,0),0,
-               0,evc->elements[j].Wij(0,0);
-        Matrix2f Bn = iS * Wij;
-        float Sij = Ki * (Bn * Dn).trace() - Bn.trace();
-        evc->elements[j].Sij =  Sij *
-                evc->elements[j].lambda * evc->elements[j].lambda *
-                evc->elements[j].pw;
-    }
+    typedef IBAnalyzerEMPolicy::SGA_PT<IBAnalyzerEMPolicy::FloatPrecision> Policy;
+    Policy::Apply(Policy::Reduce(Sigma), evc, typename BaseClass::KiFunction(this), 1);
 }
 
 
@@ -19,6 +19,9 @@
 
 
 #include "IBAnalyzerEMAlgorithmSGA.h"
+#include "IBAnalyzerEMEngine.h"
+
+#include <iostream>
 
 #include <Eigen/Dense>
 #include <Eigen/LU>
@@ -30,22 +33,10 @@
  ************************************************/
 
 void IBAnalyzerEMAlgorithmSGA_PXTZ::evaluate(Matrix4f &Sigma,
-                                                IBAnalyzerEMAlgorithm::Event *evc)
+                                              IBAnalyzerEMAlgorithm::Event *evc)
 {
-
-    Matrix4f iS;
-    iS = Sigma.inverse();
-    Matrix4f Wij = Matrix4f::Zero();
-    Matrix4f Dn = iS * (evc->header.Di * evc->header.Di.transpose());
-    
-    for (unsigned int j = 0; j < evc->elements.size(); ++j) {
-      Wij.block<2,2>(0,0) = evc->elements[j].Wij;
-      Wij.block<2,2>(2,2) = evc->elements[j].Wij;	
-      Matrix4f Bn = iS * Wij;
-      evc->elements[j].Sij =  ((Bn * Dn).trace() - Bn.trace()) *
-	evc->elements[j].lambda * evc->elements[j].lambda *
-	evc->elements[j].pw / 4 / $$.inertia;
-    }
+    typedef IBAnalyzerEMPolicy::SGA_PXTZ<IBAnalyzerEMPolicy::FloatPrecision> Policy;
+    Policy::Evaluate(Policy::Reduce(Sigma), evc, $$.inertia);
 }
 
 
@@ -96,42 +87,77 @@ bool IBAnalyzerEMAlgorithmSGA_PXTZ3::ComputeSigma(Matrix4f &Sigma, IBAnalyzerEMA
 
 
 
-void IBAnalyzerEMAlgorithmSGA_PXTZ4::evaluate(Matrix4f &Sigma, IBAnalyzerEMAlgorithm::Event *evc)
+IBAnalyzerEMAlgorithmSGA_PXTZ4::IBAnalyzerEMAlgorithmSGA_PXTZ4() :
+    m_AR(0,0,0),
+    m_MA(0,0,0)
 {
-    Matrix4f iS;
-    iS = Sigma.inverse();    
-    Matrix4f Wij = Matrix4f::Zero();
-
-    Matrix4f Dn = iS * (evc->header.Di * evc->header.Di.transpose());
-
-
+    const Scalarf factor[5] = {2,3,3,3,2};
+    Vector<Scalarf> weights;
+    for(int i=0; i<5; ++i) weights.push_back(factor[i]);
+    this->SetSmoothingWeights(weights);
+}
 
-    for (unsigned int j = 0; j < evc->elements.size(); ++j) {
-        Wij.block<2,2>(0,0) = evc->elements[j].Wij;
-        Wij.block<2,2>(2,2) = evc->elements[j].Wij;
-        Matrix4f Bn = iS * Wij;
-        float Sij = ((Bn * Dn).trace() - Bn.trace()) *
-                evc->elements[j].lambda * evc->elements[j].lambda *
-                evc->elements[j].pw;
-        evc->elements[j].Sij =  Sij;
+void IBAnalyzerEMAlgorithmSGA_PXTZ4::SetSmoothingWeights(const Vector<Scalarf> &weights)
+{
+    int size = weights.size();
+    if(size % 2 == 0 || size > MaxSmoothingWindow) {
+        std::cerr << "SGA_PXTZ4: smoothing window must be odd and at most "
+                  << MaxSmoothingWindow << ", weights ignored\n";
+        return;
+    }
+    // normalization: the sum of weights but the largest one //
+    Scalarf sum = 0, max = 0;
+    for(int i=0; i<size; ++i) {
+        m_SmoothWeights[i] = weights[i];
+        sum += weights[i];
+        if(weights[i] > max) max = weights[i];
     }
+    m_SmoothWindow = size;
+    m_SmoothNorm   = sum > max ? sum - max : 1;
+}
+
+Vector<Scalarf> IBAnalyzerEMAlgorithmSGA_PXTZ4::GetSmoothingWeights() const
+{
+    Vector<Scalarf> weights;
+    for(int i=0; i<m_SmoothWindow; ++i) weights.push_back(m_SmoothWeights[i]);
+    return weights;
+}
 
-    Vector<Event::Element> copy = evc->elements;
-    const float factor[5] = {2,3,3,3,2};
-
-    float Sij;
-    if(evc->elements.size() > 5)
-    for(int i=2; i<evc->elements.size()-2; ++i) {
-        Sij=0;
-        float maxSij = 0;
-        for ( int j=-2; j<3; ++j) {
-            float s = copy[i+j].Sij * factor[j+2];
-            if(s > maxSij) maxSij = s;
+void IBAnalyzerEMAlgorithmSGA_PXTZ4::evaluate(Matrix4f &Sigma, IBAnalyzerEMAlgorithm::Event *evc)
+{
+    typedef IBAnalyzerEMPolicy::SGA_PXTZ<IBAnalyzerEMPolicy::FloatPrecision> Policy;
+    Policy::Apply(Policy::Reduce(Sigma), evc, IBAnalyzerEMPolicy::SingleGaussian(), 1);
+
+    const int w = m_SmoothWindow;
+    const int h = w / 2;
+    const int n = evc->elements.size();
+    if(w < 3 || n <= w) return;
+
+    // ring of the raw Sij in the window, each value is written twice so
+    // that the window is always contiguous at ring[head, head + w) //
+    Scalarf ring[2 * MaxSmoothingWindow];
+    for(int k=0; k<w; ++k)
+        ring[k] = ring[k + w] = evc->elements[k].Sij;
+
+    const Scalarf *weights = m_SmoothWeights;
+    const Scalarf  norm    = 1 / m_SmoothNorm;
+    int head = 0;
+    for(int i=h; i<n-h; ++i) {
+        const Scalarf *win = ring + head;
+        Scalarf Sij = 0, maxSij = 0;
+        #pragma omp simd reduction(+:Sij) reduction(max:maxSij)
+        for(int k=0; k<w; ++k) {
+            Scalarf s = win[k] * weights[k];
             Sij += s;
+            maxSij = s > maxSij ? s : maxSij;
+        }
+        evc->elements[i].Sij = (Sij - maxSij) * norm;
+
+        // slide: the raw value leaving the window is replaced by the next //
+        if(i + h + 1 < n) {
+            ring[head] = ring[head + w] = evc->elements[i + h + 1].Sij;
+            if(++head == w) head = 0;
         }
-        Sij -= maxSij;
-        Sij /= 10;
-        evc->elements[i].Sij = Sij;
     }
 }
 
@@ -145,48 +171,15 @@ void IBAnalyzerEMAlgorithmSGA_PXTZ4::evaluate(Matrix4f &Sigma, IBAnalyzerEMAlgor
 void IBAnalyzerEMAlgorithmSGA_PX::evaluate(Matrix4f &Sigma,
                                               IBAnalyzerEMAlgorithm::Event *evc)
 {
-    Matrix2f iS;
-    {
-        Matrix2f S;
-        S << Sigma(0,0), Sigma(0,1), Sigma(1,0), Sigma(1,1);
-        iS = S.inverse();
-//        bool invertible;
-//        S.computeInverseWithCheck(iS,invertible);
-//        Matrix2d iSd;
-//        S.cast<double>().computeInverseWithCheck(iSd,invertible);
-//        if(!invertible) {
-//            std::cerr << ".InvErr.";
-//        }
-//        iS = iSd.cast<float>();
-
-    }
-    Vector2f Di(evc->header.Di(0),evc->header.Di(1));
-
-    for (unsigned int j = 0; j < evc->elements.size(); ++j) {
-        Matrix2f iSWij = iS * evc->elements[j].Wij;
-        float DISWISD  = Di.transpose() * iSWij * iS * Di;
-        evc->elements[j].Sij = (DISWISD - iSWij.trace()) * evc->elements[j].pw *
-                evc->elements[j].lambda * evc->elements[j].lambda / 2 /$$.inertia; // << reintroduced 2 factor !!
-    }
+    typedef IBAnalyzerEMPolicy::SGA_PX<IBAnalyzerEMPolicy::FloatPrecision> Policy;
+    Policy::Evaluate(Policy::Reduce(Sigma), evc, $$.inertia);
 }
 
 void IBAnalyzerEMAlgorithmSGA_TZ::evaluate(Matrix4f &Sigma,
                                               IBAnalyzerEMAlgorithm::Event *evc)
 {
-    Matrix2f iS;
-    {
-        Matrix2f S;
-        S << Sigma(2,2), Sigma(2,3), Sigma(3,2), Sigma(3,3);
-        iS = S.inverse();
-    }
-    Vector2f Di(evc->header.Di(2),evc->header.Di(3));
-
-    for (unsigned int j = 0; j < evc->elements.size(); ++j) {
-        Matrix2f iSWij = iS * evc->elements[j].Wij;
-        float DISWISD  = Di.transpose() * iSWij * iS * Di;
-        evc->elements[j].Sij = (DISWISD - iSWij.trace()) * evc->elements[j].pw *
-                evc->elements[j].lambda * evc->elements[j].lambda / 2 / $$.inertia; // << reintroduced 2 factor !!
-    }
+    typedef IBAnalyzerEMPolicy::SGA_TZ<IBAnalyzerEMPolicy::FloatPrecision> Policy;
+    Policy::Evaluate(Policy::Reduce(Sigma), evc, $$.inertia);
 }
 
 
@@ -231,38 +224,8 @@ void IBAnalyzerEMAlgorithmSGA_PXT::evaluate(Matrix4f &Sigma, IBAnalyzerEMAlgorit
 void IBAnalyzerEMAlgorithmSGA_PT::evaluate(Matrix4f &Sigma,
                                               IBAnalyzerEMAlgorithm::Event *evc)
 {
-
-    Matrix2f S;
-    Matrix2f iS;
-    {
-        S << Sigma(0,0), Sigma(0,2), Sigma(2,0), Sigma(2,2);
-        iS = S.inverse();
-    }
-    Vector2f Di(evc->header.Di(0),evc->header.Di(2));
-
-    for (unsigned int j = 0; j < evc->elements.size(); ++j) {
-        Matrix2f Wij;
-        Wij << evc->elements[j].Wij(0,0),0,
-               0,evc->elements[j].Wij(0,0);
-        Matrix2f iSWij = iS * Wij;
-        float lambda = evc->elements[j].lambda;
-        float DISWISD  = Di.transpose() * iSWij * iS * Di;
-        evc->elements[j].Sij = (DISWISD - iSWij.trace()) * evc->elements[j].pw *
-                evc->elements[j].lambda * evc->elements[j].lambda / 2 / $$.inertia;
-        //        if(isnan(evc->elements[j].Sij)) {
-        //            std::cout << "\n\n -------------------------- \n"
-        //                      << "Di: " << Di.transpose() << "\n"
-        //                      << "\nlambda: " << lambda
-        //                      << "\nWij: \n" << Wij
-        //                      << "\nSigma:\n" << S
-        //                      << "\nE:\n" << evc->header.E
-        //                      << "\nISigma: \n" << iS
-        //                      << "\npw:" << evc->elements[j].pw
-        //                      << "\ninertia:" << $$.inertia
-        //                      << "\nlambda dopo: " << evc->elements[j].lambda
-        //                      << "\n" << std::flush;
-        //        }
-    }
+    typedef IBAnalyzerEMPolicy::SGA_PT<IBAnalyzerEMPolicy::FloatPrecision> Policy;
+    Policy::Evaluate(Policy::Reduce(Sigma), evc, $$.inertia);
 }
 
 
@@ -273,23 +236,8 @@ void IBAnalyzerEMAlgorithmSGA_PT::evaluate(Matrix4f &Sigma,
 void IBAnalyzerEMAlgorithmSGA_XZ::evaluate(Matrix4f &Sigma,
                                               IBAnalyzerEMAlgorithm::Event *evc)
 {
-    Matrix2f iS;
-    {
-        Matrix2f S;
-        S << Sigma(1,1), Sigma(1,3), Sigma(3,1), Sigma(3,3);
-        iS = S.inverse();
-    }
-    Vector2f Di(evc->header.Di(1),evc->header.Di(3));
-
-    for (unsigned int j = 0; j < evc->elements.size(); ++j) {
-        Matrix2f Wij;
-        Wij << evc->elements[j].Wij(1,1),0,
-               0,evc->elements[j].Wij(1,1);
-        Matrix2f iSWij = iS * Wij;
-        float DISWISD  = Di.transpose() * iSWij * iS * Di;
-        evc->elements[j].Sij = (DISWISD - iSWij.trace()) * evc->elements[j].pw *
-                evc->elements[j].lambda * evc->elements[j].lambda / 2 / $$.inertia;
-    }
+    typedef IBAnalyzerEMPolicy::SGA_XZ<IBAnalyzerEMPolicy::FloatPrecision> Policy;
+    Policy::Evaluate(Policy::Reduce(Sigma), evc, $$.inertia);
 }
 
 
@@ -298,29 +246,17 @@ void IBAnalyzerEMAlgorithmSGA_XZ::evaluate(Matrix4f &Sigma,
  ****************************************/
 
 void IBAnalyzerEMAlgorithmSGA_P::evaluate(Matrix4f &Sigma,
-                                             IBAnalyzerEMAlgorithm::Event *evc)
+                                              IBAnalyzerEMAlgorithm::Event *evc)
 {
-    float Di = evc->header.Di(0);
-    float iS = 1/Sigma(0,0);
-    for (unsigned int j = 0; j < evc->elements.size(); ++j) {
-        float Wij = evc->elements[j].Wij(0,0);
-        float DISWISD = Di * iS * Wij * iS * Di;
-        evc->elements[j].Sij = (DISWISD - iS * Wij) * evc->elements[j].pw *
-                evc->elements[j].lambda * evc->elements[j].lambda / $$.inertia;
-    }
+    typedef IBAnalyzerEMPolicy::SGA_P<IBAnalyzerEMPolicy::FloatPrecision> Policy;
+    Policy::Evaluate(Policy::Reduce(Sigma), evc, $$.inertia);
 }
 
 void IBAnalyzerEMAlgorithmSGA_T::evaluate(Matrix4f &Sigma,
-                                             IBAnalyzerEMAlgorithm::Event *evc)
+                                              IBAnalyzerEMAlgorithm::Event *evc)
 {
-    float Di = evc->header.Di(2);
-    float iS = 1/Sigma(2,2);
-    for (unsigned int j = 0; j < evc->elements.size(); ++j) {
-        float Wij = evc->elements[j].Wij(0,0);
-        float DISWISD = Di * iS * Wij * iS * Di;
-        evc->elements[j].Sij = (DISWISD - iS * Wij) * evc->elements[j].pw *
-                evc->elements[j].lambda * evc->elements[j].lambda / $$.inertia;
-    }
+    typedef IBAnalyzerEMPolicy::SGA_T<IBAnalyzerEMPolicy::FloatPrecision> Policy;
+    Policy::Evaluate(Policy::Reduce(Sigma), evc, $$.inertia);
 }
 
 
@@ -332,29 +268,17 @@ void IBAnalyzerEMAlgorithmSGA_T::evaluate(Matrix4f &Sigma,
 ************************************************/
 
 void IBAnalyzerEMAlgorithmSGA_X::evaluate(Matrix4f &Sigma,
-                                             IBAnalyzerEMAlgorithm::Event *evc)
+                                              IBAnalyzerEMAlgorithm::Event *evc)
 {
-    float Di = evc->header.Di(1);
-    float iS = 1/Sigma(1,1);
-    for (unsigned int j = 0; j < evc->elements.size(); ++j) {
-        float Wij = evc->elements[j].Wij(1,1);
-        float DISWISD = Di * iS * Wij * iS * Di;
-        evc->elements[j].Sij = (DISWISD - iS * Wij) * evc->elements[j].pw *
-                evc->elements[j].lambda * evc->elements[j].lambda / $$.inertia;
-    }
+    typedef IBAnalyzerEMPolicy::SGA_X<IBAnalyzerEMPolicy::FloatPrecision> Policy;
+    Policy::Evaluate(Policy::Reduce(Sigma), evc, $$.inertia);
 }
 
 void IBAnalyzerEMAlgorithmSGA_Z::evaluate(Matrix4f &Sigma,
-                                             IBAnalyzerEMAlgorithm::Event *evc)
+                                              IBAnalyzerEMAlgorithm::Event *evc)
 {
-    float Di = evc->header.Di(3);
-    float iS = 1/Sigma(3,3);
-    for (unsigned int j = 0; j < evc->elements.size(); ++j) {
-        float Wij = evc->elements[j].Wij(1,1);
-        float DISWISD = Di * iS * Wij * iS * Di;
-        evc->elements[j].Sij = (DISWISD - iS * Wij) * evc->elements[j].pw *
-                evc->elements[j].lambda * evc->elements[j].lambda / $$.inertia;
-    }
+    typedef IBAnalyzerEMPolicy::SGA_Z<IBAnalyzerEMPolicy::FloatPrecision> Policy;
+    Policy::Evaluate(Policy::Reduce(Sigma), evc, $$.inertia);
 }
 
 
@@ -51,16 +51,25 @@ private:
 class IBAnalyzerEMAlgorithmSGA_PXTZ4 : public IBAnalyzerEMAlgorithmSGA {
     typedef IBAnalyzerEMAlgorithmSGA_PXTZ BaseClass;
 public:
-    IBAnalyzerEMAlgorithmSGA_PXTZ4() : m_AR(0,0,0), m_MA(0,0,0) {}
+    IBAnalyzerEMAlgorithmSGA_PXTZ4();
 
     uLibGetSetMacro(AR,Vector3f)
     uLibGetSetMacro(MA,Vector3f)
 
+    // Sij is smoothed along the track with an odd window of weights, the
+    // largest weighted term of each window is rejected //
+    static const int MaxSmoothingWindow = 15;
+    void SetSmoothingWeights(const Vector<Scalarf> &weights);
+    Vector<Scalarf> GetSmoothingWeights() const;
+
     void evaluate(Matrix4f &Sigma, Event *evc);
 
 private:
     Vector3f m_AR;
     Vector3f m_MA;
+    int      m_SmoothWindow;
+    Scalarf  m_SmoothNorm;
+    Scalarf  m_SmoothWeights[MaxSmoothingWindow];
 };
 
 
@@ -0,0 +1,144 @@
+/*////////////////////////////////////////////////////////////////////////////
+ Copyright 2018 Istituto Nazionale di Fisica Nucleare
+
+ Licensed under the EUPL, Version 1.2 or - as soon they will be approved by
+ the European Commission - subsequent versions of the EUPL (the "Licence").
+ You may not use this work except in compliance with the Licence.
+
+ You may obtain a copy of the Licence at:
+
+ https://joinup.ec.europa.eu/software/page/eupl
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the Licence is distributed on an "AS IS" basis, WITHOUT
+ WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ Licence for the specific language governing permissions and limitations under
+ the Licence.
+////////////////////////////////////////////////////////////////////////////*/
+
+#include <typeinfo>
+
+#include "IBAnalyzerEMEngine.h"
+#include "IBAnalyzerEMAlgorithmSGA.h"
+#include "IBMAPUpdateDensityAlgorithms.h"
+
+using namespace IBAnalyzerEMPolicy;
+
+namespace {
+
+// per voxel form of IBMAPPriorGaussianUpdateAlgorithm::UpdateDensity //
+struct GaussianPrior {
+    GaussianPrior(IBAbstract::IBVoxCollectionMAPAlgorithm *map) :
+        m_Algorithm(static_cast<IBMAPPriorGaussianUpdateAlgorithm *>(map)),
+        m_Prior(NULL),
+        m_Beta(1) {}
+
+    inline void Begin(IBVoxCollection *voxels) {
+        IBVoxCollection *prior = m_Algorithm->GetDensityPrior();
+        m_Prior = (prior && voxels->GetDims() == prior->GetDims()) ? prior : NULL;
+        m_Beta = m_Algorithm->GetBeta();
+    }
+
+    inline void UpdateVoxel(IBVoxel &voxel, Id_t id) const {
+        if (m_Prior) {
+            IBVoxel &prior = m_Prior->Data()[id];
+            float tau = static_cast<float>(voxel.Count) / m_Beta;
+            if( tau > prior.Value * prior.Value / 3 ) {
+                voxel.Value = m_Algorithm->GetDensity(voxel,prior);
+                return;
+            }
+        }
+        voxel.Value = m_Algorithm->GetDensity(voxel);
+    }
+
+    IBMAPPriorGaussianUpdateAlgorithm *m_Algorithm;
+    IBVoxCollection                   *m_Prior;
+    Scalarf                            m_Beta;
+};
+
+struct LaplacianPrior {
+    LaplacianPrior(IBAbstract::IBVoxCollectionMAPAlgorithm *map) :
+        m_Algorithm(static_cast<IBMAPPriorLaplacianUpdateAlgorithm *>(map)) {}
+
+    inline void Begin(IBVoxCollection *) {}
+
+    inline void UpdateVoxel(IBVoxel &voxel, Id_t) const {
+        voxel.Value = m_Algorithm->GetDensity(voxel);
+    }
+
+    IBMAPPriorLaplacianUpdateAlgorithm *m_Algorithm;
+};
+
+template < template <class> class SijT, class UpdateT, class P >
+IBAnalyzerEMEngine *CreateWithMap(IBAnalyzerEMAlgorithm *sij,
+                                  IBAbstract::IBVoxCollectionMAPAlgorithm *map)
+{
+    if (!map)
+        return new IBAnalyzerEMEngineT<SijT,UpdateT,NoPrior,P>(sij, map);
+    const std::type_info &type = typeid(*map);
+    if (type == typeid(IBMAPPriorGaussianUpdateAlgorithm))
+        return new IBAnalyzerEMEngineT<SijT,UpdateT,GaussianPrior,P>(sij, map);
+    if (type == typeid(IBMAPPriorLaplacianUpdateAlgorithm))
+        return new IBAnalyzerEMEngineT<SijT,UpdateT,LaplacianPrior,P>(sij, map);
+    return NULL;
+}
+
+template < template <class> class SijT, class UpdateT >
+IBAnalyzerEMEngine *CreateWithPrecision(IBAnalyzerEMAlgorithm *sij,
+                                        IBAbstract::IBVoxCollectionMAPAlgorithm *map,
+                                        IBAnalyzerEMEngine::Precision precision)
+{
+    switch (precision) {
+    case IBAnalyzerEM::FloatPrecision:
+        return CreateWithMap<SijT,UpdateT,IBAnalyzerEMPolicy::FloatPrecision>(sij, map);
+    case IBAnalyzerEM::MixedPrecision:
+        return CreateWithMap<SijT,UpdateT,IBAnalyzerEMPolicy::MixedPrecision>(sij, map);
+    case IBAnalyzerEM::DoublePrecision:
+        return CreateWithMap<SijT,UpdateT,IBAnalyzerEMPolicy::DoublePrecision>(sij, map);
+    }
+    return NULL;
+}
+
+template < template <class> class SijT >
+IBAnalyzerEMEngine *CreateWithUpdate(IBAnalyzerEMAlgorithm *sij,
+                                     IBAbstract::IBVoxCollectionUpdateAlgorithm *update,
+                                     IBAbstract::IBVoxCollectionMAPAlgorithm *map,
+                                     IBAnalyzerEMEngine::Precision precision)
+{
+    // custom update functors are only known through their virtual call //
+    if (update) return NULL;
+    return CreateWithPrecision<SijT,SijCapUpdate>(sij, map, precision);
+}
+
+} // namespace
+
+
+IBAnalyzerEMEngine *
+IBAnalyzerEMEngine::Create(IBAnalyzerEMAlgorithm *sij,
+                           IBAbstract::IBVoxCollectionUpdateAlgorithm *update,
+                           IBAbstract::IBVoxCollectionMAPAlgorithm *map,
+                           Precision precision)
+{
+    if (!sij) return NULL;
+    // exact type match, derived algorithms may override ComputeSigma //
+    const std::type_info &type = typeid(*sij);
+    if (type == typeid(IBAnalyzerEMAlgorithmSGA_PXTZ))
+        return CreateWithUpdate<SGA_PXTZ>(sij, update, map, precision);
+    if (type == typeid(IBAnalyzerEMAlgorithmSGA_PX))
+        return CreateWithUpdate<SGA_PX>(sij, update, map, precision);
+    if (type == typeid(IBAnalyzerEMAlgorithmSGA_TZ))
+        return CreateWithUpdate<SGA_TZ>(sij, update, map, precision);
+    if (type == typeid(IBAnalyzerEMAlgorithmSGA_PT))
+        return CreateWithUpdate<SGA_PT>(sij, update, map, precision);
+    if (type == typeid(IBAnalyzerEMAlgorithmSGA_XZ))
+        return CreateWithUpdate<SGA_XZ>(sij, update, map, precision);
+    if (type == typeid(IBAnalyzerEMAlgorithmSGA_P))
+        return CreateWithUpdate<SGA_P>(sij, update, map, precision);
+    if (type == typeid(IBAnalyzerEMAlgorithmSGA_T))
+        return CreateWithUpdate<SGA_T>(sij, update, map, precision);
+    if (type == typeid(IBAnalyzerEMAlgorithmSGA_X))
+        return CreateWithUpdate<SGA_X>(sij, update, map, precision);
+    if (type == typeid(IBAnalyzerEMAlgorithmSGA_Z))
+        return CreateWithUpdate<SGA_Z>(sij, update, map, precision);
+    return NULL;
+}
@@ -0,0 +1,511 @@
+/*////////////////////////////////////////////////////////////////////////////
+ Copyright 2018 Istituto Nazionale di Fisica Nucleare
+
+ Licensed under the EUPL, Version 1.2 or - as soon they will be approved by
+ the European Commission - subsequent versions of the EUPL (the "Licence").
+ You may not use this work except in compliance with the Licence.
+
+ You may obtain a copy of the Licence at:
+
+ https://joinup.ec.europa.eu/software/page/eupl
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the Licence is distributed on an "AS IS" basis, WITHOUT
+ WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ Licence for the specific language governing permissions and limitations under
+ the Licence.
+////////////////////////////////////////////////////////////////////////////*/
+
+#ifndef IBANALYZEREMENGINE_H
+#define IBANALYZEREMENGINE_H
+
+#include <math.h>
+#include <functional>
+
+#include <Math/Utils.h>
+
+#include "IBAnalyzerEM.h"
+#include "IBAnalyzerEMAlgorithm.h"
+#include "IBVoxCollection.h"
+
+////////////////////////////////////////////////////////////////////////////////
+//// PRECISION POLICIES ////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+namespace IBAnalyzerEMPolicy {
+
+typedef IBAnalyzerEM::Event Event;
+
+// Scalar is used for Sigma and the per element products, Inverse for the
+// Sigma inversion, Accumulator for the per thread Sij sums of the
+// backprojection, Kahan compensated when Compensated is set //
+
+// all float, compensated sums: the fast production mode //
+struct FloatPrecision {
+    typedef float  Scalar;
+    typedef float  Inverse;
+    typedef float  Accumulator;
+    static const bool Compensated = true;
+};
+
+// float kernels, double inversion of nearly singular Sigma and double sums //
+struct MixedPrecision {
+    typedef float  Scalar;
+    typedef double Inverse;
+    typedef double Accumulator;
+    static const bool Compensated = false;
+};
+
+// all double, for validation //
+struct DoublePrecision {
+    typedef double Scalar;
+    typedef double Inverse;
+    typedef double Accumulator;
+    static const bool Compensated = false;
+};
+
+template < class P, class MatrixT >
+inline MatrixT Invert(const MatrixT &S)
+{
+    typedef typename P::Inverse I;
+    return S.template cast<I>().inverse().template cast<typename P::Scalar>();
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//// SIJ POLICIES //////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+// Stateless SGA kernels, templated on the precision policy. Each works on the
+// part of Sigma its hidden data need: the full 4x4 for PXTZ, a 2x2 view for
+// two hidden data and a scalar for one. Policies provide
+//   SigmaType ComputeSigma(Event *)   lambda refresh and reduced Sigma
+//   SigmaType Reduce(const Matrix4f&) reduced view of a full Sigma
+//   void Evaluate(const SigmaType&, Event *, Scalarf inertia)
+//   void Apply(const SigmaType&, Event *, const KiT &Ki, T scale)
+// where Apply is the shared per element kernel
+//   Sij = (Ki(chi2) Di' iS Wij iS Di - tr(iS Wij)) lambda^2 pw scale
+// with chi2 = Di' iS Di, Evaluate is the single gaussian case and the MGA
+// models pass their Ki. The virtual IBAnalyzerEMAlgorithmSGA_* and MGA_*
+// classes forward to the float ones.
+
+// Ki of the single gaussian model //
+struct SingleGaussian {
+    template < typename T > inline T operator()(T) const { return 1; }
+};
+
+// refreshes lambda from the voxels and sums Wij * lambda * pw along the path,
+// fabs needed to cope with negative (fixed) lambdas //
+template < typename T >
+inline Eigen::Matrix<T,2,2> PathSigma(Event *evc)
+{
+    Eigen::Matrix<T,2,2> S = Eigen::Matrix<T,2,2>::Zero();
+    for (unsigned int j = 0; j < evc->elements.size(); ++j) {
+        Event::Element &el = evc->elements[j];
+        el.lambda = fabs(el.voxel->Value);
+        S += el.Wij.cast<T>() * (T(el.lambda) * el.pw);
+    }
+    return S;
+}
+
+template < int K, typename T >
+inline T PathSigma1(Event *evc)
+{
+    T S = 0;
+    for (unsigned int j = 0; j < evc->elements.size(); ++j) {
+        Event::Element &el = evc->elements[j];
+        el.lambda = fabs(el.voxel->Value);
+        S += T(el.Wij(K,K)) * el.lambda * el.pw;
+    }
+    return S;
+}
+
+// full 4x4 Sigma, Wij is block diagonal so the per element products are
+// done on the two 2x2 blocks //
+template < class P >
+struct SGA_PXTZ {
+    typedef typename P::Scalar T;
+    typedef Eigen::Matrix<T,4,4> SigmaType;
+    typedef Eigen::Matrix<T,2,2> BlockType;
+    typedef Eigen::Matrix<T,4,1> VectorType;
+
+    static inline SigmaType ComputeSigma(Event *evc) {
+        BlockType P2 = PathSigma<T>(evc);
+        SigmaType S = evc->header.E.cast<T>();
+        S.template block<2,2>(0,0) += P2;
+        S.template block<2,2>(2,2) += P2;
+        return S;
+    }
+
+    static inline SigmaType Reduce(const Matrix4f &Sigma) { return Sigma.cast<T>(); }
+
+    static inline void Evaluate(const SigmaType &Sigma, Event *evc, Scalarf inertia) {
+        Apply(Sigma, evc, SingleGaussian(), T(1) / (4 * inertia));
+    }
+
+    template < class KiT >
+    static inline void Apply(const SigmaType &Sigma, Event *evc, const KiT &Ki, T scale) {
+        SigmaType iS = Invert<P>(Sigma);
+        // Di' iS Wij iS Di and tr(iS Wij) //
+        VectorType Di = evc->header.Di.cast<T>();
+        VectorType u = iS * Di;
+        VectorType v = iS.transpose() * Di;
+        BlockType C = (iS.template block<2,2>(0,0) +
+                       iS.template block<2,2>(2,2)).transpose();
+        T k = Ki(Di.dot(u));
+        for (unsigned int j = 0; j < evc->elements.size(); ++j) {
+            Event::Element &el = evc->elements[j];
+            BlockType W = el.Wij.cast<T>();
+            T lambda = el.lambda;
+            T q = v.template head<2>().dot(W * u.template head<2>()) +
+                  v.template tail<2>().dot(W * u.template tail<2>());
+            T t = C.cwiseProduct(W).sum();
+            el.Sij = (k * q - t) * lambda * lambda * el.pw * scale;
+        }
+    }
+};
+
+// two hidden data on rows I,J of Sigma. Block uses the element Wij as is,
+// otherwise Wij(K,K) on the diagonal //
+template < int I, int J, int K, bool Block, class P >
+struct SGA2 {
+    typedef typename P::Scalar T;
+    typedef Eigen::Matrix<T,2,2> SigmaType;
+    typedef Eigen::Matrix<T,2,1> VectorType;
+
+    static inline SigmaType ComputeSigma(Event *evc) {
+        const Matrix4f &E = evc->header.E;
+        SigmaType S;
+        if (Block) {
+            S = PathSigma<T>(evc);
+        } else {
+            T p = PathSigma1<K,T>(evc);
+            S << p, 0, 0, p;
+        }
+        S(0,0) += E(I,I); S(0,1) += E(I,J);
+        S(1,0) += E(J,I); S(1,1) += E(J,J);
+        return S;
+    }
+
+    static inline SigmaType Reduce(const Matrix4f &Sigma) {
+        SigmaType S;
+        S << Sigma(I,I), Sigma(I,J), Sigma(J,I), Sigma(J,J);
+        return S;
+    }
+
+    static inline void Evaluate(const SigmaType &Sigma, Event *evc, Scalarf inertia) {
+        Apply(Sigma, evc, SingleGaussian(), T(1) / (2 * inertia));
+    }
+
+    template < class KiT >
+    static inline void Apply(const SigmaType &Sigma, Event *evc, const KiT &Ki, T scale) {
+        SigmaType iS = Invert<P>(Sigma);
+        VectorType Di(evc->header.Di(I), evc->header.Di(J));
+        VectorType u = iS * Di;
+        VectorType v = iS.transpose() * Di;
+        SigmaType iST = iS.transpose();
+        T k = Ki(Di.dot(u));
+        T vu = k * v.dot(u);
+        T tr = iS.trace();
+        for (unsigned int j = 0; j < evc->elements.size(); ++j) {
+            Event::Element &el = evc->elements[j];
+            T lambda = el.lambda;
+            T q, t;
+            if (Block) {
+                SigmaType W = el.Wij.cast<T>();
+                q = k * v.dot(W * u);
+                t = iST.cwiseProduct(W).sum();
+            } else {
+                T w = el.Wij(K,K);
+                q = w * vu;
+                t = w * tr;
+            }
+            el.Sij = (q - t) * el.pw * lambda * lambda * scale;
+        }
+    }
+};
+
+// one hidden data on row I of Sigma with Wij(K,K) //
+template < int I, int K, class P >
+struct SGA1 {
+    typedef typename P::Scalar T;
+    typedef T SigmaType;
+
+    static inline SigmaType ComputeSigma(Event *evc) {
+        return PathSigma1<K,T>(evc) + evc->header.E(I,I);
+    }
+
+    static inline SigmaType Reduce(const Matrix4f &Sigma) { return Sigma(I,I); }
+
+    static inline void Evaluate(const SigmaType &Sigma, Event *evc, Scalarf inertia) {
+        Apply(Sigma, evc, SingleGaussian(), T(1) / inertia);
+    }
+
+    template < class KiT >
+    static inline void Apply(const SigmaType &Sigma, Event *evc, const KiT &Ki, T scale) {
+        T Di = evc->header.Di(I);
+        T iS = 1 / static_cast<typename P::Inverse>(Sigma);
+        T k = Ki(Di * iS * Di);
+        for (unsigned int j = 0; j < evc->elements.size(); ++j) {
+            Event::Element &el = evc->elements[j];
+            T W = el.Wij(K,K);
+            T lambda = el.lambda;
+            T DISWISD = Di * iS * W * iS * Di;
+            el.Sij = (k * DISWISD - iS * W) * el.pw * lambda * lambda * scale;
+        }
+    }
+};
+
+template < class P > struct SGA_PX : SGA2<0,1,0,true,P>  {};
+template < class P > struct SGA_TZ : SGA2<2,3,0,true,P>  {};
+template < class P > struct SGA_PT : SGA2<0,2,0,false,P> {};
+template < class P > struct SGA_XZ : SGA2<1,3,1,false,P> {};
+template < class P > struct SGA_P  : SGA1<0,0,P> {};
+template < class P > struct SGA_T  : SGA1<2,0,P> {};
+template < class P > struct SGA_X  : SGA1<1,1,P> {};
+template < class P > struct SGA_Z  : SGA1<3,1,P> {};
+
+// backprojection of the element Sij into the voxel caps //
+inline void BackProject(Event *evc)
+{
+    for (unsigned int j = 0; j < evc->elements.size(); j++) {
+        const Event::Element &el = evc->elements[j];
+        IBVoxel *vox = el.voxel;
+        if( vox==NULL || std::isnan(el.Sij) || std::isnan(vox->SijCap))
+            continue;
+        #pragma omp atomic
+        vox->SijCap += el.Sij;
+        #pragma omp atomic
+        vox->Count++;
+    }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//// UPDATE POLICIES ///////////////////////////////////////////////////////////
+
+// default lambda update: mean Sij of voxels crossed at least threshold times
+struct SijCapUpdate {
+    static inline void UpdateVoxel(IBVoxel &voxel, unsigned int threshold) {
+        unsigned int tcount = voxel.Count;
+        if ( voxel.Value > 0 && tcount > 0 && (threshold == 0 || tcount >= threshold) ) {
+            voxel.Value += voxel.SijCap / static_cast<float>(tcount);
+            if(unlikely(!isFinite(voxel.Value) || voxel.Value > 100.E-6)) {  // HARDCODED!!!
+                voxel.Value = 100.E-6;
+            }
+        }
+        voxel.SijCap = 0;
+    }
+};
+
+
+////////////////////////////////////////////////////////////////////////////////
+//// MAP POLICIES //////////////////////////////////////////////////////////////
+
+// no prior, the per voxel MAP step vanishes //
+struct NoPrior {
+    NoPrior(IBAbstract::IBVoxCollectionMAPAlgorithm *) {}
+    inline void Begin(IBVoxCollection *) {}
+    inline void UpdateVoxel(IBVoxel &, Id_t) const {}
+};
+
+} // IBAnalyzerEMPolicy
+
+
+////////////////////////////////////////////////////////////////////////////////
+//// ENGINE ////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+// One EM iteration with the Sij kernel, the density update, the MAP prior and
+// the precision resolved at compile time. Create() picks among the pre
+// instantiated combinations from the configured algorithms and returns NULL
+// for anything else, the analyzer then keeps the virtual path.
+class IBAnalyzerEMEngine {
+public:
+    typedef IBAnalyzerEM::Event Event;
+
+    typedef IBAnalyzerEM::Precision Precision;
+
+    // budget on threads x voxels of the per thread backprojection buffers,
+    // 12 to 20 bytes each; above it the backprojection goes through atomics
+    // on the voxels //
+    static const long MaxBufferedValues = 1L << 24;
+
+    virtual ~IBAnalyzerEMEngine() {}
+
+    // projection and backprojection of all events. With the dense voxels the
+    // Sij are summed in per thread buffers owned by the engine and merged in
+    // parallel by voxel ranges, otherwise atomically //
+    virtual void Evaluate(Vector<Event> &events, IBVoxCollection *voxels = NULL) = 0;
+
+    // density update, MAP prior and count reset in a single pass //
+    virtual void UpdateDensity(IBVoxCollection *voxels, unsigned int threshold) = 0;
+
+    static IBAnalyzerEMEngine *Create(IBAnalyzerEMAlgorithm *sij,
+                                      IBAbstract::IBVoxCollectionUpdateAlgorithm *update,
+                                      IBAbstract::IBVoxCollectionMAPAlgorithm *map,
+                                      Precision precision = IBAnalyzerEM::FloatPrecision);
+};
+
+
+template < template <class> class SijT, class UpdateT, class MapT, class P >
+class IBAnalyzerEMEngineT : public IBAnalyzerEMEngine {
+    typedef SijT<P> Kernel;
+    typedef typename P::Accumulator Acc;
+public:
+    IBAnalyzerEMEngineT(IBAnalyzerEMAlgorithm *sij,
+                        IBAbstract::IBVoxCollectionMAPAlgorithm *map) :
+        m_Sij(sij), m_Map(map) {}
+
+    void Evaluate(Vector<Event> &events, IBVoxCollection *voxels = NULL);
+
+    void UpdateDensity(IBVoxCollection *voxels, unsigned int threshold);
+
+private:
+    static inline void Project(Event *evc, Scalarf inertia) {
+        Kernel::Evaluate(Kernel::ComputeSigma(evc), evc, inertia);
+    }
+
+    // backprojection buffer of one thread, kept zeroed between calls //
+    struct Buffer {
+        Vector<Acc>          sum;
+        Vector<Acc>          err;
+        Vector<unsigned int> count;
+        int                  first, last;   // voxel range touched by the last pass //
+
+        void Reset(int nvox) {
+            if ((int)count.size() == nvox) return;
+            sum.assign(nvox, 0);
+            err.assign(P::Compensated ? nvox : 0, 0);
+            count.assign(nvox, 0);
+        }
+    };
+
+    IBAnalyzerEMAlgorithm *m_Sij;
+    MapT                   m_Map;
+    Vector<Buffer>         m_Buffers;
+};
+
+template < template <class> class SijT, class UpdateT, class MapT, class P >
+void IBAnalyzerEMEngineT<SijT,UpdateT,MapT,P>::Evaluate(Vector<Event> &events,
+                                                       IBVoxCollection *voxels)
+{
+    const Scalarf inertia = m_Sij->GetInertia();
+    const int size = events.size();
+    const int nvox = voxels ? (int)voxels->Data().size() : 0;
+
+    if (nvox == 0) {
+        #pragma omp parallel for schedule(dynamic,256)
+        for (int i = 0; i < size; ++i) {
+            Event *evc = &events[i];
+            Project(evc, inertia);
+            IBAnalyzerEMPolicy::BackProject(evc);
+        }
+        return;
+    }
+
+    IBVoxel *data = &voxels->Data()[0];
+    IBVoxel *data_end = data + nvox;
+    std::less<const IBVoxel *> before;
+    int nthreads = 0;
+    #pragma omp parallel
+    {
+        int slot;
+        #pragma omp critical (IBAnalyzerEMEngine_Slot)
+        slot = nthreads++;
+        #pragma omp barrier
+
+        // the team size is only known here, every thread takes the same way //
+        if ((long)nthreads * nvox > MaxBufferedValues) {
+            #pragma omp for schedule(dynamic,256)
+            for (int i = 0; i < size; ++i) {
+                Event *evc = &events[i];
+                Project(evc, inertia);
+                IBAnalyzerEMPolicy::BackProject(evc);
+            }
+        }
+        else {
+            #pragma omp single
+            if ((int)m_Buffers.size() < nthreads) m_Buffers.resize(nthreads);
+
+            Buffer &buf = m_Buffers[slot];
+            buf.Reset(nvox);
+            Acc *sum = &buf.sum[0];
+            Acc *err = P::Compensated ? &buf.err[0] : NULL;
+            unsigned int *count = &buf.count[0];
+            int first = nvox, last = -1;
+
+            #pragma omp for schedule(dynamic,256)
+            for (int i = 0; i < size; ++i) {
+                Event *evc = &events[i];
+                Project(evc, inertia);
+                for (unsigned int j = 0; j < evc->elements.size(); ++j) {
+                    const Event::Element &el = evc->elements[j];
+                    if (std::isnan(el.Sij) || std::isnan(el.voxel->SijCap))
+                        continue;
+                    if (unlikely(before(el.voxel, data) || !before(el.voxel, data_end))) {
+                        // not in this collection //
+                        #pragma omp atomic
+                        el.voxel->SijCap += el.Sij;
+                        #pragma omp atomic
+                        el.voxel->Count++;
+                        continue;
+                    }
+                    const int id = el.voxel - data;
+                    if (P::Compensated) {
+                        Acc y = el.Sij - err[id];
+                        Acc t = sum[id] + y;
+                        err[id] = (t - sum[id]) - y;
+                        sum[id] = t;
+                    } else {
+                        sum[id] += el.Sij;
+                    }
+                    ++count[id];
+                    if (id < first) first = id;
+                    if (id > last) last = id;
+                }
+            }
+            buf.first = first;
+            buf.last = last;
+            #pragma omp barrier
+
+            // each thread merges a range of voxels over the buffers that touched
+            // it, zeroing them for the next call //
+            #pragma omp for schedule(static)
+            for (int v = 0; v < nvox; ++v) {
+                Acc cap = 0;
+                unsigned int cnt = 0;
+                for (int t = 0; t < nthreads; ++t) {
+                    Buffer &b = m_Buffers[t];
+                    if (v < b.first || v > b.last || !b.count[v]) continue;
+                    cap += P::Compensated ? b.sum[v] - b.err[v] : b.sum[v];
+                    cnt += b.count[v];
+                    b.sum[v] = 0;
+                    if (P::Compensated) b.err[v] = 0;
+                    b.count[v] = 0;
+                }
+                if (!cnt) continue;
+                data[v].SijCap += cap;
+                data[v].Count += cnt;
+            }
+        }
+    }
+}
+
+template < template <class> class SijT, class UpdateT, class MapT, class P >
+void IBAnalyzerEMEngineT<SijT,UpdateT,MapT,P>::UpdateDensity(IBVoxCollection *voxels,
+                                                            unsigned int threshold)
+{
+    m_Map.Begin(voxels);
+    const int size = voxels->Data().size();
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < size; ++i) {
+        IBVoxel &voxel = voxels->Data()[i];
+        UpdateT::UpdateVoxel(voxel, threshold);
+        m_Map.UpdateVoxel(voxel, i);
+        voxel.Count = 0;
+    }
+}
+
+
+#endif // IBANALYZEREMENGINE_H
@@ -0,0 +1,155 @@
+/*////////////////////////////////////////////////////////////////////////////
+ Copyright 2018 Istituto Nazionale di Fisica Nucleare
+
+ Licensed under the EUPL, Version 1.2 or - as soon they will be approved by
+ the European Commission - subsequent versions of the EUPL (the "Licence").
+ You may not use this work except in compliance with the Licence.
+
+ You may obtain a copy of the Licence at:
+
+ https://joinup.ec.europa.eu/software/page/eupl
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the Licence is distributed on an "AS IS" basis, WITHOUT
+ WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ Licence for the specific language governing permissions and limitations under
+ the Licence.
+////////////////////////////////////////////////////////////////////////////*/
+
+
+
+#include <math.h>
+#include <cmath>
+#include <algorithm>
+
+#include "IBAnalyzerEMSijRank.h"
+#include "IBVoxel.h"
+
+
+namespace {
+
+// NaN Sij are ordered after every number and equal among themselves, so the
+// ordering stays a strict weak one //
+inline bool SijLess(Scalarf a, Scalarf b) {
+    return std::isnan(b) ? !std::isnan(a) : a < b;
+}
+
+struct RankKey {
+    const IBVoxel *voxel;
+    Scalarf        Sij;
+    unsigned int   flat;
+
+    bool operator < (const RankKey &other) const {
+        if(voxel != other.voxel) return voxel < other.voxel;
+        if(SijLess(Sij, other.Sij)) return true;
+        if(SijLess(other.Sij, Sij)) return false;
+        return flat < other.flat;
+    }
+};
+
+// chunks are sorted in parallel, then merged pairwise in parallel rounds //
+static const int SortChunk = 1 << 16;
+
+void parallel_sort(Vector<RankKey> &keys)
+{
+    const int size = keys.size();
+    const int chunks = (size + SortChunk - 1) / SortChunk;
+    RankKey *k = size ? &keys[0] : NULL;
+
+    #pragma omp parallel for schedule(dynamic, 1)
+    for(int c = 0; c < chunks; ++c)
+        std::sort(k + c * SortChunk, k + std::min(size, (c + 1) * SortChunk));
+
+    for(int width = SortChunk; width < size; width *= 2) {
+        const int pairs = (size + 2 * width - 1) / (2 * width);
+        #pragma omp parallel for schedule(dynamic, 1)
+        for(int p = 0; p < pairs; ++p) {
+            int begin = p * 2 * width;
+            int mid   = std::min(size, begin + width);
+            int end   = std::min(size, begin + 2 * width);
+            std::inplace_merge(k + begin, k + mid, k + end);
+        }
+    }
+}
+
+} // namespace
+
+
+void IBAnalyzerEMSijRank::Clear()
+{
+    m_EventOffset.clear();
+    m_VoxelOffset.clear();
+    m_Entry.clear();
+    m_Voxel.clear();
+    m_Rank.clear();
+    m_Score.clear();
+}
+
+unsigned int IBAnalyzerEMSijRank::EventIndex(unsigned int flat) const
+{
+    return std::upper_bound(m_EventOffset.begin(), m_EventOffset.end(), flat)
+            - m_EventOffset.begin() - 1;
+}
+
+void IBAnalyzerEMSijRank::Build(const Vector<Event> &events)
+{
+    const int nev = events.size();
+
+    // flat element index //
+    m_EventOffset.resize(nev + 1);
+    m_EventOffset[0] = 0;
+    for(int i = 0; i < nev; ++i)
+        m_EventOffset[i+1] = m_EventOffset[i] + events[i].elements.size();
+    const int size = m_EventOffset[nev];
+
+    Vector<RankKey> keys(size);
+    #pragma omp parallel for schedule(dynamic, 1024)
+    for(int i = 0; i < nev; ++i) {
+        const Event &evc = events[i];
+        for(unsigned int j = 0; j < evc.elements.size(); ++j) {
+            RankKey &key = keys[m_EventOffset[i] + j];
+            key.voxel = evc.elements[j].voxel;
+            key.Sij   = evc.elements[j].Sij;
+            key.flat  = m_EventOffset[i] + j;
+        }
+    }
+    parallel_sort(keys);
+
+    // voxel segments of the sorted keys //
+    m_VoxelOffset.clear();
+    for(int p = 0; p < size; ++p)
+        if(p == 0 || keys[p].voxel != keys[p-1].voxel)
+            m_VoxelOffset.push_back(p);
+    m_VoxelOffset.push_back(size);
+    const int nvox = m_VoxelOffset.size() - 1;
+
+    m_Entry.resize(size);
+    m_Voxel.resize(size);
+    m_Rank.resize(size);
+    #pragma omp parallel for schedule(dynamic, 256)
+    for(int v = 0; v < nvox; ++v) {
+        const unsigned int begin = m_VoxelOffset[v], end = m_VoxelOffset[v+1];
+        unsigned int rank = 0;
+        for(unsigned int p = begin; p < end; ++p) {
+            // a NaN Sij matches no entry, it ranks past the end //
+            if(std::isnan(keys[p].Sij)) rank = end - begin;
+            else if(p == begin || keys[p].Sij != keys[p-1].Sij) rank = p - begin;
+            m_Entry[p] = keys[p].flat;
+            m_Voxel[keys[p].flat] = v;
+            m_Rank[keys[p].flat]  = rank;
+        }
+    }
+
+    // event scores //
+    m_Score.resize(nev);
+    #pragma omp parallel for schedule(dynamic, 1024)
+    for(int i = 0; i < nev; ++i) {
+        const unsigned int n = events[i].elements.size();
+        Scalarf score = 0;
+        for(unsigned int j = 0; j < n; ++j) {
+            const unsigned int N = this->VoxelSize(i, j);
+            score += ((Scalarf)this->Rank(i, j) - (Scalarf)(N / 2)) / sqrt((Scalarf)N);
+        }
+        m_Score[i] = n ? score / sqrt((Scalarf)n) : 0;
+    }
+}
@@ -0,0 +1,81 @@
+/*////////////////////////////////////////////////////////////////////////////
+ Copyright 2018 Istituto Nazionale di Fisica Nucleare
+
+ Licensed under the EUPL, Version 1.2 or - as soon they will be approved by
+ the European Commission - subsequent versions of the EUPL (the "Licence").
+ You may not use this work except in compliance with the Licence.
+
+ You may obtain a copy of the Licence at:
+
+ https://joinup.ec.europa.eu/software/page/eupl
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the Licence is distributed on an "AS IS" basis, WITHOUT
+ WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ Licence for the specific language governing permissions and limitations under
+ the Licence.
+////////////////////////////////////////////////////////////////////////////*/
+
+
+
+#ifndef IBANALYZEREMSIJRANK_H
+#define IBANALYZEREMSIJRANK_H
+
+#include <Core/Vector.h>
+
+#include "IBAnalyzerEM.h"
+
+using namespace uLib;
+
+
+// Rank of each element Sij among all the Sij that cross the same voxel.
+// A CSR index voxel -> (event, element) is built with the entries of each
+// voxel sorted by Sij, so the rank of any element is a single lookup. The
+// event score is the normalized rank sum
+//   R = 1/sqrt(n) sum_j (rank_j - N_j/2) / sqrt(N_j)
+// with N_j the number of crossings of the voxel of element j and N_j/2 an
+// integer division; muons that sit systematically low in their voxels give
+// large negative R. NaN Sij sort last and rank N_j.
+
+class IBAnalyzerEMSijRank {
+    typedef IBAnalyzerEM::Event Event;
+public:
+    IBAnalyzerEMSijRank() {}
+
+    void Build(const Vector<Event> &events);
+    void Clear();
+
+    unsigned int GetNumberOfEvents() const { return m_EventOffset.size() ? m_EventOffset.size() - 1 : 0; }
+    unsigned int GetNumberOfVoxels() const { return m_VoxelOffset.size() ? m_VoxelOffset.size() - 1 : 0; }
+
+    // CSR: entries of voxel v are m_Entry[VoxelBegin(v), VoxelEnd(v)), each
+    // a flat element index, split by EventIndex/ElementIndex //
+    unsigned int VoxelBegin(unsigned int v) const { return m_VoxelOffset[v]; }
+    unsigned int VoxelEnd(unsigned int v) const { return m_VoxelOffset[v+1]; }
+    unsigned int Entry(unsigned int i) const { return m_Entry[i]; }
+    unsigned int EventIndex(unsigned int flat) const;
+    unsigned int ElementIndex(unsigned int flat) const { return flat - m_EventOffset[EventIndex(flat)]; }
+
+    // rank of the element among the crossings of its voxel, equal values
+    // share the lowest rank //
+    unsigned int Rank(unsigned int event, unsigned int element) const {
+        return m_Rank[m_EventOffset[event] + element];
+    }
+    unsigned int VoxelSize(unsigned int event, unsigned int element) const {
+        unsigned int v = m_Voxel[m_EventOffset[event] + element];
+        return m_VoxelOffset[v+1] - m_VoxelOffset[v];
+    }
+
+    Scalarf Score(unsigned int event) const { return m_Score[event]; }
+
+private:
+    Vector<unsigned int> m_EventOffset;
+    Vector<unsigned int> m_VoxelOffset;
+    Vector<unsigned int> m_Entry;
+    Vector<unsigned int> m_Voxel;
+    Vector<unsigned int> m_Rank;
+    Vector<Scalarf>      m_Score;
+};
+
+
+#endif // IBANALYZEREMSIJRANK_H
@@ -0,0 +1,154 @@
+/*////////////////////////////////////////////////////////////////////////////
+ Copyright 2018 Istituto Nazionale di Fisica Nucleare
+
+ Licensed under the EUPL, Version 1.2 or - as soon they will be approved by
+ the European Commission - subsequent versions of the EUPL (the "Licence").
+ You may not use this work except in compliance with the Licence.
+
+ You may obtain a copy of the Licence at:
+
+ https://joinup.ec.europa.eu/software/page/eupl
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the Licence is distributed on an "AS IS" basis, WITHOUT
+ WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ Licence for the specific language governing permissions and limitations under
+ the Licence.
+////////////////////////////////////////////////////////////////////////////*/
+
+
+
+#include <math.h>
+#include <algorithm>
+
+#include "IBAnalyzerEMSijStatistics.h"
+#include "IBVoxel.h"
+
+
+////////////////////////////////////////////////////////////////////////////////
+//// SELECTION /////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+// Nij is NaN on voxels with a zero SijCap; NaN are ordered after every
+// number so the selections below keep a strict weak ordering //
+inline bool NijLess(Scalarf a, Scalarf b) {
+    return std::isnan(b) ? !std::isnan(a) : a < b;
+}
+
+// median of v[0,n) as the mean of the two central values for even n; the
+// lower one is the largest of the left partition left by nth_element //
+inline Scalarf select_median(Scalarf *v, int n)
+{
+    if(n == 0) return NAN;
+    Scalarf *mid = v + n / 2;
+    std::nth_element(v, mid, v + n, NijLess);
+    if(n % 2) return *mid;
+    return (*std::max_element(v, mid, NijLess) + *mid) / 2;
+}
+
+} // namespace
+
+
+////////////////////////////////////////////////////////////////////////////////
+//// STATISTICS ////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+inline Scalarf IBAnalyzerEMSijStatistics::Nij(const Event::Element &el)
+{
+    return fabs( (el.Sij * el.voxel->Count - el.voxel->SijCap) / el.voxel->SijCap );
+}
+
+void IBAnalyzerEMSijStatistics::SetQuantiles(const Vector<Scalarf> &quantiles)
+{
+    m_Quantiles = quantiles;
+    std::sort(m_Quantiles.begin(), m_Quantiles.end());
+    m_Valid = false;
+}
+
+void IBAnalyzerEMSijStatistics::SetCutLevels(const Vector<Scalarf> &levels)
+{
+    m_CutLevels = levels;
+    m_Valid = false;
+}
+
+int IBAnalyzerEMSijStatistics::LevelIndex(Scalarf level) const
+{
+    for(unsigned int i=0; i<m_CutLevels.size(); ++i)
+        if(m_CutLevels[i] == level) return i;
+    return -1;
+}
+
+bool IBAnalyzerEMSijStatistics::HasCutLevel(Scalarf level) const
+{
+    return LevelIndex(level) >= 0;
+}
+
+int IBAnalyzerEMSijStatistics::CutCount(unsigned int event, Scalarf level) const
+{
+    int l = LevelIndex(level);
+    return l < 0 ? 0 : CutCount(event, (unsigned int)l);
+}
+
+bool IBAnalyzerEMSijStatistics::IsCut(unsigned int event, Scalarf level) const
+{
+    return CutCount(event, level) > (int)(m_Size[event] / 3);
+}
+
+Scalarf IBAnalyzerEMSijStatistics::Median(const Event &evc, Vector<Scalarf> &scratch)
+{
+    const int n = evc.elements.size();
+    scratch.resize(n);
+    for(int j=0; j<n; ++j)
+        scratch[j] = Nij(evc.elements[j]);
+    return select_median(n ? &scratch[0] : NULL, n);
+}
+
+void IBAnalyzerEMSijStatistics::Compute(const Vector<Event> &events)
+{
+    const int size = events.size();
+    const int nq = m_Quantiles.size();
+    const int nl = m_CutLevels.size();
+    m_Median.resize(size);
+    m_Size.resize(size);
+    m_Quantile.resize(size * nq);
+    m_Count.resize(size * nl);
+
+    #pragma omp parallel
+    {
+        Vector<Scalarf> scratch;
+        #pragma omp for schedule(dynamic, 1024)
+        for(int i=0; i<size; ++i) {
+            const Event &evc = events[i];
+            const int n = evc.elements.size();
+            scratch.resize(n);
+            Scalarf *v = n ? &scratch[0] : NULL;
+            int *count = nl ? &m_Count[i * nl] : NULL;
+            for(int l=0; l<nl; ++l) count[l] = 0;
+
+            for(int j=0; j<n; ++j) {
+                Scalarf s = Nij(evc.elements[j]);
+                v[j] = s;
+                for(int l=0; l<nl; ++l)
+                    count[l] += s > m_CutLevels[l];
+            }
+            m_Size[i] = n;
+
+            // quantiles go first, the median selection reorders them all //
+            Scalarf *first = v;
+            for(int q=0; q<nq; ++q) {
+                if(n == 0) { m_Quantile[i * nq + q] = NAN; continue; }
+                int k = (int)(m_Quantiles[q] * (n - 1) + 0.5);
+                k = std::min(std::max(k, 0), n - 1);
+                // quantiles are sorted so each selection works on the right
+                // part left by the previous one //
+                std::nth_element(first, v + k, v + n, NijLess);
+                m_Quantile[i * nq + q] = v[k];
+                first = v + k;
+            }
+            m_Median[i] = select_median(v, n);
+        }
+    }
+    m_Valid = true;
+}
@@ -0,0 +1,90 @@
+/*////////////////////////////////////////////////////////////////////////////
+ Copyright 2018 Istituto Nazionale di Fisica Nucleare
+
+ Licensed under the EUPL, Version 1.2 or - as soon they will be approved by
+ the European Commission - subsequent versions of the EUPL (the "Licence").
+ You may not use this work except in compliance with the Licence.
+
+ You may obtain a copy of the Licence at:
+
+ https://joinup.ec.europa.eu/software/page/eupl
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the Licence is distributed on an "AS IS" basis, WITHOUT
+ WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ Licence for the specific language governing permissions and limitations under
+ the Licence.
+////////////////////////////////////////////////////////////////////////////*/
+
+
+
+#ifndef IBANALYZEREMSIJSTATISTICS_H
+#define IBANALYZEREMSIJSTATISTICS_H
+
+#include <Core/Vector.h>
+
+#include "IBAnalyzerEM.h"
+
+using namespace uLib;
+
+
+// Per event statistics of the normalized Sij residuals
+//   Nij = | (Sij Count - SijCap) / SijCap |
+// taken just after a projection/backprojection, before the density update.
+// All events are done in a single parallel pass: the Nij of one event are
+// gathered in a thread local scratch, the cut counts are taken on the fly
+// and median and quantiles are found by selection instead of a full sort.
+
+class IBAnalyzerEMSijStatistics {
+    typedef IBAnalyzerEM::Event Event;
+public:
+    IBAnalyzerEMSijStatistics() : m_Valid(false) {}
+
+    // quantiles in [0,1], nearest rank //
+    void SetQuantiles(const Vector<Scalarf> &quantiles);
+    const Vector<Scalarf> &GetQuantiles() const { return m_Quantiles; }
+
+    // counts of Nij above each level //
+    void SetCutLevels(const Vector<Scalarf> &levels);
+    const Vector<Scalarf> &GetCutLevels() const { return m_CutLevels; }
+    bool HasCutLevel(Scalarf level) const;
+
+    void Compute(const Vector<Event> &events);
+    void Invalidate() { m_Valid = false; }
+    bool IsValid() const { return m_Valid; }
+
+    unsigned int Size() const { return m_Median.size(); }
+
+    Scalarf Median(unsigned int event) const { return m_Median[event]; }
+
+    Scalarf Quantile(unsigned int event, unsigned int q) const {
+        return m_Quantile[event * m_Quantiles.size() + q];
+    }
+
+    int CutCount(unsigned int event, unsigned int level) const {
+        return m_Count[event * m_CutLevels.size() + level];
+    }
+
+    int CutCount(unsigned int event, Scalarf level) const;
+
+    // SijCut recipe: more than a third of the voxels above the level //
+    bool IsCut(unsigned int event, Scalarf level) const;
+
+    // median of a single event, NAN if it has no elements //
+    static Scalarf Median(const Event &evc, Vector<Scalarf> &scratch);
+
+private:
+    static Scalarf Nij(const Event::Element &el);
+    int LevelIndex(Scalarf level) const;
+
+    bool m_Valid;
+    Vector<Scalarf> m_Quantiles;
+    Vector<Scalarf> m_CutLevels;
+    Vector<Scalarf> m_Median;
+    Vector<Scalarf> m_Quantile;
+    Vector<int>     m_Count;
+    Vector<int>     m_Size;
+};
+
+
+#endif // IBANALYZEREMSIJSTATISTICS_H
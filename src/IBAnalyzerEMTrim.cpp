@@ -295,7 +295,10 @@ IBAnalyzerEMTrim::~IBAnalyzerEMTrim()
 void IBAnalyzerEMTrim::Run(unsigned int iterations, float muons_ratio, float a, float b)
 {
     //IBVoxCollection -> IBVoxCollectionMedian
-    assert(this->GetVoxCollection());
+    if(this->GetSparseVoxCollection() || !this->GetVoxCollection()) {
+        std::cerr << "Error: EM Trim needs a dense voxel collection\n";
+        return;
+    }
     IBAnalyzerEMTrimDetail::IBVoxCollectionATrim voxels_trim(this->GetVoxCollection()->GetDims());
 
     // IF WE HAVE A MEAN VALUE COPUTE AB TRIM //
@@ -25,6 +25,7 @@
 #include "IBAnalyzerPoca.h"
 #include "IBPocaEvaluator.h"
 #include "IBVoxCollectionCap.h"
+#include "IBSparseVoxCollection.h"
 
 using namespace uLib;
 
@@ -55,7 +56,8 @@ public:
         } else return false;
     }
 
-    void SetVoxels(IBVoxCollection *voxels)
+    template < class VoxelsT >
+    void SetVoxels(VoxelsT *voxels)
     {
         for(int i=0; i<m_Data.size(); ++i) {
             Vector3i id = voxels->Find(m_Data[i]);
@@ -88,7 +90,10 @@ bool IBAnalyzerPoca::AddMuon(const MuonScatterData &event) {
 }
 
 void IBAnalyzerPoca::Run(unsigned int iterations, float muons_ratio) {
-    d->SetVoxels((IBVoxCollection *)this->GetVoxCollection());
+    if(this->GetSparseVoxCollection())
+        d->SetVoxels(this->GetSparseVoxCollection());
+    else
+        d->SetVoxels((IBVoxCollection *)this->GetVoxCollection());
 }
 
 void IBAnalyzerPoca::SetPocaAlgorithm(IBPocaEvaluator *poca)
@@ -18,6 +18,7 @@
 #include "IBVoxCollectionCap.h"
 #include "IBAnalyzerTrackCount.h"
 #include "IBVoxRaytracer.h"
+#include "IBMuonCollection.h"
 
 using namespace uLib;
 
@@ -35,9 +36,67 @@ public:
     IBAnalyzerTrackCountPimpl() :
         m_RayAlgorithm(NULL),
         m_PocaAlgorithm(NULL),
-        m_detSgnZ(0)
+        m_detSgnZ(0),
+        m_Streaming(false)
     {}
 
+    // ray through entry, poca and exit points, NULL poca for stopping muons.
+    // Uses only the stateless poca batch and the given tracer, one per
+    // thread, so it can run concurrently //
+    bool Trace(VoxRaytracer &tracer, const MuonScatterData &muon,
+               const StructuredGrid *voxels, IBVoxRaytracer::RayData &ray)
+    {
+        // ENTRY and EXIT point present
+        if( !std::isnan(muon.LineOut().origin().prod()) )
+        { // Get RayTrace RayData //
+            Vector4f entry_pt,
+                    poca,
+                    exit_pt;
+            if( !tracer.GetEntryPoint(muon.LineIn(),entry_pt) ||
+                    !tracer.GetExitPoint(muon.LineOut(),exit_pt) )
+                return false;
+
+            // 20170420 SV - select only one detector based on Z coordinate
+            if(m_detSgnZ  && entry_pt[2]*m_detSgnZ < 0)
+                return false;
+
+            bool test;
+            m_PocaAlgorithm->evaluate(&muon, 1, &poca, &test);
+            if(test && voxels->IsInsideBounds(poca)) {
+                ray = tracer.TraceBetweenPoints(entry_pt,poca);
+                ray.AppendRay( tracer.TraceBetweenPoints(poca,exit_pt) );
+            }
+            else {
+                ray = tracer.TraceBetweenPoints(entry_pt,exit_pt);
+            }
+        } else // Get RayTrace Data for stopping muon //
+            ray = tracer.TraceLine(muon.LineIn());
+        return true;
+    }
+
+    // streaming: trace in parallel and count straight into per thread grids
+    // merged in m_Value, no event is retained //
+    void Stream(IBMuonCollection *muons, const StructuredGrid *voxels)
+    {
+        const int nvox = voxels->GetDims().prod();
+        if((int)m_Value.size() != nvox) m_Value.assign(nvox, 0);
+        const int size = muons->size();
+
+        #pragma omp parallel
+        {
+            VoxRaytracer tracer(*m_RayAlgorithm);
+            Vector<Scalarf> value(nvox, 0);
+            #pragma omp for schedule(dynamic,256)
+            for(int i = 0; i < size; ++i) {
+                IBVoxRaytracer::RayData ray;
+                if(!Trace(tracer, muons->At(i), voxels, ray)) continue;
+                for(unsigned int j = 0; j < ray.Data().size(); ++j)
+                    value[ray.Data()[j].vox_id] += 1;
+            }
+            #pragma omp critical
+            for(int v = 0; v < nvox; ++v) m_Value[v] += value[v];
+        }
+    }
 
     void Project(Event *evc) {
         IBVoxel *vox;
@@ -53,6 +112,8 @@ public:
     IBPocaEvaluator *m_PocaAlgorithm;
     //20170420 select detector based on Z coordinate: -1, 1, 0 if not used
     int m_detSgnZ;
+    bool m_Streaming;
+    Vector<Scalarf> m_Value;
 };
 
 
@@ -68,42 +129,24 @@ IBAnalyzerTrackCount::~IBAnalyzerTrackCount()
 bool IBAnalyzerTrackCount::AddMuon(const MuonScatterData &muon)
 {
     if(!d->m_RayAlgorithm || !d->m_PocaAlgorithm) return false;
-    IBAnalyzerTrackCountPimpl::Event evc;
 
     IBVoxRaytracer::RayData ray;
-    // ENTRY and EXIT point present
-    if( !std::isnan(muon.LineOut().origin().prod()) )
-    { // Get RayTrace RayData //
-        Vector4f entry_pt,
-                poca,
-                exit_pt;
-        if( !d->m_RayAlgorithm->GetEntryPoint(muon.LineIn(),entry_pt) ||
-                !d->m_RayAlgorithm->GetExitPoint(muon.LineOut(),exit_pt) )
-            return false;
-
-        // 20170420 SV - select only one detector based on Z coordinate
-        if(d->m_detSgnZ  && entry_pt[2]*d->m_detSgnZ < 0)
-            return false;
-
-        bool test = d->m_PocaAlgorithm->evaluate(muon);
-        poca = d->m_PocaAlgorithm->getPoca();
-        if(test && this->GetVoxCollection()->IsInsideBounds(poca)) {
-            poca = d->m_PocaAlgorithm->getPoca();
-            ray = d->m_RayAlgorithm->TraceBetweenPoints(entry_pt,poca);
-            ray.AppendRay( d->m_RayAlgorithm->TraceBetweenPoints(poca,exit_pt) );
-        }
-        else {
-            ray = d->m_RayAlgorithm->TraceBetweenPoints(entry_pt,exit_pt);
-        }
-    } else // Get RayTrace Data for stopping muon //
-        ray = d->m_RayAlgorithm->TraceLine(muon.LineIn());
+    if(!d->Trace(*d->m_RayAlgorithm, muon, this->GetVoxelGrid(), ray)) return false;
+
+    if(d->m_Streaming) {
+        const int nvox = this->GetNumberOfVoxels();
+        if((int)d->m_Value.size() != nvox) d->m_Value.assign(nvox, 0);
+        for(unsigned int i=0; i<ray.Data().size(); ++i)
+            d->m_Value[ray.Data()[i].vox_id] += 1;
+        return true;
+    }
 
+    IBAnalyzerTrackCountPimpl::Event evc;
     IBAnalyzerTrackCountPimpl::Event::Element elc;
-    Scalarf T = ray.TotalLength();
     for(int i=0; i<ray.Data().size(); ++i)
     {
         const IBVoxRaytracer::RayData::Element *el = &ray.Data().at(i);
-        elc.voxel = &this->GetVoxCollection()->operator [](el->vox_id);
+        elc.voxel = this->GetVoxel(el->vox_id);
         evc.elements.push_back(elc);
     }
     d->m_Events.push_back(evc);
@@ -113,10 +156,17 @@ bool IBAnalyzerTrackCount::AddMuon(const MuonScatterData &muon)
 void IBAnalyzerTrackCount::SetMuonCollection(IBMuonCollection *muons)
 {
     uLibAssert(muons);
+    // a new collection restarts the counts, nothing is kept from before //
     d->m_Events.clear();
-    for(int i=0; i<muons->size(); ++i)
-    {
-        this->AddMuon(muons->At(i));
+    d->m_Value.clear();
+    if(d->m_Streaming && d->m_RayAlgorithm && d->m_PocaAlgorithm) {
+        d->Stream(muons, this->GetVoxelGrid());
+    }
+    else {
+        for(int i=0; i<muons->size(); ++i)
+        {
+            this->AddMuon(muons->At(i));
+        }
     }
     BaseClass::SetMuonCollection(muons);
 }
@@ -125,6 +175,13 @@ void IBAnalyzerTrackCount::SetMuonCollection(IBMuonCollection *muons)
 
 void IBAnalyzerTrackCount::Run(unsigned int iterations, float muons_ratio)
 {
+    if(d->m_Streaming) {
+        // only crossed voxels are touched, so sparse blocks stay empty //
+        const Id_t nvox = this->GetNumberOfVoxels();
+        for(Id_t i=0; i<(Id_t)d->m_Value.size() && i<nvox; ++i)
+            if(d->m_Value[i] != 0) this->GetVoxel(i)->Value += d->m_Value[i];
+        return;
+    }
     for(int i=0; i<d->m_Events.size(); ++i)
         d->Project(&d->m_Events[i]);
 }
@@ -144,9 +201,15 @@ void IBAnalyzerTrackCount::SetDetectorZSelection(int selectZ)
     d->m_detSgnZ = selectZ;
 }
 
+void IBAnalyzerTrackCount::SetStreaming(bool enable)
+{
+    d->m_Streaming = enable;
+}
+
 void IBAnalyzerTrackCount::Clear()
 {
     d->m_Events.clear();
+    d->m_Value.clear();
 }
 
 unsigned int IBAnalyzerTrackCount::Size() const
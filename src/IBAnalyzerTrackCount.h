@@ -45,6 +45,10 @@ public:
 
     void SetDetectorZSelection(int selectZ);
 
+    // streaming mode: SetMuonCollection traces in parallel accumulating into
+    // per thread grids, no events are kept. Run adds the counts to voxels.
+    void SetStreaming(bool enable = true);
+
     void Clear();
 
     unsigned int Size() const;
@@ -22,6 +22,7 @@
 #include "IBAnalyzerTrackLengths.h"
 #include "IBVoxRaytracer.h"
 #include "IBPocaEvaluator.h"
+#include "IBMuonCollection.h"
 
 using namespace uLib;
 
@@ -42,9 +43,80 @@ public:
     IBAnalyzerTrackLengthsPimpl() :
         m_RayAlgorithm(NULL),
         m_PocaAlgorithm(NULL),
-        m_detSgnZ(0)
+        m_detSgnZ(0),
+        m_Streaming(false)
     {}
 
+    // ray through entry, poca and exit points, uses only the stateless poca
+    // batch and the given tracer, one per thread, so it can run
+    // concurrently //
+    bool Trace(VoxRaytracer &tracer, const MuonScatterData &muon,
+               IBVoxCollection *voxels, IBVoxRaytracer::RayData &ray)
+    {
+        // ENTRY and EXIT point present
+        if( !std::isnan(muon.LineOut().origin().prod()) )
+        { // Get RayTrace RayData //
+            Vector4f entry_pt,poca,exit_pt;
+            if( !tracer.GetEntryPoint(muon.LineIn(),entry_pt) ||
+                    !tracer.GetExitPoint(muon.LineOut(),exit_pt) )
+                return false;
+
+            // 20170420 SV - select only one detector based on Z coordinate
+            if(m_detSgnZ  && entry_pt[2]*m_detSgnZ < 0)
+                return false;
+
+            bool test;
+            m_PocaAlgorithm->evaluate(&muon, 1, &poca, &test);
+            if(test && voxels->IsInsideBounds(poca)) {
+                ray = tracer.TraceBetweenPoints(entry_pt,poca);
+                ray.AppendRay( tracer.TraceBetweenPoints(poca,exit_pt) );
+            }
+            else {
+                ray = tracer.TraceBetweenPoints(entry_pt,exit_pt);
+            }
+        } else // Get RayTrace Data for stopping muon //
+            ray = tracer.TraceLine(muon.LineIn());
+        return true;
+    }
+
+    void InitGrid(int nvox) {
+        if((int)m_Value.size() != nvox) {
+            m_Value.assign(nvox, 0);
+            m_Count.assign(nvox, 0);
+        }
+    }
+
+    // streaming: trace in parallel and accumulate lengths straight into per
+    // thread grids merged in m_Value/m_Count, no event is retained //
+    void Stream(IBMuonCollection *muons, IBVoxCollection *voxels)
+    {
+        const int nvox = voxels->Data().size();
+        InitGrid(nvox);
+        const int size = muons->size();
+
+        #pragma omp parallel
+        {
+            VoxRaytracer tracer(*m_RayAlgorithm);
+            Vector<Scalarf> value(nvox, 0);
+            Vector<unsigned int> count(nvox, 0);
+            #pragma omp for schedule(dynamic,256)
+            for(int i = 0; i < size; ++i) {
+                IBVoxRaytracer::RayData ray;
+                if(!Trace(tracer, muons->At(i), voxels, ray)) continue;
+                for(unsigned int j = 0; j < ray.Data().size(); ++j) {
+                    const IBVoxRaytracer::RayData::Element &el = ray.Data()[j];
+                    value[el.vox_id] += el.L;
+                    count[el.vox_id]++;
+                }
+            }
+            #pragma omp critical
+            for(int v = 0; v < nvox; ++v) {
+                m_Value[v] += value[v];
+                m_Count[v] += count[v];
+            }
+        }
+    }
+
     void Project(Event *evc) {
         IBVoxel *vox;
         for (unsigned int j = 0; j < evc->elements.size(); ++j) {
@@ -60,6 +132,9 @@ public:
     IBPocaEvaluator *m_PocaAlgorithm;
     //20170420 select detector based on Z coordinate: -1, 1, 0 if not used
     int m_detSgnZ;
+    bool m_Streaming;
+    Vector<Scalarf> m_Value;
+    Vector<unsigned int> m_Count;
 };
 
 
@@ -77,34 +152,21 @@ IBAnalyzerTrackLengths::~IBAnalyzerTrackLengths()
 bool IBAnalyzerTrackLengths::AddMuon(const MuonScatterData &muon)
 {
     if(!d->m_RayAlgorithm || !d->m_PocaAlgorithm) return false;
-    IBAnalyzerTrackLengthsPimpl::Event evc;
 
     IBVoxRaytracer::RayData ray;
-    // ENTRY and EXIT point present
-    if( !std::isnan(muon.LineOut().origin().prod()) )
-    { // Get RayTrace RayData //
-        Vector4f entry_pt,poca,exit_pt;
-        if( !d->m_RayAlgorithm->GetEntryPoint(muon.LineIn(),entry_pt) ||
-                !d->m_RayAlgorithm->GetExitPoint(muon.LineOut(),exit_pt) )
-            return false;
-
-        // 20170420 SV - select only one detector based on Z coordinate
-        if(d->m_detSgnZ  && entry_pt[2]*d->m_detSgnZ < 0)
-            return false;
-
-        bool test = d->m_PocaAlgorithm->evaluate(muon);
-        poca = d->m_PocaAlgorithm->getPoca();
-        if(test && this->GetVoxCollection()->IsInsideBounds(poca)) {
-            poca = d->m_PocaAlgorithm->getPoca();
-            ray = d->m_RayAlgorithm->TraceBetweenPoints(entry_pt,poca);
-            ray.AppendRay( d->m_RayAlgorithm->TraceBetweenPoints(poca,exit_pt) );
+    if(!d->Trace(*d->m_RayAlgorithm, muon, this->GetVoxCollection(), ray)) return false;
+
+    if(d->m_Streaming) {
+        d->InitGrid(this->GetVoxCollection()->Data().size());
+        for(unsigned int i=0; i<ray.Data().size(); ++i) {
+            const IBVoxRaytracer::RayData::Element &el = ray.Data()[i];
+            d->m_Value[el.vox_id] += el.L;
+            d->m_Count[el.vox_id]++;
         }
-        else {
-            ray = d->m_RayAlgorithm->TraceBetweenPoints(entry_pt,exit_pt);
-        }
-    } else // Get RayTrace Data for stopping muon //
-        ray = d->m_RayAlgorithm->TraceLine(muon.LineIn());
+        return true;
+    }
 
+    IBAnalyzerTrackLengthsPimpl::Event evc;
     IBAnalyzerTrackLengthsPimpl::Event::Element elc;
     Scalarf T = ray.TotalLength();
     for(int i=0; i<ray.Data().size(); ++i)
@@ -133,16 +195,32 @@ bool IBAnalyzerTrackLengths::AddMuon(const MuonScatterData &muon)
 void IBAnalyzerTrackLengths::SetMuonCollection(IBMuonCollection *muons)
 {
     uLibAssert(muons);
+    // a new collection restarts the lengths, nothing is kept from before //
     d->m_Events.clear();
-    for(int i=0; i<muons->size(); ++i)
-    {
-        this->AddMuon(muons->At(i));
+    d->m_Value.clear();
+    d->m_Count.clear();
+    if(d->m_Streaming && d->m_RayAlgorithm && d->m_PocaAlgorithm) {
+        d->Stream(muons, this->GetVoxCollection());
+    }
+    else {
+        for(int i=0; i<muons->size(); ++i)
+        {
+            this->AddMuon(muons->At(i));
+        }
     }
     BaseClass::SetMuonCollection(muons);
 }
 
 void IBAnalyzerTrackLengths::Run(unsigned int iterations, float muons_ratio)
 {
+    if(d->m_Streaming) {
+        Vector<IBVoxel> &voxels = this->GetVoxCollection()->Data();
+        for(unsigned int i=0; i<d->m_Value.size() && i<voxels.size(); ++i) {
+            voxels[i].Value += d->m_Value[i];
+            voxels[i].Count += d->m_Count[i];
+        }
+        return;
+    }
     for(int i=0; i<d->m_Events.size(); ++i)
         d->Project(&d->m_Events[i]);
 }
@@ -161,3 +239,8 @@ void IBAnalyzerTrackLengths::SetDetectorZSelection(int selectZ)
 {
     d->m_detSgnZ = selectZ;
 }
+
+void IBAnalyzerTrackLengths::SetStreaming(bool enable)
+{
+    d->m_Streaming = enable;
+}
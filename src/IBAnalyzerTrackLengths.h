@@ -47,6 +47,11 @@ public:
 
     void SetDetectorZSelection(int selectZ);
 
+    // streaming mode: SetMuonCollection traces in parallel accumulating the
+    // lengths into per thread grids, no events are kept. Run adds them to
+    // voxels.
+    void SetStreaming(bool enable = true);
+
 private:
     class IBAnalyzerTrackLengthsPimpl *d;
 };
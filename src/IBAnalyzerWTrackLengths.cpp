@@ -23,6 +23,7 @@
 #include "IBAnalyzerWTrackLengths.h"
 #include "IBVoxRaytracer.h"
 #include "IBPocaEvaluator.h"
+#include "IBMuonCollection.h"
 
 using namespace uLib;
 
@@ -32,53 +33,167 @@ using namespace uLib;
 
 class IBAnalyzerWTrackLengthsPimpl {
 public:
-    struct Event {
-        struct Element {
-            Matrix4f Wij;
-            IBVoxel *voxel;
-        };
-        Vector4f PoCa;
-        Vector4f Variables;
-        Scalarf  Length;
-        Scalarf  Momentum;
-        Vector<Element> elements;
-    };
-
     IBAnalyzerWTrackLengthsPimpl(IBAnalyzerWTrackLengths *parent) :
         m_RayAlgorithm(NULL),
         m_PocaAlgorithm(NULL),
         m_VarAlgorithm(NULL),
-        m_poca_proximity_rms(0)
+        m_poca_proximity_rms(0),
+        m_Streaming(false)
     {}
 
-    void Project(Event *evc) {
-        IBVoxel *vox;
-        for (unsigned int j = 0; j < evc->elements.size(); ++j) {
-            vox = evc->elements[j].voxel;
-            float a;
-            if(m_VarAlgorithm)
-                a = ( pow(fabs(evc->Variables(0)),2) + pow(fabs(evc->Variables(2)),2)  ) *
-                        evc->elements[j].Wij(0,0) * pow(evc->Momentum,2) * 1.5E-6 / evc->Length;
-            else
-                a = evc->Variables(0) * pow(evc->Momentum,2) * 1.5E-6 * evc->elements[j].Wij(0,0) / evc->Length;
+    Vector4f Variables(const MuonScatterData &muon) {
+        if(likely(m_VarAlgorithm && m_VarAlgorithm->evaluate(muon)))
+            return m_VarAlgorithm->getDataVector();
+        return ScatteringVariables(muon);
+    }
+
+    // stateless batch of Variables, up to VariablesBlock muons //
+    enum { VariablesBlock = 256 };
+    void Variables(const MuonScatterData *muons, int size, Vector4f *variables) const {
+        bool valid[VariablesBlock];
+        for(int i = 0; i < size; ++i) valid[i] = false;
+        if(m_VarAlgorithm)
+            m_VarAlgorithm->evaluate(muons, size, variables, NULL, valid);
+        for(int i = 0; i < size; ++i)
+            if(!valid[i]) variables[i] = ScatteringVariables(muons[i]);
+    }
+
+    // squared scattering angle only, when minimization variables are missing //
+    static Vector4f ScatteringVariables(const MuonScatterData &muon) {
+        Vector4f variables = Vector4f::Zero();
+        Vector3f in, out;
+        in  = muon.LineIn().direction().head(3);
+        out = muon.LineOut().direction().head(3);
+        float a = in.transpose() * out;
+        a = acos(a / (in.norm() * out.norm()) );
+        if(uLib::isFinite(a)) variables(0) = pow(a,2);
+        return variables;
+    }
+
+    // ray through entry, poca and exit points, uses only the stateless poca
+    // batch and the given tracer, one per thread, so it can run
+    // concurrently //
+    bool Trace(VoxRaytracer &tracer, const MuonScatterData &muon,
+               IBVoxCollection *voxels, IBVoxRaytracer::RayData &ray)
+    {
+        Vector4f entry_pt,poca,exit_pt;
+        if( !tracer.GetEntryPoint(muon.LineIn(),entry_pt) ||
+                !tracer.GetExitPoint(muon.LineOut(),exit_pt) )
+            return false;
+        bool test;
+        m_PocaAlgorithm->evaluate(&muon, 1, &poca, &test);
+        if(test && voxels->IsInsideBounds(poca)) {
+            ray = tracer.TraceBetweenPoints(entry_pt,poca);
+            ray.AppendRay( tracer.TraceBetweenPoints(poca,exit_pt) );
+        }
+        else {
+            ray = tracer.TraceBetweenPoints(entry_pt,exit_pt);
+        }
+        return true;
+    }
+
+    // weighted lengths of the ray added to value/count, only the L term of
+    // the Wij block is needed //
+    template < typename ValueT, typename CountT >
+    void Project(const IBVoxRaytracer::RayData &ray, const Vector4f &variables,
+                 Scalarf momentum, ValueT &value, CountT &count) {
+        Scalarf length = ray.TotalLength();
+        Scalarf k;
+        if(m_VarAlgorithm)
+            k = ( pow(fabs(variables(0)),2) + pow(fabs(variables(2)),2) ) *
+                    pow(momentum,2) * 1.5E-6 / length;
+        else
+            k = variables(0) * pow(momentum,2) * 1.5E-6 / length;
+        for (unsigned int j = 0; j < ray.Data().size(); ++j) {
+            const IBVoxRaytracer::RayData::Element &el = ray.Data()[j];
+            float a = k * el.L;
             // FINIRE //
             //  if(m_poca_proximity_rms > 0) {
             //    float d = 1/sqrt(2*M_PI)/fabs(m_poca_proximity_rms) ;// ...
             //  }
             if(a<1E-6) {
-                vox->Value += a;
-                vox->Count++;
+                value(el.vox_id) += a;
+                count(el.vox_id)++;
             }
         }
     }
 
+    // streaming: variables are evaluated per chunk with the batch evaluator,
+    // rays are traced in parallel into per thread grids merged in m_Value and
+    // m_Count, that are restarted at each call and added to voxels by Run //
+    void Stream(IBMuonCollection *muons, IBVoxCollection *voxels)
+    {
+        static const int chunk = 16384;
+        const int nvox = voxels->Data().size();
+        const int size = muons->size();
+        m_Value.assign(nvox, 0);
+        m_Count.assign(nvox, 0);
+        // selected muons are gathered per chunk, both passes read the copy //
+        Vector<MuonScatterData> buffer(std::min(chunk, size));
+        Vector<Vector4f> variables(std::min(chunk, size));
+
+        #pragma omp parallel
+        {
+            VoxRaytracer tracer(*m_RayAlgorithm);
+            Vector<Scalarf> value(nvox, 0);
+            Vector<unsigned int> count(nvox, 0);
+            GridRef<Scalarf> v(value);
+            GridRef<unsigned int> c(count);
+            for(int start = 0; start < size; start += chunk) {
+                int len = std::min(chunk, size - start);
+                #pragma omp for schedule(static)
+                for(int i = 0; i < len; ++i)
+                    buffer[i] = muons->At(start + i);
+
+                #pragma omp for schedule(dynamic)
+                for(int i = 0; i < len; i += VariablesBlock)
+                    Variables(&buffer[i],
+                              std::min<int>(VariablesBlock, len - i), &variables[i]);
+
+                #pragma omp for schedule(dynamic,256)
+                for(int i = 0; i < len; ++i) {
+                    const MuonScatterData &muon = buffer[i];
+                    IBVoxRaytracer::RayData ray;
+                    if(!Trace(tracer, muon, voxels, ray)) continue;
+                    Project(ray, variables[i], muon.GetMomentum(), v, c);
+                }
+            }
+            #pragma omp critical
+            for(int id = 0; id < nvox; ++id) {
+                m_Value[id] += value[id];
+                m_Count[id] += count[id];
+            }
+        }
+    }
+
+    template < typename T >
+    struct GridRef {
+        GridRef(Vector<T> &grid) : m_grid(grid) {}
+        T &operator()(Id_t id) { return m_grid[id]; }
+        Vector<T> &m_grid;
+    };
+
+    struct VoxValueRef {
+        VoxValueRef(IBVoxCollection *voxels) : m_voxels(voxels) {}
+        Scalarf &operator()(Id_t id) { return m_voxels->Data()[id].Value; }
+        IBVoxCollection *m_voxels;
+    };
+
+    struct VoxCountRef {
+        VoxCountRef(IBVoxCollection *voxels) : m_voxels(voxels) {}
+        unsigned int &operator()(Id_t id) { return m_voxels->Data()[id].Count; }
+        IBVoxCollection *m_voxels;
+    };
+
     // members //
     IBAnalyzerWTrackLengths *p;
-    Vector<Event> m_Events;
     VoxRaytracer *m_RayAlgorithm;
     IBPocaEvaluator *m_PocaAlgorithm;
     IBMinimizationVariablesEvaluator *m_VarAlgorithm;
     Scalarf m_poca_proximity_rms;
+    bool m_Streaming;
+    Vector<Scalarf> m_Value;
+    Vector<unsigned int> m_Count;
 };
 
 
@@ -100,70 +215,40 @@ bool IBAnalyzerWTrackLengths::AddMuon(const MuonScatterData &muon)
         return false;
     }
 
-    IBAnalyzerWTrackLengthsPimpl::Event evc;
-
-    evc.Momentum = muon.GetMomentum();
-
-    // VARIABLES //    
-    if(likely(d->m_VarAlgorithm && d->m_VarAlgorithm->evaluate(muon))) {
-        evc.Variables = d->m_VarAlgorithm->getDataVector();
-    }
-    else {
-        Vector3f in, out;
-        in  = muon.LineIn().direction().head(3);
-        out = muon.LineOut().direction().head(3);
-        float a = in.transpose() * out;
-        a = acos(a / (in.norm() * out.norm()) );
-        if(uLib::isFinite(a)) evc.Variables(0) = pow(a,2);
-        else evc.Variables(0) = 0;
-    }
+    // VARIABLES //
+    Vector4f variables = d->Variables(muon);
 
     // RAY //
     IBVoxRaytracer::RayData ray;
-    { // Get RayTrace RayData //
-        Vector4f entry_pt,poca,exit_pt;
-        if( !d->m_RayAlgorithm->GetEntryPoint(muon.LineIn(),entry_pt) ||
-                !d->m_RayAlgorithm->GetExitPoint(muon.LineOut(),exit_pt) )
-            return false;
-        bool test = d->m_PocaAlgorithm->evaluate(muon);
-        poca = d->m_PocaAlgorithm->getPoca();
-        if(test && this->GetVoxCollection()->IsInsideBounds(poca)) {
-            poca = d->m_PocaAlgorithm->getPoca();
-            ray = d->m_RayAlgorithm->TraceBetweenPoints(entry_pt,poca);
-            ray.AppendRay( d->m_RayAlgorithm->TraceBetweenPoints(poca,exit_pt) );
-        }
-        else {
-            ray = d->m_RayAlgorithm->TraceBetweenPoints(entry_pt,exit_pt);
-        }
-    }
+    if(!d->Trace(*d->m_RayAlgorithm, muon, this->GetVoxCollection(), ray))
+        return false;
 
     // LENGTHS //
-    IBAnalyzerWTrackLengthsPimpl::Event::Element elc;
-    Scalarf T = ray.TotalLength();
-    evc.Length = T;
-    for(int i=0; i<ray.Data().size(); ++i)
-    {
-        const IBVoxRaytracer::RayData::Element *el = &ray.Data().at(i);
-        elc.voxel = &this->GetVoxCollection()->operator [](el->vox_id);
-        Scalarf L = el->L;
-        T -= L;
-
-        Matrix2f wij_block;
-        wij_block << L ,          L*L/2 + L*T,
-                     L*L/2 + L*T, L*L*L/3 + L*L*T + L*T*T;
-        elc.Wij = Matrix4f::Zero();
-        elc.Wij.block<2,2>(0,0) = wij_block;
-        elc.Wij.block<2,2>(2,2) = wij_block;
-
-        evc.elements.push_back(elc);
-    }
-//    d->m_Events.push_back(evc);
-    d->Project(&evc);
+    IBAnalyzerWTrackLengthsPimpl::VoxValueRef value(this->GetVoxCollection());
+    IBAnalyzerWTrackLengthsPimpl::VoxCountRef count(this->GetVoxCollection());
+    d->Project(ray, variables, muon.GetMomentum(), value, count);
     return true;
 }
 
+void IBAnalyzerWTrackLengths::SetMuonCollection(IBMuonCollection *muons)
+{
+    uLibAssert(muons);
+    // in non streaming mode muons are still projected by AddMuon //
+    if(d->m_Streaming && d->m_RayAlgorithm && d->m_PocaAlgorithm)
+        d->Stream(muons, this->GetVoxCollection());
+    BaseClass::SetMuonCollection(muons);
+}
+
 void IBAnalyzerWTrackLengths::Run(unsigned int iterations, float muons_ratio)
 {
+    if(d->m_Streaming) {
+        Vector<IBVoxel> &voxels = this->GetVoxCollection()->Data();
+        for(unsigned int i=0; i<d->m_Value.size() && i<voxels.size(); ++i) {
+            voxels[i].Value += d->m_Value[i];
+            voxels[i].Count += d->m_Count[i];
+        }
+        return;
+    }
     std::cerr << "WARNING: Run function does nothing ... as the projection is "
                  "made inside AddMuon funcion (without accounting events).";
     //    for(int i=0; i<d->m_Events.size(); ++i)
@@ -185,6 +270,11 @@ void IBAnalyzerWTrackLengths::SetVarAlgorithm(IBMinimizationVariablesEvaluator *
     d->m_VarAlgorithm = algorithm;
 }
 
+void IBAnalyzerWTrackLengths::SetStreaming(bool enable)
+{
+    d->m_Streaming = enable;
+}
+
 void IBAnalyzerWTrackLengths::SetPocaProximity(float sigma)
 {
     // FINIRE //
@@ -48,6 +48,12 @@ public:
 
     void SetPocaProximity(float sigma = 0); // TODO: //
 
+    void SetMuonCollection(IBMuonCollection *muons);
+
+    // streaming mode: SetMuonCollection projects the whole collection,
+    // tracing in parallel into per thread grids, Run adds them to voxels //
+    void SetStreaming(bool enable = true);
+
 private:
     class IBAnalyzerWTrackLengthsPimpl *d;
 };
@@ -0,0 +1,215 @@
+/*////////////////////////////////////////////////////////////////////////////
+ Copyright 2018 Istituto Nazionale di Fisica Nucleare
+
+ Licensed under the EUPL, Version 1.2 or - as soon they will be approved by
+ the European Commission - subsequent versions of the EUPL (the "Licence").
+ You may not use this work except in compliance with the Licence.
+
+ You may obtain a copy of the Licence at:
+
+ https://joinup.ec.europa.eu/software/page/eupl
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the Licence is distributed on an "AS IS" basis, WITHOUT
+ WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ Licence for the specific language governing permissions and limitations under
+ the Licence.
+////////////////////////////////////////////////////////////////////////////*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <iostream>
+#include <thread>
+
+#include "IBColumnExport.h"
+
+
+////////////////////////////////////////////////////////////////////////////////
+/////  PIMPL  //////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+class IBColumnExportPimpl {
+public:
+    IBColumnExportPimpl() :
+        m_File(NULL),
+        m_Format(IBColumnExport::Binary),
+        m_Columns(0),
+        m_Failed(false),
+        m_Thread(NULL)
+    {}
+
+    bool Write(const void *data, size_t size)
+    {
+        if (size && fwrite(data, 1, size, m_File) != size) m_Failed = true;
+        return !m_Failed;
+    }
+
+    // runs on the background thread //
+    void WriteBlock()
+    {
+        const size_t rows = m_Back.empty() ? 0 : m_Back[0].size();
+        if (!rows) return;
+        if (m_Format == IBColumnExport::Binary) {
+            uint64_t n = rows;
+            Write(&n, sizeof(n));
+            for (unsigned int c = 0; c < m_Back.size(); ++c)
+                Write(&m_Back[c][0], rows * sizeof(float));
+        }
+        else
+            WriteText(rows);
+    }
+
+    // rows are formatted on this thread into the stdio buffer //
+    void WriteText(size_t rows)
+    {
+        const unsigned int ncols = m_Back.size();
+        for (size_t i = 0; i < rows && !m_Failed; ++i) {
+            for (unsigned int c = 0; c < ncols; ++c) {
+                const char sep = (c + 1 < ncols) ? ' ' : '\n';
+                int n;
+                if (m_Types[c] == IBColumnExport::UInt32)
+                    n = fprintf(m_File, "%u%c",
+                                IBColumnExport::ToUInt(m_Back[c][i]), sep);
+                else
+                    n = fprintf(m_File, "%g%c", m_Back[c][i], sep);
+                if (n < 0) m_Failed = true;
+            }
+        }
+    }
+
+    void Wait()
+    {
+        if (!m_Thread) return;
+        m_Thread->join();
+        delete m_Thread;
+        m_Thread = NULL;
+    }
+
+    FILE                    *m_File;
+    IBColumnExport::Format   m_Format;
+    unsigned int             m_Columns;
+    bool                     m_Failed;
+    std::vector<IBColumnExport::Type> m_Types;
+    IBColumnExport::Block    m_Back;
+    std::thread             *m_Thread;
+};
+
+
+////////////////////////////////////////////////////////////////////////////////
+/////  EXPORT  /////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+IBColumnExport::IBColumnExport() :
+    d(new IBColumnExportPimpl)
+{}
+
+IBColumnExport::~IBColumnExport()
+{
+    this->Close();
+    delete d;
+}
+
+bool IBColumnExport::Open(const char *filename,
+                          const std::vector<std::string> &names, Format format,
+                          const std::vector<Type> &types)
+{
+    this->Close();
+    if (!types.empty() && types.size() != names.size()) {
+        std::cerr << "IBColumnExport: " << types.size() << " column types for "
+                  << names.size() << " columns\n";
+        return false;
+    }
+    d->m_File = fopen(filename, format == Binary ? "wb" : "w");
+    if (!d->m_File) {
+        std::cerr << "IBColumnExport: cannot open " << filename << "\n";
+        return false;
+    }
+    setvbuf(d->m_File, NULL, _IOFBF, 1 << 22);
+    d->m_Format = format;
+    d->m_Columns = names.size();
+    d->m_Failed = false;
+    if (types.empty()) d->m_Types.assign(names.size(), Float32);
+    else d->m_Types = types;
+
+    if (format == Binary) {
+        uint32_t n = names.size();
+        d->Write("IBCOL002", 8);
+        d->Write(&n, sizeof(n));
+        for (unsigned int c = 0; c < names.size(); ++c)
+            d->Write(names[c].c_str(), names[c].size() + 1);
+        for (unsigned int c = 0; c < names.size(); ++c) {
+            uint8_t t = d->m_Types[c];
+            d->Write(&t, sizeof(t));
+        }
+    }
+    else {
+        std::string header("#");
+        for (unsigned int c = 0; c < names.size(); ++c)
+            header += " " + names[c];
+        header += "\n";
+        d->Write(header.data(), header.size());
+    }
+    return !d->m_Failed;
+}
+
+bool IBColumnExport::IsOpen() const
+{
+    return d->m_File != NULL;
+}
+
+unsigned int IBColumnExport::GetNumberOfColumns() const
+{
+    return d->m_File ? d->m_Columns : 0;
+}
+
+IBColumnExport::Type IBColumnExport::GetColumnType(unsigned int column) const
+{
+    return column < this->GetNumberOfColumns() ? d->m_Types[column] : Float32;
+}
+
+void IBColumnExport::Allocate(Block &block, size_t rows) const
+{
+    block.resize(this->GetNumberOfColumns());
+    for (unsigned int c = 0; c < block.size(); ++c)
+        block[c].resize(rows);
+}
+
+bool IBColumnExport::Push(Block &block)
+{
+    if (!d->m_File) return false;
+    if (block.size() != d->m_Columns) {
+        std::cerr << "IBColumnExport: block of " << block.size()
+                  << " columns, expected " << d->m_Columns << "\n";
+        return false;
+    }
+    for (unsigned int c = 1; c < block.size(); ++c)
+        if (block[c].size() != block[0].size()) {
+            std::cerr << "IBColumnExport: columns of different size\n";
+            return false;
+        }
+
+    d->Wait();
+    if (d->m_Failed) {
+        std::cerr << "IBColumnExport: write error\n";
+        return false;
+    }
+    d->m_Back.swap(block);
+    d->m_Thread = new std::thread(&IBColumnExportPimpl::WriteBlock, d);
+    return true;
+}
+
+bool IBColumnExport::Close()
+{
+    if (!d->m_File) return true;
+    d->Wait();
+    if (d->m_Format == Binary) {
+        uint64_t end = 0;
+        d->Write(&end, sizeof(end));
+    }
+    if (fclose(d->m_File) != 0) d->m_Failed = true;
+    d->m_File = NULL;
+    d->m_Back.clear();
+    if (d->m_Failed) std::cerr << "IBColumnExport: write error\n";
+    return !d->m_Failed;
+}
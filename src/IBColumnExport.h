@@ -0,0 +1,98 @@
+/*////////////////////////////////////////////////////////////////////////////
+ Copyright 2018 Istituto Nazionale di Fisica Nucleare
+
+ Licensed under the EUPL, Version 1.2 or - as soon they will be approved by
+ the European Commission - subsequent versions of the EUPL (the "Licence").
+ You may not use this work except in compliance with the Licence.
+
+ You may obtain a copy of the Licence at:
+
+ https://joinup.ec.europa.eu/software/page/eupl
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the Licence is distributed on an "AS IS" basis, WITHOUT
+ WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ Licence for the specific language governing permissions and limitations under
+ the Licence.
+////////////////////////////////////////////////////////////////////////////*/
+
+#ifndef IBCOLUMNEXPORT_H
+#define IBCOLUMNEXPORT_H
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include <Core/Vector.h>
+
+using namespace uLib;
+
+
+// Buffered columnar export of float tables. The caller fills a block of
+// columns, typically in parallel, and pushes it; the block is written on a
+// background thread while the next one is filled, so dumps can run between
+// EM iterations without waiting for the disk. Push only waits for the
+// previous block.
+//
+// Counters and indices lose precision as float32 above 2^24, so columns
+// can be declared UInt32: their slots hold the bit pattern of a uint32,
+// set with UInt() and read back with ToUInt().
+//
+// Binary layout, native endian:
+//
+//   "IBCOL002"  uint32 columns  column names, each '\0' terminated
+//               uint8 type per column (0 float32, 1 uint32)
+//   blocks:     uint64 rows  then each column as rows 4 byte values
+//   end:        uint64 0
+//
+// Text writes a "# name ..." line and then the rows, "%g" or "%u"
+// separated by spaces. The background thread formats them serially, so
+// it does not start an OpenMP team next to the caller's.
+
+class IBColumnExport {
+public:
+    enum Format { Binary = 0, Text };
+    enum Type { Float32 = 0, UInt32 };
+
+    // one Vector per column, all of the same size //
+    typedef Vector< Vector<float> > Block;
+
+    IBColumnExport();
+    ~IBColumnExport();
+
+    // types, if given, has one entry per name; columns are Float32 otherwise //
+    bool Open(const char *filename, const std::vector<std::string> &names,
+              Format format = Binary,
+              const std::vector<Type> &types = std::vector<Type>());
+    bool IsOpen() const;
+    unsigned int GetNumberOfColumns() const;
+    Type GetColumnType(unsigned int column) const;
+
+    // sizes block to all the columns of rows rows //
+    void Allocate(Block &block, size_t rows) const;
+
+    // takes the block over, block is left with spare columns to refill;
+    // false on a wrong block or if a previous write failed //
+    bool Push(Block &block);
+
+    // waits for the pending write and closes, false if any write failed //
+    bool Close();
+
+    // slot value of a UInt32 column //
+    static inline float UInt(uint32_t value) {
+        float slot;
+        memcpy(&slot, &value, sizeof(slot));
+        return slot;
+    }
+    static inline uint32_t ToUInt(float slot) {
+        uint32_t value;
+        memcpy(&value, &slot, sizeof(value));
+        return value;
+    }
+
+private:
+    class IBColumnExportPimpl *d;
+};
+
+#endif // IBCOLUMNEXPORT_H
@@ -18,7 +18,104 @@
 
 
 #include "IBLineDistancePocaEvaluator.h"
+#include <Core/Vector.h>
 #include <iostream>
+#include <cfloat>
+#include <cmath>
+#include <algorithm>
+
+////////////////////////////////////////////////////////////////////////////////
+////// SOA KERNEL //////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+// muons are processed in blocks transposed to structure of arrays so that
+// the inner loops carry no branches and vectorize across muons //
+static const int PocaBlockSize = 16;
+
+struct PocaBlock {
+    Scalarf px[PocaBlockSize], py[PocaBlockSize], pz[PocaBlockSize];
+    Scalarf qx[PocaBlockSize], qy[PocaBlockSize], qz[PocaBlockSize];
+    Scalarf vx[PocaBlockSize], vy[PocaBlockSize], vz[PocaBlockSize];
+    Scalarf wx[PocaBlockSize], wy[PocaBlockSize], wz[PocaBlockSize];
+    // results //
+    Scalarf ix[PocaBlockSize], iy[PocaBlockSize], iz[PocaBlockSize];
+    Scalarf ox[PocaBlockSize], oy[PocaBlockSize], oz[PocaBlockSize];
+    Scalarf dist[PocaBlockSize];
+    int     valid[PocaBlockSize];
+
+    void load(const HLine3f *line_in, const HLine3f *line_out, int n)
+    {
+        for (int i = 0; i < n; ++i) {
+            const Vector4f &p = line_in[i].origin();
+            const Vector4f &v = line_in[i].direction();
+            const Vector4f &q = line_out[i].origin();
+            const Vector4f &w = line_out[i].direction();
+            px[i] = p(0); py[i] = p(1); pz[i] = p(2);
+            vx[i] = v(0); vy[i] = v(1); vz[i] = v(2);
+            qx[i] = q(0); qy[i] = q(1); qz[i] = q(2);
+            wx[i] = w(0); wy[i] = w(1); wz[i] = w(2);
+        }
+    }
+
+    void load(const MuonScatterData *muons, int n)
+    {
+        for (int i = 0; i < n; ++i) {
+            const Vector4f &p = muons[i].LineIn().origin();
+            const Vector4f &v = muons[i].LineIn().direction();
+            const Vector4f &q = muons[i].LineOut().origin();
+            const Vector4f &w = muons[i].LineOut().direction();
+            px[i] = p(0); py[i] = p(1); pz[i] = p(2);
+            vx[i] = v(0); vy[i] = v(1); vz[i] = v(2);
+            qx[i] = q(0); qy[i] = q(1); qz[i] = q(2);
+            wx[i] = w(0); wy[i] = w(1); wz[i] = w(2);
+        }
+    }
+
+    void compute(int n, Scalarf cutlength)
+    {
+        #pragma omp simd
+        for (int i = 0; i < n; ++i) {
+            // director cosines //
+            Scalarf nv = 1.f / std::sqrt(vx[i]*vx[i] + vy[i]*vy[i] + vz[i]*vz[i]);
+            Scalarf nw = 1.f / std::sqrt(wx[i]*wx[i] + wy[i]*wy[i] + wz[i]*wz[i]);
+            Scalarf v0 = vx[i]*nv, v1 = vy[i]*nv, v2 = vz[i]*nv;
+            Scalarf w0 = wx[i]*nw, w1 = wy[i]*nw, w2 = wz[i]*nw;
+            Scalarf d0 = qx[i]-px[i], d1 = qy[i]-py[i], d2 = qz[i]-pz[i];
+
+            Scalarf prod = v0*w0 + v1*w1 + v2*w2;
+            Scalarf den  = 1.f / (1.f - prod*prod);
+            Scalarf dv   = d0*v0 + d1*v1 + d2*v2;
+            Scalarf dw   = d0*w0 + d1*w1 + d2*w2;
+            Scalarf lambda = den * (dv - prod*dw);
+            Scalarf mu     = den * (prod*dv - dw);
+
+            ix[i] = px[i] + v0*lambda;
+            iy[i] = py[i] + v1*lambda;
+            iz[i] = pz[i] + v2*lambda;
+            ox[i] = qx[i] + w0*mu;
+            oy[i] = qy[i] + w1*mu;
+            oz[i] = qz[i] + w2*mu;
+            Scalarf s0 = ox[i]-ix[i], s1 = oy[i]-iy[i], s2 = oz[i]-iz[i];
+            Scalarf seg = std::sqrt(s0*s0 + s1*s1 + s2*s2);
+
+            // parallel tracks: distance of out origin from the in line //
+            Scalarf c0 = v1*d2 - v2*d1, c1 = v2*d0 - v0*d2, c2 = v0*d1 - v1*d0;
+            Scalarf par = std::sqrt(c0*c0 + c1*c1 + c2*c2);
+
+            bool finite = std::fabs(den) <= FLT_MAX;
+            bool cut    = cutlength != 0.f && seg > cutlength;
+            dist[i]  = finite ? (cut ? NAN : seg) : par;
+            valid[i] = finite && !cut;
+        }
+    }
+};
+
+} // namespace
+
+
+
 
 class IBLineDistancePocaEvaluatorPimpl
 {
@@ -29,75 +126,14 @@ public:
         m_cutlength = 0.f;
         m_dist = NAN;
         m_poca << 0,0,0,1;
-    }
-
-    void evaluatePoCA()
-    {
-        m_dist = NAN;
-
-        Vector4f p    = m_muon.LineIn().origin();
-        Vector4f q    = m_muon.LineOut().origin();
-        Vector4f v    = getDirectorCosines(m_muon.LineIn().direction());
-        Vector4f w    = getDirectorCosines(m_muon.LineOut().direction());
-        Vector4f diff = q - p;
-        Scalarf  prod = v.transpose() * w;
-        Scalarf  den  = 1./(1. - prod*prod);
-        if (unlikely(!isFinite(den))) {
-            // ATTENTION it always returns m_integrity false... to be FIXED
-//            if (m_cutlength==0) {
-//                m_integrity = false;
-//                return;
-//            } else {
-                float pr = diff.dot(v);
-                Vector3f proj = (v * pr).head(3);
-                Vector3f dist = diff.head(3);
-                dist = proj.cross(dist);
-                dist /= pr;
-                m_dist = dist.head(3).norm();
-                if (unlikely(m_cutlength != 0.f && dist.head(3).norm()>m_cutlength)) {
-		    m_integrity = false;
-                    return;
-                }
-//                std::cout << "ATTENTION from evaluatePoca : infinite den, prod " << prod
-//                          << ", angles " << v << ", " << w
-//                          << ", dist " << m_dist << std::endl;
-
-		// std::cout << "The following event fails" << std::endl;
-		// std::cout << "Point " << p << std::endl;
-		// std::cout << "to point " << q << std::endl;
-		// std::cout << "with directions " << v << std::endl;
-		// std::cout << "and " << w << std::endl;
-		// std::cout << "Giving a product of " << prod << std::endl;
-                m_integrity = false;
-				  
-            //}
-        }
-        else {
-            Scalarf lambda = (diff.transpose()*(v*den-(w*prod*den)));
-            Scalarf mu     = (diff.transpose()*((v*prod)*den-w*den));
-            m_inPoca       = p + v*lambda;
-            m_outPoca      = q + w*mu;
-            Vector4f mdseg = (m_outPoca-m_inPoca);
-            if (unlikely(m_cutlength != 0.f && mdseg.head(3).norm() > m_cutlength)) {
-                m_integrity = false;
-                return;
-            }
-            m_dist = mdseg.head(3).norm();
-            m_poca = m_inPoca + (mdseg*0.5);
-            m_integrity   = true;
-        }
-    }
-
-    Vector4f getDirectorCosines(const Vector4f &track_direction)
-    {
-        return track_direction / track_direction.head(3).norm();
+        m_inPoca << 0,0,0,1;
+        m_outPoca << 0,0,0,1;
     }
 
 public:
     bool m_integrity;
     Scalarf m_cutlength;
     Scalarf m_dist;
-    MuonScatterData m_muon;
     Vector4f m_poca;
     Vector4f m_inPoca;
     Vector4f m_outPoca;
@@ -116,10 +152,68 @@ IBLineDistancePocaEvaluator::~IBLineDistancePocaEvaluator()
 
 bool IBLineDistancePocaEvaluator::evaluate(MuonScatterData muon)
 {
-    d->m_muon = muon;
-    d->m_integrity = true;
-    d->evaluatePoCA();
-    return d->m_integrity;
+    bool integrity;
+    this->evaluate(&muon.LineIn(), &muon.LineOut(), 1,
+                   &d->m_poca, &d->m_inPoca, &d->m_outPoca,
+                   &d->m_dist, &integrity);
+    d->m_integrity = integrity;
+    return integrity;
+}
+
+void IBLineDistancePocaEvaluator::evaluate(const HLine3f *line_in,
+                                           const HLine3f *line_out,
+                                           unsigned int size,
+                                           Vector4f *poca,
+                                           Vector4f *in_poca,
+                                           Vector4f *out_poca,
+                                           Scalarf *distance,
+                                           bool *integrity) const
+{
+    const Scalarf cutlength = d->m_cutlength;
+    const int n = size;
+
+    #pragma omp parallel for schedule(static) if(n > 64 * PocaBlockSize)
+    for (int start = 0; start < n; start += PocaBlockSize) {
+        int len = std::min(PocaBlockSize, n - start);
+        PocaBlock blk;
+        blk.load(line_in + start, line_out + start, len);
+        blk.compute(len, cutlength);
+        for (int i = 0; i < len; ++i) {
+            int id = start + i;
+            if (in_poca)  in_poca[id]  << blk.ix[i], blk.iy[i], blk.iz[i], 1;
+            if (out_poca) out_poca[id] << blk.ox[i], blk.oy[i], blk.oz[i], 1;
+            if (poca)     poca[id] << (blk.ix[i] + blk.ox[i]) * 0.5f,
+                                      (blk.iy[i] + blk.oy[i]) * 0.5f,
+                                      (blk.iz[i] + blk.oz[i]) * 0.5f, 1;
+            if (distance)  distance[id]  = blk.dist[i];
+            if (integrity) integrity[id] = blk.valid[i];
+        }
+    }
+}
+
+void IBLineDistancePocaEvaluator::evaluate(const MuonScatterData *muons,
+                                           unsigned int size,
+                                           Vector4f *poca,
+                                           bool *integrity) const
+{
+    const Scalarf cutlength = d->m_cutlength;
+    const int n = size;
+
+    // lines are loaded straight from the muons into the block //
+    #pragma omp parallel for schedule(static) if(n > 64 * PocaBlockSize)
+    for (int start = 0; start < n; start += PocaBlockSize) {
+        int len = std::min(PocaBlockSize, n - start);
+        PocaBlock blk;
+        blk.load(muons + start, len);
+        blk.compute(len, cutlength);
+        for (int i = 0; i < len; ++i) {
+            int id = start + i;
+            if (poca)      poca[id] << (blk.ix[i] + blk.ox[i]) * 0.5f,
+                                       (blk.iy[i] + blk.oy[i]) * 0.5f,
+                                       (blk.iz[i] + blk.oz[i]) * 0.5f, 1;
+            if (integrity) integrity[id] = blk.valid[i];
+        }
+    }
 }
 
 Vector4f IBLineDistancePocaEvaluator::getPoca()
@@ -29,6 +29,19 @@ public:
     ~IBLineDistancePocaEvaluator();
 
     bool evaluate(MuonScatterData muon);
+
+    // Batch evaluation over size pairs of in/out lines. Stateless and const,
+    // can be called concurrently. Any output array may be NULL. Poca values
+    // are meaningful only where integrity is true, distance is NAN when the
+    // cut length rejects a non parallel pair.
+    void evaluate(const HLine3f *line_in, const HLine3f *line_out,
+                  unsigned int size,
+                  Vector4f *poca, Vector4f *in_poca, Vector4f *out_poca,
+                  Scalarf *distance, bool *integrity) const;
+
+    void evaluate(const MuonScatterData *muons, unsigned int size,
+                  Vector4f *poca, bool *integrity) const;
+
     Vector4f getPoca();
     Vector4f getOutTrackPoca();
     Vector4f getInTrackPoca();
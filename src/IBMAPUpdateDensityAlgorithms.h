@@ -40,7 +40,8 @@ public:
     IBMAPPriorGaussianUpdateAlgorithm(Scalarf beta) :
         m_beta(beta), m_DensityPrior(NULL) {}
 
-    uLibSetMacro(DensityPrior, IBVoxCollection *)
+    uLibGetSetMacro(DensityPrior, IBVoxCollection *)
+    Scalarf GetBeta() const { return m_beta; }
 
     void UpdateDensity(IBVoxCollection *voxels, unsigned int threshold);
 
@@ -140,6 +141,8 @@ public:
 
     void UpdateDensity(IBVoxCollection *voxels, unsigned int threshold);
 
+    inline float GetDensity(IBVoxel &voxel);
+
 private:
     Scalarf m_beta;
 };
@@ -150,12 +153,18 @@ IBMAPPriorLaplacianUpdateAlgorithm::UpdateDensity(IBVoxCollection *voxels,
 {
     for(unsigned int i=0; i< voxels->Data().size(); ++i) {
         IBVoxel &voxel = voxels->Data()[i];
-        float tau = static_cast<float>(voxel.Count) / m_beta; //  1/bj
-        float t = voxel.Value;
-        voxel.Value = (sqrt(1+4*t*tau)-1)/(2*tau);
+        voxel.Value = GetDensity(voxel);
     }
 }
 
+inline float
+IBMAPPriorLaplacianUpdateAlgorithm::GetDensity(IBVoxel &voxel)
+{
+    float tau = static_cast<float>(voxel.Count) / m_beta; //  1/bj
+    float t = voxel.Value;
+    return (sqrt(1+4*t*tau)-1)/(2*tau);
+}
+
 
 
 
@@ -231,12 +240,12 @@ protected:
 };
 
 
-void IBMAPPriorNeighbourDensity::UpdateDensity(IBVoxCollection *voxels,
-                                               unsigned int threshold)
+inline void IBMAPPriorNeighbourDensity::UpdateDensity(IBVoxCollection *voxels,
+                                               unsigned int /*threshold*/)
 {
     //    std::cout << "\n == UPDATE DENSITY == \n";
     int rcount = 0;
-    for (int i=0; i < voxels->Data().size(); ++i)
+    for (unsigned int i=0; i < voxels->Data().size(); ++i)
     {
         IBVoxel &vox = voxels->Data()[i];
         const IBVoxel &vox_int = this->m_NeighMap.At(i);
@@ -298,10 +307,10 @@ protected:
 };
 
 
-void IBMAPPriorNeighbourDensity2::UpdateDensity(IBVoxCollection *voxels,
-                                               unsigned int threshold)
+inline void IBMAPPriorNeighbourDensity2::UpdateDensity(IBVoxCollection *voxels,
+                                               unsigned int /*threshold*/)
 {
-    for (int i=0; i < voxels->Data().size(); ++i)
+    for (unsigned int i=0; i < voxels->Data().size(); ++i)
     {
         IBVoxel       &vox = voxels->Data()[i];
         const IBVoxel &vox_int = this->m_NeighMap.At(i);
@@ -44,6 +44,13 @@ public:
     static IBMinimizationVariablesEvaluator* New(IBMinVarEvaluatorAlgorithm S);
 
     virtual bool evaluate(MuonScatterData muon)         = 0;
+
+    // Stateless batch, safe to share one configured evaluator among threads.
+    // Any output pointer may be NULL //
+    virtual void evaluate(const MuonScatterData *muons, unsigned int size,
+                          Vector4f *data, Matrix4f *covariance,
+                          bool *integrity) const = 0;
+
     virtual Vector4f getDataVector()                    = 0;
     virtual Scalarf  getDataVector(int i)               = 0;
     virtual Matrix4f getCovarianceMatrix()              = 0;
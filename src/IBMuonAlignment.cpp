@@ -0,0 +1,181 @@
+/*////////////////////////////////////////////////////////////////////////////
+ Copyright 2018 Istituto Nazionale di Fisica Nucleare
+
+ Licensed under the EUPL, Version 1.2 or - as soon they will be approved by
+ the European Commission - subsequent versions of the EUPL (the "Licence").
+ You may not use this work except in compliance with the Licence.
+
+ You may obtain a copy of the Licence at:
+
+ https://joinup.ec.europa.eu/software/page/eupl
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the Licence is distributed on an "AS IS" basis, WITHOUT
+ WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ Licence for the specific language governing permissions and limitations under
+ the Licence.
+////////////////////////////////////////////////////////////////////////////*/
+
+#include <stdio.h>
+#include <math.h>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+#include "IBMuonAlignment.h"
+
+
+namespace {
+
+// median of the absolute values, v is reordered //
+static Scalarf MedianAbs(Vector<Scalarf> &v)
+{
+    if(v.empty()) return 0;
+    Vector<Scalarf>::iterator mid = v.begin() + v.size() / 2;
+    std::nth_element(v.begin(), mid, v.end());
+    return *mid;
+}
+
+static inline Scalarf Biweight(Scalarf r, Scalarf c)
+{
+    if(c <= 0) return 1;  // no spread, nothing to reject //
+    if(!(fabs(r) < c)) return 0;
+    Scalarf u = r / c;
+    return (1 - u * u) * (1 - u * u);
+}
+
+} // namespace
+
+
+IBMuonAlignment::IBMuonAlignment() :
+    m_ViewWeights(1,1),
+    m_Iterations(0),
+    m_Cut(4.685),
+    m_Rejected(0)
+{}
+
+void IBMuonAlignment::Clear()
+{
+    m_Rows.clear();
+    m_Weights.clear();
+    m_Rejected = 0;
+}
+
+void IBMuonAlignment::Add(const MuonScatter *muons, unsigned long size)
+{
+    const long first = m_Rows.size();
+    m_Rows.resize(first + size);
+    m_Weights.resize(first + size, Vector2f(1,1));
+    #pragma omp parallel for schedule(static)
+    for(long i = 0; i < (long)size; ++i) {
+        const MuonScatter &mu = muons[i];
+        Row &r = m_Rows[first + i];
+        r.tphi = mu.LineIn().direction(0);
+        r.tthe = mu.LineIn().direction(2);
+        r.x2   = mu.LineOut().origin(0);
+        r.z2   = mu.LineOut().origin(2);
+        r.dx   = mu.LineIn().origin(0) - r.x2;
+        r.dz   = mu.LineIn().origin(2) - r.z2;
+    }
+}
+
+// map reduce of the weighted normal system, in double to keep millions of
+// rows accurate //
+void IBMuonAlignment::Accumulate(Eigen::Matrix4d &M, Eigen::Vector4d &K) const
+{
+    M.setZero();
+    K.setZero();
+    const long size = m_Rows.size();
+    #pragma omp parallel
+    {
+        Eigen::Matrix4d Mt = Eigen::Matrix4d::Zero();
+        Eigen::Vector4d Kt = Eigen::Vector4d::Zero();
+        #pragma omp for schedule(static) nowait
+        for(long i = 0; i < size; ++i) {
+            const Row &r = m_Rows[i];
+            const double wx = m_ViewWeights(0) * m_Weights[i](0);
+            const double wz = m_ViewWeights(1) * m_Weights[i](1);
+            if(wx == 0 && wz == 0) continue;
+            const Eigen::Vector4d a(r.tphi, -r.z2, 1, 0);
+            const Eigen::Vector4d b(r.tthe,  r.x2, 0, 1);
+            Mt.noalias() += wx * a * a.transpose() + wz * b * b.transpose();
+            Kt += wx * r.dx * a + wz * r.dz * b;
+        }
+        #pragma omp critical
+        {
+            M += Mt;
+            K += Kt;
+        }
+    }
+}
+
+bool IBMuonAlignment::Solve(Vector4f &X)
+{
+    const long size = m_Rows.size();
+    if(size < 4) return false;
+    std::fill(m_Weights.begin(), m_Weights.end(), Vector2f(1,1));
+
+    Eigen::Matrix4d M;
+    Eigen::Vector4d K;
+    Vector<Scalarf> rx(size), rz(size), ax(size), az(size);
+    for(int it = 0; ; ++it) {
+        Accumulate(M, K);
+        Eigen::FullPivLU<Eigen::Matrix4d> lu(M);
+        if(!lu.isInvertible()) return false;
+        X = lu.solve(K).cast<float>();
+        if(it == m_Iterations) break;
+
+        // residuals of both views and their robust scale //
+        #pragma omp parallel for schedule(static)
+        for(long i = 0; i < size; ++i) {
+            const Row &r = m_Rows[i];
+            rx[i] = r.dx - (r.tphi * X(0) - r.z2 * X(1) + X(2));
+            rz[i] = r.dz - (r.tthe * X(0) + r.x2 * X(1) + X(3));
+            ax[i] = fabs(rx[i]);
+            az[i] = fabs(rz[i]);
+        }
+        const Scalarf cx = m_Cut * 1.4826 * MedianAbs(ax);
+        const Scalarf cz = m_Cut * 1.4826 * MedianAbs(az);
+
+        long rejected = 0;
+        #pragma omp parallel for schedule(static) reduction(+:rejected)
+        for(long i = 0; i < size; ++i) {
+            // a muon scattered in one view is dropped from both //
+            Scalarf w = std::min(Biweight(rx[i], cx), Biweight(rz[i], cz));
+            m_Weights[i] = Vector2f(w, w);
+            rejected += (w == 0);
+        }
+        m_Rejected = (Scalarf)rejected / size;
+    }
+    return true;
+}
+
+bool IBMuonAlignment::LoadCache(const char *filename, const std::string &key, Vector4f &X)
+{
+    std::ifstream in(filename);
+    if(!in.good()) return false;
+    bool found = false;
+    std::string line;
+    while(std::getline(in, line)) {
+        std::istringstream s(line);
+        std::string k;
+        Vector4f v;
+        if(s >> k >> v(0) >> v(1) >> v(2) >> v(3) && k == key) {
+            X = v;
+            found = true;
+        }
+    }
+    return found;
+}
+
+bool IBMuonAlignment::StoreCache(const char *filename, const std::string &key, const Vector4f &X)
+{
+    FILE *out = fopen(filename, "a");
+    if(!out) {
+        printf("Unable to write the alignment cache %s\n", filename);
+        return false;
+    }
+    fprintf(out, "%s %.9g %.9g %.9g %.9g\n", key.c_str(), X(0), X(1), X(2), X(3));
+    fclose(out);
+    return true;
+}
@@ -0,0 +1,86 @@
+/*////////////////////////////////////////////////////////////////////////////
+ Copyright 2018 Istituto Nazionale di Fisica Nucleare
+
+ Licensed under the EUPL, Version 1.2 or - as soon they will be approved by
+ the European Commission - subsequent versions of the EUPL (the "Licence").
+ You may not use this work except in compliance with the Licence.
+
+ You may obtain a copy of the Licence at:
+
+ https://joinup.ec.europa.eu/software/page/eupl
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the Licence is distributed on an "AS IS" basis, WITHOUT
+ WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ Licence for the specific language governing permissions and limitations under
+ the Licence.
+////////////////////////////////////////////////////////////////////////////*/
+
+#ifndef IBMUONALIGNMENT_H
+#define IBMUONALIGNMENT_H
+
+#include <string>
+
+#include <Core/Vector.h>
+#include <Math/Dense.h>
+
+#include "Detectors/MuonScatter.h"
+
+using namespace uLib;
+
+
+// Self alignment of the out detector on the in detector from the data. Each
+// muon gives the linear residuals of the two views
+//
+//   x1 - x2 = tphi1 * H - z2 * Phi + x0
+//   z1 - z2 = tthe1 * H + x2 * Phi + z0
+//
+// for the alignment X = [H, Phi, x0, z0]. The 4x4 normal system is
+// accumulated in parallel with per thread partial sums. The solution is then
+// refined by iteratively reweighted least squares with Tukey biweights on
+// the residuals scaled by their median absolute deviation, so that muons
+// scattered in the volume do not bias the alignment. The robust iterations
+// are opt in (SetIterations, 5 is a good start); with none, the default,
+// the result is the plain least squares one.
+
+class IBMuonAlignment {
+public:
+    IBMuonAlignment();
+
+    // robust iterations and biweight cut, in units of the robust sigma //
+    void SetIterations(int iterations) { m_Iterations = iterations; }
+    void SetCut(Scalarf cut) { m_Cut = cut; }
+    // relative weights of the phi (x) and theta (z) views //
+    void SetViewWeights(const Vector2f &w) { m_ViewWeights = w; }
+
+    void Clear();
+    void Add(const MuonScatter *muons, unsigned long size);
+    unsigned long size() const { return m_Rows.size(); }
+
+    // false when the system is singular //
+    bool Solve(Vector4f &X);
+
+    // fraction of the muons with a zero weight in the last solution //
+    Scalarf GetRejected() const { return m_Rejected; }
+
+    // persisted results, one "key H Phi x0 z0" line each; the last line
+    // with the key wins //
+    static bool LoadCache(const char *filename, const std::string &key, Vector4f &X);
+    static bool StoreCache(const char *filename, const std::string &key, const Vector4f &X);
+
+private:
+    // per muon: tphi1, tthe1, x2, z2, x1 - x2, z1 - z2 //
+    struct Row { Scalarf tphi, tthe, x2, z2, dx, dz; };
+
+    void Accumulate(Eigen::Matrix4d &M, Eigen::Vector4d &K) const;
+
+    Vector<Row>     m_Rows;
+    Vector<Vector2f> m_Weights;
+    Vector2f        m_ViewWeights;
+    int             m_Iterations;
+    Scalarf         m_Cut;
+    Scalarf         m_Rejected;
+};
+
+
+#endif // IBMUONALIGNMENT_H
@@ -18,6 +18,7 @@
 #include <math.h>
 #include <iostream>
 #include <fstream>
+#include <algorithm>
 
 #include <TFile.h>
 #include <TTree.h>
@@ -29,28 +30,11 @@
 #include "Root/RootMuonScatter.h"
 
 #include "IBMuonCollection.h"
+#include "IBColumnExport.h"
 
 class IBMuonCollectionPimpl {
 
     friend class IBMuonCollection;
-    struct _Cmp {
-        bool operator()(MuonScatter &data, const float value)
-        {
-            return MuonScatterAngle(data) <= value;
-        }
-    };
-    struct _PCmp {
-        bool operator()(const MuonScatter &data, const float value)
-        {
-            return data.GetMomentumPrime() <= value;
-        }
-    };
-    struct _PPCmp {
-        bool operator()(const MuonScatter &data, const float value)
-        {
-            return data.GetMomentum() <= value;
-        }
-    };
 
     static float MuonScatterAngle(const MuonScatter &mu) {
         Vector3f in = mu.LineIn().direction().head(3);
@@ -61,16 +45,245 @@ class IBMuonCollectionPimpl {
         else return 0;
     }
 
+    // mean rotation and shift of muon out relative to in over the selected
+    // muons (the ones At and size go through), with the out lines rotated
+    // by q and shifted by shift on the fly. An empty selection gives no
+    // correction //
+    std::pair<Vector4f,Vector4f> MeanAlignment(const Eigen::Quaternionf &q,
+                                               const Vector4f &shift) const
+    {
+        const Matrix3f R = q.toRotationMatrix();
+        const int size = this->Size();
+        if(size == 0)
+            return std::pair<Vector4f,Vector4f>(Vector4f::Zero(), Vector4f::Zero());
+        double dx = 0, dy = 0, dz = 0, px = 0, py = 0, pz = 0;
+        #pragma omp parallel for schedule(static) reduction(+:dx,dy,dz,px,py,pz)
+        for(int i = 0; i < size; ++i) {
+            const MuonScatter &mu = m_Data[Map(i)];
+            Vector3f dir_in  = mu.LineIn().direction().head<3>().normalized();
+            Vector3f dir_out = (R * mu.LineOut().direction().head<3>()).normalized();
+            Vector3f c = dir_in.cross(dir_out);
+            dx += c(0); dy += c(1); dz += c(2);
+
+            Vector3f out = mu.LineOut().origin().head<3>() + shift.head<3>();
+            float y = out(1) - mu.LineIn().origin(1);
+            Vector3f p = mu.LineIn().origin().head<3>() - (out - dir_in*(y/dir_in(1)));
+            px += p(0); py += p(1); pz += p(2);
+        }
+        Vector3f direction(dx / size, dy / size, dz / size);
+        Vector4f pos(px / size, py / size, pz / size, 0);
+        Vector4f rot;
+        rot.head<3>() = direction.normalized();
+        rot(3) = direction.norm();
+//    std::cout << " ---- muons self adjust (use with care!) ----- \n";
+//    std::cout << "Rotation : " << rot.transpose() << "\n";
+//    std::cout << "Position : " << position.transpose() << "\n\n";
+        return std::pair<Vector4f,Vector4f>(pos, rot);
+    }
+
+    // rotates and shifts the out lines of all the muons, the alignment is
+    // estimated on the selected ones but holds for the whole detector, so
+    // the selection refreshed afterwards sees only aligned muons //
+    void Transform(const Eigen::Quaternionf &q, const Vector4f &shift)
+    {
+        const Matrix3f R = q.toRotationMatrix();
+        const int size = m_Data.size();
+        #pragma omp parallel for schedule(static)
+        for(int i = 0; i < size; ++i) {
+            HLine3f &out = m_Data[i].LineOut();
+            out.direction().head<3>() = R * out.direction().head<3>();
+            out.direction() /= fabs(out.direction()(1)); // back to slopes
+            out.origin() += shift;
+        }
+    }
+
+    ////////////////////////////////////////////////////////////////////////
+    // SELECTION //////////////////////////////////////////////////////////
+    //
+    // Each cut keeps a bitmap over m_Data built from a cached derived
+    // column; the selection is the AND of the active bitmaps, listed in
+    // m_Index in data order. As before the Momentum cuts act on the
+    // momentum prime and the MomentumPrime cuts on the momentum.
+
+    enum CutType {
+        AngleCut = 0,
+        MomentumCut,
+        MomentumPrimeCut,
+        NumberOfCuts
+    };
+
+    struct Cut {
+        bool    active;
+        bool    hiPass;   // value > threshold, low pass is value <= threshold
+        Scalarf threshold;
+    };
+
+    typedef unsigned long long Word;
+
+    static Scalarf ColumnValue(int c, const MuonScatter &mu) {
+        switch(c) {
+        case AngleCut:    return MuonScatterAngle(mu);
+        case MomentumCut: return mu.GetMomentumPrime();
+        default:          return mu.GetMomentum();
+        }
+    }
+
+    bool Pass(int c, Scalarf value) const {
+        return m_Cuts[c].hiPass != (value <= m_Cuts[c].threshold);
+    }
+
+    bool HasSelection() const { return m_Selected; }
+
+    // derived columns of the muons from first on, in parallel //
+    void UpdateColumns(size_t first) {
+        const long size = m_Data.size();
+        for(int c = 0; c < NumberOfCuts; ++c)
+            if(m_Cuts[c].active) m_Columns[c].resize(size);
+        #pragma omp parallel for schedule(static)
+        for(long i = first; i < size; ++i)
+            for(int c = 0; c < NumberOfCuts; ++c)
+                if(m_Cuts[c].active) m_Columns[c][i] = ColumnValue(c, m_Data[i]);
+    }
+
+    // true if the muons changed in place since the columns were computed //
+    bool Stale(size_t size) const {
+        for(int c = 0; c < NumberOfCuts; ++c)
+            if(m_Cuts[c].active && m_Columns[c].size() != size) return true;
+        return false;
+    }
+
+    void UpdateBitmap(int c) {
+        const long size = m_Data.size();
+        const long words = (size + 63) / 64;
+        m_Bitmaps[c].resize(words);
+        #pragma omp parallel for schedule(static)
+        for(long w = 0; w < words; ++w) {
+            Word bits = 0;
+            const long end = std::min(size, 64 * (w + 1));
+            for(long i = 64 * w; i < end; ++i)
+                bits |= (Word)Pass(c, m_Columns[c][i]) << (i - 64 * w);
+            m_Bitmaps[c][w] = bits;
+        }
+    }
+
+    // AND of the active bitmaps into the index, counted per word and
+    // filled in parallel from the prefix sums //
+    void UpdateIndex() {
+        const long size = m_Data.size();
+        const long words = (size + 63) / 64;
+        Vector<Word> bits(words, ~(Word)0);
+        if(words && size % 64) bits[words - 1] = ((Word)1 << (size % 64)) - 1;
+        Vector<unsigned int> offset(words + 1, 0);
+        #pragma omp parallel for schedule(static)
+        for(long w = 0; w < words; ++w) {
+            for(int c = 0; c < NumberOfCuts; ++c)
+                if(m_Cuts[c].active) bits[w] &= m_Bitmaps[c][w];
+            offset[w + 1] = __builtin_popcountll(bits[w]);
+        }
+        for(long w = 0; w < words; ++w) offset[w + 1] += offset[w];
+        m_Index.resize(offset[words]);
+        #pragma omp parallel for schedule(static)
+        for(long w = 0; w < words; ++w) {
+            unsigned int k = offset[w];
+            for(Word b = bits[w]; b; b &= b - 1)
+                m_Index[k++] = 64 * w + __builtin_ctzll(b);
+        }
+    }
+
+    // full refresh after the muons changed in place //
+    void UpdateSelection() {
+        if(!m_Selected) return;
+        UpdateColumns(0);
+        for(int c = 0; c < NumberOfCuts; ++c)
+            if(m_Cuts[c].active) UpdateBitmap(c);
+        UpdateIndex();
+    }
+
+    // replaces the cut on one column, the others are kept //
+    void SetCut(int c, Scalarf threshold, bool hiPass) {
+        const bool was_active = m_Cuts[c].active;
+        const bool stale = Stale(m_Data.size());
+        m_Cuts[c].active = true;
+        m_Cuts[c].hiPass = hiPass;
+        m_Cuts[c].threshold = threshold;
+        m_Selected = true;
+        if(stale) {
+            UpdateSelection();
+            return;
+        }
+        if(!was_active) {
+            const long size = m_Data.size();
+            m_Columns[c].resize(size);
+            #pragma omp parallel for schedule(static)
+            for(long i = 0; i < size; ++i)
+                m_Columns[c][i] = ColumnValue(c, m_Data[i]);
+        }
+        UpdateBitmap(c);
+        UpdateIndex();
+    }
+
+    // incremental update for muons appended from first on //
+    void Append(size_t first) {
+        if(!m_Selected) return;
+        if(Stale(first)) {
+            UpdateSelection();
+            return;
+        }
+        UpdateColumns(first);
+        const long size = m_Data.size();
+        for(int c = 0; c < NumberOfCuts; ++c)
+            if(m_Cuts[c].active) m_Bitmaps[c].resize((size + 63) / 64, 0);
+        for(long i = first; i < size; ++i) {
+            bool pass = true;
+            for(int c = 0; c < NumberOfCuts; ++c) {
+                if(!m_Cuts[c].active) continue;
+                bool p = Pass(c, m_Columns[c][i]);
+                if(p) m_Bitmaps[c][i / 64] |= (Word)1 << (i % 64);
+                else  m_Bitmaps[c][i / 64] &= ~((Word)1 << (i % 64));
+                pass &= p;
+            }
+            if(pass) m_Index.push_back(i);
+        }
+    }
+
+    void ClearSelection() {
+        for(int c = 0; c < NumberOfCuts; ++c) {
+            m_Cuts[c].active = false;
+            m_Columns[c].clear();
+            m_Bitmaps[c].clear();
+        }
+        m_Index.clear();
+        m_Selected = false;
+    }
+
+    inline size_t Map(int i) const {
+        return m_Selected ? m_Index.at(i) : i;
+    }
+
+    inline size_t Size() const {
+        return m_Selected ? m_Index.size() : m_Data.size();
+    }
+
 public:
 
-    IBMuonCollectionPimpl() : m_HiPass(1), m_SliceIndex(0) { }
+    IBMuonCollectionPimpl() : m_Selected(false) {
+        for(int c = 0; c < NumberOfCuts; ++c) {
+            m_Cuts[c].active = false;
+            m_Cuts[c].hiPass = true;
+            m_Cuts[c].threshold = 0;
+        }
+    }
 
 
     // members //
-    bool m_HiPass;
-    unsigned int m_SliceIndex;
     Vector<MuonScatter> m_Data;
   Vector<Vector<Vector4f> > m_FullPathData;
+
+    Cut                  m_Cuts[NumberOfCuts];
+    Vector<Scalarf>      m_Columns[NumberOfCuts];
+    Vector<Word>         m_Bitmaps[NumberOfCuts];
+    bool                 m_Selected;
+    Vector<unsigned int> m_Index;
 };
 
 
@@ -87,7 +300,14 @@ IBMuonCollection::~IBMuonCollection()
 void IBMuonCollection::AddMuon(MuonScatter &mu)
 {
     d->m_Data.push_back(mu);
-    // FINIRE o PENSARE perche non si puo' fare add muon dopo set Hi/LowPass //
+    d->Append(d->m_Data.size() - 1);
+}
+
+void IBMuonCollection::AddMuons(const MuonScatter *muons, size_t size)
+{
+    const size_t first = d->m_Data.size();
+    d->m_Data.insert(d->m_Data.end(), muons, muons + size);
+    d->Append(first);
 }
 
 void IBMuonCollection::AddMuonFullPath(Vector<Vector4f> fullPath)
@@ -108,67 +328,83 @@ Vector<Vector<Vector4f> > &IBMuonCollection::FullPath()
 
 const MuonScatter &IBMuonCollection::At(int i) const
 {
-    return d->m_Data.at(d->m_SliceIndex * d->m_HiPass + i);
+    return d->m_Data.at(d->Map(i));
 }
 
 MuonScatter &IBMuonCollection::operator [](int i)
 {    
-    return d->m_Data[d->m_SliceIndex * d->m_HiPass + i];
+    return d->m_Data[d->Map(i)];
 }
 
 size_t IBMuonCollection::size() const
 {
-    if(d->m_HiPass) return d->m_Data.size() - d->m_SliceIndex;
-    else return d->m_SliceIndex;
+    return d->Size();
 }
 
 
 void IBMuonCollection::SetHiPassAngle(float angle)
 {
-    d->m_SliceIndex =
-    VectorSplice(d->m_Data.begin(),d->m_Data.end(),angle,
-                 IBMuonCollectionPimpl::_Cmp());
-    d->m_HiPass = 1;
+    d->SetCut(IBMuonCollectionPimpl::AngleCut, angle, true);
 }
 
 void IBMuonCollection::SetLowPassAngle(float angle)
 {
-    d->m_SliceIndex =
-    VectorSplice(d->m_Data.begin(),d->m_Data.end(),angle,
-                 IBMuonCollectionPimpl::_Cmp());
-    d->m_HiPass = 0;
+    d->SetCut(IBMuonCollectionPimpl::AngleCut, angle, false);
 }
 
 void IBMuonCollection::SetHiPassMomentum(float momenutm)
 {
-    d->m_SliceIndex =
-    VectorSplice(d->m_Data.begin(),d->m_Data.end(),momenutm,
-                 IBMuonCollectionPimpl::_PCmp());
-    d->m_HiPass = 1;
+    d->SetCut(IBMuonCollectionPimpl::MomentumCut, momenutm, true);
 }
 
 void IBMuonCollection::SetLowPassMomentum(float momentum)
 {
-    d->m_SliceIndex =
-    VectorSplice(d->m_Data.begin(),d->m_Data.end(),momentum,
-                 IBMuonCollectionPimpl::_PCmp());
-    d->m_HiPass = 0;
+    d->SetCut(IBMuonCollectionPimpl::MomentumCut, momentum, false);
 }
 
 void IBMuonCollection::SetHiPassMomentumPrime(float momenutm)
 {
-    d->m_SliceIndex =
-    VectorSplice(d->m_Data.begin(),d->m_Data.end(),momenutm,
-                 IBMuonCollectionPimpl::_PPCmp());
-    d->m_HiPass = 1;
+    d->SetCut(IBMuonCollectionPimpl::MomentumPrimeCut, momenutm, true);
 }
 
 void IBMuonCollection::SetLowPassMomentumPrime(float momentum)
 {
-    d->m_SliceIndex =
-    VectorSplice(d->m_Data.begin(),d->m_Data.end(),momentum,
-                 IBMuonCollectionPimpl::_PPCmp());
-    d->m_HiPass = 0;
+    d->SetCut(IBMuonCollectionPimpl::MomentumPrimeCut, momentum, false);
+}
+
+void IBMuonCollection::ClearSelection()
+{
+    d->ClearSelection();
+}
+
+bool IBMuonCollection::HasSelection() const
+{
+    return d->HasSelection();
+}
+
+void IBMuonCollection::UpdateSelection()
+{
+    d->UpdateSelection();
+}
+
+const Vector<unsigned int> &IBMuonCollection::Selection() const
+{
+    return d->m_Index;
+}
+
+void IBMuonCollection::ApplySelection()
+{
+    if(!d->HasSelection()) return;
+    const Vector<unsigned int> &index = d->m_Index;
+    const bool paths = d->m_FullPathData.size() == d->m_Data.size();
+    for(unsigned int k = 0; k < index.size(); ++k) {
+        if(k == index[k]) continue;
+        d->m_Data[k] = d->m_Data[index[k]];
+        if(paths) d->m_FullPathData[k].swap(d->m_FullPathData[index[k]]);
+    }
+    d->m_Data.resize(index.size());
+    if(paths) d->m_FullPathData.resize(index.size());
+    d->ClearSelection();
 }
 
 
@@ -191,7 +427,7 @@ void IBMuonCollection::PrintSelf(std::ostream &o)
 void IBMuonCollection::DumpTTree(const char *filename)
 { 
     std::cout << "\n\n------------- Dump muon collection on root file " << filename << std::endl;
-    static TFile *file = new TFile(filename,"RECREATE");
+    TFile *file = new TFile(filename,"RECREATE");
 
     char name[100];
     sprintf(name,"muons");
@@ -216,7 +452,7 @@ void IBMuonCollection::DumpTTree(const char *filename)
 //    file->Write();
     file->Close();
 //    delete tree;
-//    delete file;
+    delete file;
 
     return;
 }
@@ -227,7 +463,7 @@ void IBMuonCollection::DumpSimpleTree(const char *filename)
 
     std::cout << "\n\n------------- Dump muon collection on root file " << filename << std::endl;
 
-    static TFile *file = new TFile(filename,"RECREATE");
+    TFile *file = new TFile(filename,"RECREATE");
 
     /// open file, tree
     gDirectory->cd(file->GetPath());
@@ -285,6 +521,7 @@ void IBMuonCollection::DumpSimpleTree(const char *filename)
 
     tree->Write();
     file->Close();
+    delete file;
 
     return;
 }
@@ -293,32 +530,101 @@ void IBMuonCollection::DumpSimpleTree(const char *filename)
 void IBMuonCollection::DumpTxt(const char *filename)
 {
     std::cout << "\nDUMP on txt file for Calvini 3D reconstruction\n";
-    std::fstream file;
-    file.open(filename, std::ios::out);
+    FILE *file = fopen(filename, "w");
+    if(!file) {
+        std::cerr << "Error opening " << filename << "\n";
+        return;
+    }
 
-    uLib::MuonScatter mu;
-    // event loop
-    for(int i=0; i < this->size(); ++i )
-    {
-        const MuonScatter &mu = this->At(i);
+    // rows formatted by chunks in parallel as iostream would, written in
+    // order //
+    const long size = this->size();
+    const long chunk = 4096;
+    const long nchunks = (size + chunk - 1) / chunk;
+    std::vector<std::string> text(nchunks);
+    #pragma omp parallel for schedule(dynamic)
+    for(long k = 0; k < nchunks; ++k) {
+        std::string &out = text[k];
+        char buf[160];
+        for(long i = k * chunk; i < std::min(size, (k + 1) * chunk); ++i) {
+            const MuonScatter &mu = this->At(i);
+
+            const Vector4f &inPos = mu.LineIn().origin();
+            const Vector4f &inDir = mu.LineIn().direction();
+            int n = snprintf(buf, sizeof(buf), "%g %g %g %g %g ",
+                             inPos[0], inPos[1], inPos[2],
+                             inDir[0]/inDir[1], inDir[2]/inDir[1]);
+            out.append(buf, n);
+
+            const Vector4f &outPos = mu.LineOut().origin();
+            const Vector4f &outDir = mu.LineOut().direction();
+            if(!std::isnan(outPos[0])) {
+                n = snprintf(buf, sizeof(buf), "%g %g %g %g %g\n",
+                             outPos[0], outPos[1], outPos[2],
+                             outDir[0]/outDir[1], outDir[2]/outDir[1]);
+                out.append(buf, n);
+            }
+            else
+                out += "\n";
+        }
+    }
+    for(long k = 0; k < nchunks; ++k)
+        fwrite(text[k].data(), 1, text[k].size(), file);
 
-        Vector4f inPos = mu.LineIn().origin();
-        Vector4f inDir = mu.LineIn().direction();
-        file << inPos[0] << " " << inPos[1] << " " << inPos[2] << " " << inDir[0]/inDir[1] << " " << inDir[2]/inDir[1] << " ";
+    fclose(file);
+    return;
+}
 
-        Vector4f outPos = mu.LineOut().origin();
-        Vector4f outDir = mu.LineOut().direction();
+// //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////7
+std::vector<std::string> IBMuonCollection::ColumnNames()
+{
+    static const char *names[] = {
+        "in_x", "in_y", "in_z", "in_dx", "in_dy", "in_dz", "in_p",
+        "out_x", "out_y", "out_z", "out_dx", "out_dy", "out_dz", "out_p"
+    };
+    return std::vector<std::string>(names, names + 14);
+}
 
-        if(!std::isnan(outPos[0]))
-            file << outPos[0] << " " << outPos[1] << " " << outPos[2] << " " << outDir[0]/outDir[1] << " " << outDir[2]/outDir[1] << "\n";
-        else
-            file << "\n";
+bool IBMuonCollection::DumpColumns(IBColumnExport &out, size_t block_size) const
+{
+    if(out.GetNumberOfColumns() != 14) {
+        std::cerr << "Muon collection: export not open on the muon columns\n";
+        return false;
     }
-
-    file.close();
-    return;
+    if(!block_size) block_size = 1 << 20;
+    IBColumnExport::Block block;
+    for(size_t first = 0; first < this->size(); first += block_size) {
+        const long rows = std::min(block_size, this->size() - first);
+        out.Allocate(block, rows);
+        float *c[14];
+        for(int k = 0; k < 14; ++k) c[k] = &block[k][0];
+        #pragma omp parallel for schedule(static)
+        for(long i = 0; i < rows; ++i) {
+            const MuonScatter &mu = this->At(first + i);
+            const HLine3f &in = mu.LineIn(), &ou = mu.LineOut();
+            for(int k = 0; k < 3; ++k) {
+                c[k][i]      = in.origin()(k);
+                c[k + 3][i]  = in.direction()(k);
+                c[k + 7][i]  = ou.origin()(k);
+                c[k + 10][i] = ou.direction()(k);
+            }
+            c[6][i]  = mu.GetMomentum();
+            c[13][i] = mu.GetMomentumPrime();
+        }
+        if(!out.Push(block)) return false;
+    }
+    return true;
 }
 
+bool IBMuonCollection::DumpColumns(const char *filename, bool text) const
+{
+    std::cout << "\n\n------------- Dump muon collection columns on " << filename << std::endl;
+    IBColumnExport out;
+    if(!out.Open(filename, ColumnNames(), text ? IBColumnExport::Text : IBColumnExport::Binary))
+        return false;
+    bool ok = this->DumpColumns(out);
+    return out.Close() && ok;
+}
 
 // //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 /**
@@ -328,30 +634,7 @@ void IBMuonCollection::DumpTxt(const char *filename)
  */
 std::pair<Vector4f,Vector4f> IBMuonCollection::GetAlignment()
 {
-    Vector3f direction(0,0,0);
-    Vector3f position(0,0,0);
-    for(int i=0; i<this->size(); ++i) {
-        const MuonScatter &mu = this->At(i);
-        Vector3f dir_in  = mu.LineIn().direction().head(3).normalized();
-        Vector3f dir_out = mu.LineOut().direction().head(3).normalized();
-        direction += dir_in.cross(dir_out);
-
-        float y = mu.LineOut().origin(1) - mu.LineIn().origin(1);
-        Vector3f shift = mu.LineOut().origin().head(3) - dir_in*(y/dir_in(1));
-        position += mu.LineIn().origin().head(3) - shift;
-    }
-    direction /= this->size();
-    position  /= this->size();
-    Vector4f  pos;
-    pos.head(3) = position;
-    Vector4f rot;
-    rot.head(3) = direction.normalized();
-    rot(3) = direction.norm();
-//    std::cout << " ---- muons self adjust (use with care!) ----- \n";
-//    std::cout << "Rotation : " << rot.transpose() << "\n";
-//    std::cout << "Position : " << position.transpose() << "\n\n";
-
-    return std::pair<Vector4f,Vector4f>(pos,rot);
+    return d->MeanAlignment(Eigen::Quaternionf::Identity(), Vector4f::Zero());
 }
 
 void IBMuonCollection::SetAlignment(std::pair<Vector4f,Vector4f> align)
@@ -362,54 +645,27 @@ void IBMuonCollection::SetAlignment(std::pair<Vector4f,Vector4f> align)
     Eigen::Quaternion<float> q(Eigen::AngleAxis<float>(-asin(rot(3)), rot.head(3)));
 //    Eigen::Affine3f tr(Eigen::AngleAxis<float>(-rot(3), rot.head(3)));
 //    std::cout << "QUATERNION: \n" << q.matrix() << "\n\nROTATION: \n" << tr.matrix() << "\n\n";
-
-    for(int i=0; i<this->size(); ++i) {
-        MuonScatter &mu = this->operator [](i);
-//        if(i<10){
-//            Vector3f v1 = q * mu.LineOut().direction.head<3>();
-//            Vector4f v2 = tr * mu.LineOut().direction;
-//            std::cout << "dif: " << v1.transpose() << " vs " << v2.transpose() << "\n";
-//        }
-//        mu.LineOut().direction = tr * mu.LineOut().direction;
-        mu.LineOut().direction().head<3>() = q * mu.LineOut().direction().head<3>();
-        mu.LineOut().direction() /= fabs(mu.LineOut().direction(1)); // back to slopes
-        mu.LineOut().origin() += pos;
-    }
+    d->Transform(q, pos);
+    d->UpdateSelection();
 }
 
 // //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// The passes are evaluated on the fly through the composed rotation and
+// shift, the collection is rewritten once at the end
 void IBMuonCollection::PerformMuonSelfAlignment(){
     std::cout << "\n--------- DATA ALIGNMENT.... (muon self adjust)" << std::endl;
-    std::pair<Vector4f,Vector4f> align = GetAlignment();
-    align.first << 0,0,0,0;
-    SetAlignment(align);
-    align = GetAlignment();
-    align.first << 0,0,0,0;
-    SetAlignment(align);
-    align = GetAlignment();
-    align.first << 0,0,0,0;
-    SetAlignment(align);
-    align = GetAlignment();
-    align.first << 0,0,0,0;
-    SetAlignment(align);
-    align = GetAlignment();
-    align.first << 0,0,0,0;
-    SetAlignment(align);
-    align = GetAlignment();
-    SetAlignment(align);
-    align = GetAlignment();
-    SetAlignment(align);
-    align = GetAlignment();
-    SetAlignment(align);
-    align = GetAlignment();
-    SetAlignment(align);
-    align = GetAlignment();
-    SetAlignment(align);
-    align = GetAlignment();
-    SetAlignment(align);
-    align = GetAlignment();
-    SetAlignment(align);
-
+    Eigen::Quaternionf q = Eigen::Quaternionf::Identity();
+    Vector4f shift = Vector4f::Zero();
+    for(int i = 0; i < 12; ++i) {
+        std::pair<Vector4f,Vector4f> align = d->MeanAlignment(q, shift);
+        // rotation only for the first passes //
+        if(i < 5) align.first << 0,0,0,0;
+        const Vector4f &rot = align.second;
+        q = Eigen::Quaternionf(Eigen::AngleAxisf(-asin(rot(3)), rot.head<3>())) * q;
+        shift += align.first;
+    }
+    d->Transform(q, shift);
+    d->UpdateSelection();
     return;
 }
 
@@ -418,7 +674,10 @@ void IBMuonCollection::dataRotoTranslation(Eigen::Matrix4f  t)
 {
     std::cout << "\nMuon collection: apply roto-translation matrix: \n" << t <<  "\n\n";
 
-    for(int i=0; i<this->size(); ++i) {
+    // one parallel pass in place //
+    const int size = this->size();
+    #pragma omp parallel for schedule(static)
+    for(int i=0; i<size; ++i) {
         MuonScatter &mu = this->operator [](i);
 
         // IN muon roto-traslation
@@ -452,21 +711,7 @@ void IBMuonCollection::dataRotoTranslation(Vector3f rot, Vector3f trans)
 
     Eigen::Matrix4f  t = this->createAffineMatrix(rot[0], rot[1], rot[2], trans);
 
-    std::cout << "\nMuon collection: apply roto-translation matrix: \n" << t <<  "\n\n";
-
-    for(int i=0; i<this->size(); ++i) {
-        MuonScatter &mu = this->operator [](i);
-
-        // IN muon roto-traslation
-        mu.LineIn().origin() = t * mu.LineIn().origin();
-        mu.LineIn().direction() = t * mu.LineIn().direction();
-        mu.LineIn().direction() /= fabs(mu.LineIn().direction()(1)); // back to slopes
-
-        // OUT muon roto-traslation
-        mu.LineOut().origin() = t * mu.LineOut().origin();
-        mu.LineOut().direction() = t * mu.LineOut().direction();
-        mu.LineOut().direction() /= fabs(mu.LineOut().direction(1)); // back to slopes
-    }
+    this->dataRotoTranslation(t);
 }
 
 // //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -20,6 +20,9 @@
 #ifndef IBMUONCOLLECTION_H
 #define IBMUONCOLLECTION_H
 
+#include <string>
+#include <vector>
+
 #include <Core/Object.h>
 #include <Core/Vector.h>
 
@@ -30,6 +33,8 @@
 
 using namespace uLib;
 
+class IBColumnExport;
+
 class IBMuonCollection : public Object {
 
 public:
@@ -38,6 +43,7 @@ public:
     ~IBMuonCollection();
 
     void AddMuon(MuonScatter &mu);
+    void AddMuons(const MuonScatter *muons, size_t size);
     void AddMuonFullPath(Vector<Vector4f> fullPath);
       
     Vector<MuonScatter> &Data();
@@ -58,12 +64,33 @@ public:
     void SetHiPassMomentumPrime(float momenutm);
     void SetLowPassMomentumPrime(float momentum);
 
+    // The pass cuts above combine, one per quantity, without moving the
+    // data: At, operator[] and size go through the selected muons in data
+    // order, Data() still holds them all. Muons added later are selected
+    // as they come; after editing Data() in place call UpdateSelection.
+    // ApplySelection drops the muons not selected //
+    void ClearSelection();
+    bool HasSelection() const;
+    void UpdateSelection();
+    void ApplySelection();
+    const Vector<unsigned int> &Selection() const;
+
 
     void PrintSelf(std::ostream &o);
     void DumpTTree(const char *filename);
     void DumpSimpleTree(const char *filename);
 
     void DumpTxt(const char *filename);
+
+    // selected muons as IBColumnExport columns, in ColumnNames() order: in
+    // and out origin, direction and momentum. The last block is still being
+    // written when DumpColumns(out) returns //
+    static std::vector<std::string> ColumnNames();
+    bool DumpColumns(IBColumnExport &out, size_t block_size = 1 << 20) const;
+    bool DumpColumns(const char *filename, bool text = false) const;
+
+    // alignment of the out lines to the in lines, measured on and applied
+    // to the selected muons only //
     std::pair<Vector4f, Vector4f> GetAlignment();
     void SetAlignment(std::pair<Vector4f, Vector4f> align);
     void PerformMuonSelfAlignment();
@@ -0,0 +1,323 @@
+/*////////////////////////////////////////////////////////////////////////////
+ Copyright 2018 Istituto Nazionale di Fisica Nucleare
+
+ Licensed under the EUPL, Version 1.2 or - as soon they will be approved by
+ the European Commission - subsequent versions of the EUPL (the "Licence").
+ You may not use this work except in compliance with the Licence.
+
+ You may obtain a copy of the Licence at:
+
+ https://joinup.ec.europa.eu/software/page/eupl
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the Licence is distributed on an "AS IS" basis, WITHOUT
+ WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ Licence for the specific language governing permissions and limitations under
+ the Licence.
+////////////////////////////////////////////////////////////////////////////*/
+
+
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <iostream>
+#include <algorithm>
+
+#include "IBMuonDataset.h"
+#include "IBMuonCollection.h"
+
+
+////////////////////////////////////////////////////////////////////////////////
+//// FORMAT ////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+static const char IBMuonDatasetMagic[8] = { 'I','B','M','U','O','N','D','S' };
+static const unsigned int IBMuonDatasetVersion = 1;
+static const unsigned long long IBMuonDatasetAlign = 64;
+
+struct IBMuonDatasetHeader {
+    char               magic[8];
+    unsigned int       version;
+    unsigned int       flags;        // bit 0: full paths
+    unsigned long long count;        // muons
+    unsigned long long path_count;   // full path points
+    unsigned long long offset[IBMuonDataset::NumberOfColumns];
+    unsigned long long length[IBMuonDataset::NumberOfColumns];
+};
+
+namespace {
+
+enum { FullPathFlag = 1 };
+
+inline unsigned long long align(unsigned long long pos)
+{
+    return (pos + IBMuonDatasetAlign - 1) / IBMuonDatasetAlign * IBMuonDatasetAlign;
+}
+
+// one column streamed through a fixed buffer, padded to the next alignment //
+class ColumnWriter {
+public:
+    ColumnWriter(FILE *f) : m_File(f), m_Pos(0), m_Good(true) {}
+
+    template < typename T >
+    void Put(const T &value) {
+        const char *c = reinterpret_cast<const char *>(&value);
+        m_Buffer.insert(m_Buffer.end(), c, c + sizeof(T));
+        if(m_Buffer.size() >= (1 << 20)) Flush();
+    }
+    void Put4f(const Vector4f &v) {
+        const char *c = reinterpret_cast<const char *>(v.data());
+        m_Buffer.insert(m_Buffer.end(), c, c + 4 * sizeof(float));
+        if(m_Buffer.size() >= (1 << 20)) Flush();
+    }
+    void Flush() {
+        if(m_Buffer.empty()) return;
+        m_Good &= fwrite(&m_Buffer[0], 1, m_Buffer.size(), m_File) == m_Buffer.size();
+        m_Pos += m_Buffer.size();
+        m_Buffer.clear();
+    }
+    unsigned long long Pad() {
+        Flush();
+        while(m_Pos % IBMuonDatasetAlign) { m_Good &= fputc(0, m_File) != EOF; ++m_Pos; }
+        return m_Pos;
+    }
+    unsigned long long Pos() const { return m_Pos + m_Buffer.size(); }
+    bool Good() const { return m_Good; }
+
+private:
+    FILE *m_File;
+    unsigned long long m_Pos;
+    bool m_Good;
+    std::vector<char> m_Buffer;
+};
+
+} // namespace
+
+
+////////////////////////////////////////////////////////////////////////////////
+//// DATASET ///////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+IBMuonDataset::IBMuonDataset() :
+    m_Data(NULL),
+    m_Length(0)
+{}
+
+IBMuonDataset::~IBMuonDataset()
+{
+    this->Close();
+}
+
+bool IBMuonDataset::Open(const char *filename)
+{
+    this->Close();
+    int fd = open(filename, O_RDONLY);
+    if(fd < 0) {
+        std::cerr << "IBMuonDataset: unable to open " << filename << "\n";
+        return false;
+    }
+    struct stat st;
+    if(fstat(fd, &st) < 0 || (unsigned long)st.st_size < sizeof(IBMuonDatasetHeader)) {
+        std::cerr << "IBMuonDataset: " << filename << " is not a muon dataset\n";
+        close(fd);
+        return false;
+    }
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(data == MAP_FAILED) {
+        std::cerr << "IBMuonDataset: unable to map " << filename << "\n";
+        return false;
+    }
+
+    // header and column extents must fit the file //
+    const IBMuonDatasetHeader *h = static_cast<const IBMuonDatasetHeader *>(data);
+    bool good = !memcmp(h->magic, IBMuonDatasetMagic, 8) &&
+            h->version == IBMuonDatasetVersion;
+    const bool full_path = good && (h->flags & FullPathFlag);
+    for(int c = 0; good && c < NumberOfColumns; ++c) {
+        unsigned long long length =
+                c < Momentum   ? h->count * sizeof(Vector4f) :
+                c < PathOffset ? h->count * sizeof(Scalarf) :
+                !full_path     ? 0 :
+                c == PathOffset ? (h->count + 1) * sizeof(unsigned long long) :
+                                  h->path_count * sizeof(Vector4f);
+        good = h->length[c] == length &&
+                h->offset[c] % IBMuonDatasetAlign == 0 &&
+                h->offset[c] + length <= (unsigned long long)st.st_size;
+    }
+    if(!good) {
+        std::cerr << "IBMuonDataset: " << filename << " is not a valid muon dataset\n";
+        munmap(data, st.st_size);
+        return false;
+    }
+    m_Data   = data;
+    m_Length = st.st_size;
+    return true;
+}
+
+void IBMuonDataset::Close()
+{
+    if(m_Data) munmap(m_Data, m_Length);
+    m_Data   = NULL;
+    m_Length = 0;
+}
+
+inline const IBMuonDatasetHeader *IBMuonDataset::Header() const
+{
+    return static_cast<const IBMuonDatasetHeader *>(m_Data);
+}
+
+unsigned long IBMuonDataset::size() const
+{
+    return m_Data ? Header()->count : 0;
+}
+
+bool IBMuonDataset::HasFullPath() const
+{
+    return m_Data && (Header()->flags & FullPathFlag);
+}
+
+const Vector4f *IBMuonDataset::Column4f(Column c) const
+{
+    return reinterpret_cast<const Vector4f *>(
+                static_cast<const char *>(m_Data) + Header()->offset[c]);
+}
+
+const Scalarf *IBMuonDataset::GetMomentum() const
+{
+    return reinterpret_cast<const Scalarf *>(
+                static_cast<const char *>(m_Data) + Header()->offset[Momentum]);
+}
+
+const Scalarf *IBMuonDataset::GetMomentumPrime() const
+{
+    return reinterpret_cast<const Scalarf *>(
+                static_cast<const char *>(m_Data) + Header()->offset[MomentumPrime]);
+}
+
+const unsigned long long *IBMuonDataset::GetPathOffset() const
+{
+    return reinterpret_cast<const unsigned long long *>(
+                static_cast<const char *>(m_Data) + Header()->offset[PathOffset]);
+}
+
+const Vector4f *IBMuonDataset::GetPathPoints() const
+{
+    return Column4f(PathPoints);
+}
+
+void IBMuonDataset::Get(unsigned long i, MuonScatter &mu) const
+{
+    mu.LineIn().origin()     = Column4f(LineInOrigin)[i];
+    mu.LineIn().direction()  = Column4f(LineInDirection)[i];
+    mu.LineOut().origin()    = Column4f(LineOutOrigin)[i];
+    mu.LineOut().direction() = Column4f(LineOutDirection)[i];
+    mu.ErrorIn().origin()     = Column4f(ErrorInOrigin)[i];
+    mu.ErrorIn().direction()  = Column4f(ErrorInDirection)[i];
+    mu.ErrorOut().origin()    = Column4f(ErrorOutOrigin)[i];
+    mu.ErrorOut().direction() = Column4f(ErrorOutDirection)[i];
+    mu.SetMomentum(GetMomentum()[i]);
+    mu.SetMomentumPrime(GetMomentumPrime()[i]);
+}
+
+void IBMuonDataset::GetFullPath(unsigned long i, Vector<Vector4f> &path) const
+{
+    path.clear();
+    if(!HasFullPath()) return;
+    const unsigned long long *offset = GetPathOffset();
+    const Vector4f *points = GetPathPoints();
+    for(unsigned long long k = offset[i]; k < offset[i+1]; ++k)
+        path.push_back(points[k]);
+}
+
+void IBMuonDataset::Load(IBMuonCollection &muons) const
+{
+    static const long chunk = 1 << 16;
+    const long size  = this->size();
+    const long first = muons.Data().size();
+
+    // decoded in parallel per chunk and appended through the collection so
+    // the selection follows //
+    Vector<MuonScatter> buffer(std::min(chunk, size));
+    for(long start = 0; start < size; start += chunk) {
+        const long len = std::min(chunk, size - start);
+        #pragma omp parallel for schedule(static)
+        for(long i = 0; i < len; ++i)
+            this->Get(start + i, buffer[i]);
+        muons.AddMuons(&buffer[0], len);
+    }
+
+    if(HasFullPath()) {
+        // paths are indexed as the muons, missing ones are left empty //
+        Vector< Vector<Vector4f> > &paths = muons.FullPath();
+        paths.resize(first + size);
+        #pragma omp parallel for schedule(dynamic, 1024)
+        for(long i = 0; i < size; ++i)
+            this->GetFullPath(i, paths[first + i]);
+    }
+}
+
+bool IBMuonDataset::Write(const char *filename, IBMuonCollection &muons)
+{
+    Vector<MuonScatter> &data = muons.Data();
+    Vector< Vector<Vector4f> > &paths = muons.FullPath();
+    const unsigned long long count = data.size();
+    const bool full_path = count && paths.size() == count;
+
+    FILE *f = fopen(filename, "wb");
+    if(!f) {
+        std::cerr << "IBMuonDataset: unable to write " << filename << "\n";
+        return false;
+    }
+
+    IBMuonDatasetHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, IBMuonDatasetMagic, 8);
+    h.version = IBMuonDatasetVersion;
+    h.flags   = full_path ? FullPathFlag : 0;
+    h.count   = count;
+    for(unsigned long long i = 0; full_path && i < count; ++i)
+        h.path_count += paths[i].size();
+
+    // the header is rewritten once the column extents are known //
+    ColumnWriter w(f);
+    w.Put(h);
+    for(int c = 0; c < NumberOfColumns; ++c) {
+        h.offset[c] = w.Pad();
+        switch(c) {
+        case LineInOrigin:      for(unsigned long long i = 0; i < count; ++i) w.Put4f(data[i].LineIn().origin()); break;
+        case LineInDirection:   for(unsigned long long i = 0; i < count; ++i) w.Put4f(data[i].LineIn().direction()); break;
+        case LineOutOrigin:     for(unsigned long long i = 0; i < count; ++i) w.Put4f(data[i].LineOut().origin()); break;
+        case LineOutDirection:  for(unsigned long long i = 0; i < count; ++i) w.Put4f(data[i].LineOut().direction()); break;
+        case ErrorInOrigin:     for(unsigned long long i = 0; i < count; ++i) w.Put4f(data[i].ErrorIn().origin()); break;
+        case ErrorInDirection:  for(unsigned long long i = 0; i < count; ++i) w.Put4f(data[i].ErrorIn().direction()); break;
+        case ErrorOutOrigin:    for(unsigned long long i = 0; i < count; ++i) w.Put4f(data[i].ErrorOut().origin()); break;
+        case ErrorOutDirection: for(unsigned long long i = 0; i < count; ++i) w.Put4f(data[i].ErrorOut().direction()); break;
+        case Momentum:          for(unsigned long long i = 0; i < count; ++i) w.Put<Scalarf>(data[i].GetMomentum()); break;
+        case MomentumPrime:     for(unsigned long long i = 0; i < count; ++i) w.Put<Scalarf>(data[i].GetMomentumPrime()); break;
+        case PathOffset:
+            if(full_path) {
+                unsigned long long offset = 0;
+                w.Put(offset);
+                for(unsigned long long i = 0; i < count; ++i) w.Put(offset += paths[i].size());
+            }
+            break;
+        case PathPoints:
+            for(unsigned long long i = 0; full_path && i < count; ++i)
+                for(unsigned int k = 0; k < paths[i].size(); ++k) w.Put4f(paths[i][k]);
+            break;
+        }
+        h.length[c] = w.Pos() - h.offset[c];
+    }
+    w.Pad();
+
+    bool good = w.Good() && fseek(f, 0, SEEK_SET) == 0 &&
+            fwrite(&h, sizeof(h), 1, f) == 1;
+    good &= fclose(f) == 0;
+    if(!good) std::cerr << "IBMuonDataset: error writing " << filename << "\n";
+    return good;
+}
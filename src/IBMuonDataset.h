@@ -0,0 +1,93 @@
+/*////////////////////////////////////////////////////////////////////////////
+ Copyright 2018 Istituto Nazionale di Fisica Nucleare
+
+ Licensed under the EUPL, Version 1.2 or - as soon they will be approved by
+ the European Commission - subsequent versions of the EUPL (the "Licence").
+ You may not use this work except in compliance with the Licence.
+
+ You may obtain a copy of the Licence at:
+
+ https://joinup.ec.europa.eu/software/page/eupl
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the Licence is distributed on an "AS IS" basis, WITHOUT
+ WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ Licence for the specific language governing permissions and limitations under
+ the Licence.
+////////////////////////////////////////////////////////////////////////////*/
+
+
+
+#ifndef IBMUONDATASET_H
+#define IBMUONDATASET_H
+
+#include <Core/Vector.h>
+#include <Math/Dense.h>
+
+#include "Detectors/MuonScatter.h"
+
+using namespace uLib;
+
+class IBMuonCollection;
+
+
+// Columnar binary muon dataset. A fixed header is followed by one array per
+// column, each 64 bytes aligned: the homogeneous vectors of lines and errors
+// as 4 floats per muon, the momenta as floats and, optionally, the full
+// paths as a CSR pair of point offsets and points. The file is mapped read
+// only and the columns are accessed in place; loading a collection is a
+// single parallel pass with no decoding.
+
+class IBMuonDataset {
+public:
+    enum Column {
+        LineInOrigin = 0,
+        LineInDirection,
+        LineOutOrigin,
+        LineOutDirection,
+        ErrorInOrigin,
+        ErrorInDirection,
+        ErrorOutOrigin,
+        ErrorOutDirection,
+        Momentum,
+        MomentumPrime,
+        PathOffset,
+        PathPoints,
+        NumberOfColumns
+    };
+
+    IBMuonDataset();
+    ~IBMuonDataset();
+
+    bool Open(const char *filename);
+    void Close();
+    bool IsOpen() const { return m_Data != NULL; }
+
+    unsigned long size() const;
+    bool HasFullPath() const;
+
+    // zero copy views on the mapped columns //
+    const Vector4f *Column4f(Column c) const;
+    const Scalarf *GetMomentum() const;
+    const Scalarf *GetMomentumPrime() const;
+    const unsigned long long *GetPathOffset() const;
+    const Vector4f *GetPathPoints() const;
+
+    void Get(unsigned long i, MuonScatter &mu) const;
+    void GetFullPath(unsigned long i, Vector<Vector4f> &path) const;
+
+    // appends all muons (and full paths if any) to the collection //
+    void Load(IBMuonCollection &muons) const;
+
+    // full paths are written when the collection has one per muon //
+    static bool Write(const char *filename, IBMuonCollection &muons);
+
+private:
+    const struct IBMuonDatasetHeader *Header() const;
+
+    void         *m_Data;
+    unsigned long m_Length;
+};
+
+
+#endif // IBMUONDATASET_H
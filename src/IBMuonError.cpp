@@ -22,9 +22,179 @@
 
 #include <IBLineDistancePocaEvaluator.h>
 
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
 
 using namespace uLib;
 
+///////////////////////////////////////////////////////////////////
+//// LINE INTEGRAL TABLE //////////////////////////////////////////
+///////////////////////////////////////////////////////////////////
+
+// Value*L integrated along straight lines through the scraps image. Lines are
+// parametrized by the slopes dx/dy, dz/dy and by the crossing point on the
+// plane of the image top, nodes are interpolated linearly in all four. The
+// plane is widened so every line within max_slope hitting the image is
+// covered, a crossing outside it misses the image //
+class IBMuonErrorLineTable
+{
+public:
+    IBMuonErrorLineTable(IBLightCollection &image, int bins, Scalarf max_slope);
+
+    // false if the line is steeper than the tabulated slopes
+    bool Integral(const HLine3f &line, Scalarf &kL) const;
+
+    // compares the table with traced integrals on lines halfway between the
+    // slope nodes, where interpolation is worst, prints the errors and
+    // returns the mean relative one //
+    Scalarf Check(IBLightCollection &image, int samples = 256) const;
+
+private:
+    Scalarf Node(int sx, int sz, int x, int z) const {
+        return m_Data[((sx * m_Bins + sz) * m_Nodes[0] + x) * m_Nodes[1] + z];
+    }
+
+    int     m_Bins;
+    Scalarf m_MaxSlope;
+    Scalarf m_SlopeStep;
+    Scalarf m_Top;
+    Scalarf m_Origin[2];
+    Scalarf m_Step[2];
+    int     m_Nodes[2];
+    Vector<Scalarf> m_Data;
+};
+
+IBMuonErrorLineTable::IBMuonErrorLineTable(IBLightCollection &image, int bins,
+                                           Scalarf max_slope) :
+    m_Bins(std::max(bins, 2)),
+    m_MaxSlope(max_slope),
+    m_SlopeStep(2 * max_slope / (std::max(bins, 2) - 1))
+{
+    Vector3f pos = image.GetPosition();
+    Vector3f spacing = image.GetSpacing();
+    Vector3i dims = image.GetDims();
+    Scalarf height = dims(1) * spacing(1);
+    m_Top = pos(1) + height;
+    for (int k = 0; k < 2; ++k) {
+        int axis = 2 * k; // x and z views
+        int margin = (int)std::ceil(max_slope * height / spacing(axis));
+        m_Step[k] = spacing(axis);
+        m_Origin[k] = pos(axis) - margin * spacing(axis);
+        m_Nodes[k] = dims(axis) + 2 * margin + 1;
+    }
+    m_Data.resize(m_Bins * m_Bins * m_Nodes[0] * m_Nodes[1]);
+
+    const int rows = m_Bins * m_Bins * m_Nodes[0];
+    #pragma omp parallel
+    {
+        IBVoxRaytracer tracer(image);
+        #pragma omp for schedule(dynamic)
+        for (int r = 0; r < rows; ++r) {
+            int sx = r / (m_Bins * m_Nodes[0]);
+            int sz = (r / m_Nodes[0]) % m_Bins;
+            int x  = r % m_Nodes[0];
+            HLine3f line;
+            line.direction() << -m_MaxSlope + sx * m_SlopeStep, -1,
+                                -m_MaxSlope + sz * m_SlopeStep, 0;
+            for (int z = 0; z < m_Nodes[1]; ++z) {
+                line.origin() << m_Origin[0] + x * m_Step[0], m_Top,
+                                 m_Origin[1] + z * m_Step[1], 1;
+                Vector4f entry_pt, exit_pt;
+                Scalarf kL = 0;
+                if (tracer.GetEntryPoint(line, entry_pt) &&
+                        tracer.GetExitPoint(line, exit_pt)) {
+                    IBVoxRaytracer::RayData ray =
+                            tracer.TraceBetweenPoints(entry_pt, exit_pt);
+                    for (unsigned int ii = 0; ii < ray.Data().size(); ++ii)
+                        kL += image[ray.Data()[ii].vox_id].Value * ray.Data()[ii].L;
+                }
+                m_Data[r * m_Nodes[1] + z] = kL;
+            }
+        }
+    }
+}
+
+Scalarf IBMuonErrorLineTable::Check(IBLightCollection &image, int samples) const
+{
+    Vector3f pos = image.GetPosition();
+    Vector3f size = image.GetSpacing().cwiseProduct(image.GetDims().cast<Scalarf>());
+    IBVoxRaytracer tracer(image);
+    Scalarf sum_err = 0, sum_ref = 0, max_err = 0;
+    int count = 0;
+    for (int s = 0; s < samples; ++s) {
+        int sx = s % (m_Bins - 1);
+        int sz = (s / (m_Bins - 1)) % (m_Bins - 1);
+        // crossing points spread over the image top by a golden ratio walk
+        Scalarf fx = std::fmod(s * 0.6180340f, 1.f);
+        Scalarf fz = std::fmod(s * 0.7548777f, 1.f);
+        HLine3f line;
+        line.direction() << -m_MaxSlope + (sx + 0.5f) * m_SlopeStep, -1,
+                            -m_MaxSlope + (sz + 0.5f) * m_SlopeStep, 0;
+        line.origin() << pos(0) + fx * size(0), m_Top, pos(2) + fz * size(2), 1;
+
+        Vector4f entry_pt, exit_pt;
+        if (!tracer.GetEntryPoint(line, entry_pt) ||
+                !tracer.GetExitPoint(line, exit_pt)) continue;
+        IBVoxRaytracer::RayData ray = tracer.TraceBetweenPoints(entry_pt, exit_pt);
+        Scalarf ref = 0, kL = 0;
+        for (unsigned int ii = 0; ii < ray.Data().size(); ++ii)
+            ref += image[ray.Data()[ii].vox_id].Value * ray.Data()[ii].L;
+        if (!this->Integral(line, kL)) continue;
+        Scalarf err = std::fabs(kL - ref);
+        sum_err += err;
+        sum_ref += std::fabs(ref);
+        max_err = std::max(max_err, err);
+        ++count;
+    }
+    const Scalarf mean = sum_ref > 0 ? sum_err / sum_ref : 0;
+    std::cout << "IBMuonError: line integral table " << m_Bins << "x" << m_Bins
+              << " slopes (step " << m_SlopeStep << "), " << count
+              << " test lines: mean relative error " << mean
+              << ", max error " << max_err << std::endl;
+    return mean;
+}
+
+bool IBMuonErrorLineTable::Integral(const HLine3f &line, Scalarf &kL) const
+{
+    const Vector4f &o = line.origin();
+    const Vector4f &dir = line.direction();
+    if (dir(1) == 0) return false;
+    Scalarf t = (m_Top - o(1)) / dir(1);
+    Scalarf slope[2] = { -dir(0) / dir(1), -dir(2) / dir(1) };
+    Scalarf cross[2] = { o(0) + t * dir(0), o(2) + t * dir(2) };
+
+    // node index and fraction for sx, sz, x, z
+    int     n[4];
+    Scalarf f[4];
+    for (int k = 0; k < 2; ++k) {
+        Scalarf u = (slope[k] + m_MaxSlope) / m_SlopeStep;
+        if (!(u >= 0 && u <= m_Bins - 1)) return false;
+        n[k] = std::min((int)u, m_Bins - 2);
+        f[k] = u - n[k];
+    }
+    for (int k = 0; k < 2; ++k) {
+        Scalarf u = (cross[k] - m_Origin[k]) / m_Step[k];
+        if (!(u >= 0 && u <= m_Nodes[k] - 1)) { kL = 0; return true; }
+        n[k+2] = std::min((int)u, m_Nodes[k] - 2);
+        f[k+2] = u - n[k+2];
+    }
+    kL = 0;
+    for (int c = 0; c < 16; ++c) {
+        int id[4];
+        Scalarf w = 1;
+        for (int k = 0; k < 4; ++k) {
+            int up = (c >> k) & 1;
+            id[k] = n[k] + up;
+            w *= up ? f[k] : 1 - f[k];
+        }
+        if (w > 0) kL += w * Node(id[0], id[1], id[2], id[3]);
+    }
+    return true;
+}
+
+
 IBMuonError::IBMuonError(Scalarf xA, Scalarf zA, Scalarf xB, Scalarf zB, Scalarf ratio) :
     m_simpler(new IBMESimpler(this)),
     m_shader(NULL)
@@ -39,16 +209,14 @@ IBMuonError::IBMuonError(Scalarf xA, Scalarf zA, Scalarf xB, Scalarf zB, Scalarf
     m_azimPcorr = false;
     m_chamberErcorr = false;
     m_squareError = false;
+    m_tableBins = 0;
+    m_tableSlope = 1;
 }
 
 IBMuonError::~IBMuonError()
 {
     delete m_simpler;
-    if(m_shader) {
-        delete m_shader->m_pproc;
-        delete m_shader->m_tracer;
-        delete m_shader;
-    }
+    delete m_shader;
 }
 
 bool IBMuonError::evaluate(MuonScatter &event, int i, int j)
@@ -61,6 +229,20 @@ bool IBMuonError::evaluate(MuonScatter &event, int i, int j)
     return false;
 }
 
+void IBMuonError::evaluate(MuonScatter *events, unsigned int size, int i, int j,
+                           bool *ok)
+{
+    if (m_shader) {
+        m_shader->evaluate(events, size, i, j, ok);
+        return;
+    }
+    #pragma omp parallel for schedule(static)
+    for (int k = 0; k < (int)size; ++k) {
+        bool good = m_simpler->evaluate(events[k], i, j);
+        if (ok) ok[k] = good;
+    }
+}
+
 void IBMuonError::azimuthalMomentumCorrection(bool enable)
 {
     m_azimPcorr = enable;
@@ -88,16 +270,29 @@ void IBMuonError::setOutMomentum(bool enable)
 
 void IBMuonError::setScrapsImage(IBLightCollection &image)
 {
-    if(m_shader) {
-        delete m_shader->m_pproc;
-        delete m_shader->m_tracer;
-        delete m_shader;
+    delete m_shader;
+    m_shader = new IBMEShader(this, image);
+    if (m_tableBins > 0)
+        m_shader->m_table = new IBMuonErrorLineTable(image, m_tableBins, m_tableSlope);
+}
+
+void IBMuonError::setLineIntegralTable(int direction_bins, Scalarf max_slope)
+{
+    m_tableBins = direction_bins;
+    m_tableSlope = max_slope;
+    if (m_shader) {
+        delete m_shader->m_table;
+        m_shader->m_table = NULL;
+        if (m_tableBins > 0)
+            m_shader->m_table = new IBMuonErrorLineTable(*m_shader->m_image,
+                                                         m_tableBins, m_tableSlope);
     }
+}
 
-    m_shader = new IBMEShader(this);
-    m_shader->m_pproc = new IBLineDistancePocaEvaluator();
-    m_shader->m_tracer = new IBVoxRaytracer(image);
-    m_shader->m_image = &image;
+Scalarf IBMuonError::checkLineIntegralTable(int samples) const
+{
+    if (!m_shader || !m_shader->m_table) return -1;
+    return m_shader->m_table->Check(*m_shader->m_image, samples);
 }
 
 
@@ -105,7 +300,7 @@ void IBMuonError::setScrapsImage(IBLightCollection &image)
 //// SIMPLER //////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////
 
-bool IBMuonError::IBMESimpler::evaluate(MuonScatter &event, int i, int j)
+bool IBMuonError::IBMESimpler::evaluate(MuonScatter &event, int i, int j) const
 {
     if (unlikely(event.GetMomentum()!=0.f)) {
         if (event.GetMomentumPrime() == 0)
@@ -147,40 +342,118 @@ bool IBMuonError::IBMESimpler::evaluate(MuonScatter &event, int i, int j)
 //// SHADER ///////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////
 
+IBMuonError::IBMEShader::IBMEShader(IBMuonError *ref, IBLightCollection &image) :
+    m_image(&image),
+    m_tracer(new IBVoxRaytracer(image)),
+    m_pproc(new IBLineDistancePocaEvaluator()),
+    m_table(NULL),
+    d(ref)
+{}
+
+IBMuonError::IBMEShader::~IBMEShader()
+{
+    delete m_table;
+    delete m_pproc;
+    delete m_tracer;
+}
+
 bool IBMuonError::IBMEShader::evaluate(MuonScatter &event, int i, int j)
 {
-    float azAngl = atan(sqrt((event.LineIn().direction(0)*event.LineIn().direction(0)+
-                              event.LineIn().direction(i)*event.LineIn().direction(i))));
-    float azAngl_deg = azAngl*M_PI/180;
-    float tiltC  = pow(0.00247*azAngl_deg,3)+0.00468;
-    IBVoxRaytracer::RayData ray;
+    Vector4f poca;
+    bool test;
+    m_pproc->evaluate(&event, 1, &poca, &test);
+    Scalarf kL;
+    return Integral(event, poca, test, *m_tracer, kL) && Assign(event, kL, i, j);
+}
+
+void IBMuonError::IBMEShader::evaluate(MuonScatter *events, unsigned int size,
+                                       int i, int j, bool *ok)
+{
+    static const int block = 256;
+    #pragma omp parallel
     {
-        Vector4f entry_pt, poca, exit_pt;
-        if (!m_tracer->GetEntryPoint(event.LineIn(),entry_pt) ||
-                !m_tracer->GetExitPoint(event.LineOut(),exit_pt)) {
-            return false;
+        // the tracer is cheap, one each thread //
+        IBVoxRaytracer tracer(*m_image);
+        Vector4f poca[block];
+        bool     test[block];
+        // the evaluator walks MuonScatterData, gathered not cast //
+        Vector<MuonScatterData> data(block);
+        #pragma omp for schedule(dynamic)
+        for (int first = 0; first < (int)size; first += block) {
+            const int n = std::min<int>(block, size - first);
+            for (int k = 0; k < n; ++k) data[k] = events[first + k];
+            m_pproc->evaluate(&data[0], n, poca, test);
+            for (int k = 0; k < n; ++k) {
+                MuonScatter &event = events[first + k];
+                Scalarf kL;
+                bool good = Integral(event, poca[k], test[k], tracer, kL) &&
+                        Assign(event, kL, i, j);
+                if (ok) ok[first + k] = good;
+            }
         }
-        bool test = m_pproc->evaluate(event);
-        poca = m_pproc->getPoca();
-        if (test && m_image->IsInsideBounds(poca)) {
-            ray = m_tracer->TraceBetweenPoints(entry_pt, poca);
-            ray.AppendRay(m_tracer->TraceBetweenPoints(poca, exit_pt));
+    }
+}
+
+// Value*L along entry -> poca -> exit, or straight when poca is missing or
+// outside the image. With the table the broken path is approximated by the
+// in and out lines weighted by the path length before and after the poca //
+bool IBMuonError::IBMEShader::Integral(const MuonScatter &event,
+                                       const Vector4f &poca, bool poca_ok,
+                                       IBVoxRaytracer &tracer, Scalarf &kL) const
+{
+    Vector4f entry_pt, exit_pt;
+    if (!tracer.GetEntryPoint(event.LineIn(),entry_pt) ||
+            !tracer.GetExitPoint(event.LineOut(),exit_pt)) {
+        return false;
+    }
+    bool broken = poca_ok && m_image->IsInsideBounds(poca);
+
+    if (m_table) {
+        if (broken) {
+            Scalarf l_in  = (poca - entry_pt).head<3>().norm();
+            Scalarf l_out = (exit_pt - poca).head<3>().norm();
+            Scalarf k_in, k_out;
+            if (l_in + l_out > 0 &&
+                    m_table->Integral(event.LineIn(), k_in) &&
+                    m_table->Integral(event.LineOut(), k_out)) {
+                kL = (l_in * k_in + l_out * k_out) / (l_in + l_out);
+                return true;
+            }
         } else {
-            ray = m_tracer->TraceBetweenPoints(entry_pt, exit_pt);
+            HLine3f line;
+            line.origin() = entry_pt;
+            line.direction() = exit_pt - entry_pt;
+            if (m_table->Integral(line, kL)) return true;
         }
     }
-    float kL = 0;
-    for (int ii=0; ii<ray.Data().size(); ++ii) {
+
+    IBVoxRaytracer::RayData ray;
+    if (broken) {
+        ray = tracer.TraceBetweenPoints(entry_pt, poca);
+        ray.AppendRay(tracer.TraceBetweenPoints(poca, exit_pt));
+    } else {
+        ray = tracer.TraceBetweenPoints(entry_pt, exit_pt);
+    }
+    kL = 0;
+    for (unsigned int ii=0; ii<ray.Data().size(); ++ii) {
         const IBVoxRaytracer::RayData::Element *el = &ray.Data().at(ii);
-        float L   = el->L;
-        float val = (m_image->operator [](el->vox_id)).Value;
-        kL += val*L;
+        kL += (m_image->operator [](el->vox_id)).Value * el->L;
     }
+    return true;
+}
+
+bool IBMuonError::IBMEShader::Assign(MuonScatter &event, Scalarf kL,
+                                     int i, int j) const
+{
+    float azAngl = atan(sqrt((event.LineIn().direction(0)*event.LineIn().direction(0)+
+                              event.LineIn().direction(i)*event.LineIn().direction(i))));
+    float azAngl_deg = azAngl*M_PI/180;
+    float tiltC  = pow(0.00247*azAngl_deg,3)+0.00468;
     kL*=tiltC;
-    // end tracing - CL eval
     if (unlikely(event.GetMomentum()!=0.f)) {
         float P2in  = pow(event.GetMomentum(),2);
         if(unlikely(P2in-kL<=0)) {
+            #pragma omp critical
             std::cout << "WARNING! I'd like to set P<0! ABORT! ABORT!\n";
             return false;
         }
@@ -209,7 +482,7 @@ bool IBMuonError::IBMEShader::evaluate(MuonScatter &event, int i, int j)
 
 }
 
-Scalarf IBMuonError::mpdEval(Scalarf a, Scalarf p, Scalarf d)
+Scalarf IBMuonError::mpdEval(Scalarf a, Scalarf p, Scalarf d) const
 {
     float sigma = 1E-3 * (a/p);
     /// SV 20141216 valid only for orizonthal or vertical chambers, not for furnace
@@ -219,7 +492,7 @@ Scalarf IBMuonError::mpdEval(Scalarf a, Scalarf p, Scalarf d)
 }
 
 
-Scalarf IBMuonError::mpdSquareEval(Scalarf a, Scalarf b, Scalarf p, Scalarf d)
+Scalarf IBMuonError::mpdSquareEval(Scalarf a, Scalarf b, Scalarf p, Scalarf d) const
 {
     float sigma = 1E-3 * sqrt(pow((a/p),2.) + pow(b,2.));
 
@@ -41,6 +41,9 @@ public:
     ~IBMuonError();
 
     bool evaluate(MuonScatter &event, int i, int j);
+    // parallel evaluation over a contiguous batch of events, ok may be NULL
+    void evaluate(MuonScatter *events, unsigned int size, int i, int j,
+                  bool *ok = NULL);
     void azimuthalMomentumCorrection(bool enable=true);
     void crossChamberErrorCorrection(bool enable=true);
     void averageMomentumCorrection(bool enable=true);
@@ -49,17 +52,36 @@ public:
 
     void setScrapsImage(IBLightCollection &image);
 
+    // Tabulates the straight line integrals of the scraps image so that kL
+    // is interpolated instead of raytraced for every muon. Slopes up to
+    // max_slope in each view are sampled on direction_bins nodes, steeper
+    // tracks fall back to tracing. Zero bins drop the table //
+    void setLineIntegralTable(int direction_bins = 9, Scalarf max_slope = 1);
+
+    // Compares the table with traced integrals on samples lines halfway
+    // between the slope nodes and prints the errors; raise direction_bins
+    // if they are too large for the image. Returns the mean relative
+    // error, -1 without a table //
+    Scalarf checkLineIntegralTable(int samples = 256) const;
+
 private:
     class IBMEShader
     {
         friend class IBMuonError;
     private:
-        IBMEShader(IBMuonError * ref) { d = ref; }
+        IBMEShader(IBMuonError * ref, IBLightCollection &image);
+        ~IBMEShader();
         bool evaluate(MuonScatter &event, int i, int j);
+        void evaluate(MuonScatter *events, unsigned int size, int i, int j,
+                      bool *ok);
+        bool Integral(const MuonScatter &event, const Vector4f &poca,
+                      bool poca_ok, IBVoxRaytracer &tracer, Scalarf &kL) const;
+        bool Assign(MuonScatter &event, Scalarf kL, int i, int j) const;
     private:
         IBLightCollection           *m_image;
         IBVoxRaytracer              *m_tracer;
         IBLineDistancePocaEvaluator *m_pproc;
+        class IBMuonErrorLineTable  *m_table;
         IBMuonError                 *d;
 
     };
@@ -69,13 +91,13 @@ private:
         friend class IBMuonError;
     private:
         IBMESimpler(IBMuonError * ref) { d = ref; }
-        bool evaluate(MuonScatter &event, int i, int j);
+        bool evaluate(MuonScatter &event, int i, int j) const;
     private:
         IBMuonError *d;
     };
 
-    Scalarf mpdEval(Scalarf a, Scalarf p, Scalarf d);
-    Scalarf mpdSquareEval(Scalarf a, Scalarf b, Scalarf p, Scalarf d);
+    Scalarf mpdEval(Scalarf a, Scalarf p, Scalarf d) const;
+    Scalarf mpdSquareEval(Scalarf a, Scalarf b, Scalarf p, Scalarf d) const;
     Scalarf      m_Ax,m_Az;
     Scalarf      m_Bx,m_Bz;
     Scalarf      m_pratio;
@@ -84,6 +106,8 @@ private:
     bool         m_usePout;
     bool         m_chamberErcorr;
     bool         m_squareError;
+    int          m_tableBins;
+    Scalarf      m_tableSlope;
     IBMEShader * m_shader;
     IBMESimpler* m_simpler;
 
@@ -17,9 +17,20 @@
 ////////////////////////////////////////////////////////////////////////////*/
 
 
+#include <string>
+#include <algorithm>
+#include <sstream>
+#include <sys/stat.h>
+
 #include <TTree.h>
 #include <TFile.h>
+#include <TROOT.h>
+#include <RVersion.h>
+
+#include <Core/Vector.h>
+
 #include "IBMuonEventTTreeLNLdataReader.h"
+#include "IBMuonAlignment.h"
 
 using namespace uLib;
 
@@ -65,6 +76,14 @@ class IBMuonEventTTreeLNLdataReaderPimpl
 public:
     typedef struct Demo_LNL_buffer Buffer;
 
+    // parallel reading: each worker owns a handle of the file and a branch
+    // buffer, entries are decoded in rounds of workers * chunk //
+    struct Worker {
+        TFile  *file;
+        TTree  *tree;
+        Buffer  buffer;
+    };
+
     IBMuonEventTTreeLNLdataReaderPimpl()
     {
         m_tree         = NULL;
@@ -75,6 +94,10 @@ public:
         m_hitZ         = 4;
         m_momentum     = 0.f;
         m_integrity    = true;
+        m_error        = NULL;
+        m_chunk        = 0;
+        m_queueFirst   = 0;
+        m_alignIterations = 0;
         m_align = Matrix4f::Identity();
 #ifndef NDEBUG
         m_out = new TFile("evDistro.root","RECREATE");
@@ -105,6 +128,8 @@ public:
             exit(0);
         }
 
+        m_fileName = file->GetName();
+
         // init trees
         TTree* t = (TTree*)file->Get("RADMU");
         if (t) {
@@ -125,19 +150,193 @@ public:
             printf("Requested time interval rejected at TTree initialization.\nAborting...\n");
             exit(0);
         }
-        tree->SetBranchAddress("EVENT",      &m_buffer.event);
-        tree->SetBranchAddress("SEG_ns_glo", &m_buffer.iseg);
-        tree->SetBranchAddress("SEG_sx_glo",  m_buffer.sx);
-        tree->SetBranchAddress("SEG_ss_glo",  m_buffer.ss);
-        tree->SetBranchAddress("SEG_sn_glo",  m_buffer.sn);
-        tree->SetBranchAddress("SEG_ersx_glo",m_buffer.ersx);
-        tree->SetBranchAddress("SEG_erss_glo",m_buffer.erss);
+        SetBranches(tree, m_buffer);
+        this->Invalidate();
+    }
+
+    // only the segment branches are read, through a read cache //
+    static void SetBranches(TTree *tree, Buffer &buffer)
+    {
+        static const char *branches[] = {
+            "EVENT", "SEG_ns_glo", "SEG_sx_glo", "SEG_ss_glo",
+            "SEG_sn_glo", "SEG_ersx_glo", "SEG_erss_glo"
+        };
+        tree->SetBranchStatus("*", 0);
+        for (int i = 0; i < 7; ++i)
+            tree->SetBranchStatus(branches[i], 1);
+        tree->SetCacheSize(32 * 1024 * 1024);
+        for (int i = 0; i < 7; ++i)
+            tree->AddBranchToCache(branches[i], true);
+
+        tree->SetBranchAddress("EVENT",      &buffer.event);
+        tree->SetBranchAddress("SEG_ns_glo", &buffer.iseg);
+        tree->SetBranchAddress("SEG_sx_glo",  buffer.sx);
+        tree->SetBranchAddress("SEG_ss_glo",  buffer.ss);
+        tree->SetBranchAddress("SEG_sn_glo",  buffer.sn);
+        tree->SetBranchAddress("SEG_ersx_glo",buffer.ersx);
+        tree->SetBranchAddress("SEG_erss_glo",buffer.erss);
+    }
+
+    void SetWorkers(int workers, unsigned long chunk)
+    {
+        ClearWorkers();
+        this->Invalidate();
+        if (workers <= 0 || chunk == 0) return;
+        if (m_fileName.empty()) {
+            printf("Parallel reading needs the reader to be set on a file, reading serially\n");
+            return;
+        }
+#if ROOT_VERSION_CODE >= ROOT_VERSION(6,0,0)
+        ROOT::EnableThreadSafety();
+#else
+        // no thread safe mode before ROOT 6: one worker keeps the chunked
+        // reading on its own file without concurrent ROOT I/O //
+        if (workers > 1) {
+            printf("ROOT %s has no thread safe mode, parallel reading clamped to one worker\n",
+                   ROOT_RELEASE);
+            workers = 1;
+        }
+#endif
+        for (int w = 0; w < workers; ++w) {
+            Worker *wk = new Worker;
+            wk->file = new TFile(m_fileName.c_str());
+            wk->tree = (TTree*)wk->file->Get("RADMU");
+            if (wk->file->IsZombie() || !wk->tree) {
+                printf("Unable to open %s for a reading worker, reading serially\n", m_fileName.c_str());
+                delete wk->file;
+                delete wk;
+                ClearWorkers();
+                return;
+            }
+            SetBranches(wk->tree, wk->buffer);
+            m_workers.push_back(wk);
+        }
+        m_chunk = chunk;
+    }
+
+    void ClearWorkers()
+    {
+        for (unsigned int w = 0; w < m_workers.size(); ++w) {
+            delete m_workers[w]->file;
+            delete m_workers[w];
+        }
+        m_workers.clear();
+        m_chunk = 0;
+    }
+
+    // decoded entries depend on cuts, alignment and error //
+    void Invalidate()
+    {
+        m_queueOk.clear();
+    }
+
+    // decodes entries [first, first + workers * chunk), each worker on its
+    // own contiguous range, then evaluates the errors of the good muons in
+    // one batch; m_queueIndex maps an entry to its muon or -1 //
+    void Fill(unsigned long first)
+    {
+        const int workers = m_workers.size();
+        unsigned long count = first < m_max_event ?
+                    std::min(workers * m_chunk, m_max_event - first) : 0;
+        Vector<MuonScatter> decoded(count);
+        m_queueOk.assign(count, 0);
+
+        #pragma omp parallel for schedule(static, 1) num_threads(workers)
+        for (int w = 0; w < workers; ++w) {
+            Worker &wk = *m_workers[w];
+            const unsigned long begin = w * m_chunk;
+            const unsigned long end = std::min(count, begin + m_chunk);
+            for (unsigned long k = begin; k < end; ++k) {
+                bool integrity = wk.tree->GetEntry(first + k) > 0;
+                if (integrity && Decode(wk.buffer, &decoded[k], integrity))
+                    m_queueOk[k] = integrity;
+            }
+        }
+
+        m_queue.clear();
+        m_queueIndex.assign(count, -1);
+        for (unsigned long k = 0; k < count; ++k)
+            if (m_queueOk[k]) {
+                m_queueIndex[k] = m_queue.size();
+                m_queue.push_back(decoded[k]);
+            }
+        if (m_error && !m_queue.empty())
+            m_error->evaluate(&m_queue[0], m_queue.size(), 2, 2);
+        m_queueFirst = first;
+
+#ifndef NDEBUG
+        for (unsigned int k = 0; k < m_queue.size(); ++k)
+            DebugFill(m_queue[k]);
+#endif // NDEBUG
+    }
+
+    bool ReadQueued(MuonScatter *event)
+    {
+        if (m_queueOk.empty() || m_pos < m_queueFirst ||
+                m_pos >= m_queueFirst + m_queueOk.size())
+            Fill(m_pos);
+        m_integrity = false;
+        if (m_pos < m_queueFirst + m_queueOk.size()) {
+            int index = m_queueIndex[m_pos - m_queueFirst];
+            if (index >= 0) {
+                *event = m_queue[index];
+                m_integrity = true;
+            }
+        }
+        m_pos++;
+        return m_integrity;
+    }
+
+    // copies the good muons of entries [m_pos, m_pos + entries) from the
+    // decoded rounds, filling new rounds as needed //
+    unsigned long ReadQueued(MuonScatter *events, unsigned long entries)
+    {
+        unsigned long n = 0;
+        const unsigned long end = m_pos + entries;
+        while (m_pos < end) {
+            if (m_queueOk.empty() || m_pos < m_queueFirst ||
+                    m_pos >= m_queueFirst + m_queueOk.size())
+                Fill(m_pos);
+            const unsigned long last = std::min(end, m_queueFirst + m_queueOk.size());
+            if (last <= m_pos) {
+                // past the end of the tree, nothing more to decode //
+                m_pos = end;
+                break;
+            }
+            for (; m_pos < last; ++m_pos) {
+                int index = m_queueIndex[m_pos - m_queueFirst];
+                if (index >= 0) events[n++] = m_queue[index];
+            }
+        }
+        m_integrity = n > 0;
+        return n;
+    }
+
+    // serial batch: entries are decoded in turn on the reader buffer, the
+    // errors of the good muons are then evaluated in one batch //
+    unsigned long ReadSerial(MuonScatter *events, unsigned long entries)
+    {
+        unsigned long n = 0;
+        for (unsigned long k = 0; k < entries; ++k) {
+            AcquireEvent();
+            if (m_integrity && Decode(m_buffer, &events[n], m_integrity) && m_integrity)
+                ++n;
+        }
+        if (m_error && n)
+            m_error->evaluate(events, n, 2, 2);
+#ifndef NDEBUG
+        for (unsigned long k = 0; k < n; ++k)
+            DebugFill(events[k]);
+#endif // NDEBUG
+        m_integrity = n > 0;
+        return n;
     }
 
     void AcquireEvent()
     {
         m_integrity = true;
-        if (likely(m_pos <= m_max_event)) {
+        // entries are [0, m_max_event), the same bound as Fill //
+        if (likely(m_pos < m_max_event)) {
             m_tree->GetEntry(m_pos);
         } else m_integrity = false;
         m_pos++;
@@ -147,35 +346,64 @@ public:
     void GetMuonScatter(MuonScatter * muon_event)
     {
         if(unlikely(!m_integrity)) return;
+        if(!Decode(m_buffer, muon_event, m_integrity)) return;
+
+        m_error->evaluate(*muon_event, 2, 2);
+
+#ifndef NDEBUG
+        DebugFill(*muon_event);
+#endif // NDEBUG
+    }
+
+#ifndef NDEBUG
+    void DebugFill(const MuonScatter &muon)
+    {
+        m_xu = muon.LineIn().origin(0);
+        m_zu = muon.LineIn().origin(2);
+        m_pu = muon.LineIn().direction(0);
+        m_tu = muon.LineIn().direction(2);
+        m_xd = muon.LineOut().origin(0);
+        m_zd = muon.LineOut().origin(2);
+        m_pd = muon.LineOut().direction(0);
+        m_td = muon.LineOut().direction(2);
+        m_dumpster->Fill();
+    }
+#endif // NDEBUG
+
+    // fills the muon from a segment buffer, false if the hit counts reject
+    // it before the lines are set; the position cuts clear integrity //
+    bool Decode(const Buffer &buffer, MuonScatter * muon_event, bool &integrity) const
+    {
         float *track_ptr;
-        MuonTracks *traks = &m_track;
+        MuonTracks track;
+        MuonTracks *traks = &track;
         MuonHits hit_count;
         hit_count.data = 0;
         //fill tracks and hits
         for (int is = 0; is < 4; is++) {
-            if ((m_buffer.sn[is] > 1300) && (m_buffer.sn[is] < 1310)) {     // Phi up
+            if ((buffer.sn[is] > 1300) && (buffer.sn[is] < 1310)) {     // Phi up
                 track_ptr = (float *)&traks->phi_up;
-                hit_count.phi_up = m_buffer.sn[is] - 1300;
+                hit_count.phi_up = buffer.sn[is] - 1300;
             }
-            else if ((m_buffer.sn[is] < -1300) && (m_buffer.sn[is] > -1310)) { // Theta up
+            else if ((buffer.sn[is] < -1300) && (buffer.sn[is] > -1310)) { // Theta up
                 track_ptr = (float *)&traks->theta_up;
-                hit_count.theta_up = -m_buffer.sn[is] - 1300;
+                hit_count.theta_up = -buffer.sn[is] - 1300;
             }
-            else if ((m_buffer.sn[is] > 2300) && (m_buffer.sn[is] < 2310)) { // Phi down
+            else if ((buffer.sn[is] > 2300) && (buffer.sn[is] < 2310)) { // Phi down
                 track_ptr = (float *)&traks->phi_down;
-                hit_count.phi_down = m_buffer.sn[is] - 2300;
+                hit_count.phi_down = buffer.sn[is] - 2300;
             }
-            else if ((m_buffer.sn[is] < -2300) && (m_buffer.sn[is] > -2310)) { // Theta down
+            else if ((buffer.sn[is] < -2300) && (buffer.sn[is] > -2310)) { // Theta down
                 track_ptr = (float *)&traks->theta_down;
-                hit_count.theta_down = -m_buffer.sn[is] - 2300;
+                hit_count.theta_down = -buffer.sn[is] - 2300;
             } else {
                 //debug_debug("error reading muon track code");
                 break;
             }
-            *track_ptr++ = m_buffer.sx[is];
-            *track_ptr++ = m_buffer.ss[is];
-            *track_ptr++ = m_buffer.ersx[is];
-            *track_ptr =   m_buffer.erss[is];
+            *track_ptr++ = buffer.sx[is];
+            *track_ptr++ = buffer.ss[is];
+            *track_ptr++ = buffer.ersx[is];
+            *track_ptr =   buffer.erss[is];
         }
 
         if (    hit_count.phi_up < m_hitX     ||
@@ -187,27 +415,27 @@ public:
                 hit_count.theta_down < m_hitZ ||
                 hit_count.theta_down > 4       )
         {
-            m_integrity = false;
-            return;
+            integrity = false;
+            return false;
         }
 
-        muon_event->LineIn().origin()     <<  m_track.phi_up.position,            0,       m_track.theta_up.position,           1;  // HARDCODED
-        muon_event->LineIn().direction()  << -m_track.phi_up.slope,              -1,       -m_track.theta_up.slope,              0;
+        muon_event->LineIn().origin()     <<  track.phi_up.position,            0,       track.theta_up.position,           1;  // HARDCODED
+        muon_event->LineIn().direction()  << -track.phi_up.slope,              -1,       -track.theta_up.slope,              0;
 
-//        muon_event->LineOut().origin    <<  m_track.phi_down.position, -183.43,  m_track.theta_down.position, 1; // NO SHIFT
-//        muon_event->LineOut().direction << -m_track.phi_down.slope,   -1,       -m_track.theta_down.slope,   0;
+//        muon_event->LineOut().origin    <<  track.phi_down.position, -183.43,  track.theta_down.position, 1; // NO SHIFT
+//        muon_event->LineOut().direction << -track.phi_down.slope,   -1,       -track.theta_down.slope,   0;
 
-//        muon_event->LineOut().origin    <<  m_track.phi_down.position - 1.004, -183.43,  m_track.theta_down.position - 0.112, 1; // PRETERREMOTO
-//        muon_event->LineOut().direction << -m_track.phi_down.slope - 0.0004,   -1,       -m_track.theta_down.slope - 0.0027,   0;
+//        muon_event->LineOut().origin    <<  track.phi_down.position - 1.004, -183.43,  track.theta_down.position - 0.112, 1; // PRETERREMOTO
+//        muon_event->LineOut().direction << -track.phi_down.slope - 0.0004,   -1,       -track.theta_down.slope - 0.0027,   0;
 
-//        muon_event->LineOut().origin    <<  m_track.phi_down.position + 0.046, -183.43,  m_track.theta_down.position - 0.18, 1; // PSTTERREMOTO
-//        muon_event->LineOut().direction << -m_track.phi_down.slope,   -1,       -m_track.theta_down.slope - 0.0061,   0;
+//        muon_event->LineOut().origin    <<  track.phi_down.position + 0.046, -183.43,  track.theta_down.position - 0.18, 1; // PSTTERREMOTO
+//        muon_event->LineOut().direction << -track.phi_down.slope,   -1,       -track.theta_down.slope - 0.0061,   0;
 
-//        muon_event->LineOut().origin    <<  m_track.phi_down.position  -0.95744, -183.43,  m_track.theta_down.position  -0.31360, 1; // FIX 2014
-//        muon_event->LineOut().direction << -m_track.phi_down.slope,   -1,       -m_track.theta_down.slope + 0.0029,   0;
+//        muon_event->LineOut().origin    <<  track.phi_down.position  -0.95744, -183.43,  track.theta_down.position  -0.31360, 1; // FIX 2014
+//        muon_event->LineOut().direction << -track.phi_down.slope,   -1,       -track.theta_down.slope + 0.0029,   0;
 
-        muon_event->LineOut().origin()    <<  m_track.phi_down.position, 0,  m_track.theta_down.position, 1; // AUTO
-        muon_event->LineOut().direction() << -m_track.phi_down.slope,   -1, -m_track.theta_down.slope,    0;
+        muon_event->LineOut().origin()    <<  track.phi_down.position, 0,  track.theta_down.position, 1; // AUTO
+        muon_event->LineOut().direction() << -track.phi_down.slope,   -1, -track.theta_down.slope,    0;
 
 
         { // ALIGNMENT //
@@ -230,29 +458,37 @@ public:
             fabs(muon_event->LineOut().direction(0)-muon_event->LineIn().direction(0))>0.5 ||
             fabs(muon_event->LineOut().direction(2)-muon_event->LineIn().direction(2))>0.5  )
         {
-            m_integrity = false;
+            integrity = false;
         }
 
         muon_event->ErrorIn().direction()  = Vector4f::Zero();
         muon_event->ErrorOut().direction() = Vector4f::Zero();
-
-        m_error->evaluate(*muon_event, 2, 2);
-
-#ifndef NDEBUG
-        m_xu = muon_event->LineIn().origin(0);
-        m_zu = muon_event->LineIn().origin(2);
-        m_pu = muon_event->LineIn().direction(0);
-        m_tu = muon_event->LineIn().direction(2);
-        m_xd = muon_event->LineOut().origin(0);
-        m_zd = muon_event->LineOut().origin(2);
-        m_pd = muon_event->LineOut().direction(0);
-        m_td = muon_event->LineOut().direction(2);
-        m_dumpster->Fill();
-#endif // NDEBUG
+        return true;
     }
 
     // LNL Experiment seems to have 324Hz of DAQ based on run 2162 files //
     // Old value was set to 6.7E4 (to remove apparatus inefficiencies?)  //
+    // alignment from data depends on the file, the window of entries, the
+    // hit cuts and the alignment already applied //
+    std::string AlignmentKey(unsigned long entries) const
+    {
+        std::ostringstream key;
+        struct stat st;
+        std::string name = m_fileName;
+        std::replace(name.begin(), name.end(), ' ', '_');
+        key << name;
+        if(!m_fileName.empty() && stat(m_fileName.c_str(), &st) == 0)
+            key << "|" << (long long)st.st_size << "|" << (long long)st.st_mtime;
+        key << "|" << entries << "|" << m_hitX << "|" << m_hitZ << "|"
+            << m_alignIterations << "|";
+        key.precision(9);
+        const Matrix4f &A = m_align.matrix();
+        for (int i = 0; i < 3; ++i)
+            for (int j = 0; j < 4; ++j)
+                key << (i || j ? "," : "") << A(i,j);
+        return key.str();
+    }
+
     static const float events_per_minute() { return 242.3912*60; } //converted to minutes
 
 public:
@@ -262,7 +498,6 @@ public:
     float         m_xu, m_zu, m_xd, m_zd, m_pu, m_tu, m_pd, m_td;
 #endif
     TTree*        m_tree;
-    MuonTracks    m_track;
     Buffer        m_buffer;
     Scalarf       m_momentum;
     IBMuonError  *m_error;
@@ -275,6 +510,16 @@ public:
     unsigned long m_pos;
 
     Eigen::Affine3f   m_align;
+
+    std::string           m_fileName;
+    std::string           m_alignCache;
+    int                   m_alignIterations;
+    Vector<Worker *>      m_workers;
+    unsigned long         m_chunk;
+    unsigned long         m_queueFirst;
+    Vector<char>          m_queueOk;
+    Vector<int>           m_queueIndex;
+    Vector<MuonScatter>   m_queue;
 };
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -290,6 +535,7 @@ IBMuonEventTTreeLNLdataReader::IBMuonEventTTreeLNLdataReader() :
 
 IBMuonEventTTreeLNLdataReader::~IBMuonEventTTreeLNLdataReader()
 {
+    d->ClearWorkers();
 #ifndef NDEBUG
     d->m_out->cd();
     d->m_dumpster->Write();
@@ -300,23 +546,30 @@ IBMuonEventTTreeLNLdataReader::~IBMuonEventTTreeLNLdataReader()
 
 void IBMuonEventTTreeLNLdataReader::setTTree(TTree *tree)
 {
+    // workers need a file to open their own handles //
+    d->ClearWorkers();
+    d->m_fileName.clear();
     d->init(tree);
 }
 
 void IBMuonEventTTreeLNLdataReader::setTFile(TFile* file)
 {
+    int workers = d->m_workers.size();
     d->init(file);
+    if(workers) d->SetWorkers(workers, d->m_chunk);
 }
 
 void IBMuonEventTTreeLNLdataReader::setHitCuts(int nx_cut, int nz_cut)
 {
     d->m_hitX = nx_cut;
     d->m_hitZ = nz_cut;
+    d->Invalidate();
 }
 
 void IBMuonEventTTreeLNLdataReader::setMomentum(Scalarf p)
 {
     d->m_momentum = p;
+    d->Invalidate();
 }
 
 void IBMuonEventTTreeLNLdataReader::selectionCode(short code)
@@ -326,6 +579,7 @@ void IBMuonEventTTreeLNLdataReader::selectionCode(short code)
 void IBMuonEventTTreeLNLdataReader::setError(IBMuonError &e)
 {
     d->m_error = &e;
+    d->Invalidate();
 }
 
 void IBMuonEventTTreeLNLdataReader::setAcquisitionTime(float min)
@@ -349,14 +603,27 @@ unsigned long IBMuonEventTTreeLNLdataReader::getCurrentPosition()
     return d->m_pos;
 }
 
+void IBMuonEventTTreeLNLdataReader::setParallelReading(int workers, unsigned long chunk)
+{
+    d->SetWorkers(workers, chunk);
+}
+
 bool IBMuonEventTTreeLNLdataReader::readNext(MuonScatter *event)
 {
+    if(!d->m_workers.empty()) return d->ReadQueued(event);
     d->AcquireEvent();
     d->GetMuonScatter(event);
     return d->m_integrity;
 }
 
 
+unsigned long IBMuonEventTTreeLNLdataReader::readBatch(MuonScatter *events, unsigned long entries)
+{
+    if(!d->m_workers.empty()) return d->ReadQueued(events, entries);
+    return d->ReadSerial(events, entries);
+}
+
+
 void IBMuonEventTTreeLNLdataReader::setStartTime(float min)
 {
     std::cout << "\n---------------" << std::endl;
@@ -370,11 +637,6 @@ void IBMuonEventTTreeLNLdataReader::setStartTime(float min)
 
 void IBMuonEventTTreeLNLdataReader::setAlignmentFromData(float min)
 {
-    Matrix4f M = Matrix4f::Zero();
-    Vector4f K = Vector4f::Zero();
-    Vector2f w(1,1);
-    MuonScatter mu;
-
     unsigned long ev;
     if(min == 0)
         ev = d->m_max_event;
@@ -382,60 +644,70 @@ void IBMuonEventTTreeLNLdataReader::setAlignmentFromData(float min)
         ev = (unsigned long)(min * d->events_per_minute());
     }
 
-    int tot=0;
-    std::cout << "Aligning Reader with data.. \n";
-    for( int i=0; i<80; ++i) std::cout << "-"; std::cout << "\r";
-    for (unsigned long i=0; i<ev; i++) {
-        d->m_integrity = true;
-        d->m_tree->GetEntry(i);
-        d->GetMuonScatter(&mu);
-
-        if(d->m_integrity) {
-            float &x1 = mu.LineIn().origin(0);
-            float &x2 = mu.LineOut().origin(0);
-            float &z1 = mu.LineIn().origin(2);
-            float &z2 = mu.LineOut().origin(2);
-            float &tphi1 = mu.LineIn().direction(0);
-            float &tphi2 = mu.LineOut().direction(0);
-            float &tthe1 = mu.LineIn().direction(2);
-            float &tthe2 = mu.LineOut().direction(2);
-
-            Matrix4f Mi;
-            Mi <<
-                  w(0) * tphi1*tphi1 + w(1) * tthe1*tthe1, w(1) * x2 * tthe1 - w(0) * z2 * tphi1, w(0) * tphi1, w(1) * tthe1,
-                  w(1) * x2 * tthe1 - w(0) * z2 * tphi1,   w(0) * z2 * z2 + w(1) * x2 *x2,        -w(0) * z2,   w(1) * x2,
-                  w(0) * tphi1,                            -w(0) * z2,                             w(0),         0,
-                  w(1) * tthe1,                             w(1) * x2,                               0 ,         w(1);
-
-            M += Mi * 2;
-
-            Vector4f Ki = Vector4f::Zero();
-            Ki <<
-                  w(0) * (x1 - x2) * tphi1 + w(1) * (z1 - z2) * tthe1,
-                  w(0) * (x2 - x1) * z2  + w(1) * (z1 - z2) * x2,
-                  w(0) * (x1 - x2),
-                  w(1) * (z1 - z2);
-            K += Ki * 2;
-
-            tot++;
+    Vector4f X;
+    const std::string key = d->AlignmentKey(ev);
+    if(!d->m_alignCache.empty() &&
+            IBMuonAlignment::LoadCache(d->m_alignCache.c_str(), key, X)) {
+        std::cout << "ALIGNMENT FROM CACHE [H, Phi, x0, z0]: " << X.transpose() << "\n";
+    }
+    else {
+        // one batched pass from the first entry, in parallel with reading
+        // workers; errors are not needed here //
+        IBMuonAlignment alignment;
+        alignment.SetIterations(d->m_alignIterations);
+        const unsigned long pos = d->m_pos;
+        IBMuonError *error = d->m_error;
+        d->m_pos = 0;
+        d->m_error = NULL;
+        d->Invalidate();
+
+        std::cout << "Aligning Reader with data.. \n";
+        for( int i=0; i<80; ++i) std::cout << "-"; std::cout << "\r";
+        const unsigned long batch = std::max(ev / 80, 1UL);
+        Vector<MuonScatter> mu(batch);
+        for (unsigned long i=0; i<ev; i+=batch) {
+            unsigned long n = this->readBatch(&mu[0], std::min(batch, ev - i));
+            alignment.Add(&mu[0], n);
+            std::cout << "o" << std::flush;
+        }
+        std::cout << "\n";
+        d->m_pos = pos;
+        d->m_error = error;
+
+        if(!alignment.Solve(X)) {
+            std::cout << "ALIGNMENT FAILED: singular system from " << alignment.size() << " muons\n";
+            d->Invalidate();
+            return;
         }
-        if(tot++%(ev/80) == 0) std::cout << "o" << std::flush;
+        std::cout << "ALIGNMENT FOUND [H, Phi, x0, z0]: " << X.transpose()
+                  << " (" << alignment.GetRejected() * 100 << "% muons rejected)\n";
+        if(!d->m_alignCache.empty())
+            IBMuonAlignment::StoreCache(d->m_alignCache.c_str(), key, X);
     }
-    std::cout << "\n";
-    Vector4f X = M.inverse() * K;
-    std::cout << "ALIGNMENT FOUND [H, Phi, x0, z0]: " << X.transpose() << "\n";
 
     { // APPLY TO PIMPL TRANSFORM //
         Eigen::Affine3f &tr = d->m_align;
         tr.rotate(Eigen::AngleAxisf(-X(1),Vector3f(0,1,0)));
         tr.translation() += Vector3f(X(2),X(0)-tr.translation()(1),X(3));
     }
+    d->Invalidate();
 
 }
 
 void IBMuonEventTTreeLNLdataReader::setAlignment(Matrix4f align)
 {
     d->m_align = align;
+    d->Invalidate();
+}
+
+void IBMuonEventTTreeLNLdataReader::setAlignmentCache(const char *filename)
+{
+    d->m_alignCache = filename ? filename : "";
+}
+
+void IBMuonEventTTreeLNLdataReader::setAlignmentRobustIterations(int iterations)
+{
+    d->m_alignIterations = iterations;
 }
 
 Matrix4f IBMuonEventTTreeLNLdataReader::getAlignment()
@@ -36,7 +36,18 @@ public:
     void setAcquisitionTime(float min);
     void setStartTime(float min);
 
+    // entries are read by workers threads, each on its own handle of the
+    // file, in rounds of workers * chunk entries delivered in order by
+    // readNext. Zero workers reads serially on the calling thread //
+    void setParallelReading(int workers, unsigned long chunk = 4096);
+
+    // Alignment on the first min minutes of data (all if 0), see
+    // IBMuonAlignment: plain least squares unless robust iterations are
+    // set. With a cache file set, the result is stored there and reused for
+    // the same file, window, cuts, iterations and prior alignment //
     void setAlignmentFromData(float min = 0.0);
+    void setAlignmentCache(const char *filename);
+    void setAlignmentRobustIterations(int iterations);
     void setAlignment(Matrix4f align);
     Matrix4f getAlignment();
 
@@ -45,6 +56,7 @@ public:
     unsigned long getCurrentPosition();
 
     bool readNext(uLib::MuonScatter *event);
+    unsigned long readBatch(uLib::MuonScatter *events, unsigned long entries);
     
 private:
     friend class IBMuonEventTTreeLNLdataReaderPimpl;
@@ -17,6 +17,8 @@
 ////////////////////////////////////////////////////////////////////////////*/
 
 
+#include <thread>
+
 #include "TTree.h"
 #include "TFile.h"
 
@@ -59,3 +61,103 @@ IBMuonEventTTreeReader *IBMuonEventTTreeReader::New(TFile* f)
     printf("File or TTree not found! Aborting...\n");
     exit(1);
 }
+
+unsigned long IBMuonEventTTreeReader::readBatch(MuonScatter *events, unsigned long entries)
+{
+    unsigned long n = 0;
+    for (unsigned long i = 0; i < entries; ++i)
+        if (readNext(&events[n])) ++n;
+    return n;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+/////  PREFETCHER  /////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+class IBMuonEventPrefetcherPimpl {
+public:
+    IBMuonEventPrefetcherPimpl(IBMuonEventTTreeReader *reader,
+                               unsigned long entries, unsigned long batch) :
+        m_reader(reader),
+        m_entries(entries),
+        m_batch(batch ? batch : 1),
+        m_read(0),
+        m_delivered(0),
+        m_pending(0),
+        m_thread(NULL)
+    {
+        Start();
+    }
+
+    ~IBMuonEventPrefetcherPimpl()
+    {
+        Wait();
+    }
+
+    // reads the next batch into the back buffer on the background thread //
+    void Start()
+    {
+        m_pending = std::min(m_batch, m_entries - m_read);
+        if (!m_pending) return;
+        m_back.resize(m_pending);
+        m_thread = new std::thread(&IBMuonEventPrefetcherPimpl::Read, this);
+    }
+
+    void Read()
+    {
+        m_back.resize(m_reader->readBatch(&m_back[0], m_pending));
+    }
+
+    void Wait()
+    {
+        if (!m_thread) return;
+        m_thread->join();
+        delete m_thread;
+        m_thread = NULL;
+        m_read += m_pending;
+    }
+
+    bool Next(Vector<MuonScatter> &muons)
+    {
+        Wait();
+        if (!m_pending) {
+            muons.clear();
+            return false;
+        }
+        m_delivered = m_read;
+        muons.swap(m_back);
+        Start();
+        return true;
+    }
+
+    IBMuonEventTTreeReader *m_reader;
+    unsigned long m_entries;
+    unsigned long m_batch;
+    unsigned long m_read;
+    unsigned long m_delivered;
+    unsigned long m_pending;
+    Vector<MuonScatter> m_back;
+    std::thread *m_thread;
+};
+
+IBMuonEventPrefetcher::IBMuonEventPrefetcher(IBMuonEventTTreeReader *reader,
+                                             unsigned long entries,
+                                             unsigned long batch) :
+    d(new IBMuonEventPrefetcherPimpl(reader, entries, batch))
+{}
+
+IBMuonEventPrefetcher::~IBMuonEventPrefetcher()
+{
+    delete d;
+}
+
+bool IBMuonEventPrefetcher::next(Vector<MuonScatter> &muons)
+{
+    return d->Next(muons);
+}
+
+unsigned long IBMuonEventPrefetcher::position() const
+{
+    return d->m_delivered;
+}
@@ -20,6 +20,7 @@
 #ifndef IBMUONEVENTTTREEREADER_H
 #define IBMUONEVENTTTREEREADER_H
 
+#include "Core/Vector.h"
 #include "Detectors/MuonScatter.h"
 #include "IBMuonError.h"
 
@@ -47,15 +48,43 @@ public:
     virtual void setStartTime(float min)             {}
     virtual void setReadPCut(float pcut)             {}
     virtual void readPguess(bool yn=true)            {}
+    virtual void setParallelReading(int workers, unsigned long chunk = 4096) {}
     virtual unsigned long getNumberOfEvents()  = 0;
     virtual unsigned long getCurrentPosition() = 0;
 
     virtual bool readNext(uLib::MuonScatter* event) = 0;
 
+    // Reads the next entries entries as many readNext calls would, storing
+    // the good muons contiguously in events, that must have room for
+    // entries muons. Returns how many were filled //
+    virtual unsigned long readBatch(uLib::MuonScatter* events, unsigned long entries);
+
     virtual ~IBMuonEventTTreeReader() {}
 protected:
     IBMuonEventTTreeReader() {}
 
 };
 
+
+// Reads entries entries of a reader from its current position in batches,
+// one batch ahead of the consumer on a background thread: the next batch is
+// decoded while the current one is processed. The reader must not be used
+// directly until the prefetcher is destroyed //
+class IBMuonEventPrefetcher {
+public:
+    IBMuonEventPrefetcher(IBMuonEventTTreeReader *reader, unsigned long entries,
+                          unsigned long batch = 16384);
+    ~IBMuonEventPrefetcher();
+
+    // swaps the good muons of the next batch into muons, false when all
+    // the entries have been delivered //
+    bool next(uLib::Vector<uLib::MuonScatter> &muons);
+
+    // entries delivered so far //
+    unsigned long position() const;
+
+private:
+    class IBMuonEventPrefetcherPimpl *d;
+};
+
 #endif // IBMUONEVENTTTREEREADER_H
@@ -24,6 +24,8 @@
 #endif
 
 #include <vector>
+#include <algorithm>
+#include <Math/Utils.h>
 #include "IBNormalPlaneMinimizationVariablesEvaluator.h"
 
 // remove after test //
@@ -31,6 +33,148 @@
 #include "Vtk/vtkMuonScatter.h"
 #include "Vtk/uLibVtkViewer.h"
 
+namespace {
+
+// Forward mode derivative with respect to the six track direction components
+// (ingoing x,y,z then outgoing x,y,z), used to propagate the errors.
+struct Jet {
+    Scalarf v;
+    Scalarf d[6];
+
+    Jet(Scalarf value = 0) : v(value) { for(int i=0; i<6; ++i) d[i] = 0; }
+    Jet(Scalarf value, int seed) : v(value) {
+        for(int i=0; i<6; ++i) d[i] = 0;
+        d[seed] = 1;
+    }
+};
+
+inline Jet operator -(const Jet &a) {
+    Jet r(-a.v);
+    for(int i=0; i<6; ++i) r.d[i] = -a.d[i];
+    return r;
+}
+inline Jet operator +(const Jet &a, const Jet &b) {
+    Jet r(a.v + b.v);
+    for(int i=0; i<6; ++i) r.d[i] = a.d[i] + b.d[i];
+    return r;
+}
+inline Jet operator -(const Jet &a, const Jet &b) {
+    Jet r(a.v - b.v);
+    for(int i=0; i<6; ++i) r.d[i] = a.d[i] - b.d[i];
+    return r;
+}
+inline Jet operator *(const Jet &a, const Jet &b) {
+    Jet r(a.v * b.v);
+    for(int i=0; i<6; ++i) r.d[i] = a.d[i] * b.v + a.v * b.d[i];
+    return r;
+}
+inline Jet operator /(const Jet &a, const Jet &b) {
+    Jet r(a.v / b.v);
+    for(int i=0; i<6; ++i) r.d[i] = (a.d[i] - r.v * b.d[i]) / b.v;
+    return r;
+}
+inline Jet Sqrt(const Jet &a) {
+    Jet r(sqrt(a.v));
+    for(int i=0; i<6; ++i) r.d[i] = a.d[i] / (2 * r.v);
+    return r;
+}
+inline Jet Atan2(const Jet &y, const Jet &x) {
+    Jet r(atan2(y.v, x.v));
+    Scalarf den = x.v * x.v + y.v * y.v;
+    for(int i=0; i<6; ++i) r.d[i] = (x.v * y.d[i] - y.v * x.d[i]) / den;
+    return r;
+}
+inline Jet Acos(const Jet &x) {
+    Jet r(acos(x.v));
+    Scalarf den = -sqrt(1 - x.v * x.v);
+    for(int i=0; i<6; ++i) r.d[i] = x.d[i] / den;
+    return r;
+}
+
+// plain values go through the same kernel //
+inline Scalarf Sqrt(Scalarf a) { return sqrt(a); }
+inline Scalarf Atan2(Scalarf y, Scalarf x) { return atan2(y, x); }
+inline Scalarf Acos(Scalarf x) { return acos(x); }
+inline Scalarf Value(Scalarf a) { return a; }
+inline Scalarf Value(const Jet &a) { return a.v; }
+
+// in place rotations of compileYRotation / compileZRotation with (cos,sin) //
+template < class T >
+inline void RotateY(const T &c, const T &s, T v[3]) {
+    T x = c * v[0] + s * v[2];
+    v[2] = c * v[2] - s * v[0];
+    v[0] = x;
+}
+template < class T >
+inline void RotateZ(const T &c, const T &s, T v[3]) {
+    T x = c * v[0] - s * v[1];
+    v[1] = s * v[0] + c * v[1];
+    v[0] = x;
+}
+
+static const int MinVarBlockSize = 16;
+
+// Normal plane variables without trigonometry: the YZY rotation of
+// getRotationMatrix is composed from the director cosines directly and only
+// the two scattering angles need an atan2.
+struct NormalPlaneModel {
+    bool    oneD, scatterOnly, displacementOnly, freeRotation;
+    Scalarf alphaXZ, cosAlpha, sinAlpha;
+
+    // D is the exit point minus the ingoing origin, or the outgoing minus the
+    // ingoing origin in 1D mode. Returns false where the variables are not
+    // differentiable (no scattering in 1D mode) //
+    template < class T >
+    bool evaluate(const T din[3], const T dout[3], const T D[3], T out[4]) const
+    {
+        T n = Sqrt(din[0]*din[0] + din[1]*din[1] + din[2]*din[2]);
+        T dc[3] = { din[0]/n, din[1]/n, din[2]/n };
+
+        if(oneD) {
+            T nB = Sqrt(dout[0]*dout[0] + dout[1]*dout[1] + dout[2]*dout[2]);
+            T alpha = dc[0]*D[0] + dc[1]*D[1] + dc[2]*D[2];
+            T BC[3] = { D[0] - alpha*dc[0], D[1] - alpha*dc[1], D[2] - alpha*dc[2] };
+            T disp = Sqrt(BC[0]*BC[0] + BC[1]*BC[1] + BC[2]*BC[2]);
+            T cosTheta = (dc[0]*dout[0] + dc[1]*dout[1] + dc[2]*dout[2]) / nB;
+            bool flat = fabs(1. - Value(cosTheta)) < 1e-6;
+            T scat = (displacementOnly || flat) ? T(0) : Acos(cosTheta);
+            if(scatterOnly) disp = T(0);
+            out[0] = scat; out[1] = disp; out[2] = scat; out[3] = disp;
+            return displacementOnly || !flat;
+        }
+
+        T r  = Sqrt(dc[0]*dc[0] + dc[2]*dc[2]);
+        T c1 = dc[0]/r, s1 = dc[2]/r;
+        T q  = Sqrt(dc[1]*dc[1] + r*r);
+        T cz = dc[1]/q, sz = r/q;
+        T c2, s2;
+        if(!freeRotation) {
+            T ax = dc[0]*(1-alphaXZ) + dc[0]*dc[1]*alphaXZ;
+            T az = -(dc[2]*dc[1])*(1-alphaXZ) - dc[2]*alphaXZ;
+            T na = Sqrt(ax*ax + az*az);
+            c2 = ax/na; s2 = az/na;
+        }
+        else {
+            c2 = T(cosAlpha);
+            s2 = T(sinAlpha);
+        }
+
+        T disp[3] = { D[0], D[1], D[2] };
+        T scat[3] = { dout[0], dout[1], dout[2] };
+        RotateY(c1,s1,disp); RotateZ(cz,sz,disp); RotateY(c2,s2,disp);
+        RotateY(c1,s1,scat); RotateZ(cz,sz,scat); RotateY(c2,s2,scat);
+
+        out[0] = Atan2(scat[0],scat[1]);
+        out[1] = disp[0];
+        out[2] = Atan2(scat[2],scat[1]);
+        out[3] = disp[2];
+        return true;
+    }
+};
+
+} // namespace
+
+
 class IBNormalPlaneMinimizationVariablesEvaluatorPimpl {
 
 public:
@@ -87,35 +231,11 @@ public:
     bool evaluate(MuonScatterData muon) {
 
         m_muon = muon;
-
-        m_integrity = true;
-
-        m_ErrorMatrix << 0,0,0,0,
-                         0,0,0,0,
-                         0,0,0,0,
-                         0,0,0,0;
-
-        m_Data        << 0,0,0,0;
-
-        m_Data        = this->evaluateVariables(  m_muon.LineIn(), m_muon.LineOut());
-
-        if (unlikely((fabs(m_Data(0)) > 1)||(fabs(m_Data(2)) > 1))){ // << HARDCODED!!!
-              //std::cout << "Rejecting muon..... scattering >1" << std::endl;
-              m_integrity = false;
-        }
-        m_ErrorMatrix = this->evaluateErrorMatrix(m_muon.LineIn(), m_muon.LineOut());
-
-        // SV 20160930: FIXED!
-        if (unlikely((m_ErrorMatrix(0,0)>0.03 || m_ErrorMatrix(1,1)>1500 ||
-                      m_ErrorMatrix(2,2)>0.03 || m_ErrorMatrix(3,3)>1500 ))){ // << HARDCODED
-            //std::cout << "Rejecting muon..... abnormal error matrix " << std::endl;
-            m_integrity = false;
-        }
-	
-        //std::cout << "Muon variables : " << m_Data << "-----------> integrity " << m_integrity << std::endl;
+        this->evaluate(&m_muon, 1, &m_Data, &m_ErrorMatrix, &m_integrity);
 
 #ifndef NDEBUG
         if (m_integrity) {
+            if (m_parent->$$.use_free_rotation) m_alpha = m_parent->$$.alphaXZ;
             EV.mx_in = m_muon.LineIn().direction(0);
             EV.my_in = m_muon.LineIn().direction(1);
             EV.mz_in = m_muon.LineIn().direction(2);
@@ -181,7 +301,8 @@ public:
 
             DT.displNorm = sqrt(m_Data(1)*m_Data(1)+m_Data(3)*m_Data(3));
             Vector4f n = getDirectorCosines(m_muon.LineIn().direction());
-            Vector4f projected  = projectOnContainer(m_muon.LineOut());
+            Vector4f projected;
+            projectOnContainer(m_muon.LineOut(), projected);
             Vector4f diff = m_muon.LineIn().origin()-projected;
             float scal = diff.transpose()*n;
             Vector4f b = diff-scal*n;
@@ -196,10 +317,87 @@ public:
 
 
 
+    ////////////////////////////////////////////////////////////////////////////
+    // EVALUATE BATCH //
+
+    NormalPlaneModel model() const
+    {
+        NormalPlaneModel m;
+        m.oneD             = m_parent->m_oneD;
+        m.scatterOnly      = m_parent->m_scatterOnly;
+        m.displacementOnly = m_parent->m_displacementOnly;
+        m.freeRotation     = m_parent->$$.use_free_rotation;
+        m.alphaXZ          = m_parent->$$.alphaXZ;
+        m.cosAlpha         = cos(m.alphaXZ);
+        m.sinAlpha         = sin(m.alphaXZ);
+        return m;
+    }
+
+    // Stateless: blocks of muons are gathered in SoA form, the variables are
+    // evaluated across the block and the errors per muon //
+    void evaluate(const MuonScatterData *muons, unsigned int size, Vector4f *data,
+                  Matrix4f *covariance, bool *integrity) const
+    {
+        const NormalPlaneModel np = this->model();
+        const int nblocks = (size + MinVarBlockSize - 1) / MinVarBlockSize;
+
+        #pragma omp parallel for schedule(static) if(nblocks > 1)
+        for (int b = 0; b < nblocks; ++b) {
+            const unsigned int first = b * MinVarBlockSize;
+            const int n = std::min<unsigned int>(MinVarBlockSize, size - first);
+            Scalarf  din[3][MinVarBlockSize], dout[3][MinVarBlockSize],
+                     D[3][MinVarBlockSize], var[4][MinVarBlockSize];
+            Vector4f prj[MinVarBlockSize];
+            bool     ok[MinVarBlockSize];
+
+            for (int i = 0; i < n; ++i) {
+                const MuonScatterData &mu = muons[first + i];
+                ok[i] = true;
+                if (np.oneD) prj[i] = mu.LineOut().origin();
+                else ok[i] = projectOnContainer(mu.LineOut(), prj[i]);
+                for (int k = 0; k < 3; ++k) {
+                    din[k][i]  = mu.LineIn().direction()(k);
+                    dout[k][i] = mu.LineOut().direction()(k);
+                    D[k][i]    = prj[i](k) - mu.LineIn().origin()(k);
+                }
+            }
+
+            #pragma omp simd
+            for (int i = 0; i < n; ++i) {
+                Scalarf a[3] = { din[0][i], din[1][i], din[2][i] };
+                Scalarf o[3] = { dout[0][i], dout[1][i], dout[2][i] };
+                Scalarf d[3] = { D[0][i], D[1][i], D[2][i] };
+                Scalarf v[4];
+                np.evaluate(a, o, d, v);
+                for (int k = 0; k < 4; ++k) var[k][i] = v[k];
+            }
+
+            for (int i = 0; i < n; ++i) {
+                const MuonScatterData &mu = muons[first + i];
+                Vector4f Di(var[0][i], var[1][i], var[2][i], var[3][i]);
+                bool good = ok[i];
+                if (unlikely((fabs(Di(0)) > 1)||(fabs(Di(2)) > 1))) // << HARDCODED!!!
+                    good = false;
+                Matrix4f E = this->evaluateErrorMatrix(mu, Di, prj[i], good);
+                // SV 20160930: FIXED!
+                if (unlikely((E(0,0)>0.03 || E(1,1)>1500 ||
+                              E(2,2)>0.03 || E(3,3)>1500 ))) // << HARDCODED
+                    good = false;
+                if (data)       data[first + i] = Di;
+                if (covariance) covariance[first + i] = E;
+                if (integrity)  integrity[first + i] = good;
+            }
+        }
+    }
+
+
+
     ////////////////////////////////////////////////////////////////////////////
     // EVALUATE VARIABLES //
 
-    Vector4f evaluateVariables(const HLine3f &ingoing_track, const HLine3f &outgoing_track)
+    // reference model with rotation matrices, used by the finite differences //
+    Vector4f evaluateVariables(const HLine3f &ingoing_track, const HLine3f &outgoing_track,
+                               bool &integrity) const
     {
       Vector4f out;
       if(m_parent->m_oneD){
@@ -222,7 +420,8 @@ public:
 	if(fabs(1.-cosTheta) < 1e-6) scat = 0.;
 	if(scat!=scat){
       Matrix4f  rotation_matrix = this->getRotationMatrix(ingoing_track.direction());
-	  Vector4f  prj  = this->projectOnContainer(outgoing_track);
+	  Vector4f  prj;
+	  this->projectOnContainer(outgoing_track, prj);
       Vector4f scat1 = rotation_matrix * outgoing_track.direction(); //this->getDirectorCosines(outgoing_track.direction);
 	  Scalarf scat_x = atan2(scat1(0),scat1(1));
 	  Scalarf scat_z = atan2(scat1(2),scat1(1));
@@ -235,7 +434,8 @@ public:
       else{
 	//----> OLD     
     Matrix4f  rotation_matrix = this->getRotationMatrix(ingoing_track.direction());
-	Vector4f  prj  = this->projectOnContainer(outgoing_track);
+	Vector4f  prj;
+	if (!this->projectOnContainer(outgoing_track, prj)) integrity = false;
     Vector4f disp = rotation_matrix * (prj - ingoing_track.origin());
     Vector4f scat = rotation_matrix * outgoing_track.direction(); //this->getDirectorCosines(outgoing_track.direction);
 	
@@ -252,15 +452,110 @@ public:
     ////////////////////////////////////////////////////////////////////////////
     // EVALUATE ERRORS //
 
-    Matrix4f evaluateErrorMatrix(const HLine3f &ingoing_track, const HLine3f &outgoing_track)
+    // J diag(err^2) J^T with the analytic jacobian, falls back to finite
+    // differences where the jacobian is not defined //
+    Matrix4f evaluateErrorMatrix(const MuonScatterData &muon, const Vector4f &data,
+                                 const Vector4f &prj, bool &integrity) const
+    {
+        Eigen::Matrix<Scalarf,4,6> J;
+        if (!integrity) return Matrix4f::Zero();
+        if (m_parent->$$.finite_difference_errors ||
+                !evaluateJacobian(muon, prj, J, integrity)) {
+            if (!integrity) return Matrix4f::Zero();
+            return evaluateErrorMatrixFD(muon, data, integrity);
+        }
+
+        Eigen::Matrix<Scalarf,6,1> err2;
+        for (int i=0; i<3; ++i) {
+            err2(i)   = muon.ErrorIn().direction(i)  * muon.ErrorIn().direction(i);
+            err2(i+3) = muon.ErrorOut().direction(i) * muon.ErrorOut().direction(i);
+        }
+        return J * err2.asDiagonal() * J.transpose();
+    }
+
+    // derivatives of the four variables with respect to the ingoing and
+    // outgoing direction components, prj is the exit point of the muon.
+    // As the finite differences, integrity is cleared when an outgoing
+    // track moved by +-1 sigma misses the container //
+    bool evaluateJacobian(const MuonScatterData &muon, const Vector4f &prj,
+                          Eigen::Matrix<Scalarf,4,6> &J, bool &integrity) const
     {
+        const NormalPlaneModel np = this->model();
+        const HLine3f &ingoing_track  = muon.LineIn();
+        const HLine3f &outgoing_track = muon.LineOut();
+
+        Jet din[3], dout[3], D[3];
+        for (int i=0; i<3; ++i) {
+            din[i]  = Jet(ingoing_track.direction()(i), i);
+            dout[i] = Jet(outgoing_track.direction()(i), i+3);
+        }
+
+        if (np.oneD) {
+            for (int a=0; a<3; ++a)
+                D[a] = Jet(outgoing_track.origin()(a) - ingoing_track.origin()(a));
+        }
+        else {
+            // The exit point slides on the container face it crosses: with
+            // pt = o + t d on the face of axis k, dpt/dd_j = t (e_j - d e_k^T / d_k).
+            // Containers here are axis aligned, so the face is the coordinate
+            // that stays fixed when the direction is slightly tilted.
+            const Vector4f &o = outgoing_track.origin();
+            const Vector4f &d = outgoing_track.direction();
+            Vector4f probe;
+            for (int i=0; i<3; ++i) {
+                const Scalarf e = muon.ErrorOut().direction(i);
+                if (e == 0.f) continue;
+                for (int sign=-1; sign<=1; sign+=2) {
+                    HLine3f variation = outgoing_track;
+                    variation.direction(i) += sign * e;
+                    if (!m_tracer->GetExitPoint(variation, probe)) {
+                        integrity = false;
+                        return false;
+                    }
+                }
+            }
+            HLine3f tilted = outgoing_track;
+            Scalarf eps = 1e-3 * d.head<3>().norm();
+            tilted.direction() += eps * Vector4f(1,2,4,0);
+            if (!m_tracer->GetExitPoint(tilted, probe)) return false;
+            int k = 0;
+            Vector3f shift = (probe - prj).head<3>().cwiseAbs();
+            shift.minCoeff(&k);
+            // probe crossed an edge into another face //
+            if (shift(k) > 1e-4 * (1 + fabs(prj(k))) || d(k) == 0) return false;
+            Scalarf t = (prj(k) - o(k)) / d(k);
+
+            for (int a=0; a<3; ++a) {
+                D[a] = Jet(prj(a) - ingoing_track.origin()(a));
+                for (int j=0; j<3; ++j)
+                    D[a].d[3+j] = t * ((a==j) - (j==k) * d(a) / d(k));
+            }
+        }
+
+        Jet out[4];
+        if (!np.evaluate(din, dout, D, out)) return false;
+        for (int i=0; i<4; ++i)
+            for (int j=0; j<6; ++j) {
+                if (!isFinite(out[i].d[j])) return false;
+                J(i,j) = out[i].d[j];
+            }
+        return true;
+    }
+
+    // central finite differences on each direction component, kept to
+    // validate the analytic propagation //
+    Matrix4f evaluateErrorMatrixFD(const MuonScatterData &muon, const Vector4f &data,
+                                   bool &integrity) const
+    {
+        const HLine3f &ingoing_track  = muon.LineIn();
+        const HLine3f &outgoing_track = muon.LineOut();
         Matrix4f covariance_p,
                  covariance_m;
         covariance_p << 0,0,0,0,
                         0,0,0,0,
                         0,0,0,0,
                         0,0,0,0;
-        if (!m_integrity) return covariance_p;
+        if (!integrity) return covariance_p;
         covariance_m << 0,0,0,0,
                         0,0,0,0,
                         0,0,0,0,
@@ -274,29 +569,29 @@ public:
         //  in  //
         //////////
         for (int i=0; i<3; ++i) {
-            if (m_muon.ErrorIn().direction(i)==0.f) {
-                plus[i] = m_Data;
+            if (muon.ErrorIn().direction(i)==0.f) {
+                plus[i] = data;
                 continue;
             }
             HLine3f in_variations = ingoing_track;
-            in_variations.direction(i) += m_muon.ErrorIn().direction(i);
-            plus[i] = evaluateVariables(in_variations, outgoing_track);
+            in_variations.direction(i) += muon.ErrorIn().direction(i);
+            plus[i] = evaluateVariables(in_variations, outgoing_track, integrity);
         }
         /////////
         // out //
         /////////
         for (int i=0; i<3; ++i) {
-            if (m_muon.ErrorOut().direction(i)==0.f) {
-                plus[i+3] = m_Data;
+            if (muon.ErrorOut().direction(i)==0.f) {
+                plus[i+3] = data;
                 continue;
             }
             HLine3f out_variations = outgoing_track;
-            out_variations.direction(i) += m_muon.ErrorOut().direction(i);
-            plus[i+3] = evaluateVariables(ingoing_track, out_variations);
+            out_variations.direction(i) += muon.ErrorOut().direction(i);
+            plus[i+3] = evaluateVariables(ingoing_track, out_variations, integrity);
         }
         Vector4f d_plus[6]; // Vector4f indexes run over j, array elements over i
         for (int j=0; j<6; ++j){
-            d_plus[j] = plus[j]-m_Data;
+            d_plus[j] = plus[j]-data;
         }
 
         for (int i=0; i<4; ++i){
@@ -315,29 +610,29 @@ public:
         //  in  //
         //////////
         for (int i=0; i<3; ++i) {
-            if (m_muon.ErrorIn().direction(i)==0.f) {
-                minus[i] = m_Data;
+            if (muon.ErrorIn().direction(i)==0.f) {
+                minus[i] = data;
                 continue;
             }
             HLine3f in_variations = ingoing_track;
-            in_variations.direction(i) -= m_muon.ErrorIn().direction(i);
-            minus[i] = evaluateVariables(in_variations, outgoing_track);
+            in_variations.direction(i) -= muon.ErrorIn().direction(i);
+            minus[i] = evaluateVariables(in_variations, outgoing_track, integrity);
         }
         /////////
         // out //
         /////////
         for (int i=0; i<3; ++i) {
-            if (m_muon.ErrorOut().direction(i)==0.f) {
-                minus[i+3] = m_Data;
+            if (muon.ErrorOut().direction(i)==0.f) {
+                minus[i+3] = data;
                 continue;
             }
             HLine3f out_variations = outgoing_track;
-            out_variations.direction(i) -= m_muon.ErrorOut().direction(i);
-            minus[i+3] = evaluateVariables(ingoing_track, out_variations);
+            out_variations.direction(i) -= muon.ErrorOut().direction(i);
+            minus[i+3] = evaluateVariables(ingoing_track, out_variations, integrity);
         }
         Vector4f d_minus[6]; // Vector4f indexes run over j, array elements over i
         for (int j=0; j<6; ++j){
-            d_minus[j] = m_Data-minus[j];
+            d_minus[j] = data-minus[j];
         }
 
         for (int i=0; i<4; ++i){
@@ -365,7 +660,7 @@ public:
         return v;
     }
 
-    Matrix4f getRotationMatrix(const Vector4f &track_direction)
+    Matrix4f getRotationMatrix(const Vector4f &track_direction) const
     {
 
         // directors cosines
@@ -387,8 +682,7 @@ public:
             secnd_y_rotation = compileYRotation(  alphaX * (1-weight) + alphaZ * (weight) );
         }
         else {
-            m_alpha = m_parent->$$.alphaXZ;
-            secnd_y_rotation = compileYRotation(m_alpha);
+            secnd_y_rotation = compileYRotation(m_parent->$$.alphaXZ);
         }
 
         Matrix4f out = secnd_y_rotation * first_z_rotation * first_y_rotation;
@@ -540,15 +834,14 @@ public:
         return out;
     }
 
-    Vector4f projectOnContainer(const HLine3f &muon_out_track)
+    bool projectOnContainer(const HLine3f &muon_out_track, Vector4f &pt) const
     {
-        Vector4f pt;
+        pt = Vector4f::Zero();
         if (!m_tracer->GetExitPoint(muon_out_track, pt)){
             //std::cout << "GetExitPoint failure....." << std::endl;
-            m_integrity = false;
+            return false;
         }
-
-        return pt;
+        return true;
     }
 
     void evaluateAlpha(Scalarf& phi, Scalarf& theta) {
@@ -650,6 +943,15 @@ bool IBNormalPlaneMinimizationVariablesEvaluator::evaluate(MuonScatterData muon)
     return d->m_integrity;
 }
 
+void IBNormalPlaneMinimizationVariablesEvaluator::evaluate(const MuonScatterData *muons,
+                                                           unsigned int size,
+                                                           Vector4f *data,
+                                                           Matrix4f *covariance,
+                                                           bool *integrity) const
+{
+    d->evaluate(muons, size, data, covariance, integrity);
+}
+
 Vector4f IBNormalPlaneMinimizationVariablesEvaluator::getDataVector()
 {
     return d->m_Data;
@@ -36,6 +36,7 @@ public:
     ULIB_props() {
         bool    use_free_rotation;
         Scalarf alphaXZ;
+        bool    finite_difference_errors; // validation: errors by +-1 sigma variations
     };
 
     bool m_scatterOnly, m_displacementOnly, m_oneD;
@@ -45,6 +46,9 @@ public:
 
     bool evaluate(MuonScatterData muon);
 
+    void evaluate(const MuonScatterData *muons, unsigned int size,
+                  Vector4f *data, Matrix4f *covariance, bool *integrity) const;
+
     Vector4f getDataVector();
     Scalarf  getDataVector(int i);
     Matrix4f getCovarianceMatrix();
@@ -61,6 +65,7 @@ inline void IBNormalPlaneMinimizationVariablesEvaluator::init_properties() {
     $_init();
     $$.use_free_rotation = 0;
     $$.alphaXZ = 1; // 0 = X ---> 1 = Z
+    $$.finite_difference_errors = 0;
 }
 
 
@@ -22,33 +22,37 @@
 
 
 #include <Core/StaticInterface.h>
+#include <Core/Vector.h>
 #include <Math/Dense.h>
 
 
 using namespace uLib;
 
 
+// Each algorithm gives pw as a function of the radiation path Xres, either
+// the residual one after the element (Cumulative) or the whole track. The
+// Weight functor holds the constants, computed once per batch.
+
 template <class EventT>
 class IBPWeightAlgorithm_PW {
 
 public:
-    static void evaluate(EventT *evc, Scalarf nominalp) {
-        float pw_A = 1.42857;
-        float pw_epsilon = 4.0;
-        float Xres = 0;
-        for (int j = evc->elements.size(); j --> 0;) //BACKWARD
-        {
-            float L = evc->elements[j].Wij(0,0);
-
-            evc->elements[j].pw = pw_A * (nominalp) *
-                    sqrt(pw_epsilon/(Xres + pw_epsilon));
-            //        Xres += (evc->elements[j].voxel->Value * 1.E6 < 2.5) ?
-            //                    L * evc->elements[j].voxel->Value * 40000 :
-            //                    L * 2.5 * 0.04;
-            Xres += L * evc->elements[j].voxel->Value * 40000;
+    enum { Cumulative = 1 };
+
+    struct Weight {
+        Weight(Scalarf nominalp) :
+            pw_A(1.42857 * nominalp),
+            pw_epsilon(4.0) {}
+
+        Scalarf operator()(Scalarf Xres) const {
+            return pw_A * sqrt(pw_epsilon/(Xres + pw_epsilon));
         }
-    }
 
+        Scalarf pw_A;
+        Scalarf pw_epsilon;
+    };
+
+    static void evaluate(EventT *evc, Scalarf nominalp);
 };
 
 
@@ -56,68 +60,174 @@ template <class EventT>
 class IBPWeightAlgorithm_SW {
 
 public:
-    static void evaluate(EventT *evc, Scalarf nominalp) {
-        float scale = 0.8;   //this is experimental and empirical!
-        float alpha = 0.436; // this is the distribution peak angle, 25 degrees
-        // note: albeit NOT efficient, this procedure is fundamental in testing the algorithm capability
-        TODO("Optimize PW functions");
-        float b1 = 13.52; // Iron Values
-        float b2 = 319.9;
-        float c1 = 3.73E-4;
-        float c2 = 2.55E-2;
-        float d = 2.33;
-        float e = 1.56;
-
-        float sw_epsilon_1 = scale * sqrt(b1 + c1 * alpha * alpha);
-        float sw_epsilon_2 = scale * sqrt(b2 + c2 * alpha * alpha);
-        float sw_A = d + e * cos(alpha) * cos(alpha);
-
-        float Xres = 0;
-        Matrix4f Wij;
-        for (int j = evc->elements.size(); j --> 0;) //BACKWARD
-        {
-            Wij = evc->elements[j].Wij;
-
-            evc->elements[j].pw = (nominalp) * sqrt( sw_A /
-                    (Xres/sw_epsilon_1 + pow(Xres/sw_epsilon_2,2) + 1) );
-        /*
-            Xres += (evc->elements[j].voxel->density * 1.E6 < 2.5) ?
-                    Wij[0] * evc->elements[j].voxel->density * 40000 :
-                    Wij[0] * 2.5 * 0.04;
-            */
-            Xres += Wij(0,0) * evc->elements[j].voxel->Value * 40000; //<- previous version of
-                                          // p_weight: bugged but enhancing!
+    enum { Cumulative = 1 };
+
+    struct Weight {
+        Weight(Scalarf nominalp) {
+            float scale = 0.8;   //this is experimental and empirical!
+            float alpha = 0.436; // this is the distribution peak angle, 25 degrees
+            float b1 = 13.52; // Iron Values
+            float b2 = 319.9;
+            float c1 = 3.73E-4;
+            float c2 = 2.55E-2;
+            float d = 2.33;
+            float e = 1.56;
+
+            sw_epsilon_1 = 1 / (scale * sqrt(b1 + c1 * alpha * alpha));
+            sw_epsilon_2 = 1 / (scale * sqrt(b2 + c2 * alpha * alpha));
+            sw_A  = d + e * cos(alpha) * cos(alpha);
+            sw_P  = nominalp;
+        }
+
+        Scalarf operator()(Scalarf Xres) const {
+            Scalarf x2 = Xres * sw_epsilon_2;
+            return sw_P * sqrt( sw_A / (Xres * sw_epsilon_1 + x2 * x2 + 1) );
         }
-    }
 
+        // inverse of the epsilons //
+        Scalarf sw_epsilon_1;
+        Scalarf sw_epsilon_2;
+        Scalarf sw_A;
+        Scalarf sw_P;
+    };
 
+    static void evaluate(EventT *evc, Scalarf nominalp);
 };
 
 
 template <class EventT>
 class IBAnalyzerAlgorithm_CW {
 public:
-    static void evaluate(EventT *evc, Scalarf nominalp){
-        float cw_A = 1.42857;
-        float cw_epsilon = 50;
-        float X0_tot = 0;
-        Matrix4f Wij;
-        for (int j = 0; j < evc->elements.size(); ++j)
-        {
-            Wij = evc->elements[j].Wij;
-            /*X0_tot += (evc->elements[j].voxel->density * 1.E6 < 2.5 ) ?
-                     Wij[0] * evc->elements[j].voxel->density * 40000 :
-                     Wij[0] * 2.5 * 0.04;
-             */
-            X0_tot += Wij(0,0) * evc->elements[j].voxel->Value * 40000;
-        }
+    enum { Cumulative = 0 };
+
+    struct Weight {
+        Weight(Scalarf nominalp) :
+            cw_A(1.42857 * nominalp),
+            cw_epsilon(50) {}
 
-        float _pw = cw_A * (nominalp) *
-                sqrt( cw_epsilon / ( X0_tot + cw_epsilon ));
-        for (int i = 0; i < evc->elements.size(); ++i )
-        {
-            evc->elements[i].pw = _pw;
+        Scalarf operator()(Scalarf X0_tot) const {
+            return cw_A * sqrt( cw_epsilon / ( X0_tot + cw_epsilon ));
         }
+
+        Scalarf cw_A;
+        Scalarf cw_epsilon;
+    };
+
+    static void evaluate(EventT *evc, Scalarf nominalp);
+};
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//// BATCHED EVALUATION ////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+
+// pw of one event: the path terms are scanned backward into the residual
+// path of each element, then the weight runs over the contiguous buffer //
+template <class AlgorithmT, class EventT>
+inline void IBPWeightEvaluate(EventT *evc,
+                              const typename AlgorithmT::Weight &weight,
+                              Vector<Scalarf> &buffer)
+{
+    const int size = evc->elements.size();
+    if(size == 0) return;
+
+    if(!AlgorithmT::Cumulative) {
+        Scalarf X0_tot = 0;
+        for (int j = 0; j < size; ++j)
+            X0_tot += evc->elements[j].Wij(0,0) * evc->elements[j].voxel->Value * 40000;
+        Scalarf pw = weight(X0_tot);
+        for (int j = 0; j < size; ++j)
+            evc->elements[j].pw = pw;
+        return;
+    }
+
+    buffer.resize(size);
+    Scalarf *X = &buffer[0];
+    Scalarf Xres = 0;
+    for (int j = size; j --> 0;) { //BACKWARD
+        X[j] = Xres;
+        Xres += evc->elements[j].Wij(0,0) * evc->elements[j].voxel->Value * 40000;
+    }
+    #pragma omp simd
+    for (int j = 0; j < size; ++j)
+        X[j] = weight(X[j]);
+    for (int j = 0; j < size; ++j)
+        evc->elements[j].pw = X[j];
+}
+
+// pw of all events, run after each density update //
+template <class AlgorithmT, class EventT>
+inline void IBPWeightEvaluate(Vector<EventT> &events, Scalarf nominalp)
+{
+    const typename AlgorithmT::Weight weight(nominalp);
+    const int size = events.size();
+    #pragma omp parallel
+    {
+        Vector<Scalarf> buffer;
+        #pragma omp for schedule(dynamic, 1024)
+        for (int i = 0; i < size; ++i)
+            IBPWeightEvaluate<AlgorithmT>(&events[i], weight, buffer);
+    }
+}
+
+
+// pw of a single event, in place and without scratch: the per event entry
+// points stay allocation free, the batch above is for whole collections //
+template <class AlgorithmT, class EventT>
+inline void IBPWeightEvaluate(EventT *evc, const typename AlgorithmT::Weight &weight)
+{
+    const int size = evc->elements.size();
+    if(!AlgorithmT::Cumulative) {
+        Scalarf X0_tot = 0;
+        for (int j = 0; j < size; ++j)
+            X0_tot += evc->elements[j].Wij(0,0) * evc->elements[j].voxel->Value * 40000;
+        Scalarf pw = weight(X0_tot);
+        for (int j = 0; j < size; ++j)
+            evc->elements[j].pw = pw;
+        return;
+    }
+    Scalarf Xres = 0;
+    for (int j = size; j --> 0;) { //BACKWARD
+        evc->elements[j].pw = weight(Xres);
+        Xres += evc->elements[j].Wij(0,0) * evc->elements[j].voxel->Value * 40000;
+    }
+}
+
+template <class EventT>
+void IBPWeightAlgorithm_PW<EventT>::evaluate(EventT *evc, Scalarf nominalp) {
+    IBPWeightEvaluate<IBPWeightAlgorithm_PW>(evc, Weight(nominalp));
+}
+
+template <class EventT>
+void IBPWeightAlgorithm_SW<EventT>::evaluate(EventT *evc, Scalarf nominalp) {
+    IBPWeightEvaluate<IBPWeightAlgorithm_SW>(evc, Weight(nominalp));
+}
+
+template <class EventT>
+void IBAnalyzerAlgorithm_CW<EventT>::evaluate(EventT *evc, Scalarf nominalp) {
+    IBPWeightEvaluate<IBAnalyzerAlgorithm_CW>(evc, Weight(nominalp));
+}
+
+
+
+namespace IBAbstract {
+
+// optional stage of the EM iteration recomputing pw after each update //
+template <class EventT>
+struct IBPWeightStage {
+    virtual ~IBPWeightStage() {}
+    virtual void operator()(Vector<EventT> &events, Scalarf nominalp) = 0;
+};
+
+}
+
+template <class AlgorithmT, class EventT>
+struct IBPWeightEngine : IBAbstract::IBPWeightStage<EventT> {
+    void operator()(Vector<EventT> &events, Scalarf nominalp) {
+        IBPWeightEvaluate<AlgorithmT>(events, nominalp);
     }
 };
 
@@ -43,6 +43,9 @@ public:
     static IBPocaEvaluator* New(enum IBPocaEvaluationAlgorithms S);
 
     virtual bool evaluate(MuonScatterData muon) = 0;
+    // stateless batch over size muons, safe to call from many threads //
+    virtual void evaluate(const MuonScatterData *muons, unsigned int size,
+                          Vector4f *poca, bool *integrity) const = 0;
     virtual Vector4f getPoca() = 0;
     virtual Vector4f getInTrackPoca() = 0;
     virtual Vector4f getOutTrackPoca() = 0;
@@ -25,8 +25,64 @@
 
 #include <stdio.h>
 #include <vector>
+#include <algorithm>
 #include "IBSimpleTwoViewsMinimizationVariablesEvaluator.h"
 
+namespace {
+
+static const int MinVarBlockSize = 16;
+
+// Two views variables without trigonometry. With (c,s) the cosine and sine
+// of the projected angle m = atan2(dc(0),-dc(1)): tan(m) = s/c and
+// cos(mo-m) = co*c + so*s, so only the scattering needs one atan2 per view.
+struct TwoViewsBlock {
+    // inputs: in/out directions, entry and exit points, in direction errors //
+    Scalarf din[3][MinVarBlockSize], dout[3][MinVarBlockSize];
+    Scalarf in[3][MinVarBlockSize], out[3][MinVarBlockSize];
+    Scalarf dy[MinVarBlockSize], ex[MinVarBlockSize], ez[MinVarBlockSize];
+    // outputs: variables and the covariance terms of each view //
+    Scalarf var[4][MinVarBlockSize];
+    Scalarf s2x[MinVarBlockSize], csx[MinVarBlockSize];
+    Scalarf s2z[MinVarBlockSize], csz[MinVarBlockSize];
+
+    void compute(int n)
+    {
+        #pragma omp simd
+        for (int i = 0; i < n; ++i) {
+            Scalarf L   = sqrt(din[0][i]*din[0][i] + din[1][i]*din[1][i] + din[2][i]*din[2][i]);
+            Scalarf Lo  = sqrt(dout[0][i]*dout[0][i] + dout[1][i]*dout[1][i] + dout[2][i]*dout[2][i]);
+            Scalarf dc0 = din[0][i]/L,   dc1 = din[1][i]/L,   dc2 = din[2][i]/L;
+            Scalarf do0 = dout[0][i]/Lo, do1 = dout[1][i]/Lo, do2 = dout[2][i]/Lo;
+
+            Scalarf rx  = sqrt(dc0*dc0 + dc1*dc1),  rz  = sqrt(dc2*dc2 + dc1*dc1);
+            Scalarf rxo = sqrt(do0*do0 + do1*do1),  rzo = sqrt(do2*do2 + do1*do1);
+            Scalarf cx  = -dc1/rx,  sx  = dc0/rx,   cz  = -dc1/rz,  sz  = dc2/rz;
+            Scalarf cxo = -do1/rxo, sxo = do0/rxo,  czo = -do1/rzo, szo = do2/rzo;
+
+            Scalarf oi0 = out[0][i] - in[0][i];
+            Scalarf oi1 = out[1][i] - in[1][i];
+            Scalarf oi2 = out[2][i] - in[2][i];
+            Scalarf dx = oi0 + sx/cx * oi1;
+            Scalarf dz = oi2 + sz/cz * oi1;
+            Scalarf dx_corr = cx * L * cxo / (cxo*cx + sxo*sx);
+            Scalarf dz_corr = cz * L * czo / (czo*cz + szo*sz);
+
+            var[0][i] = atan2(sxo*cx - cxo*sx, cxo*cx + sxo*sx);
+            var[1][i] = dx * dx_corr;
+            var[2][i] = atan2(szo*cz - czo*sz, czo*cz + szo*sz);
+            var[3][i] = dz * dz_corr;
+
+            // cos(atan2(dc(0),dc(1))) and cos(atan2(dc(2),dc(1))) //
+            csx[i] = dy[i] * rx / dc1;
+            csz[i] = dy[i] * rz / dc1;
+            s2x[i] = ex[i] * ex[i];
+            s2z[i] = ez[i] * ez[i];
+        }
+    }
+};
+
+} // namespace
+
 class IBSimpleTwoViewsMinimizationVariablesEvaluatorPimpl {
 
 public:
@@ -73,25 +129,7 @@ public:
     bool evaluate(MuonScatterData muon) {
 
         m_muon = muon;
-
-        m_integrity = true;
-
-        m_ErrorMatrix << 0,0,0,0,
-                         0,0,0,0,
-                         0,0,0,0,
-                         0,0,0,0;
-
-        m_Data        << 0,0,0,0;
-
-        m_Data        = this->evaluateVariables();
-
-        if (unlikely((fabs(m_Data(0)) > 1)||(fabs(m_Data(2)) > 1))) // << HARDCODED!!!
-        {
-            printf("this shouldn't actually happen!\n");
-            m_integrity = false;
-        }
-
-        m_ErrorMatrix = this->evaluateErrorMatrix();
+        this->evaluate(&m_muon, 1, &m_Data, &m_ErrorMatrix, &m_integrity);
 
 #ifndef NDEBUG
         if (m_integrity) {
@@ -170,64 +208,64 @@ public:
         return m_integrity;
     }
 
-    Vector4f evaluateVariables()
+    // Stateless: blocks of muons are gathered in SoA form and evaluated
+    // across the block //
+    void evaluate(const MuonScatterData *muons, unsigned int size, Vector4f *data,
+                  Matrix4f *covariance, bool *integrity) const
     {
-        Vector4f disp;
-        Vector4f dc  = getDirectorCosines(m_muon.LineIn().direction());
-        Vector4f dco = getDirectorCosines(m_muon.LineOut().direction());
-        float mx = (atan2(dc(0),-dc(1)));
-        float mz = (atan2(dc(2),-dc(1)));
-        float mxo = (atan2(dco(0),-dco(1)));
-        float mzo = (atan2(dco(2),-dco(1)));
-        float Lxy = m_muon.LineIn().direction().head(3).norm();
-        Vector4f in, out;
-        projectionOnContainer(in, out);
-        Vector4f oi = out-in;
-        float dx = oi(0) + tan(mx)*oi(1);
-        float dz = oi(2) + tan(mz)*oi(1);
-        float dx_corr = cos(mx)*Lxy*(cos(mxo)/cos(mxo-mx));
-        float dz_corr = cos(mz)*Lxy*(cos(mzo)/cos(mzo-mz));
-        disp << dx*dx_corr, 0, dz*dz_corr, 0;
-        float scat_x = mxo-mx;
-        float scat_z = mzo-mz;
-        Vector4f res(scat_x, disp(0), scat_z, disp(2));
-        return res;
-    }
-
-    Matrix4f evaluateErrorMatrix()
-    {
-        Matrix4f covariance;
-        float dy = m_muon.LineIn().origin(1) - m_muon.LineOut().origin(1);
-        Vector4f dc   = getDirectorCosines(m_muon.LineIn().direction());
-        float cosphi   = cos(atan2(dc(0),dc(1)));
-        float costheta = cos(atan2(dc(2),dc(1)));
-        float csx =  dy/cosphi;
-        float csz =  dy/costheta;
-        float s2x =  m_muon.ErrorIn().direction(0);
-        float s2z = (m_muon.ErrorIn().direction(1)==0.f) ?
-                     m_muon.ErrorIn().direction(2)       :
-                     m_muon.ErrorIn().direction(1);
-        s2x *= s2x;
-        s2z *= s2z;
-        covariance << 2*s2x,  -csx*s2x,    0,  0,
-                      -csx*s2x,csx*csx*s2x,0,  0,
-                      0,  0,              2*s2z,  -csz*s2z,
-                      0,  0,              -csz*s2z,csz*csz*s2z;
-        return covariance;
+        const int nblocks = (size + MinVarBlockSize - 1) / MinVarBlockSize;
+
+        #pragma omp parallel for schedule(static) if(nblocks > 1)
+        for (int b = 0; b < nblocks; ++b) {
+            const unsigned int first = b * MinVarBlockSize;
+            const int n = std::min<unsigned int>(MinVarBlockSize, size - first);
+            TwoViewsBlock blk;
+            bool ok[MinVarBlockSize];
+
+            for (int i = 0; i < n; ++i) {
+                const MuonScatterData &mu = muons[first + i];
+                Vector4f in = Vector4f::Zero(), out = Vector4f::Zero();
+                ok[i] = m_tracer->GetEntryPoint(mu.LineIn(),in) &&
+                        m_tracer->GetExitPoint(mu.LineOut(),out);
+                for (int k = 0; k < 3; ++k) {
+                    blk.din[k][i]  = mu.LineIn().direction()(k);
+                    blk.dout[k][i] = mu.LineOut().direction()(k);
+                    blk.in[k][i]   = in(k);
+                    blk.out[k][i]  = out(k);
+                }
+                blk.dy[i] = mu.LineIn().origin()(1) - mu.LineOut().origin()(1);
+                blk.ex[i] = mu.ErrorIn().direction()(0);
+                blk.ez[i] = (mu.ErrorIn().direction()(1)==0.f) ?
+                             mu.ErrorIn().direction()(2)       :
+                             mu.ErrorIn().direction()(1);
+            }
+
+            blk.compute(n);
+
+            for (int i = 0; i < n; ++i) {
+                const unsigned int id = first + i;
+                bool good = ok[i] &&
+                        !(fabs(blk.var[0][i]) > 1 || fabs(blk.var[2][i]) > 1); // << HARDCODED!!!
+                if (data)
+                    data[id] = Vector4f(blk.var[0][i], blk.var[1][i], blk.var[2][i], blk.var[3][i]);
+                if (covariance) {
+                    const Scalarf &s2x = blk.s2x[i], &csx = blk.csx[i];
+                    const Scalarf &s2z = blk.s2z[i], &csz = blk.csz[i];
+                    covariance[id] << 2*s2x,  -csx*s2x,    0,  0,
+                                      -csx*s2x,csx*csx*s2x,0,  0,
+                                      0,  0,              2*s2z,  -csz*s2z,
+                                      0,  0,              -csz*s2z,csz*csz*s2z;
+                }
+                if (integrity) integrity[id] = good;
+            }
+        }
     }
 
-    Vector4f getDirectorCosines(const Vector4f &track_direction)
+    Vector4f getDirectorCosines(const Vector4f &track_direction) const
     {
         return track_direction / track_direction.head(3).norm();
     }
 
-    void projectionOnContainer(Vector4f &in, Vector4f &out)
-    {
-        if (!m_tracer->GetEntryPoint(m_muon.LineIn(),in) ||
-            !m_tracer->GetExitPoint(m_muon.LineOut(),out))
-            m_integrity=false;
-    }
-
   void setDisplacementScatterOnly(bool disp, bool scat, bool oneD){m_scatterOnly = scat; m_displacementOnly = disp;}
 
 public:
@@ -282,6 +320,15 @@ bool IBSimpleTwoViewsMinimizationVariablesEvaluator::evaluate(MuonScatterData mu
     return d->m_integrity;
 }
 
+void IBSimpleTwoViewsMinimizationVariablesEvaluator::evaluate(const MuonScatterData *muons,
+                                                              unsigned int size,
+                                                              Vector4f *data,
+                                                              Matrix4f *covariance,
+                                                              bool *integrity) const
+{
+    d->evaluate(muons, size, data, covariance, integrity);
+}
+
 Vector4f IBSimpleTwoViewsMinimizationVariablesEvaluator::getDataVector()
 {
     return d->m_Data;
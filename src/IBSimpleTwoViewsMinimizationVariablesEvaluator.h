@@ -32,6 +32,9 @@ public:
 
     bool evaluate(MuonScatterData muon);
 
+    void evaluate(const MuonScatterData *muons, unsigned int size,
+                  Vector4f *data, Matrix4f *covariance, bool *integrity) const;
+
     Vector4f getDataVector();
     Scalarf  getDataVector(int i);
     Matrix4f getCovarianceMatrix();
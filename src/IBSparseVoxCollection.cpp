@@ -0,0 +1,208 @@
+/*////////////////////////////////////////////////////////////////////////////
+ Copyright 2018 Istituto Nazionale di Fisica Nucleare
+
+ Licensed under the EUPL, Version 1.2 or - as soon they will be approved by
+ the European Commission - subsequent versions of the EUPL (the "Licence").
+ You may not use this work except in compliance with the Licence.
+
+ You may obtain a copy of the Licence at:
+
+ https://joinup.ec.europa.eu/software/page/eupl
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the Licence is distributed on an "AS IS" basis, WITHOUT
+ WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ Licence for the specific language governing permissions and limitations under
+ the Licence.
+////////////////////////////////////////////////////////////////////////////*/
+
+
+
+#include "IBVoxCollection.h"
+#include "IBSparseVoxCollection.h"
+
+using namespace uLib;
+
+
+IBSparseVoxCollection::IBSparseVoxCollection(const Vector3i &dims,
+                                             int block_size) :
+    BaseClass(dims)
+{
+    Init(block_size);
+}
+
+IBSparseVoxCollection::IBSparseVoxCollection(const IBVoxCollection &dense,
+                                             const IBVoxel &background,
+                                             int block_size) :
+    BaseClass(dense.GetDims())
+{
+    this->SetSpacing(dense.GetSpacing());
+    this->SetPosition(dense.GetPosition());
+    Init(block_size);
+    m_Background = background;
+    for(unsigned int i = 0; i < dense.Data().size(); ++i) {
+        const IBVoxel &vox = dense.Data()[i];
+        if(vox.Value != background.Value || vox.Count != background.Count ||
+                vox.SijCap != background.SijCap)
+            this->operator [](dense.UnMap(i)) = vox;
+    }
+}
+
+IBSparseVoxCollection::~IBSparseVoxCollection()
+{
+    for(unsigned int i = 0; i < m_Blocks.size(); ++i)
+        delete [] m_Blocks[i];
+}
+
+void IBSparseVoxCollection::Init(int block_size)
+{
+    m_BlockSize = block_size > 0 ? block_size : 1;
+    const Vector3i &dims = this->GetDims();
+    m_BlockDims << (dims(0) + m_BlockSize - 1) / m_BlockSize,
+                   (dims(1) + m_BlockSize - 1) / m_BlockSize,
+                   (dims(2) + m_BlockSize - 1) / m_BlockSize;
+    m_Background.Value  = 0;
+    m_Background.SijCap = 0;
+    m_Background.Count  = 0;
+}
+
+Id_t IBSparseVoxCollection::BlockKey(const Vector3i &id, int &local) const
+{
+    const int b = m_BlockSize;
+    local = (id(0) % b) + b * ((id(1) % b) + b * (id(2) % b));
+    return (id(0) / b) + m_BlockDims(0) *
+            ((Id_t)(id(1) / b) + m_BlockDims(1) * (Id_t)(id(2) / b));
+}
+
+IBVoxel *IBSparseVoxCollection::Lookup(const Vector3i &id) const
+{
+    int local;
+    Id_t key = BlockKey(id, local);
+    std::unordered_map<Id_t, unsigned int>::const_iterator it = m_Index.find(key);
+    if(it == m_Index.end()) return NULL;
+    return m_Blocks[it->second] + local;
+}
+
+IBVoxel *IBSparseVoxCollection::Allocate(Id_t key)
+{
+    std::unordered_map<Id_t, unsigned int>::const_iterator it = m_Index.find(key);
+    if(it != m_Index.end()) return m_Blocks[it->second];
+    const unsigned int size = GetBlockVolume();
+    IBVoxel *block = new IBVoxel[size];
+    for(unsigned int i = 0; i < size; ++i) block[i] = m_Background;
+    m_Index[key] = m_Blocks.size();
+    m_Blocks.push_back(block);
+    m_Keys.push_back(key);
+    return block;
+}
+
+IBVoxel &IBSparseVoxCollection::operator [](const Vector3i &id)
+{
+    int local;
+    Id_t key = BlockKey(id, local);
+    return Allocate(key)[local];
+}
+
+IBVoxel &IBSparseVoxCollection::operator [](Id_t id)
+{
+    return this->operator [](this->UnMap(id));
+}
+
+const IBVoxel &IBSparseVoxCollection::At(const Vector3i &id) const
+{
+    IBVoxel *vox = Lookup(id);
+    return vox ? *vox : m_Background;
+}
+
+const IBVoxel &IBSparseVoxCollection::At(Id_t id) const
+{
+    return this->At(this->UnMap(id));
+}
+
+IBVoxel *IBSparseVoxCollection::Find(Id_t id)
+{
+    return Lookup(this->UnMap(id));
+}
+
+void IBSparseVoxCollection::Allocate(const Vector3i &p1, const Vector3i &p2)
+{
+    const int b = m_BlockSize;
+    for(int z = p1(2) / b; z <= p2(2) / b; ++z)
+        for(int y = p1(1) / b; y <= p2(1) / b; ++y)
+            for(int x = p1(0) / b; x <= p2(0) / b; ++x)
+                Allocate(x + m_BlockDims(0) * ((Id_t)y + m_BlockDims(1) * (Id_t)z));
+}
+
+Vector3i IBSparseVoxCollection::GetBlockOrigin(unsigned int i) const
+{
+    const Id_t key = m_Keys[i];
+    return Vector3i(key % m_BlockDims(0),
+                    (key / m_BlockDims(0)) % m_BlockDims(1),
+                    key / ((Id_t)m_BlockDims(0) * m_BlockDims(1))) * m_BlockSize;
+}
+
+void IBSparseVoxCollection::SetBackground(const IBVoxel &background)
+{
+    m_Background = background;
+}
+
+void IBSparseVoxCollection::InitLambda(const IBVoxel &value)
+{
+    m_Background = value;
+    const unsigned int size = GetBlockVolume();
+    for(unsigned int i = 0; i < m_Blocks.size(); ++i)
+        for(unsigned int j = 0; j < size; ++j)
+            m_Blocks[i][j] = value;
+    InitCount(0);
+    resetSijCap();
+}
+
+void IBSparseVoxCollection::InitCount(unsigned int count)
+{
+    const unsigned int size = GetBlockVolume();
+    for(unsigned int i = 0; i < m_Blocks.size(); ++i)
+        for(unsigned int j = 0; j < size; ++j)
+            m_Blocks[i][j].Count = count;
+}
+
+void IBSparseVoxCollection::resetSijCap()
+{
+    const unsigned int size = GetBlockVolume();
+    for(unsigned int i = 0; i < m_Blocks.size(); ++i)
+        for(unsigned int j = 0; j < size; ++j)
+            m_Blocks[i][j].SijCap = 0;
+}
+
+void IBSparseVoxCollection::Densify(IBVoxCollection &dense) const
+{
+    dense.SetDims(this->GetDims());
+    dense.SetSpacing(this->GetSpacing());
+    dense.SetPosition(this->GetPosition());
+    dense.InitVoxels(m_Background);
+
+    const int b = m_BlockSize;
+    for(unsigned int i = 0; i < m_Blocks.size(); ++i) {
+        Vector3i origin = GetBlockOrigin(i);
+        for(int z = 0; z < b; ++z)
+            for(int y = 0; y < b; ++y)
+                for(int x = 0; x < b; ++x) {
+                    Vector3i id = origin + Vector3i(x,y,z);
+                    if(this->IsInsideGrid(id))
+                        dense.Data()[dense.Map(id)] = m_Blocks[i][x + b * (y + b * z)];
+                }
+    }
+}
+
+IBVoxCollection IBSparseVoxCollection::Densify() const
+{
+    IBVoxCollection dense(this->GetDims());
+    this->Densify(dense);
+    return dense;
+}
+
+int IBSparseVoxCollection::ExportToVtk(const char *file, bool density_type) const
+{
+    IBVoxCollection dense(Vector3i(0,0,0));
+    this->Densify(dense);
+    return dense.ExportToVtk(file, density_type);
+}
@@ -0,0 +1,130 @@
+/*////////////////////////////////////////////////////////////////////////////
+ Copyright 2018 Istituto Nazionale di Fisica Nucleare
+
+ Licensed under the EUPL, Version 1.2 or - as soon they will be approved by
+ the European Commission - subsequent versions of the EUPL (the "Licence").
+ You may not use this work except in compliance with the Licence.
+
+ You may obtain a copy of the Licence at:
+
+ https://joinup.ec.europa.eu/software/page/eupl
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the Licence is distributed on an "AS IS" basis, WITHOUT
+ WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ Licence for the specific language governing permissions and limitations under
+ the Licence.
+////////////////////////////////////////////////////////////////////////////*/
+
+
+
+#ifndef IBSPARSEVOXCOLLECTION_H
+#define IBSPARSEVOXCOLLECTION_H
+
+#include <unordered_map>
+
+#include <Math/Dense.h>
+#include <Math/StructuredGrid.h>
+#include <Core/Vector.h>
+
+#include "IBVoxel.h"
+
+class IBVoxCollection;
+
+////////////////////////////////////////////////////////////////////////////////
+//////  SPARSE VOX COLLECTION  /////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+///
+/// Blocked hash grid with the geometry and Find/At/IsInsideGrid interface of
+/// IBVoxCollection. Only blocks of block_size^3 voxels that were written are
+/// allocated; every other voxel reads as the background voxel, which is
+/// never updated (typically air or a frozen value). Block storage never
+/// moves so IBVoxel pointers held by analyzers stay valid.
+///
+class IBSparseVoxCollection : public uLib::StructuredGrid {
+    typedef uLib::StructuredGrid BaseClass;
+public:
+    IBSparseVoxCollection(const uLib::Vector3i &dims, int block_size = 8);
+
+    // allocates only the blocks holding a voxel that differs from background
+    IBSparseVoxCollection(const IBVoxCollection &dense,
+                          const IBVoxel &background, int block_size = 8);
+
+    ~IBSparseVoxCollection();
+
+    using BaseClass::Find;
+
+    // write access, allocates the block if needed //
+    IBVoxel &operator[](uLib::Id_t id);
+    IBVoxel &operator[](const uLib::Vector3i &id);
+
+    // read access, background for voxels in empty blocks //
+    const IBVoxel &At(uLib::Id_t id) const;
+    const IBVoxel &At(const uLib::Vector3i &id) const;
+
+    // NULL for voxels in empty blocks //
+    IBVoxel *Find(uLib::Id_t id);
+
+    // allocates the blocks covering the voxel box [p1,p2] //
+    void Allocate(const uLib::Vector3i &p1, const uLib::Vector3i &p2);
+
+    void SetBackground(const IBVoxel &background);
+    inline const IBVoxel &GetBackground() const { return m_Background; }
+
+    inline int GetBlockSize() const { return m_BlockSize; }
+    inline unsigned int GetNumberOfBlocks() const { return m_Blocks.size(); }
+    inline unsigned int GetBlockVolume() const
+    { return m_BlockSize * m_BlockSize * m_BlockSize; }
+
+    // raw voxels of an allocated block, some may lie outside the grid //
+    inline IBVoxel *GetBlock(unsigned int i) { return m_Blocks[i]; }
+    inline const IBVoxel *GetBlock(unsigned int i) const { return m_Blocks[i]; }
+
+    // index of the first voxel of an allocated block //
+    uLib::Vector3i GetBlockOrigin(unsigned int i) const;
+
+    // same semantics as IBVoxCollection, applied to allocated voxels //
+    void InitLambda(const IBVoxel &value);
+    void InitCount(unsigned int count);
+    void resetSijCap();
+
+    template < typename StaticUpdateAlgT >
+    void UpdateDensity(unsigned int threshold);
+
+    void Densify(IBVoxCollection &dense) const;
+    IBVoxCollection Densify() const;
+
+    int ExportToVtk(const char *file, bool density_type = 0) const;
+
+private:
+    IBSparseVoxCollection(const IBSparseVoxCollection &);
+    IBSparseVoxCollection &operator=(const IBSparseVoxCollection &);
+
+    void Init(int block_size);
+    uLib::Id_t BlockKey(const uLib::Vector3i &id, int &local) const;
+    IBVoxel *Lookup(const uLib::Vector3i &id) const;
+    IBVoxel *Allocate(uLib::Id_t key);
+
+    int                  m_BlockSize;
+    uLib::Vector3i       m_BlockDims;
+    IBVoxel              m_Background;
+    std::unordered_map<uLib::Id_t, unsigned int> m_Index;
+    uLib::Vector<IBVoxel *>   m_Blocks;
+    uLib::Vector<uLib::Id_t>  m_Keys;
+};
+
+
+// --- Update --------------------------------------------------------------- //
+
+template < class StaticUpdateAlgT >
+void IBSparseVoxCollection::UpdateDensity(unsigned int threshold) {
+
+    // Analyzer Update //
+    StaticUpdateAlgT::UpdateDensity(this,threshold);
+
+    // Reinitialize voxels //
+    this->InitCount(0);
+}
+
+
+#endif // IBSPARSEVOXCOLLECTION_H
@@ -18,18 +18,138 @@
 
 
 #include "IBTiltedAxisPocaEvaluator.h"
+#include <cfloat>
+#include <cmath>
+#include <algorithm>
 
 using namespace uLib;
 
+////////////////////////////////////////////////////////////////////////////////
+////// SOA KERNEL //////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+//
+// The tilted axis a = (d0/d1, 1, d2/d1)/|.| with d = in - out origin defines
+// the rotation R = Rz(acos a1) * Ry(atan2(a2,a0)). Writing r = sqrt(a0^2+a2^2)
+// all its entries are algebraic:
+//
+//      | a1*a0/r   -r   a1*a2/r |
+//  R = |    a0     a1      a2   |
+//      |  -a2/r     0    a0/r   |
+//
+// R is orthogonal so the inverse is the transpose, and the weights
+// cos^2(atan(t)) are 1/(1+t^2). Slopes in the rotated frame are ratios so
+// directions need not be normalized.
+//
+
+namespace {
+
+static const int PocaBlockSize = 16;
+
+inline bool is_finite(Scalarf x) { return std::fabs(x) <= FLT_MAX; }
+
+struct TiltedPocaBlock {
+    Scalarf pi[3][PocaBlockSize], po[3][PocaBlockSize];
+    Scalarf vi[3][PocaBlockSize], vo[3][PocaBlockSize];
+    Scalarf e2pi[PocaBlockSize], e2po[PocaBlockSize];
+    Scalarf e2ti[PocaBlockSize], e2to[PocaBlockSize];
+    // results //
+    Scalarf poca[3][PocaBlockSize];
+    int     valid[PocaBlockSize];
+
+    void load(const MuonScatterData *muons, int n)
+    {
+        for (int i = 0; i < n; ++i) {
+            const MuonScatterData &mu = muons[i];
+            for (int j = 0; j < 3; ++j) {
+                pi[j][i] = mu.LineIn().origin()(j);
+                po[j][i] = mu.LineOut().origin()(j);
+                vi[j][i] = mu.LineIn().direction()(j);
+                vo[j][i] = mu.LineOut().direction()(j);
+            }
+            const Vector4f &ei = mu.ErrorIn().direction();
+            const Vector4f &eo = mu.ErrorOut().direction();
+            Scalarf ti = (ei(2) == 0.f) ? ei(1) : ei(2);
+            Scalarf to = (eo(2) == 0.f) ? eo(1) : eo(2);
+            e2pi[i] = ei(0) * ei(0);
+            e2po[i] = eo(0) * eo(0);
+            e2ti[i] = ti * ti;
+            e2to[i] = to * to;
+        }
+    }
+
+    void compute(int n)
+    {
+        #pragma omp simd
+        for (int i = 0; i < n; ++i) {
+            Scalarf d0 = pi[0][i] - po[0][i];
+            Scalarf d1 = pi[1][i] - po[1][i];
+            Scalarf d2 = pi[2][i] - po[2][i];
+
+            // rotation //
+            Scalarf ax = d0 / d1, az = d2 / d1;
+            Scalarf an = 1.f / std::sqrt(1.f + ax*ax + az*az);
+            Scalarf a0 = ax * an, a1 = an, a2 = az * an;
+            Scalarf r  = std::sqrt(a0*a0 + a2*a2);
+            Scalarf cp = r > 0.f ? a0 / r : 1.f;
+            Scalarf sp = r > 0.f ? a2 / r : 0.f;
+            Scalarf r00 = a1*cp, r01 = -r, r02 = a1*sp;
+            Scalarf r10 = r*cp,  r11 = a1, r12 = r*sp;
+            Scalarf r20 = -sp,             r22 = cp;
+
+            // slopes in the rotated frame //
+            Scalarf in1  = r10*vi[0][i] + r11*vi[1][i] + r12*vi[2][i];
+            Scalarf out1 = r10*vo[0][i] + r11*vo[1][i] + r12*vo[2][i];
+            Scalarf ti0 = (r00*vi[0][i] + r01*vi[1][i] + r02*vi[2][i]) / in1;
+            Scalarf ti2 = (r20*vi[0][i] + r22*vi[2][i]) / in1;
+            Scalarf to0 = (r00*vo[0][i] + r01*vo[1][i] + r02*vo[2][i]) / out1;
+            Scalarf to2 = (r20*vo[0][i] + r22*vo[2][i]) / out1;
+
+            Scalarf dtphi    = ti0 - to0;
+            Scalarf dttheta  = ti2 - to2;
+            Scalarf distance = std::sqrt(d0*d0 + d1*d1 + d2*d2);
+            Scalarf yp = (ti0 * distance) / dtphi;
+            Scalarf np = (to0 * distance) / dtphi;
+            Scalarf yt = (ti2 * distance) / dttheta;
+            Scalarf nt = (to2 * distance) / dttheta;
+
+            // weighted mean of the two views //
+            Scalarf s2yp = (np*np*e2pi[i] + yp*yp*e2po[i]) / (dtphi*dtphi);
+            Scalarf s2yt = (nt*nt*e2ti[i] + yt*yt*e2to[i]) / (dttheta*dttheta);
+            Scalarf wy   = (yp/s2yp + yt/s2yt) / (1.f/s2yp + 1.f/s2yt);
+            Scalarf y    = !is_finite(yp) ? yt : (!is_finite(yt) ? yp : wy);
+
+            Scalarf wi0 = 1.f / (1.f + ti0*ti0), wo0 = 1.f / (1.f + to0*to0);
+            Scalarf wi2 = 1.f / (1.f + ti2*ti2), wo2 = 1.f / (1.f + to2*to2);
+            Scalarf x = (wi0*ti0*(y - distance) + wo0*to0*y) / (wi0 + wo0);
+            Scalarf z = (wi2*ti2*(y - distance) + wo2*to2*y) / (wi2 + wo2);
+
+            // back to the detector frame: R^T //
+            poca[0][i] = r00*x + r10*y + r20*z + po[0][i];
+            poca[1][i] = r01*x + r11*y         + po[1][i];
+            poca[2][i] = r02*x + r12*y + r22*z + po[2][i];
+
+            valid[i] = is_finite(y) && is_finite(poca[0][i]) &&
+                       is_finite(poca[1][i]) && is_finite(poca[2][i]);
+        }
+    }
+};
+
+} // namespace
+
+
+
+
 class IBTiltedAxisPocaEvaluatorPimpl {
 
 public:
 
     IBTiltedAxisPocaEvaluatorPimpl() {
         m_integrity = true;
+        m_poca << 0,0,0,1;
     }
 
-    void evaluatePoCA()
+    // previous trigonometric kernel, kept to validate the algebraic one //
+    void evaluatePoCAReference()
     {
         Vector4f  diff = m_muon.LineIn().origin() -
                          m_muon.LineOut().origin();
@@ -162,10 +282,39 @@ IBTiltedAxisPocaEvaluator::~IBTiltedAxisPocaEvaluator()
 }
 
 bool IBTiltedAxisPocaEvaluator::evaluate(MuonScatterData muon)
+{
+    bool integrity;
+    this->evaluate(&muon, 1, &d->m_poca, &integrity);
+    d->m_integrity = integrity;
+    return integrity;
+}
+
+void IBTiltedAxisPocaEvaluator::evaluate(const MuonScatterData *muons,
+                                         unsigned int size,
+                                         Vector4f *poca,
+                                         bool *integrity) const
+{
+    const int n = size;
+
+    #pragma omp parallel for schedule(static) if(n > 64 * PocaBlockSize)
+    for (int start = 0; start < n; start += PocaBlockSize) {
+        int len = std::min(PocaBlockSize, n - start);
+        TiltedPocaBlock blk;
+        blk.load(muons + start, len);
+        blk.compute(len);
+        for (int i = 0; i < len; ++i) {
+            int id = start + i;
+            if (poca) poca[id] << blk.poca[0][i], blk.poca[1][i], blk.poca[2][i], 1;
+            if (integrity) integrity[id] = blk.valid[i];
+        }
+    }
+}
+
+bool IBTiltedAxisPocaEvaluator::evaluateReference(MuonScatterData muon)
 {
     d->m_muon = muon;
     d->m_integrity = true;
-    d->evaluatePoCA();
+    d->evaluatePoCAReference();
     return d->m_integrity;
 }
 
@@ -30,6 +30,15 @@ public:
     ~IBTiltedAxisPocaEvaluator();
 
     bool     evaluate(MuonScatterData muon);
+
+    // Batch evaluation over size muons, stateless and const. Either output
+    // array may be NULL.
+    void     evaluate(const MuonScatterData *muons, unsigned int size,
+                      Vector4f *poca, bool *integrity) const;
+
+    // previous trigonometric kernel, for validation only //
+    bool     evaluateReference(MuonScatterData muon);
+
     Vector4f getPoca();
     Vector4f getInTrackPoca(){ return HPoint3f();}
     Vector4f getOutTrackPoca(){ return HPoint3f();}
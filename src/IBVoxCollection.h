@@ -81,6 +81,8 @@ public:
 
     void SetMAPAlgorithm(IBAbstract::IBVoxCollectionMAPAlgorithm *algorithm);
 
+    IBAbstract::IBVoxCollectionMAPAlgorithm *GetMAPAlgorithm() const { return m_MAPAlgorithm; }
+
     inline void InitLambda(const IBVoxel &value);
 
     inline void InitCount(unsigned int count);
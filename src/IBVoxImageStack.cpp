@@ -0,0 +1,352 @@
+/*////////////////////////////////////////////////////////////////////////////
+ Copyright 2018 Istituto Nazionale di Fisica Nucleare
+
+ Licensed under the EUPL, Version 1.2 or - as soon they will be approved by
+ the European Commission - subsequent versions of the EUPL (the "Licence").
+ You may not use this work except in compliance with the Licence.
+
+ You may obtain a copy of the Licence at:
+
+ https://joinup.ec.europa.eu/software/page/eupl
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the Licence is distributed on an "AS IS" basis, WITHOUT
+ WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ Licence for the specific language governing permissions and limitations under
+ the Licence.
+////////////////////////////////////////////////////////////////////////////*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <iostream>
+
+#include "IBVoxCollection.h"
+#include "IBVoxImageStack.h"
+
+
+namespace {
+
+// read only mapping of a whole file //
+class MappedFile {
+public:
+    MappedFile(const char *filename) : m_Data(NULL), m_Size(0)
+    {
+        int fd = open(filename, O_RDONLY);
+        if (fd < 0) return;
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED) {
+                madvise(p, st.st_size, MADV_SEQUENTIAL);
+                m_Data = (const char *)p;
+                m_Size = st.st_size;
+            }
+        }
+        close(fd);
+    }
+
+    ~MappedFile() { if (m_Data) munmap((void *)m_Data, m_Size); }
+
+    const char *data() const { return m_Data; }
+    size_t size() const { return m_Size; }
+
+private:
+    const char *m_Data;
+    size_t      m_Size;
+};
+
+struct StackHeader {
+    char     magic[8];
+    int32_t  dims[3];
+    float    spacing[3];
+    float    position[3];
+    uint32_t count;
+};
+
+static inline float SwapBytes(float v)
+{
+    unsigned char *b = (unsigned char *)&v;
+    std::swap(b[0], b[3]);
+    std::swap(b[1], b[2]);
+    return v;
+}
+
+static bool IsBigEndian()
+{
+    const unsigned int one = 1;
+    return *(const unsigned char *)&one == 0;
+}
+
+static void SetGeometry(IBVoxCollection &image, const Vector3i &dims,
+                        const Vector3f &spacing, const Vector3f &position)
+{
+    image.SetDims(dims);
+    image.SetSpacing(spacing);
+    image.SetPosition(position);
+    image.Data().resize(dims.prod());
+}
+
+// values x fastest from the mapping, value = fabs(v) * scale //
+static void SetValues(IBVoxCollection &image, const char *data, bool swap,
+                      float scale)
+{
+    const Vector3i dims = image.GetDims();
+    #pragma omp parallel for schedule(static)
+    for (int z = 0; z < dims(2); ++z)
+        for (int y = 0; y < dims(1); ++y)
+            for (int x = 0; x < dims(0); ++x) {
+                float v;
+                size_t id = x + dims(0) * (y + dims(1) * (size_t)z);
+                memcpy(&v, data + id * sizeof(float), sizeof(float));
+                if (swap) v = SwapBytes(v);
+                image.Data()[image.Map(Vector3i(x,y,z))].Value = fabs(v) * scale;
+            }
+}
+
+// legacy binary STRUCTURED_POINTS. Values are divided by the "scale" of
+// the title line written by IBVoxSnapshot, 1e6 as ImportFromVtk if none //
+static bool LoadVtkBinary(const MappedFile &f, IBVoxCollection &image)
+{
+    const size_t hsize = std::min(f.size(), (size_t)2048);
+    std::string header(f.data(), hsize);
+    size_t lut = header.find("LOOKUP_TABLE");
+    if (lut == std::string::npos) return false;
+    size_t begin = header.find('\n', lut);
+    if (begin == std::string::npos) return false;
+    ++begin;
+
+    Vector3i dims;
+    Vector3f spacing, position;
+    const char *h = header.c_str();
+    const char *k;
+    if (!(k = strstr(h, "DIMENSIONS")) ||
+        sscanf(k, "DIMENSIONS %d %d %d", &dims(0), &dims(1), &dims(2)) != 3) return false;
+    if (!(k = strstr(h, "SPACING")) ||
+        sscanf(k, "SPACING %f %f %f", &spacing(0), &spacing(1), &spacing(2)) != 3) return false;
+    if (!(k = strstr(h, "ORIGIN")) ||
+        sscanf(k, "ORIGIN %f %f %f", &position(0), &position(1), &position(2)) != 3) return false;
+    if (!strstr(h, " float") ||
+        f.size() < begin + (size_t)dims.prod() * sizeof(float)) return false;
+
+    // the title is the second line //
+    float scale = 1.E6;
+    size_t title = header.find('\n');
+    size_t title_end = header.find('\n', title + 1);
+    if (title != std::string::npos && title_end != std::string::npos) {
+        size_t k = header.substr(title + 1, title_end - title - 1).find("scale ");
+        if (k != std::string::npos &&
+            sscanf(h + title + 1 + k, "scale %f", &scale) != 1) return false;
+    }
+    if (scale == 0) return false;
+
+    SetGeometry(image, dims, spacing, position);
+    SetValues(image, f.data() + begin, !IsBigEndian(), 1 / scale);
+    return true;
+}
+
+static bool JsonVector(const std::string &json, const char *key, float *v, int n)
+{
+    size_t k = json.find(key);
+    if (k == std::string::npos) return false;
+    const char *s = strchr(json.c_str() + k, '[');
+    for (int i = 0; s && i < n; ++i) {
+        char *end;
+        v[i] = strtof(s + 1, &end);
+        if (end == s + 1) return false;
+        s = strchr(end, i + 1 < n ? ',' : ']');
+    }
+    return s != NULL;
+}
+
+// raw values with the .json header written by IBVoxSnapshot //
+static bool LoadRaw(const char *filename, const MappedFile &f, IBVoxCollection &image)
+{
+    FILE *jf = fopen((std::string(filename) + ".json").c_str(), "r");
+    if (!jf) return false;
+    std::string json;
+    char buf[512];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), jf)) > 0) json.append(buf, n);
+    fclose(jf);
+
+    float d[3], scale = 1;
+    Vector3f spacing, position;
+    if (!JsonVector(json, "\"dims\"", d, 3) ||
+        !JsonVector(json, "\"spacing\"", spacing.data(), 3) ||
+        !JsonVector(json, "\"origin\"", position.data(), 3)) return false;
+    size_t k = json.find("\"scale\"");
+    if (k != std::string::npos) sscanf(json.c_str() + k, "\"scale\": %f", &scale);
+    const bool big = json.find("\"big\"") != std::string::npos;
+
+    Vector3i dims((int)d[0], (int)d[1], (int)d[2]);
+    if (f.size() < (size_t)dims.prod() * sizeof(float) || scale == 0) return false;
+    SetGeometry(image, dims, spacing, position);
+    SetValues(image, f.data(), big != IsBigEndian(), 1 / scale);
+    return true;
+}
+
+static bool ReadStackHeader(const MappedFile &f, StackHeader &h, Vector3i &dims)
+{
+    if (f.size() < sizeof(StackHeader)) return false;
+    memcpy(&h, f.data(), sizeof(StackHeader));
+    if (memcmp(h.magic, "IBSTACK1", 8)) return false;
+    dims << h.dims[0], h.dims[1], h.dims[2];
+    return f.size() >= sizeof(StackHeader) +
+                       (size_t)h.count * (size_t)dims.prod() * sizeof(float);
+}
+
+} // namespace
+
+
+////////////////////////////////////////////////////////////////////////////////
+/////  STACK  //////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+IBVoxImageStack::IBVoxImageStack() :
+    m_Dims(0,0,0),
+    m_Spacing(0,0,0),
+    m_Position(0,0,0),
+    m_Count(0)
+{}
+
+void IBVoxImageStack::Allocate(const IBVoxCollection &image, size_t count)
+{
+    m_Dims = image.GetDims();
+    m_Spacing = image.GetSpacing();
+    m_Position = image.GetPosition();
+    m_Count = count;
+    m_Values.assign(count * this->GetNumberOfVoxels(), 0);
+}
+
+bool IBVoxImageStack::SameGeometry(const IBVoxCollection &image) const
+{
+    return image.GetDims() == m_Dims &&
+           image.GetSpacing() == m_Spacing &&
+           image.GetPosition() == m_Position &&
+           image.Data().size() == this->GetNumberOfVoxels();
+}
+
+bool IBVoxImageStack::SetImage(size_t i, const IBVoxCollection &image)
+{
+    if (i >= m_Count || !this->SameGeometry(image)) return false;
+    float *v = this->Values(i);
+    const long size = this->GetNumberOfVoxels();
+    #pragma omp parallel for schedule(static)
+    for (long j = 0; j < size; ++j)
+        v[j] = image.Data()[j].Value;
+    return true;
+}
+
+bool IBVoxImageStack::GetImage(size_t i, IBVoxCollection &image) const
+{
+    if (i >= m_Count) return false;
+    SetGeometry(image, m_Dims, m_Spacing, m_Position);
+    const float *v = this->Values(i);
+    const long size = this->GetNumberOfVoxels();
+    #pragma omp parallel for schedule(static)
+    for (long j = 0; j < size; ++j)
+        image.Data()[j].Value = v[j];
+    return true;
+}
+
+size_t IBVoxImageStack::LoadSequence(const std::vector<std::string> &files)
+{
+    m_Count = 0;
+    if (files.empty()) return 0;
+    IBVoxCollection first(Vector3i::Zero());
+    if (!Load(files[0].c_str(), first)) return 0;
+    this->Allocate(first, files.size());
+    this->SetImage(0, first);
+
+    const long n = files.size();
+    Vector<char> loaded(n, 0);
+    loaded[0] = 1;
+    #pragma omp parallel
+    {
+        IBVoxCollection image(Vector3i::Zero());
+        #pragma omp for schedule(dynamic)
+        for (long k = 1; k < n; ++k)
+            loaded[k] = Load(files[k].c_str(), image) && this->SetImage(k, image);
+    }
+
+    size_t count = 0;
+    while (count < files.size() && loaded[count]) ++count;
+    if (count < files.size())
+        std::cerr << "IBVoxImageStack: sequence ends at " << files[count] << "\n";
+    m_Count = count;
+    return count;
+}
+
+bool IBVoxImageStack::Write(const char *filename) const
+{
+    FILE *f = fopen(filename, "wb");
+    if (!f) return false;
+    StackHeader h;
+    memcpy(h.magic, "IBSTACK1", 8);
+    for (int k = 0; k < 3; ++k) {
+        h.dims[k] = m_Dims(k);
+        h.spacing[k] = m_Spacing(k);
+        h.position[k] = m_Position(k);
+    }
+    h.count = m_Count;
+    const size_t size = m_Count * this->GetNumberOfVoxels();
+    bool ok = fwrite(&h, sizeof(h), 1, f) == 1;
+    if (size) ok = fwrite(&m_Values[0], sizeof(float), size, f) == size && ok;
+    return (fclose(f) == 0) && ok;
+}
+
+bool IBVoxImageStack::Read(const char *filename)
+{
+    MappedFile f(filename);
+    StackHeader h;
+    Vector3i dims;
+    if (!ReadStackHeader(f, h, dims)) return false;
+    m_Dims = dims;
+    m_Spacing << h.spacing[0], h.spacing[1], h.spacing[2];
+    m_Position << h.position[0], h.position[1], h.position[2];
+    m_Count = h.count;
+    const char *data = f.data() + sizeof(StackHeader);
+    m_Values.assign((const float *)data,
+                    (const float *)data + m_Count * this->GetNumberOfVoxels());
+    return true;
+}
+
+bool IBVoxImageStack::Load(const char *filename, IBVoxCollection &image)
+{
+    MappedFile f(filename);
+    if (!f.data()) return false;
+
+    StackHeader h;
+    Vector3i dims;
+    if (ReadStackHeader(f, h, dims)) {
+        if (!h.count) return false;
+        SetGeometry(image, dims, Vector3f(h.spacing[0], h.spacing[1], h.spacing[2]),
+                    Vector3f(h.position[0], h.position[1], h.position[2]));
+        const float *v = (const float *)(f.data() + sizeof(StackHeader));
+        for (long j = 0; j < dims.prod(); ++j) image.Data()[j].Value = v[j];
+        return true;
+    }
+
+    const size_t len = strlen(filename);
+    if (len > 4 && !strcmp(filename + len - 4, ".raw"))
+        return LoadRaw(filename, f, image);
+
+    std::string head(f.data(), std::min(f.size(), (size_t)256));
+    if (head.find("# vtk") == 0 && head.find("\nBINARY") != std::string::npos)
+        return LoadVtkBinary(f, image);
+
+    return image.ImportFromVtk(filename);
+}
+
+bool IBVoxImageStack::Exists(const char *filename)
+{
+    return access(filename, R_OK) == 0;
+}
@@ -0,0 +1,85 @@
+/*////////////////////////////////////////////////////////////////////////////
+ Copyright 2018 Istituto Nazionale di Fisica Nucleare
+
+ Licensed under the EUPL, Version 1.2 or - as soon they will be approved by
+ the European Commission - subsequent versions of the EUPL (the "Licence").
+ You may not use this work except in compliance with the Licence.
+
+ You may obtain a copy of the Licence at:
+
+ https://joinup.ec.europa.eu/software/page/eupl
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the Licence is distributed on an "AS IS" basis, WITHOUT
+ WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ Licence for the specific language governing permissions and limitations under
+ the Licence.
+////////////////////////////////////////////////////////////////////////////*/
+
+#ifndef IBVOXIMAGESTACK_H
+#define IBVOXIMAGESTACK_H
+
+#include <string>
+#include <vector>
+
+#include <Math/Dense.h>
+#include <Core/Vector.h>
+
+using namespace uLib;
+
+class IBVoxCollection;
+
+
+// Many images of the same geometry held contiguously, one slot of voxel
+// values per image in the collection data order. LoadSequence fills a
+// preallocated stack loading the files in parallel, Write and Read keep
+// the whole stack in one file:
+//
+//   "IBSTACK1"  int32 dims[3]  float32 spacing[3]  float32 position[3]
+//   uint32 images  then images x voxels float32 values, native endian
+//
+// Load reads one image: memory mapped for binary VTK (as written by
+// IBVoxSnapshot, scaled back by its title line), raw with its .json
+// header and stack files (the first image); ASCII VTK goes through
+// ImportFromVtk.
+
+class IBVoxImageStack {
+public:
+    IBVoxImageStack();
+
+    // geometry taken from image, values zeroed //
+    void Allocate(const IBVoxCollection &image, size_t count);
+
+    size_t size() const { return m_Count; }
+    size_t GetNumberOfVoxels() const { return m_Dims.prod(); }
+    const Vector3i &GetDims() const { return m_Dims; }
+
+    float *Values(size_t i) { return &m_Values[i * GetNumberOfVoxels()]; }
+    const float *Values(size_t i) const { return &m_Values[i * GetNumberOfVoxels()]; }
+
+    // false out of range or, for Set, on a different geometry //
+    bool SetImage(size_t i, const IBVoxCollection &image);
+    bool GetImage(size_t i, IBVoxCollection &image) const;
+
+    // loads the files in parallel, the first one gives the geometry. The
+    // sequence ends at the first file not loaded or of another geometry,
+    // returns the number of images //
+    size_t LoadSequence(const std::vector<std::string> &files);
+
+    bool Write(const char *filename) const;
+    bool Read(const char *filename);
+
+    static bool Load(const char *filename, IBVoxCollection &image);
+    static bool Exists(const char *filename);
+
+private:
+    bool SameGeometry(const IBVoxCollection &image) const;
+
+    Vector3i      m_Dims;
+    Vector3f      m_Spacing;
+    Vector3f      m_Position;
+    size_t        m_Count;
+    Vector<float> m_Values;
+};
+
+#endif // IBVOXIMAGESTACK_H
@@ -0,0 +1,198 @@
+/*////////////////////////////////////////////////////////////////////////////
+ Copyright 2018 Istituto Nazionale di Fisica Nucleare
+
+ Licensed under the EUPL, Version 1.2 or - as soon they will be approved by
+ the European Commission - subsequent versions of the EUPL (the "Licence").
+ You may not use this work except in compliance with the Licence.
+
+ You may obtain a copy of the Licence at:
+
+ https://joinup.ec.europa.eu/software/page/eupl
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the Licence is distributed on an "AS IS" basis, WITHOUT
+ WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ Licence for the specific language governing permissions and limitations under
+ the Licence.
+////////////////////////////////////////////////////////////////////////////*/
+
+
+
+#include <Math/Utils.h>
+
+#include "IBVoxCollection.h"
+#include "IBSparseVoxCollection.h"
+#include "IBVoxOccupancy.h"
+
+IBVoxOccupancy::IBVoxOccupancy(int block_size) :
+    m_BlockSize(block_size > 0 ? block_size : 1),
+    m_Blocks(Vector3i(0,0,0)),
+    m_Tracer(NULL)
+{}
+
+IBVoxOccupancy::~IBVoxOccupancy()
+{
+    delete m_Tracer;
+}
+
+namespace {
+
+// running min-max of the voxel values in each block //
+struct BlockRange {
+    Vector<Scalarf> min, max;
+    Vector<char>    usable;
+
+    BlockRange(int nblocks) :
+        min(nblocks, NAN), max(nblocks, NAN), usable(nblocks, 1) {}
+
+    inline void Add(Id_t bid, const IBVoxel &vox) {
+        if(vox.Count != 0 || !isFinite(vox.Value) || vox.Value > 0) {
+            usable[bid] = 0;
+            return;
+        }
+        if(std::isnan(min[bid]) || vox.Value < min[bid]) min[bid] = vox.Value;
+        if(std::isnan(max[bid]) || vox.Value > max[bid]) max[bid] = vox.Value;
+    }
+};
+
+} // namespace
+
+void IBVoxOccupancy::Reset(const StructuredGrid &grid)
+{
+    delete m_Tracer;
+    m_Tracer = NULL;
+
+    const int b = m_BlockSize;
+    Vector3i dims = grid.GetDims();
+    Vector3i bdims((dims(0) + b - 1) / b,
+                   (dims(1) + b - 1) / b,
+                   (dims(2) + b - 1) / b);
+    m_Blocks = IBLightCollection(bdims);
+    m_Blocks.SetSpacing(grid.GetSpacing() * b);
+    m_Blocks.SetPosition(grid.GetPosition());
+}
+
+void IBVoxOccupancy::Finalize(const Vector<Scalarf> &bmin,
+                              const Vector<Scalarf> &bmax,
+                              const Vector<char> &usable)
+{
+    for(unsigned int i = 0; i < bmin.size(); ++i) {
+        bool frozen = usable[i] && !std::isnan(bmin[i]) && bmin[i] == bmax[i];
+        m_Blocks[i].Value = frozen ? bmin[i] : NAN;
+    }
+    m_Tracer = new IBVoxRaytracer(m_Blocks);
+}
+
+void IBVoxOccupancy::Build(IBVoxCollection *voxels)
+{
+    if(!voxels) {
+        delete m_Tracer;
+        m_Tracer = NULL;
+        return;
+    }
+    Reset(*voxels);
+
+    const int b = m_BlockSize;
+    BlockRange range(m_Blocks.GetDims().prod());
+    for(unsigned int i = 0; i < voxels->Data().size(); ++i) {
+        Vector3i id = voxels->UnMap(i);
+        range.Add(m_Blocks.Map(Vector3i(id(0) / b, id(1) / b, id(2) / b)),
+                  voxels->Data()[i]);
+    }
+    Finalize(range.min, range.max, range.usable);
+}
+
+void IBVoxOccupancy::Build(IBSparseVoxCollection *voxels)
+{
+    if(!voxels) {
+        delete m_Tracer;
+        m_Tracer = NULL;
+        return;
+    }
+    Reset(*voxels);
+
+    // with a masked background every block starts as background and the
+    // allocated voxels are added on top, otherwise only the blocks fully
+    // covered by allocated voxels may be frozen //
+    const int b = m_BlockSize;
+    const int nblocks = m_Blocks.GetDims().prod();
+    const IBVoxel &bg = voxels->GetBackground();
+    const bool frozen_bg = bg.Count == 0 && isFinite(bg.Value) && bg.Value < 0;
+    BlockRange range(nblocks);
+    Vector<int> covered(nblocks, 0);
+    if(frozen_bg)
+        for(int i = 0; i < nblocks; ++i) range.Add(i, bg);
+
+    const int sb = voxels->GetBlockSize();
+    for(unsigned int k = 0; k < voxels->GetNumberOfBlocks(); ++k) {
+        const IBVoxel *block = voxels->GetBlock(k);
+        Vector3i origin = voxels->GetBlockOrigin(k);
+        for(int z = 0; z < sb; ++z)
+            for(int y = 0; y < sb; ++y)
+                for(int x = 0; x < sb; ++x) {
+                    Vector3i id = origin + Vector3i(x,y,z);
+                    if(!voxels->IsInsideGrid(id)) continue;
+                    Id_t bid = m_Blocks.Map(Vector3i(id(0) / b, id(1) / b, id(2) / b));
+                    range.Add(bid, block[x + sb * (y + sb * z)]);
+                    ++covered[bid];
+                }
+    }
+    if(!frozen_bg) {
+        const Vector3i &dims = voxels->GetDims();
+        for(int i = 0; i < nblocks; ++i) {
+            Vector3i origin = m_Blocks.UnMap(i) * b;
+            int inside = std::min(b, dims(0) - origin(0)) *
+                         std::min(b, dims(1) - origin(1)) *
+                         std::min(b, dims(2) - origin(2));
+            if(covered[i] < inside) range.usable[i] = 0;
+        }
+    }
+    Finalize(range.min, range.max, range.usable);
+}
+
+unsigned int IBVoxOccupancy::GetNumberOfFrozenBlocks() const
+{
+    unsigned int count = 0;
+    for(unsigned int i = 0; i < m_Blocks.Data().size(); ++i)
+        if(isFinite(m_Blocks.Data()[i].Value)) ++count;
+    return count;
+}
+
+void IBVoxOccupancy::Split(const Vector4f &pt1, const Vector4f &pt2,
+                           Vector<Piece> &pieces) const
+{
+    Vector4f dir = pt2 - pt1;
+    Scalarf  length = dir.norm();
+    if(!m_Tracer || !(length > 0)) {
+        Piece p = { pt1, pt2, false, 0 };
+        pieces.push_back(p);
+        return;
+    }
+    dir /= length;
+
+    IBVoxRaytracer::RayData ray = m_Tracer->TraceBetweenPoints(pt1, pt2);
+    const unsigned int first = pieces.size();
+    Scalarf s = 0;
+    for(unsigned int i = 0; i < ray.Data().size(); ++i) {
+        const IBVoxRaytracer::RayData::Element &el = ray.Data()[i];
+        Scalarf value  = m_Blocks.At(el.vox_id).Value;
+        bool    frozen = isFinite(value);
+        Vector4f begin = pt1 + s * dir;
+        s += el.L;
+        Vector4f end   = pt1 + s * dir;
+        if(pieces.size() > first && pieces.back().frozen == frozen &&
+                (!frozen || pieces.back().value == value)) {
+            pieces.back().end = end;
+        }
+        else {
+            Piece p = { begin, end, frozen, frozen ? value : 0 };
+            pieces.push_back(p);
+        }
+    }
+    if(pieces.size() == first) {
+        Piece p = { pt1, pt2, false, 0 };
+        pieces.push_back(p);
+    }
+    pieces[first].begin = pt1;
+    pieces.back().end   = pt2;
+}
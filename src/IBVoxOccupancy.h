@@ -0,0 +1,89 @@
+/*////////////////////////////////////////////////////////////////////////////
+ Copyright 2018 Istituto Nazionale di Fisica Nucleare
+
+ Licensed under the EUPL, Version 1.2 or - as soon they will be approved by
+ the European Commission - subsequent versions of the EUPL (the "Licence").
+ You may not use this work except in compliance with the Licence.
+
+ You may obtain a copy of the Licence at:
+
+ https://joinup.ec.europa.eu/software/page/eupl
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the Licence is distributed on an "AS IS" basis, WITHOUT
+ WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ Licence for the specific language governing permissions and limitations under
+ the Licence.
+////////////////////////////////////////////////////////////////////////////*/
+
+
+
+#ifndef IBVOXOCCUPANCY_H
+#define IBVOXOCCUPANCY_H
+
+#include <Math/Dense.h>
+#include <Core/Vector.h>
+
+#include "IBVoxel.h"
+#include "IBVoxRaytracer.h"
+
+using namespace uLib;
+
+class IBVoxCollection;
+class IBSparseVoxCollection;
+
+////////////////////////////////////////////////////////////////////////////////
+//////  VOXEL OCCUPANCY  ///////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+///
+/// Min-max summary of an IBVoxCollection over cubic blocks of voxels. A block
+/// is frozen when all its voxels share the same finite value <= 0 and have
+/// Count == 0, so a ray crossing it can be accounted analytically instead of
+/// walking each voxel. Blocks are traced with a coarse raytracer sharing the
+/// collection geometry.
+///
+class IBVoxOccupancy {
+public:
+    struct Piece {
+        Vector4f begin;
+        Vector4f end;
+        bool     frozen;
+        Scalarf  value;  // voxel value of a frozen piece
+    };
+
+    IBVoxOccupancy(int block_size = 4);
+    ~IBVoxOccupancy();
+
+    // must be rebuilt whenever the voxel values or mask change //
+    void Build(IBVoxCollection *voxels);
+
+    // voxels of empty sparse blocks read as the collection background, that
+    // is frozen only if masked (negative) //
+    void Build(IBSparseVoxCollection *voxels);
+
+    inline bool IsValid() const { return m_Tracer != NULL; }
+
+    inline int GetBlockSize() const { return m_BlockSize; }
+
+    unsigned int GetNumberOfFrozenBlocks() const;
+
+    // splits segment pt1-pt2 into consecutive pieces that are either frozen
+    // with a single value or have to be traced voxel by voxel //
+    void Split(const Vector4f &pt1, const Vector4f &pt2,
+               Vector<Piece> &pieces) const;
+
+private:
+    IBVoxOccupancy(const IBVoxOccupancy &);
+    IBVoxOccupancy &operator=(const IBVoxOccupancy &);
+
+    void Reset(const StructuredGrid &grid);
+    void Finalize(const Vector<Scalarf> &bmin, const Vector<Scalarf> &bmax,
+                  const Vector<char> &usable);
+
+    int               m_BlockSize;
+    IBLightCollection m_Blocks;  // frozen value, NAN for blocks to trace
+    IBVoxRaytracer   *m_Tracer;
+};
+
+
+#endif // IBVOXOCCUPANCY_H
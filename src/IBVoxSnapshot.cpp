@@ -0,0 +1,244 @@
+/*////////////////////////////////////////////////////////////////////////////
+ Copyright 2018 Istituto Nazionale di Fisica Nucleare
+
+ Licensed under the EUPL, Version 1.2 or - as soon they will be approved by
+ the European Commission - subsequent versions of the EUPL (the "Licence").
+ You may not use this work except in compliance with the Licence.
+
+ You may obtain a copy of the Licence at:
+
+ https://joinup.ec.europa.eu/software/page/eupl
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the Licence is distributed on an "AS IS" basis, WITHOUT
+ WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ Licence for the specific language governing permissions and limitations under
+ the Licence.
+////////////////////////////////////////////////////////////////////////////*/
+
+#include <stdio.h>
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "IBVoxCollection.h"
+#include "IBVoxSnapshot.h"
+
+using namespace uLib;
+
+
+namespace {
+
+static bool IsBigEndian()
+{
+    const unsigned int one = 1;
+    return *(const unsigned char *)&one == 0;
+}
+
+static inline float SwapBytes(float v)
+{
+    unsigned char *b = (unsigned char *)&v;
+    std::swap(b[0], b[3]);
+    std::swap(b[1], b[2]);
+    return v;
+}
+
+} // namespace
+
+
+////////////////////////////////////////////////////////////////////////////////
+/////  PIMPL  //////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+class IBVoxSnapshotPimpl {
+public:
+    IBVoxSnapshotPimpl(IBVoxSnapshot::Format format) :
+        m_Format(format),
+        m_DensityType(false),
+        m_Failed(false),
+        m_Front(0),
+        m_Thread(NULL)
+    {}
+
+    const IBLightCollection &Back() const { return m_Buffers[!m_Front]; }
+
+    // voxel values x fastest, scaled as ExportToVtk; serial, not to take
+    // the cores of the running iterations //
+    void Values(Vector<float> &values) const
+    {
+        const IBLightCollection &image = this->Back();
+        const Vector3i dims = image.GetDims();
+        const float norm = m_DensityType ? 1 : 1.E6;
+        values.resize(dims.prod());
+        for (int z = 0; z < dims(2); ++z)
+            for (int y = 0; y < dims(1); ++y)
+                for (int x = 0; x < dims(0); ++x) {
+                    Id_t id = x + dims(0) * (y + dims(1) * z);
+                    values[id] = fabs(image.At(Vector3i(x,y,z)).Value) * norm;
+                }
+    }
+
+    bool WriteVtkBinary(const char *file)
+    {
+        Vector<float> values;
+        this->Values(values);
+        if (!IsBigEndian())
+            for (unsigned int i = 0; i < values.size(); ++i)
+                values[i] = SwapBytes(values[i]);
+
+        FILE *f = fopen(file, "wb");
+        if (!f) return false;
+        const IBLightCollection &image = this->Back();
+        const Vector3i dims = image.GetDims();
+        const Vector3f spacing = image.GetSpacing();
+        const Vector3f origin = image.GetPosition();
+        fprintf(f, "# vtk DataFile Version 2.0\n"
+                   "Image Builder vtk output, scale %g\n"
+                   "BINARY\n"
+                   "DATASET STRUCTURED_POINTS\n"
+                   "DIMENSIONS %d %d %d\n"
+                   "SPACING %f %f %f\n"
+                   "ORIGIN %f %f %f\n"
+                   "POINT_DATA %d\n"
+                   "SCALARS volume_scalars float 1\n"
+                   "LOOKUP_TABLE default\n",
+                m_DensityType ? 1. : 1.E6,
+                dims(0), dims(1), dims(2),
+                spacing(0), spacing(1), spacing(2),
+                origin(0), origin(1), origin(2),
+                dims.prod());
+        bool ok = fwrite(values.data(), sizeof(float), values.size(), f) == values.size();
+        ok = (fputs("\n", f) >= 0) && ok;
+        return (fclose(f) == 0) && ok;
+    }
+
+    bool WriteRaw(const char *file)
+    {
+        Vector<float> values;
+        this->Values(values);
+
+        FILE *f = fopen(file, "wb");
+        if (!f) return false;
+        bool ok = fwrite(values.data(), sizeof(float), values.size(), f) == values.size();
+        ok = (fclose(f) == 0) && ok;
+
+        std::string json = std::string(file) + ".json";
+        const char *name = strrchr(file, '/');
+        name = name ? name + 1 : file;
+        f = fopen(json.c_str(), "w");
+        if (!f) return false;
+        const IBLightCollection &image = this->Back();
+        const Vector3i dims = image.GetDims();
+        const Vector3f spacing = image.GetSpacing();
+        const Vector3f origin = image.GetPosition();
+        fprintf(f, "{\n"
+                   "  \"data\": \"%s\",\n"
+                   "  \"type\": \"float32\",\n"
+                   "  \"endian\": \"%s\",\n"
+                   "  \"order\": \"xyz\",\n"
+                   "  \"dims\": [%d, %d, %d],\n"
+                   "  \"spacing\": [%g, %g, %g],\n"
+                   "  \"origin\": [%g, %g, %g],\n"
+                   "  \"scale\": %g\n"
+                   "}\n",
+                name, IsBigEndian() ? "big" : "little",
+                dims(0), dims(1), dims(2),
+                spacing(0), spacing(1), spacing(2),
+                origin(0), origin(1), origin(2),
+                m_DensityType ? 1. : 1.E6);
+        return (fclose(f) == 0) && ok;
+    }
+
+    // runs on the background thread //
+    void Write()
+    {
+        bool ok;
+        switch (m_Format) {
+        case IBVoxSnapshot::VtkBinary: ok = WriteVtkBinary(m_File.c_str()); break;
+        case IBVoxSnapshot::Raw:       ok = WriteRaw(m_File.c_str()); break;
+        default:
+            ok = m_Buffers[!m_Front].ExportToVtk(m_File.c_str(), m_DensityType) != 0;
+        }
+        if (!ok) {
+            std::cerr << "IBVoxSnapshot: error writing " << m_File << "\n";
+            m_Failed = true;
+        }
+    }
+
+    void Join()
+    {
+        if (!m_Thread) return;
+        m_Thread->join();
+        delete m_Thread;
+        m_Thread = NULL;
+    }
+
+    IBVoxSnapshot::Format m_Format;
+    bool                  m_DensityType;
+    bool                  m_Failed;
+    IBLightCollection     m_Buffers[2];
+    int                   m_Front;
+    std::string           m_File;
+    std::thread          *m_Thread;
+};
+
+
+////////////////////////////////////////////////////////////////////////////////
+/////  SNAPSHOT  ///////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+IBVoxSnapshot::IBVoxSnapshot(Format format) :
+    d(new IBVoxSnapshotPimpl(format))
+{}
+
+IBVoxSnapshot::~IBVoxSnapshot()
+{
+    this->Wait();
+    delete d;
+}
+
+void IBVoxSnapshot::SetFormat(Format format)
+{
+    d->Join();
+    d->m_Format = format;
+}
+
+IBVoxSnapshot::Format IBVoxSnapshot::GetFormat() const
+{
+    return d->m_Format;
+}
+
+bool IBVoxSnapshot::Export(const IBVoxCollection &voxels, const char *filename,
+                           bool density_type)
+{
+    // the copy overlaps the write of the previous snapshot //
+    IBLightCollection &copy = d->m_Buffers[d->m_Front];
+    copy.SetDims(voxels.GetDims());
+    copy.SetSpacing(voxels.GetSpacing());
+    copy.SetPosition(voxels.GetPosition());
+    copy.Data().resize(voxels.Data().size());
+    const long size = voxels.Data().size();
+    Voxel *dst = copy.Data().data();
+    const IBVoxel *src = voxels.Data().data();
+    #pragma omp parallel for schedule(static)
+    for (long i = 0; i < size; ++i)
+        dst[i].Value = src[i].Value;
+
+    d->Join();
+    d->m_Front = !d->m_Front;
+    d->m_File = filename;
+    d->m_DensityType = density_type;
+    d->m_Thread = new std::thread(&IBVoxSnapshotPimpl::Write, d);
+    return !d->m_Failed;
+}
+
+bool IBVoxSnapshot::Wait()
+{
+    d->Join();
+    bool ok = !d->m_Failed;
+    d->m_Failed = false;
+    return ok;
+}
@@ -0,0 +1,60 @@
+/*////////////////////////////////////////////////////////////////////////////
+ Copyright 2018 Istituto Nazionale di Fisica Nucleare
+
+ Licensed under the EUPL, Version 1.2 or - as soon they will be approved by
+ the European Commission - subsequent versions of the EUPL (the "Licence").
+ You may not use this work except in compliance with the Licence.
+
+ You may obtain a copy of the Licence at:
+
+ https://joinup.ec.europa.eu/software/page/eupl
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the Licence is distributed on an "AS IS" basis, WITHOUT
+ WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ Licence for the specific language governing permissions and limitations under
+ the Licence.
+////////////////////////////////////////////////////////////////////////////*/
+
+#ifndef IBVOXSNAPSHOT_H
+#define IBVOXSNAPSHOT_H
+
+#include "IBVoxel.h"
+
+class IBVoxCollection;
+
+
+// Asynchronous image snapshots: Export copies the voxel values into a
+// double buffer and returns, the file is written on a background thread.
+// Export only waits for the snapshot before the previous one, so periodic
+// exports between EM iterations cost about one copy of the Value array.
+//
+// Vtk writes through ExportToVtk of the copy, same file as the collection
+// would write. VtkBinary writes legacy binary VTK (big endian float).
+// Raw writes the float values, x fastest, native endian, and a
+// filename.json header with dims, spacing, origin and byte order. Binary
+// and raw values are scaled as ExportToVtk does: absolute value, times 1e6
+// unless density_type. The scale is recorded in the VTK title line and in
+// the json header, so IBVoxImageStack::Load reads either back.
+
+class IBVoxSnapshot {
+public:
+    enum Format { Vtk = 0, VtkBinary, Raw };
+
+    IBVoxSnapshot(Format format = Vtk);
+    ~IBVoxSnapshot();
+
+    void SetFormat(Format format);
+    Format GetFormat() const;
+
+    bool Export(const IBVoxCollection &voxels, const char *filename,
+                bool density_type = 0);
+
+    // waits for the pending snapshot, false if any write failed //
+    bool Wait();
+
+private:
+    class IBVoxSnapshotPimpl *d;
+};
+
+#endif // IBVOXSNAPSHOT_H
@@ -0,0 +1,215 @@
+/*////////////////////////////////////////////////////////////////////////////
+ Copyright 2018 Istituto Nazionale di Fisica Nucleare
+
+ Licensed under the EUPL, Version 1.2 or - as soon they will be approved by
+ the European Commission - subsequent versions of the EUPL (the "Licence").
+ You may not use this work except in compliance with the Licence.
+
+ You may obtain a copy of the Licence at:
+
+ https://joinup.ec.europa.eu/software/page/eupl
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the Licence is distributed on an "AS IS" basis, WITHOUT
+ WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ Licence for the specific language governing permissions and limitations under
+ the Licence.
+////////////////////////////////////////////////////////////////////////////*/
+
+
+
+#include <sys/time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "IBAnalyzerEM.h"
+#include "IBAnalyzerEMAlgorithmSGA.h"
+#include "IBAnalyzerEMEngine.h"
+#include "IBVoxCollection.h"
+
+using namespace uLib;
+
+
+// Benchmark and accuracy report of the EM engine precision modes. A fixed
+// synthetic dataset (seeded) of straight muons through a block of dense
+// material in a light matrix is reconstructed with each mode, the lambda
+// image of the double run is the reference.
+
+typedef IBAnalyzerEM::Event Event;
+
+namespace {
+
+// small deterministic generator, the dataset must not depend on libc //
+struct Random {
+    Random(unsigned long seed) : m_State(seed * 2862933555777941757ULL + 3037000493ULL) {}
+    double Uniform() {
+        m_State = m_State * 6364136223846793005ULL + 1442695040888963407ULL;
+        return ((m_State >> 11) + 0.5) / 9007199254740992.;
+    }
+    double Gaus() {
+        return sqrt(-2 * log(Uniform())) * cos(2 * M_PI * Uniform());
+    }
+    unsigned long long m_State;
+};
+
+static double Now()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + 1E-6 * tv.tv_usec;
+}
+
+static Scalarf TrueLambda(const Vector3i &id, const Vector3i &dims)
+{
+    for (int k = 0; k < 3; ++k)
+        if (id(k) < dims(k) * 3 / 8 || id(k) >= dims(k) * 5 / 8) return 2.E-6;
+    return 40.E-6;
+}
+
+// muons with slopes up to 0.5 crossing the grid top to bottom, elements and
+// Wij built as IBAnalyzerEM::AddMuon does on the voxels crossed at each layer,
+// the scattering is sampled from the true lambda plus the measurement error //
+static void BuildDataset(IBVoxCollection &voxels, Vector<Event> &events,
+                         int size, unsigned long seed)
+{
+    Random rnd(seed);
+    const Vector3i dims = voxels.GetDims();
+    const Scalarf spacing = voxels.GetSpacing()(1);
+    const Scalarf error = 2.E-3;
+    events.clear();
+    events.reserve(size);
+    while ((int)events.size() < size) {
+        Scalarf sx = rnd.Uniform() - 0.5, sz = rnd.Uniform() - 0.5;
+        Scalarf x = rnd.Uniform() * dims(0), z = rnd.Uniform() * dims(2);
+        Scalarf L = spacing * sqrt(1 + sx*sx + sz*sz);
+        Event evc;
+        Matrix2f S = Matrix2f::Zero();
+        Scalarf T = L * dims(1);
+        for (int y = dims(1) - 1; y >= 0; --y) {
+            Vector3i id((int)x, y, (int)z);
+            x += sx; z += sz;
+            if (!voxels.IsInsideGrid(id)) continue;
+            Event::Element elc;
+            T = fabs(T - L);
+            elc.Wij << L,           L*L/2 + L*T,
+                       L*L/2 + L*T, L*L*L/3 + L*L*T + L*T*T;
+            elc.pw = 1;
+            elc.voxel = &voxels[id];
+            S += elc.Wij * TrueLambda(id, dims);
+            evc.elements.push_back(elc);
+        }
+        if (evc.elements.size() < 2) continue;
+        evc.header.InitialSqrP = 1;
+        evc.header.pTrue = 3;
+        evc.header.E = Matrix4f::Identity() * error * error;
+        Eigen::LLT<Matrix2f> llt(S);
+        Matrix2f C = llt.matrixL();
+        for (int view = 0; view < 2; ++view) {
+            Vector2f g(rnd.Gaus(), rnd.Gaus());
+            Vector2f d = C * g + Vector2f(rnd.Gaus(), rnd.Gaus()) * error;
+            evc.header.Di(2*view) = d(0);
+            evc.header.Di(2*view + 1) = d(1);
+        }
+        events.push_back(evc);
+    }
+}
+
+struct Result {
+    double seconds;
+    Vector<Scalarf> lambda;
+};
+
+static Result Reconstruct(IBAnalyzerEMAlgorithm *algorithm,
+                          IBAnalyzerEM::Precision precision,
+                          const Vector3i &dims, int muons, int iterations,
+                          unsigned long seed)
+{
+    IBVoxCollection voxels(dims);
+    voxels.SetSpacing(Vector3f(5,5,5));
+    IBVoxel init = { 10.E-6, 0, 0 };
+    voxels.InitLambda(init);
+    Vector<Event> events;
+    BuildDataset(voxels, events, muons, seed);
+
+    IBAnalyzerEMEngine *engine =
+            IBAnalyzerEMEngine::Create(algorithm, NULL, NULL, precision);
+    Result result;
+    double start = Now();
+    for (int it = 0; it < iterations; ++it) {
+        engine->Evaluate(events, &voxels);
+        engine->UpdateDensity(&voxels, 10);
+    }
+    result.seconds = (Now() - start) / iterations;
+    delete engine;
+
+    result.lambda.resize(voxels.Data().size());
+    for (unsigned int i = 0; i < voxels.Data().size(); ++i)
+        result.lambda[i] = voxels.Data()[i].Value;
+    return result;
+}
+
+} // namespace
+
+
+int main(int argc, char *argv[])
+{
+    struct Params {
+        int muons;
+        int iterations;
+        int dims;
+        unsigned long seed;
+        const char *kernel;
+    } parameters = {
+        200000,  // muons
+        20,      // iterations
+        40,      // voxels per side
+        1,       // seed
+        "PXTZ"
+    };
+    if(argc > 1) parameters.muons      = atoi(argv[1]);
+    if(argc > 2) parameters.iterations = atoi(argv[2]);
+    if(argc > 3) parameters.dims       = atoi(argv[3]);
+    if(argc > 4) parameters.seed       = atol(argv[4]);
+    if(argc > 5) parameters.kernel     = argv[5];
+
+    IBAnalyzerEMAlgorithm *algorithm;
+    if     (!strcmp(parameters.kernel, "PX"))  algorithm = new IBAnalyzerEMAlgorithmSGA_PX;
+    else if(!strcmp(parameters.kernel, "PT"))  algorithm = new IBAnalyzerEMAlgorithmSGA_PT;
+    else if(!strcmp(parameters.kernel, "P"))   algorithm = new IBAnalyzerEMAlgorithmSGA_P;
+    else                                       algorithm = new IBAnalyzerEMAlgorithmSGA_PXTZ;
+
+    const Vector3i dims(parameters.dims, parameters.dims, parameters.dims);
+    const char *names[3] = { "float", "mixed", "double" };
+    const IBAnalyzerEM::Precision modes[3] = {
+        IBAnalyzerEM::FloatPrecision,
+        IBAnalyzerEM::MixedPrecision,
+        IBAnalyzerEM::DoublePrecision
+    };
+
+    printf("EM precision report: %s kernel, %d muons, %d iterations, %d^3 voxels, seed %lu\n",
+           parameters.kernel, parameters.muons, parameters.iterations,
+           parameters.dims, parameters.seed);
+
+    Result results[3];
+    for (int m = 2; m >= 0; --m)
+        results[m] = Reconstruct(algorithm, modes[m], dims, parameters.muons,
+                                 parameters.iterations, parameters.seed);
+
+    const Vector<Scalarf> &ref = results[2].lambda;
+    printf("%-8s %14s %9s %14s %14s\n", "mode", "s/iteration", "speedup",
+           "max rel dev", "rms rel dev");
+    for (int m = 0; m < 3; ++m) {
+        double max_dev = 0, sum2 = 0;
+        for (unsigned int i = 0; i < ref.size(); ++i) {
+            double dev = fabs(results[m].lambda[i] - ref[i]) / fabs(ref[i]);
+            if (dev > max_dev) max_dev = dev;
+            sum2 += dev * dev;
+        }
+        printf("%-8s %14.4f %9.2f %14.3e %14.3e\n", names[m],
+               results[m].seconds, results[2].seconds / results[m].seconds,
+               max_dev, sqrt(sum2 / ref.size()));
+    }
+    return 0;
+}
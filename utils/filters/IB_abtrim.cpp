@@ -35,6 +35,7 @@
 
 #include <IBVoxFilters.h>
 #include "IBVoxCollection.h"
+#include "IBVoxImageStack.h"
 
 #include <Vtk/vtkVoxImage.h>
 
@@ -130,7 +131,7 @@ int main(int argc, char *argv[])
     char filename[150];
     sprintf(filename,"%s",p.file.c_str());
 
-    if(!image.ImportFromVtk(filename))
+    if(!IBVoxImageStack::Load(filename, image))
     {
         std::cerr << "Error: Could not open file\n";
         exit(1);
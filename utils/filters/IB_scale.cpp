@@ -36,6 +36,7 @@
 
 #include <IBVoxFilters.h>
 #include "IBVoxCollection.h"
+#include "IBVoxImageStack.h"
 #include <Vtk/vtkVoxImage.h>
 
 using namespace uLib;
@@ -101,7 +102,7 @@ int main(int argc, char *argv[])
     char filename[150];
     sprintf(filename,"%s",parameters.file);
 
-    if(!image.ImportFromVtk(filename))
+    if(!IBVoxImageStack::Load(filename, image))
     {
         std::cerr << "Error: Could not open file\n";
         exit(1);
@@ -35,6 +35,7 @@
 
 #include <IBVoxFilters.h>
 #include "IBVoxCollection.h"
+#include "IBVoxImageStack.h"
 #include <Vtk/vtkVoxImage.h>
 
 using namespace uLib;
@@ -107,7 +108,7 @@ int main(int argc, char *argv[])
     char filename[150];
     sprintf(filename,"%s",parameters.file);
 
-    if(!image.ImportFromVtk(filename))
+    if(!IBVoxImageStack::Load(filename, image))
     {
         std::cerr << "Error: Could not open file\n";
         exit(1);
@@ -0,0 +1,117 @@
+/*////////////////////////////////////////////////////////////////////////////
+ Copyright 2018 Istituto Nazionale di Fisica Nucleare
+
+ Licensed under the EUPL, Version 1.2 or - as soon they will be approved by
+ the European Commission - subsequent versions of the EUPL (the "Licence").
+ You may not use this work except in compliance with the Licence.
+
+ You may obtain a copy of the Licence at:
+
+ https://joinup.ec.europa.eu/software/page/eupl
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the Licence is distributed on an "AS IS" basis, WITHOUT
+ WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ Licence for the specific language governing permissions and limitations under
+ the Licence.
+////////////////////////////////////////////////////////////////////////////*/
+
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include <TFile.h>
+
+#include "IBMuonError.h"
+#include "IBMuonEventTTreeLNLdataReader.h"
+
+using namespace uLib;
+
+
+// Reads an LNL muon file serially and with parallel reading workers and
+// checks that both give the same muons, bit for bit, in the same order.
+//
+//   IB_lnlReaderValidate input.root [workers] [chunk] [min]
+
+namespace {
+
+static double Now()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + 1E-6 * tv.tv_usec;
+}
+
+template < class T >
+static bool Same(const T &a, const T &b)
+{
+    return a.origin() == b.origin() && a.direction() == b.direction();
+}
+
+static bool Same(const MuonScatter &a, const MuonScatter &b)
+{
+    return Same(a.LineIn(), b.LineIn()) && Same(a.LineOut(), b.LineOut()) &&
+           Same(a.ErrorIn(), b.ErrorIn()) && Same(a.ErrorOut(), b.ErrorOut()) &&
+           a.GetMomentum() == b.GetMomentum() &&
+           a.GetMomentumPrime() == b.GetMomentumPrime();
+}
+
+static IBMuonEventTTreeLNLdataReader *Open(TFile *file, IBMuonError &sigma, float min)
+{
+    IBMuonEventTTreeLNLdataReader *reader = new IBMuonEventTTreeLNLdataReader;
+    reader->setTFile(file);
+    reader->setMomentum(3);
+    if(min > 0) reader->setAcquisitionTime(min);
+    reader->setError(sigma);
+    return reader;
+}
+
+} // namespace
+
+
+int main(int argc, char *argv[])
+{
+    if(argc < 2) {
+        fprintf(stderr, "usage: %s input.root [workers] [chunk] [min]\n", argv[0]);
+        return 1;
+    }
+    int workers         = argc > 2 ? atoi(argv[2]) : 4;
+    unsigned long chunk = argc > 3 ? atol(argv[3]) : 4096;
+    float min           = argc > 4 ? atof(argv[4]) : 0;
+
+    TFile *f = new TFile(argv[1]);
+    if(f->IsZombie()) return 1;
+    IBMuonError sigma(6.02, 7.07);
+    sigma.crossChamberErrorCorrection(true);
+    IBMuonEventTTreeLNLdataReader *serial = Open(f, sigma, min);
+    IBMuonEventTTreeLNLdataReader *parallel = Open(f, sigma, min);
+    parallel->setParallelReading(workers, chunk);
+
+    const unsigned long ev = serial->getNumberOfEvents();
+    unsigned long good = 0, bad = 0;
+    double ts = 0, tp = 0;
+    MuonScatter a, b;
+    for(unsigned long i = 0; i < ev; ++i) {
+        double t0 = Now();
+        bool oka = serial->readNext(&a);
+        double t1 = Now();
+        bool okb = parallel->readNext(&b);
+        ts += t1 - t0;
+        tp += Now() - t1;
+        if(oka != okb || (oka && !Same(a, b))) {
+            if(bad < 10)
+                printf("entry %lu differs: serial %d parallel %d\n", i, oka, okb);
+            ++bad;
+        }
+        good += oka;
+    }
+    printf("%s: %lu entries, %lu muons, %lu mismatches; serial %.3f s, "
+           "%d workers x %lu %.3f s\n", argv[1], ev, good, bad, ts, workers, chunk, tp);
+
+    delete parallel;
+    delete serial;
+    return bad ? 1 : 0;
+}
@@ -0,0 +1,143 @@
+/*////////////////////////////////////////////////////////////////////////////
+ Copyright 2018 Istituto Nazionale di Fisica Nucleare
+
+ Licensed under the EUPL, Version 1.2 or - as soon they will be approved by
+ the European Commission - subsequent versions of the EUPL (the "Licence").
+ You may not use this work except in compliance with the Licence.
+
+ You may obtain a copy of the Licence at:
+
+ https://joinup.ec.europa.eu/software/page/eupl
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the Licence is distributed on an "AS IS" basis, WITHOUT
+ WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ Licence for the specific language governing permissions and limitations under
+ the Licence.
+////////////////////////////////////////////////////////////////////////////*/
+
+
+
+#include <ctime>
+
+#include <TFile.h>
+
+#include "IBMuonError.h"
+#include "IBMuonEventTTreeReader.h"
+#include "IBVoxCollection.h"
+#include "IBVoxRaytracer.h"
+#include "IBNormalPlaneMinimizationVariablesEvaluator.h"
+
+using namespace uLib;
+
+
+// Compares the analytic jacobian error propagation of the normal plane
+// minimization variables against the finite difference one on recorded data
+// and reports the time spent by each per million muons.
+
+static Scalarf evaluateAll(IBNormalPlaneMinimizationVariablesEvaluator &minvar,
+                           const Vector<MuonScatter> &muons,
+                           Vector<Matrix4f> &errors, Vector<char> &valid)
+{
+    errors.resize(muons.size());
+    valid.resize(muons.size());
+    clock_t start = clock();
+    for(unsigned int i = 0; i < muons.size(); ++i) {
+        valid[i] = minvar.evaluate(muons[i]);
+        errors[i] = minvar.getCovarianceMatrix();
+    }
+    return (Scalarf)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+int main(int argc, char *argv[])
+{
+    if(argc < 2)
+    {
+        std::cerr << "No input filename given ..\n" <<
+                     "use: IB_minvarValidate file.root [max_events] [tolerance]\n";
+        exit(1);
+    }
+
+    struct Params {
+        char *file;
+        unsigned long max_events;
+        Scalarf tolerance;
+    } parameters = {
+        argv[1],
+                0,    // all events
+                0.01  // relative
+    };
+    if(argc > 2) parameters.max_events = atol(argv[2]);
+    if(argc > 3) parameters.tolerance  = atof(argv[3]);
+
+    TFile* f = new TFile(parameters.file);
+    if(f->IsZombie()) {
+        std::cerr << "Error: Could not open file\n";
+        exit(1);
+    }
+    IBMuonEventTTreeReader *reader = IBMuonEventTTreeReader::New(f);
+    reader->setTFile(f);
+    IBMuonError sigma(6.02, 7.07);
+    sigma.crossChamberErrorCorrection(true);
+    reader->setError(sigma);
+
+    unsigned long ev = reader->getNumberOfEvents();
+    if(parameters.max_events && parameters.max_events < ev)
+        ev = parameters.max_events;
+
+    Vector<MuonScatter> muons;
+    for(unsigned long i = 0; i < ev; ++i) {
+        MuonScatter mu;
+        if(reader->readNext(&mu)) muons.push_back(mu);
+    }
+    std::cout << "read " << muons.size() << " muons\n";
+    if(muons.empty()) return 0;
+
+    // voxels //
+    IBVoxel air = {0.1E-6,0,0};
+    IBVoxCollection voxels(Vector3i(61,32,48));
+    voxels.SetSpacing (Vector3f(5,5,5));
+    voxels.SetPosition(Vector3f(-152.5,-171.8,-120));
+    voxels.InitLambda(air);
+    IBVoxRaytracer tracer(voxels);
+
+    IBNormalPlaneMinimizationVariablesEvaluator minvar;
+    minvar.setRaytracer(&tracer);
+
+    Vector<Matrix4f> analytic, numeric;
+    Vector<char> valid, valid_fd;
+    Scalarf t_analytic = evaluateAll(minvar, muons, analytic, valid);
+    minvar.$$.finite_difference_errors = 1;
+    Scalarf t_numeric  = evaluateAll(minvar, muons, numeric, valid_fd);
+
+    unsigned long mismatch = 0, compared = 0, over = 0;
+    Scalard sum = 0, max = 0;
+    for(unsigned int i = 0; i < muons.size(); ++i) {
+        if(valid[i] != valid_fd[i]) { ++mismatch; continue; }
+        if(!valid[i]) continue;
+        // deviation on the variances, relative to the finite difference ones //
+        Scalarf dev = 0;
+        for(int j = 0; j < 4; ++j) {
+            Scalarf ref = numeric[i](j,j);
+            if(ref > 0) dev = std::max(dev, (Scalarf)fabs(analytic[i](j,j) - ref) / ref);
+        }
+        sum += dev;
+        if(dev > max) max = dev;
+        if(dev > parameters.tolerance) ++over;
+        ++compared;
+    }
+
+    Scalarf scale = 1.E6 / muons.size();
+    std::cout << "// -------- [minvar validate] --------- //\n"
+              << "integrity mismatch : " << mismatch << "\n"
+              << "compared           : " << compared << "\n"
+              << "mean deviation     : " << (compared ? sum/compared : 0) << "\n"
+              << "max deviation      : " << max << "\n"
+              << "over tolerance     : " << over << " (" << parameters.tolerance << ")\n"
+              << "analytic [s/Mmu]   : " << t_analytic * scale << "\n"
+              << "finite diff [s/Mmu]: " << t_numeric * scale << "\n"
+              << "speedup            : " << (t_analytic > 0 ? t_numeric / t_analytic : 0) << "\n"
+              << "// ------------------------------------ //\n";
+
+    return mismatch ? 1 : 0;
+}
@@ -0,0 +1,128 @@
+/*////////////////////////////////////////////////////////////////////////////
+ Copyright 2018 Istituto Nazionale di Fisica Nucleare
+
+ Licensed under the EUPL, Version 1.2 or - as soon they will be approved by
+ the European Commission - subsequent versions of the EUPL (the "Licence").
+ You may not use this work except in compliance with the Licence.
+
+ You may obtain a copy of the Licence at:
+
+ https://joinup.ec.europa.eu/software/page/eupl
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the Licence is distributed on an "AS IS" basis, WITHOUT
+ WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ Licence for the specific language governing permissions and limitations under
+ the Licence.
+////////////////////////////////////////////////////////////////////////////*/
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include <TFile.h>
+
+#include "IBMuonCollection.h"
+#include "IBMuonDataset.h"
+#include "IBMuonError.h"
+#include "IBMuonEventTTreeReader.h"
+#include "IBMuonEventTTreeLNLdataReader.h"
+
+using namespace uLib;
+
+
+// Converts a ROOT muon file (any source IBMuonEventTTreeReader::New knows)
+// to the columnar muon dataset, or prints a summary of a dataset.
+//
+//   IB_muonDataset input.root output.ibmu [momentum] [min] [start] [align_min]
+//   IB_muonDataset dataset.ibmu
+
+namespace {
+
+static double Now()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + 1E-6 * tv.tv_usec;
+}
+
+static int Info(const char *filename)
+{
+    double t0 = Now();
+    IBMuonDataset dataset;
+    if(!dataset.Open(filename)) return 1;
+    IBMuonCollection muons;
+    dataset.Load(muons);
+    printf("%s: %lu muons%s, loaded in %.3f s\n", filename, dataset.size(),
+           dataset.HasFullPath() ? " with full paths" : "", Now() - t0);
+    muons.PrintSelf(std::cout);
+    return 0;
+}
+
+} // namespace
+
+
+int main(int argc, char *argv[])
+{
+    if(argc == 2) return Info(argv[1]);
+    if(argc < 3) {
+        fprintf(stderr, "usage: %s input.root output.ibmu [momentum] [min] [start] [align_min]\n"
+                        "       %s dataset.ibmu\n", argv[0], argv[0]);
+        return 1;
+    }
+
+    struct Params {
+        float momentum;
+        float min;
+        float start;
+        float align_min;
+    } parameters = {
+        3,    // momentum
+        0,    // acquisition time [min], 0 reads all
+        0,    // start time [min]
+        0     // chamber alignment from data [min], 0 disables
+    };
+    if(argc > 3) parameters.momentum  = atof(argv[3]);
+    if(argc > 4) parameters.min       = atof(argv[4]);
+    if(argc > 5) parameters.start     = atof(argv[5]);
+    if(argc > 6) parameters.align_min = atof(argv[6]);
+
+    double t0 = Now();
+    TFile* f = new TFile(argv[1]);
+    IBMuonEventTTreeReader *reader = IBMuonEventTTreeReader::New(f);
+    reader->setTFile(f);
+    reader->setMomentum(parameters.momentum);
+    if(parameters.min > 0) reader->setAcquisitionTime(parameters.min);
+    reader->setStartTime(parameters.start);
+
+    IBMuonError sigma(6.02, 7.07);
+    sigma.crossChamberErrorCorrection(true);
+    reader->setError(sigma);
+
+    if(parameters.align_min > 0) {
+        IBMuonEventTTreeLNLdataReader *rd = dynamic_cast<IBMuonEventTTreeLNLdataReader *>(reader);
+        if(rd) rd->setAlignmentFromData(parameters.align_min);
+    }
+
+    IBMuonCollection muons;
+    unsigned long ev = reader->getNumberOfEvents();
+    {
+        // the next batch is decoded while this one is appended //
+        IBMuonEventPrefetcher prefetcher(reader, ev);
+        Vector<MuonScatter> batch;
+        while(prefetcher.next(batch))
+            if(!batch.empty()) muons.AddMuons(&batch[0], batch.size());
+    }
+    double t1 = Now();
+
+    if(!IBMuonDataset::Write(argv[2], muons)) return 1;
+    printf("%s: %lu of %lu events decoded in %.3f s, written to %s in %.3f s\n",
+           argv[1], (unsigned long)muons.Data().size(), ev, t1 - t0,
+           argv[2], Now() - t1);
+
+    delete reader;
+    return 0;
+}
@@ -0,0 +1,107 @@
+/*////////////////////////////////////////////////////////////////////////////
+ Copyright 2018 Istituto Nazionale di Fisica Nucleare
+
+ Licensed under the EUPL, Version 1.2 or - as soon they will be approved by
+ the European Commission - subsequent versions of the EUPL (the "Licence").
+ You may not use this work except in compliance with the Licence.
+
+ You may obtain a copy of the Licence at:
+
+ https://joinup.ec.europa.eu/software/page/eupl
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the Licence is distributed on an "AS IS" basis, WITHOUT
+ WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ Licence for the specific language governing permissions and limitations under
+ the Licence.
+////////////////////////////////////////////////////////////////////////////*/
+
+#include <TFile.h>
+
+#include "IBMuonError.h"
+#include "IBMuonEventTTreeReader.h"
+#include "IBTiltedAxisPocaEvaluator.h"
+
+using namespace uLib;
+
+
+// Compares the algebraic batched tilted axis kernel against the previous
+// trigonometric one on recorded data.
+
+int main(int argc, char *argv[])
+{
+    if(argc < 2)
+    {
+        std::cerr << "No input filename given ..\n" <<
+                     "use: IB_pocaValidate file.root [max_events] [tolerance]\n";
+        exit(1);
+    }
+
+    struct Params {
+        char *file;
+        unsigned long max_events;
+        Scalarf tolerance;
+    } parameters = {
+        argv[1],
+                0,    // all events
+                0.1   // mm
+    };
+    if(argc > 2) parameters.max_events = atol(argv[2]);
+    if(argc > 3) parameters.tolerance  = atof(argv[3]);
+
+    TFile* f = new TFile(parameters.file);
+    if(f->IsZombie()) {
+        std::cerr << "Error: Could not open file\n";
+        exit(1);
+    }
+    IBMuonEventTTreeReader *reader = IBMuonEventTTreeReader::New(f);
+    reader->setTFile(f);
+    IBMuonError sigma(6.02, 7.07);
+    sigma.crossChamberErrorCorrection(true);
+    reader->setError(sigma);
+
+    unsigned long ev = reader->getNumberOfEvents();
+    if(parameters.max_events && parameters.max_events < ev)
+        ev = parameters.max_events;
+
+    Vector<MuonScatter> muons;
+    for(unsigned long i = 0; i < ev; ++i) {
+        MuonScatter mu;
+        if(reader->readNext(&mu)) muons.push_back(mu);
+    }
+    std::cout << "read " << muons.size() << " muons\n";
+    if(muons.empty()) return 0;
+
+    // the batch evaluator walks MuonScatterData, gathered not cast //
+    Vector<MuonScatterData> data(muons.size());
+    for(unsigned int i = 0; i < muons.size(); ++i) data[i] = muons[i];
+
+    IBTiltedAxisPocaEvaluator tilted;
+    Vector<Vector4f> poca(muons.size());
+    bool *valid = new bool[muons.size()];
+    tilted.evaluate(&data[0], data.size(), &poca[0], valid);
+
+    unsigned long mismatch = 0, compared = 0, over = 0;
+    Scalard sum = 0, max = 0;
+    for(unsigned int i = 0; i < muons.size(); ++i) {
+        bool ref = tilted.evaluateReference(muons[i]);
+        if(ref != valid[i]) { ++mismatch; continue; }
+        if(!ref) continue;
+        Scalarf dist = (tilted.getPoca() - poca[i]).head(3).norm();
+        sum += dist;
+        if(dist > max) max = dist;
+        if(dist > parameters.tolerance) ++over;
+        ++compared;
+    }
+    delete [] valid;
+
+    std::cout << "// --------- [poca validate] ---------- //\n"
+              << "integrity mismatch : " << mismatch << "\n"
+              << "compared           : " << compared << "\n"
+              << "mean deviation     : " << (compared ? sum/compared : 0) << "\n"
+              << "max deviation      : " << max << "\n"
+              << "over tolerance     : " << over << " (" << parameters.tolerance << ")\n"
+              << "// ------------------------------------ //\n";
+
+    return (mismatch || over) ? 1 : 0;
+}
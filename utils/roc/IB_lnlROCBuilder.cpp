@@ -39,6 +39,7 @@
 #include "IBVoxCollectionCap.h"
 #include "IBSubImageGrabber.h"
 #include "IBVoxImageScanner.h"
+#include "IBVoxImageStack.h"
 #include <IBVoxFilters.h>
 
 #include "testing-prototype.h"
@@ -197,8 +198,24 @@ struct Trim5 {
 
 
 
+// loads the images prefix<i>_<iteration>.vtk in parallel, up to the first
+// missing one //
+static size_t LoadSamples(IBVoxImageStack &stack, const char *prefix, int iteration)
+{
+    std::vector<std::string> files;
+    char fname[200];
+    for (int i = 0; ; ++i) {
+        sprintf(fname, "%s%i_%i.vtk", prefix, i, iteration);
+        if (!IBVoxImageStack::Exists(fname)) break;
+        files.push_back(fname);
+    }
+    return stack.LoadSequence(files);
+}
+
+
 template < class RecipeT >
-int process_ROC(int argc, char** argv, int sequence_number=-1)
+int process_ROC(int argc, char** argv, const IBVoxImageStack &lead,
+                const IBVoxImageStack &empty, int sequence_number=-1)
 {
     std::cout << "Initializing containers..." << std::flush;
 
@@ -252,11 +269,9 @@ int process_ROC(int argc, char** argv, int sequence_number=-1)
     float iron_average_accumulator_1 = 0.;
 
     char fname[200];
-    sprintf(fname, "%s%i_%i.vtk", argv[1], 0, atoi(argv[4]));
 
-    while (image.ImportFromVtk(fname)) {
+    while (lead.GetImage(fbulk, image)) {
         fbulk++;
-        sprintf(fname, "%s%i_%i.vtk", argv[1], fbulk, atoi(argv[4]));
 
         //        bool read_status = image.ImportFromVtk(fname);
         //        if(!read_status) {
@@ -319,11 +334,8 @@ int process_ROC(int argc, char** argv, int sequence_number=-1)
     int fBulk = 0;
 
 
-    sprintf(fname, "%s%i_%i.vtk", argv[2], 0, atoi(argv[4]));
-
-    while ( image.ImportFromVtk(fname) ){
+    while ( empty.GetImage(fBulk, image) ){
         fBulk++;
-        sprintf(fname, "%s%i_%i.vtk", argv[2], fBulk, atoi(argv[4]));
 
         // FILTER RECIPE //
         RecipeT::Run(&image);
@@ -416,15 +428,21 @@ int process_ROC(int argc, char** argv, int sequence_number=-1)
 
 int main(int argc, char **argv)
 {
-
-    process_ROC<Recipes::NoFilter>(argc,argv);
-    process_ROC<Recipes::Gauss3>(argc,argv);
-//    process_ROC<Recipes::Gauss5>(argc,argv);
-    process_ROC<Recipes::Avg>(argc,argv);
-//    process_ROC<Recipes::Median>(argc,argv);
-//    process_ROC<Recipes::Trim3s2>(argc,argv);
-    process_ROC<Recipes::Trim3u>(argc,argv);
-//    process_ROC<Recipes::Trim3>(argc,argv);
-//    process_ROC<Recipes::Trim5>(argc,argv);
+    // both datasets loaded once for all the recipes //
+    IBVoxImageStack lead, empty;
+    std::cout << "Loading samples..." << std::flush;
+    LoadSamples(lead, argv[1], atoi(argv[4]));
+    LoadSamples(empty, argv[2], atoi(argv[4]));
+    std::cout << " " << lead.size() << " + " << empty.size() << " images\n";
+
+    process_ROC<Recipes::NoFilter>(argc,argv,lead,empty);
+    process_ROC<Recipes::Gauss3>(argc,argv,lead,empty);
+//    process_ROC<Recipes::Gauss5>(argc,argv,lead,empty);
+    process_ROC<Recipes::Avg>(argc,argv,lead,empty);
+//    process_ROC<Recipes::Median>(argc,argv,lead,empty);
+//    process_ROC<Recipes::Trim3s2>(argc,argv,lead,empty);
+    process_ROC<Recipes::Trim3u>(argc,argv,lead,empty);
+//    process_ROC<Recipes::Trim3>(argc,argv,lead,empty);
+//    process_ROC<Recipes::Trim5>(argc,argv,lead,empty);
     return 0;
 }
@@ -41,6 +41,7 @@
 #include "IBVoxCollection.h"
 #include "IBVoxFilters.h"
 #include "IBSubImageGrabber.h"
+#include "IBVoxImageStack.h"
 #include "IBROC.h"
 #include "testing-prototype.h"
 
@@ -235,8 +236,23 @@ float max_of_image(IBVoxCollection &image) {
     return max;
 }
 
+// loads the images format(i, iteration) in parallel, up to the first
+// missing one //
+static size_t LoadSamples(IBVoxImageStack &stack, const char *format, int iteration)
+{
+    std::vector<std::string> files;
+    char fname[200];
+    for (int i = 0; ; ++i) {
+        sprintf(fname, format, i, iteration);
+        if (!IBVoxImageStack::Exists(fname)) break;
+        files.push_back(fname);
+    }
+    return stack.LoadSequence(files);
+}
+
 template < class RecipeT >
-int process_ROC(int argc, char** argv, int sequence_number=-1)
+int process_ROC(int argc, char** argv, const IBVoxImageStack &lead,
+                const IBVoxImageStack &empty, int sequence_number=-1)
 {
     std::cout << "Initializing containers..." << std::flush;
     char fname[200];
@@ -251,8 +267,7 @@ int process_ROC(int argc, char** argv, int sequence_number=-1)
         int index = 0;
         sprintf(fname, p.file_inTp, index, p.iteration);
         std::cout << "starting autorange with file: " << fname << "\n";
-        while (image.ImportFromVtk(fname)) {
-            sprintf(fname, p.file_inTp, ++index, p.iteration);
+        while (lead.GetImage(index++, image)) {
             //IBSubImageGrabber<IBVoxCollection> grabber(image);
             //IBVoxCollection img = grabber.GrabRegion<IBVoxCollection>(img_center,img_hsize);
             RecipeT::Run(&image);
@@ -278,7 +293,7 @@ int process_ROC(int argc, char** argv, int sequence_number=-1)
     int y=0;
     sprintf(fname, p.file_inTp, y, p.iteration);
     std::cout << "starting Lead dataset with file: " << fname << "\n";
-    while (image.ImportFromVtk(fname)) {
+    while (lead.GetImage(y, image)) {
         // FILTER RECIPE //
         RecipeT::Run(&image);
         IBVoxCollection img;
@@ -299,7 +314,7 @@ int process_ROC(int argc, char** argv, int sequence_number=-1)
 //                    roc[i].Owa() += img.CountLambdaOverThreshold(roc[i].X()) > 0 ? 1 : 0;
             }
         }
-        sprintf(fname, p.file_inTp, ++y, p.iteration);
+        ++y;
         std::cout << "\rProcessing LEAD: " << y << std::flush;
     }
     std::cout << std::endl;
@@ -311,8 +326,8 @@ int process_ROC(int argc, char** argv, int sequence_number=-1)
     int fBulk = 0;
     sprintf(fname, p.file_inFp, fBulk, p.iteration);
     std::cout << "starting Scraps dataset with file: " << fname << "\n";
-    while ( image.ImportFromVtk(fname) ){
-        sprintf(fname, p.file_inFp, ++fBulk, p.iteration);
+    while ( empty.GetImage(fBulk, image) ){
+        ++fBulk;
 
         // FILTER RECIPE //
         RecipeT::Run(&image);
@@ -379,19 +394,26 @@ int main(int argc, char **argv)
         exit(1);
     }
 
+    // both datasets loaded once for all the recipes //
+    IBVoxImageStack lead, empty;
+    std::cout << "Loading samples..." << std::flush;
+    LoadSamples(lead, p.file_inTp, p.iteration);
+    LoadSamples(empty, p.file_inFp, p.iteration);
+    std::cout << " " << lead.size() << " + " << empty.size() << " images\n";
+
     // used
-//    process_ROC<Recipes::NoFilter>(argc,argv);
-//    process_ROC<Recipes::Avg>(argc,argv);
-    process_ROC<Recipes::Trim3u>(argc,argv);
-//    process_ROC<Recipes::Trim3>(argc,argv);
-    process_ROC<Recipes::BilateralTrim>(argc,argv);
+//    process_ROC<Recipes::NoFilter>(argc,argv,lead,empty);
+//    process_ROC<Recipes::Avg>(argc,argv,lead,empty);
+    process_ROC<Recipes::Trim3u>(argc,argv,lead,empty);
+//    process_ROC<Recipes::Trim3>(argc,argv,lead,empty);
+    process_ROC<Recipes::BilateralTrim>(argc,argv,lead,empty);
 
     // not used
-    //    process_ROC<Recipes::Gauss3>(argc,argv);
-    //    process_ROC<Recipes::Gauss5>(argc,argv);
-    //    process_ROC<Recipes::Median>(argc,argv);
-    //    process_ROC<Recipes::Trim3s2>(argc,argv);
-    //    process_ROC<Recipes::Trim5>(argc,argv);
+    //    process_ROC<Recipes::Gauss3>(argc,argv,lead,empty);
+    //    process_ROC<Recipes::Gauss5>(argc,argv,lead,empty);
+    //    process_ROC<Recipes::Median>(argc,argv,lead,empty);
+    //    process_ROC<Recipes::Trim3s2>(argc,argv,lead,empty);
+    //    process_ROC<Recipes::Trim5>(argc,argv,lead,empty);
     return 0;
 }
 